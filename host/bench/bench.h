@@ -0,0 +1,68 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Host microbenchmark harness ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Each suite drives the real mqtt_ha.cpp against the fake lwIP of
+// host_platform.cpp and times one operation at a time.
+// Cycles come from the TSC on x86 (ns elsewhere): they are host cycles,
+// only meaningful to compare two versions of the same code path.
+#include <stdint.h>
+#include <stddef.h>
+#include <chrono>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+static inline uint64_t bench_cycles() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+//--- Accumulated timings for one benchmarked operation
+struct BenchStat {
+    uint64_t n      = 0;
+    uint64_t total  = 0;
+    uint64_t min    = UINT64_MAX;
+    uint64_t max    = 0;
+    uint64_t bytes  = 0;    // payload bytes produced by the operation
+    uint64_t wire   = 0;    // MQTT bytes on the wire (fake broker count)
+
+    void add(uint64_t cycles) {
+        n++;
+        total += cycles;
+        if (cycles < min) min = cycles;
+        if (cycles > max) max = cycles;
+    }
+};
+
+//--- Time one statement, accumulated into a BenchStat
+#define BENCH_TIME(stat, stmt)                          \
+    do {                                                \
+        uint64_t bench_t0_ = bench_cycles();            \
+        stmt;                                           \
+        (stat).add(bench_cycles() - bench_t0_);         \
+    } while (0)
+
+//--- Library printf() output is sent to /dev/null while timing:
+//--- it is still formatted (part of the real cost) but not displayed.
+void bench_quiet(bool quiet);
+
+void bench_header(const char* suite);
+void bench_report(const char* name, const BenchStat& s);
+void bench_note(const char* fmt, ...);
+
+//--- Bring the library up against the fake broker, its counters at zero (mqtt_ha_host_reset_stats()):
+//--- wifi_mqtt_init() + polls until discovery, availability and subscribe are done.
+void bench_session_up();
+//--- mqtt_poll() every 10 ms of virtual time until the library is ONLINE with nothing in flight.
+//--- @return virtual ms it took, or UINT32_MAX after max_ms
+uint32_t bench_until_online(uint32_t max_ms = 600000);
+//--- mqtt_poll() every 10 ms of virtual time until the library has sent a new MQTT connect:
+//--- the next cyw43_arch_poll() delivers the CONNACK (and runs the discovery).
+void bench_until_connect_pending();
+//--- Poll until nothing is left in flight (acks every pending request).
+void bench_drain();
@@ -0,0 +1,54 @@
+//───────────────────────────────────────────────────────────────────
+//─── Offline backlog benchmarks ────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Outage of 300 samples (1 per second) with a 256-sample backlog,
+// then reconnect and replay through mqtt_poll().
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+static int max_in_flight = 0;
+
+static void track_in_flight(const HostPublish* msg, void* arg) {
+    if (host_in_flight() > max_in_flight) max_in_flight = host_in_flight();
+}
+
+void bench_backlog() {
+    bench_header("offline backlog (host cycles per call)");
+    bench_quiet(true);
+    bench_session_up();
+    host_set_publish_hook(track_in_flight, nullptr);
+
+    //--- OUTAGE: every reading goes to the ring buffer
+    host_drop_connection();
+    BenchStat store;
+    for (uint32_t i = 0; i < 300; i++) {
+        host_advance_us(1000000);
+        BENCH_TIME(store, mqtt_ha_publish_state(20.0 + i * 0.1, 50.0, 400 + i, i, 1));
+        mqtt_ha_log_flush();
+    }
+
+    //--- RECONNECT (the library does it by itself) then replay, one mqtt_poll() per main loop iteration
+    bench_until_connect_pending();
+    max_in_flight = 0;
+    BenchStat poll;
+    uint64_t wb = host_stats().wire_bytes;
+    uint64_t pb = host_stats().payload_bytes;
+    uint32_t polls = 0;
+    while ((mqtt_ha_backlog_stats().pending > 0 || host_in_flight() > 0) && polls < 10000) {
+        BENCH_TIME(poll, mqtt_poll());
+        polls++;
+    }
+    poll.bytes = host_stats().payload_bytes - pb;
+    poll.wire  = host_stats().wire_bytes - wb;
+
+    bench_quiet(false);
+    bench_report("mqtt_ha_publish_state (offline, stored)", store);
+    bench_report("mqtt_poll (replaying)", poll);
+    MqttHaBacklogStats st = mqtt_ha_backlog_stats();
+    bench_note("buffered %u, replayed %u, evicted %u, pending %u",
+               st.buffered, st.replayed, st.evicted, st.pending);
+    bench_note("drained in %u polls, max lwIP requests in flight %d / %d",
+               polls, max_in_flight, MQTT_REQ_MAX_IN_FLIGHT);
+    host_set_publish_hook(nullptr, nullptr);
+}
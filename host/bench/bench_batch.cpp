@@ -0,0 +1,103 @@
+//───────────────────────────────────────────────────────────────────
+//─── Batched samples benchmarks ────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// One minute of virtual time at 10 samples/s (built-in channels, QoS 1,
+// mqtt_poll() every 10 ms), one state per sample vs mqtt_ha_set_batching():
+// messages per second, MQTT bytes, bytes in the air and radio-on time.
+// Air / radio model (802.11n 2.4 GHz, CYW43 power save as set by the SDK):
+//  - each message is 3 frames: PUBLISH, PUBACK, TCP ACK, each with 40 bytes
+//    of TCP/IP and 36 of 802.11 header, RADIO_FRAME_US of channel access,
+//    preamble and MAC ack, then the bytes at RADIO_MBPS;
+//  - after traffic the radio stays awake RADIO_TAIL_MS before it can sleep
+//    again (CYW43_PERFORMANCE_PM: 200 ms), the on intervals are merged.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+#define RADIO_FRAME_US  150
+#define RADIO_MBPS      20
+#define RADIO_TAIL_MS   200
+#define FRAME_OVERHEAD  (40 + 36)
+
+struct AirTime {
+    uint32_t messages;
+    uint64_t mqtt_bytes;    // PUBLISH packets
+    uint64_t air_bytes;     // PUBLISH + PUBACK + TCP ACK frames, headers included
+    uint64_t on_us;         // radio awake
+    uint64_t on_until;      // end of the current awake interval
+};
+static AirTime air;
+
+static void air_hook(const HostPublish* msg, void* arg) {
+    if (strncmp(msg->topic, "pico_env_sensor/state", 21) != 0) return;   // state + batch
+    uint32_t remaining = 2 + (uint32_t)strlen(msg->topic) + (msg->qos > 0 ? 2 : 0) + msg->len;
+    uint32_t publish   = 1 + (remaining < 128 ? 1 : 2) + remaining;
+    uint32_t frames    = publish + FRAME_OVERHEAD + (msg->qos > 0 ? 4 + FRAME_OVERHEAD : 0) + FRAME_OVERHEAD;
+    uint64_t busy_us   = 3 * RADIO_FRAME_US + (uint64_t)frames * 8 / RADIO_MBPS;
+
+    air.messages++;
+    air.mqtt_bytes += publish;
+    air.air_bytes  += frames;
+    //--- Awake from now until the end of the exchange + the power save tail
+    uint64_t now = time_us_64();
+    uint64_t end = now + busy_us + RADIO_TAIL_MS * 1000;
+    if (now >= air.on_until) {
+        air.on_us += end - now;
+    } else if (end > air.on_until) {
+        air.on_us += end - air.on_until;
+    }
+    if (end > air.on_until) air.on_until = end;
+}
+
+static void bench_rate(const char* name, uint16_t samples, uint32_t max_ms) {
+    bench_session_up();
+    if (!mqtt_ha_set_batching(samples, max_ms)) {
+        bench_quiet(false);
+        bench_note("%s: refused (BATCH_PAYLOAD_MAX)", name);
+        bench_quiet(true);
+        return;
+    }
+    host_set_publish_hook(air_hook, nullptr);
+    MqttHaBatchStats b0 = mqtt_ha_batch_stats();
+    air = AirTime();
+    air.on_until = time_us_64();
+
+    const uint32_t seconds = 60;
+    BenchStat s;
+    for (uint32_t t = 0; t < seconds * 1000; t += 10) {
+        if (t % 100 == 0) {
+            uint32_t i = t / 100;
+            BENCH_TIME(s, mqtt_ha_publish_state(20.0 + (i % 50) * 0.1, 45.0 + (i % 7) * 0.1, 400 + i % 100, i % 500, 1));
+        }
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+    host_set_publish_hook(nullptr, nullptr);
+    MqttHaBatchStats b = mqtt_ha_batch_stats();
+    if (air.on_until > time_us_64()) air.on_us -= air.on_until - time_us_64();  // tail after the minute
+    mqtt_ha_set_batching(0, 0);
+    bench_until_online();
+    bench_drain();
+
+    s.bytes = air.mqtt_bytes;   // per sample once divided by s.n
+    s.wire  = air.air_bytes;
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_note("%.1f messages/s, %llu MQTT bytes, %llu bytes in the air, radio on %.1f %%  (%u batches, %u samples)",
+               air.messages / (double)seconds, (unsigned long long)air.mqtt_bytes,
+               (unsigned long long)air.air_bytes, air.on_us / (seconds * 1e4),
+               b.batches - b0.batches, b.samples - b0.samples);
+    bench_quiet(true);
+}
+
+void bench_batch() {
+    bench_header("batched samples, 10 samples/s for 60 s (per sample: bytes = MQTT, wire = air)");
+    bench_quiet(true);
+
+    bench_rate("one state per sample", 0, 0);
+    bench_rate("batch K=5 (T=1 s)", 5, 1000);
+    bench_rate("batch K=10 (T=2 s)", 10, 2000);
+    bench_rate("batch K=20 (T=5 s)", 20, 5000);
+    bench_rate("batch K=30 (T=5 s)", 30, 5000);     // over BATCH_PAYLOAD_MAX with 5 channels
+}
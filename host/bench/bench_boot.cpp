@@ -0,0 +1,59 @@
+//───────────────────────────────────────────────────────────────────
+//─── Fast boot benchmarks ──────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// wifi_mqtt_init() -> ONLINE (virtual ms) per phase, mqtt_poll() every 10 ms.
+// The fake link: 1.8 s scan, 0.6 s join, 0.9 s DHCP, broker round trip 30 ms.
+//  - cold boot on a blank flash: scan, DHCP, full discovery
+//  - reboot: AP, lease and discovery hash from the flash
+//  - reboot after the AP moved to another channel: targeted join fails, scan
+//  - reboot after the DHCP server handed our address to someone else:
+//    no CONNACK on the cached lease, DHCP
+// A reboot is wifi_mqtt_init() again: the fake flash survives it like the real one.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+#define SCAN_MS  1800
+#define JOIN_MS  600
+#define DHCP_MS  900
+#define RTT_MS   30
+
+static void boot(const char* name, uint8_t channel, const char* lease) {
+    host_reset();
+    host_set_scan_ms(SCAN_MS);
+    host_set_link_timing(JOIN_MS, DHCP_MS);
+    host_set_ack_delay_ms(RTT_MS);
+    host_set_ap(channel, 0x01);
+    host_set_dhcp_lease(lease);
+    uint32_t flash0 = host_flash_erases();
+    wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883);
+    bench_until_online();
+    for (int i = 0; i < 100; i++) {         // online for a second: the last PUBACK, the flash write
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+
+    MqttHaBootStats b = mqtt_ha_boot_stats();
+    bench_quiet(false);
+    bench_note("%-40s %5u ms: join %4u%s, IP %4u%s, connect %3u, setup %3u",
+               name, b.total_ms, b.join_ms, b.fast_join ? " (cached)" : "         ",
+               b.dhcp_ms, b.fast_ip ? " (cached)" : "         ", b.connect_ms, b.setup_ms);
+    bench_note("%-40s %u targeted join, %u cached lease, %u fallbacks, flash writes %u",
+               "", b.fast_joins, b.fast_ips, b.fallbacks, host_flash_erases() - flash0);
+    bench_quiet(true);
+}
+
+void bench_boot() {
+    bench_header("fast boot, wifi_mqtt_init() -> ONLINE (virtual ms)");
+    bench_quiet(true);
+    mqtt_ha_host_reset_stats();     // counters of the earlier suites
+
+    host_erase_flash();
+    boot("cold boot, blank flash", 6, "192.168.1.100");
+    boot("reboot, AP and lease cached", 6, "192.168.1.100");
+    boot("reboot, AP moved to channel 11", 11, "192.168.1.100");
+    boot("reboot, lease given away (now .101)", 11, "192.168.1.101");
+    boot("reboot, new AP and lease cached", 11, "192.168.1.101");
+
+    host_reset();
+}
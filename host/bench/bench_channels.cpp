@@ -0,0 +1,91 @@
+//───────────────────────────────────────────────────────────────────
+//─── Channel registry benchmarks ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// A device with many sensors (MQTT_HA_MAX_CHANNELS) registered at runtime:
+//  - discovery on connect: number of chunks and bytes
+//  - mqtt_ha_publish_channels() with every channel set
+//  - offline backlog: records kept in BACKLOG_BYTES
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+
+#define BENCH_CHANNELS 48
+
+static char          keys[BENCH_CHANNELS][16];
+static char          ids[BENCH_CHANNELS][8];
+static MqttHaChannel table[BENCH_CHANNELS];
+
+static uint32_t discovery_msgs = 0;
+static void count_discovery(const HostPublish* msg, void* arg) {
+    if (msg->retain && msg->topic[0] == 'h') discovery_msgs++;   // homeassistant/...
+}
+
+static void build_table() {
+    static const MqttHaStorage types[] = { MQTT_HA_I16, MQTT_HA_U16, MQTT_HA_U8, MQTT_HA_I32 };
+    for (int i = 0; i < BENCH_CHANNELS; i++) {
+        snprintf(keys[i], sizeof(keys[i]), "probe_%02d", i);
+        snprintf(ids[i], sizeof(ids[i]), "p%02d", i);
+        table[i] = { keys[i], ids[i], nullptr, (i % 2) ? "°C" : "%",
+                     (i % 2) ? "temperature" : "humidity", (uint8_t)(i % 3), types[i % 4] };
+    }
+}
+
+static void set_all(uint32_t i) {
+    for (uint8_t ch = 0; ch < BENCH_CHANNELS; ch++) {
+        mqtt_ha_set(ch, 10.0 + ((i + ch) % 500) * 0.1);
+    }
+}
+
+void bench_channels() {
+    bench_header("channel registry, 48 channels (host cycles per call)");
+    bench_quiet(true);
+    build_table();
+    mqtt_ha_register_channels(table, BENCH_CHANNELS);
+    bench_session_up();
+    host_set_publish_hook(count_discovery, nullptr);
+
+    //--- Discovery: every chunk is sent from the PUBACK of the previous one
+    BenchStat disc;
+    discovery_msgs = 0;
+    for (uint32_t i = 0; i < 500; i++) {
+        mqtt_ha_discovery_invalidate();     // the full discovery, not the cached one
+        host_drop_connection();
+        bench_until_connect_pending();
+        uint64_t pb = host_stats().payload_bytes;
+        uint64_t wb = host_stats().wire_bytes;
+        uint64_t t0 = bench_cycles();
+        bench_until_online();
+        disc.add(bench_cycles() - t0);
+        disc.bytes += host_stats().payload_bytes - pb;
+        disc.wire  += host_stats().wire_bytes - wb;
+    }
+
+    BenchStat set, pub;
+    for (uint32_t i = 0; i < 20000; i++) {
+        BENCH_TIME(set, set_all(i));
+        uint64_t pb = host_stats().payload_bytes;
+        uint64_t wb = host_stats().wire_bytes;
+        BENCH_TIME(pub, mqtt_ha_publish_channels());
+        pub.bytes += host_stats().payload_bytes - pb;
+        pub.wire  += host_stats().wire_bytes - wb;
+        bench_drain();
+    }
+
+    //--- Offline: fill the backlog
+    host_drop_wifi();
+    mqtt_poll();
+    for (uint32_t i = 0; i < 1000; i++) mqtt_ha_publish_channels();
+    MqttHaBacklogStats bl = mqtt_ha_backlog_stats();
+
+    host_set_publish_hook(nullptr, nullptr);
+    bench_quiet(false);
+    bench_report("connect -> ONLINE (all discovery chunks)", disc);
+    bench_note("discovery messages per connect: %.1f (sensors + button + diagnostics)", discovery_msgs / 500.0);
+    bench_report("mqtt_ha_set x48", set);
+    bench_report("mqtt_ha_publish_channels", pub);
+    bench_note("backlog: %u records kept offline out of %u", bl.pending, bl.buffered);
+
+    //--- Leave the built-in table for the other suites
+    mqtt_ha_register_channels(nullptr, 0);
+}
@@ -0,0 +1,107 @@
+//───────────────────────────────────────────────────────────────────
+//─── Discovery cache benchmarks ────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Time-to-online (CONNACK -> ONLINE, virtual ms) with the discovery hash in flash,
+// broker round trip 30 ms (host_set_ack_delay_ms), mqtt_poll() every 10 ms:
+//  - cold boot on a blank flash: full discovery, hash written once
+//  - 20 reconnects (flaky WiFi) and a reboot: discovery skipped
+//  - new channel table (48 channels, 4 chunks): full again, then skipped
+//  - discovery not retained (topic policy): never skipped
+// A reboot is wifi_mqtt_init() again: the fake flash survives it like the real one.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+
+#define RTT_MS       30
+#define RECONNECTS   20
+#define BIG_CHANNELS 48
+
+static char          big_keys[BIG_CHANNELS][16];
+static char          big_ids[BIG_CHANNELS][8];
+static MqttHaChannel big_table[BIG_CHANNELS];
+
+static void boot() {
+    host_reset();
+    host_set_ack_delay_ms(RTT_MS);
+    wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883);
+    bench_until_online();
+}
+
+//--- One session: CONNACK poll cost, bytes, CONNACK -> ONLINE
+static uint32_t reconnect(BenchStat& connack) {
+    host_drop_connection();
+    bench_until_connect_pending();
+    uint64_t pb = host_stats().payload_bytes;
+    uint64_t wb = host_stats().wire_bytes;
+    BENCH_TIME(connack, cyw43_arch_poll());
+    bench_until_online();
+    connack.bytes += host_stats().payload_bytes - pb;
+    connack.wire  += host_stats().wire_bytes - wb;
+    return mqtt_ha_discovery_stats().last_ms;
+}
+
+static void scenario(const char* name, uint32_t sessions) {
+    MqttHaDiscoveryStats d0 = mqtt_ha_discovery_stats();
+    uint32_t  flash0 = host_flash_erases();
+    BenchStat connack;
+    uint64_t  online_ms = 0;
+    for (uint32_t i = 0; i < sessions; i++) online_ms += reconnect(connack);
+    MqttHaDiscoveryStats d = mqtt_ha_discovery_stats();
+    bench_quiet(false);
+    bench_report(name, connack);
+    bench_note("CONNACK -> ONLINE %.0f ms avg (full discovery: %u ms), %u skipped / %u full, ~%u ms saved, flash writes %u",
+               (double)online_ms / sessions, d.full_ms, d.skipped - d0.skipped, d.published - d0.published,
+               d.saved_ms - d0.saved_ms, host_flash_erases() - flash0);
+    bench_quiet(true);
+}
+
+static void report_boot(const char* name, const MqttHaDiscoveryStats& d0, uint32_t flash0) {
+    MqttHaDiscoveryStats d = mqtt_ha_discovery_stats();
+    bench_quiet(false);
+    bench_note("%s: CONNACK -> ONLINE %u ms, discovery %s, hash %08x, flash writes %u",
+               name, d.last_ms, d.skipped != d0.skipped ? "skipped" : "sent", d.hash, host_flash_erases() - flash0);
+    bench_quiet(true);
+}
+
+void bench_discovery() {
+    bench_header("discovery cache, broker RTT 30 ms (CONNACK poll: host cycles, bytes sent in the session)");
+    bench_quiet(true);
+    mqtt_ha_host_reset_stats();     // counters of the earlier suites
+    mqtt_ha_register_channels(nullptr, 0);
+
+    //--- COLD BOOT, blank flash
+    host_erase_flash();
+    MqttHaDiscoveryStats d0 = mqtt_ha_discovery_stats();
+    uint32_t flash0 = host_flash_erases();
+    boot();
+    report_boot("cold boot, blank flash", d0, flash0);
+
+    scenario("reconnect, built-in table", RECONNECTS);
+
+    d0 = mqtt_ha_discovery_stats();
+    flash0 = host_flash_erases();
+    boot();
+    report_boot("reboot, same firmware", d0, flash0);
+
+    //--- NEW TABLE: 48 channels, the discovery is 4 chunks sent one after the other
+    for (int i = 0; i < BIG_CHANNELS; i++) {
+        snprintf(big_keys[i], sizeof(big_keys[i]), "probe_%02d", i);
+        snprintf(big_ids[i], sizeof(big_ids[i]), "p%02d", i);
+        big_table[i] = { big_keys[i], big_ids[i], nullptr, "°C", "temperature", 1, MQTT_HA_I16 };
+    }
+    mqtt_ha_register_channels(big_table, BIG_CHANNELS);
+    d0 = mqtt_ha_discovery_stats();
+    flash0 = host_flash_erases();
+    boot();
+    report_boot("reboot, 48 channels", d0, flash0);
+    scenario("reconnect, 48 channels", RECONNECTS);
+
+    //--- NOT RETAINED: HA only sees what is sent in the session
+    mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_DISCOVERY, 1, false);
+    scenario("reconnect, 48 channels, not retained", RECONNECTS);
+    mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_DISCOVERY, 1, true);
+
+    mqtt_ha_register_channels(nullptr, 0);
+    host_set_ack_delay_ms(0);
+}
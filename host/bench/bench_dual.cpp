@@ -0,0 +1,229 @@
+//───────────────────────────────────────────────────────────────────
+//─── Dual-core mode benchmarks (mqtt_ha_bench_dual) ────────────────
+//───────────────────────────────────────────────────────────────────
+// Library built with MQTT_HA_DUAL_CORE=1: "core 1" is a thread running the
+// network loop against the fake lwIP, the main thread is the application core.
+// Every sample carries a sequence number (an I32 channel), every command a
+// counter, so both queues are checked for ordering while they are measured:
+//  - samples: cost of mqtt_ha_publish_channels() on core 0, flood (queue full
+//    -> dropped), back-pressure (retried while full: pipeline throughput)
+//    and paced (one at a time: push -> mqtt_publish() latency)
+//  - commands: host_deliver() on core 1 -> handler on core 0 latency
+// Latencies are host cycles between the two threads (TSC).
+// Usage: mqtt_ha_bench_dual [samples|commands]
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <atomic>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLES_FLOOD  200000
+#define SAMPLES_FULL   50000
+#define SAMPLES_PACED  20000
+#define COMMANDS       20000
+#define CMD_TOPIC      "bench/dual/cmd"
+#define STATE_TOPIC    "pico_env_sensor/state"
+
+static const MqttHaChannel seq_channel[] = {
+    { "seq", "seq", nullptr, "", nullptr, 0, MQTT_HA_I32 },
+};
+
+//--- Written by core 0 before the push, read by core 1 after the pop (ordered by the queue)
+static uint64_t sample_t0[SAMPLES_FLOOD + SAMPLES_FULL + SAMPLES_PACED + 1];
+static uint64_t command_t0[COMMANDS + 1];
+
+//--- Core 1 side: publish hook
+static std::atomic<int32_t>  last_published{-1};
+static std::atomic<uint32_t> published{0};
+static std::atomic<uint32_t> sample_disorder{0};
+static BenchStat             sample_latency;     // core 1 only, read once the phase is over
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, STATE_TOPIC) != 0) return;
+    const char* v = strstr(msg->payload, "\"seq\":");
+    if (!v) return;
+    int32_t seq = atoi(v + 6);
+    if (seq <= last_published.load(std::memory_order_relaxed)) {
+        sample_disorder.store(sample_disorder.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+    if (seq >= 0 && seq <= SAMPLES_FLOOD + SAMPLES_FULL + SAMPLES_PACED) sample_latency.add(bench_cycles() - sample_t0[seq]);
+    published.store(published.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    last_published.store(seq, std::memory_order_release);
+}
+
+//--- Core 1 side: one command per cyw43_arch_poll() up to command_target
+static std::atomic<uint32_t> command_target{0};
+static uint32_t              command_sent = 0;
+
+static void on_poll(void* arg) {
+    if (command_sent >= command_target.load(std::memory_order_acquire)) return;
+    char payload[12];
+    int  len = snprintf(payload, sizeof(payload), "%u", command_sent + 1);
+    command_t0[command_sent + 1] = bench_cycles();
+    command_sent++;
+    host_deliver(CMD_TOPIC, payload, (size_t)len);
+}
+
+//--- Core 0 side: handler
+static int32_t   last_command     = 0;
+static uint32_t  command_handled  = 0;
+static uint32_t  command_disorder = 0;
+static BenchStat command_latency;
+
+static void on_command(const MqttHaCommand* cmd) {
+    if (!cmd->has_value) return;
+    if (cmd->value <= last_command) command_disorder++;
+    if (cmd->value > 0 && cmd->value <= COMMANDS) command_latency.add(bench_cycles() - command_t0[cmd->value]);
+    last_command = cmd->value;
+    command_handled++;
+}
+
+static const MqttHaRoute routes[] = {
+    { CMD_TOPIC, nullptr, on_command, nullptr, 0 },
+};
+
+//--- Core 0 waiting for core 1: handlers + logs, then the CPU (the host may have a single one)
+static void poll_wait() {
+    mqtt_poll();
+    tight_loop_contents();
+}
+
+static void dual_up() {
+    host_reset();
+    mqtt_ha_host_reset_stats();
+    host_set_publish_hook(on_publish, nullptr);
+    host_set_poll_hook(on_poll, nullptr);
+    mqtt_ha_register_channels(seq_channel, 1);
+    mqtt_ha_register_routes(routes, 1);
+    if (!wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883)) {
+        fprintf(stderr, "wifi_mqtt_init failed\n");
+        exit(1);
+    }
+    while (mqtt_ha_state() != MQTT_HA_ONLINE) poll_wait();
+}
+
+//--- Queue one sample, retried while the queue is full
+static void push_sample(int32_t seq, BenchStat& stat) {
+    uint32_t queued = mqtt_ha_core_stats().samples;
+    while (true) {
+        sample_t0[seq] = bench_cycles();
+        mqtt_ha_set_scaled(0, seq);
+        BENCH_TIME(stat, mqtt_ha_publish_channels());
+        if (mqtt_ha_core_stats().samples != queued) return;
+        poll_wait();
+    }
+}
+
+static void dual_down() {
+    mqtt_ha_stop_network_core();
+    mqtt_poll();     // last logs
+}
+
+static void bench_samples() {
+    bench_header("dual-core samples, core 0 -> core 1 (host cycles)");
+    bench_quiet(true);
+    dual_up();
+
+    //--- Flood: as fast as core 0 can, the queue decides what gets through
+    BenchStat flood;
+    MqttHaCoreStats before = mqtt_ha_core_stats();
+    uint64_t t0 = bench_cycles();
+    for (int32_t seq = 0; seq < SAMPLES_FLOOD; seq++) {
+        sample_t0[seq] = bench_cycles();
+        mqtt_ha_set_scaled(0, seq);
+        BENCH_TIME(flood, mqtt_ha_publish_channels());
+        if ((seq & 255) == 0) mqtt_poll();
+    }
+    uint64_t flood_cycles = bench_cycles() - t0;
+    MqttHaCoreStats after = mqtt_ha_core_stats();
+    //--- Marker: once it is published, core 1 is done with the flood
+    BenchStat marker;
+    push_sample(SAMPLES_FLOOD, marker);
+    while (last_published.load(std::memory_order_acquire) < SAMPLES_FLOOD) poll_wait();
+    BenchStat flood_latency = sample_latency;
+
+    //--- Back-pressure: every sample goes through, as fast as core 1 takes them
+    BenchStat full;
+    uint32_t  full_published = published.load(std::memory_order_acquire);
+    t0 = bench_cycles();
+    for (int32_t seq = SAMPLES_FLOOD + 1; seq <= SAMPLES_FLOOD + SAMPLES_FULL; seq++) {
+        push_sample(seq, full);
+    }
+    while (last_published.load(std::memory_order_acquire) < SAMPLES_FLOOD + SAMPLES_FULL) poll_wait();
+    uint64_t full_cycles = bench_cycles() - t0;
+    full_published = published.load(std::memory_order_acquire) - full_published;
+
+    //--- Paced: one sample, wait until it is on the wire
+    sample_latency = BenchStat();
+    BenchStat paced;
+    for (int32_t seq = SAMPLES_FLOOD + SAMPLES_FULL + 1; seq <= SAMPLES_FLOOD + SAMPLES_FULL + SAMPLES_PACED; seq++) {
+        push_sample(seq, paced);
+        while (last_published.load(std::memory_order_acquire) < seq) poll_wait();
+    }
+    BenchStat paced_latency = sample_latency;
+    uint32_t  total_published = published.load();
+    dual_down();
+
+    bench_quiet(false);
+    bench_report("publish_channels() core 0, flood", flood);
+    bench_report("publish_channels() core 0, back-pressure", full);
+    bench_report("publish_channels() core 0, paced", paced);
+    bench_report("push -> mqtt_publish, flood", flood_latency);
+    bench_report("push -> mqtt_publish, paced", paced_latency);
+    uint32_t accepted = after.samples - before.samples;
+    bench_note("flood: %u samples in %.1f Mcycles, %u queued, %u dropped (queue full, SAMPLE_QUEUE_SLOTS)",
+               SAMPLES_FLOOD, flood_cycles / 1e6, accepted, after.samples_dropped - before.samples_dropped);
+    bench_note("back-pressure: %u samples in %.1f Mcycles (%.0f cycles each), %u states published (outbox coalescing)",
+               SAMPLES_FULL, full_cycles / 1e6, (double)full_cycles / SAMPLES_FULL, full_published);
+    bench_note("%u states published in total, out of order: %u", total_published, sample_disorder.load());
+}
+
+static void bench_commands() {
+    bench_header("dual-core commands, core 1 -> core 0 (host cycles)");
+    bench_quiet(true);
+    dual_up();
+
+    //--- One command per network pass, core 0 polls as fast as it can
+    command_target.store(COMMANDS, std::memory_order_release);
+    while (command_handled + mqtt_ha_core_stats().commands_dropped < COMMANDS) poll_wait();
+    MqttHaCoreStats s = mqtt_ha_core_stats();
+    dual_down();
+
+    bench_quiet(false);
+    bench_report("host_deliver -> handler on core 0", command_latency);
+    bench_note("%u commands handled, %u dropped (queue full, COMMAND_QUEUE_SLOTS), out of order: %u",
+               command_handled, s.commands_dropped, command_disorder);
+}
+
+struct BenchSuite {
+    const char* name;
+    void      (*run)();
+};
+
+static const BenchSuite suites[] = {
+    { "samples",  bench_samples },
+    { "commands", bench_commands },
+};
+
+int main(int argc, char** argv) {
+    int ran = 0;
+    for (const auto& s : suites) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], s.name) == 0) selected = true;
+        }
+        if (selected) {
+            s.run();
+            ran++;
+        }
+    }
+    if (ran == 0) {
+        fprintf(stderr, "Unknown suite. Available:");
+        for (const auto& s : suites) fprintf(stderr, " %s", s.name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+}
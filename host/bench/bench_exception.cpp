@@ -0,0 +1,117 @@
+//───────────────────────────────────────────────────────────────────
+//─── Report by exception benchmarks ────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Ten minutes of virtual time, built-in channels sampled at 10 Hz and
+// mqtt_ha_publish_state() called for every sample (mqtt_poll() too):
+//  - temperature: 21 °C ± 2 over the 10 minutes, noise ± 0.15
+//  - humidity: 45 % ± 5, noise ± 0.6; eco2: 500 ppm ± 100, noise ± 10
+//  - tvoc: steps of 50 ppb every 2 minutes; aqi: constant
+// Every sample published, then deadbands (+ a 60 s heartbeat), with the
+// mean or an EWMA as the value sent. Cost of mqtt_ha_publish_state() in
+// host cycles, messages per second, and how far the temperature HA shows
+// is from the noise-free signal (mean / max error, °C).
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define SAMPLE_MS  100
+#define SAMPLES    6000     // 10 minutes at 10 Hz
+
+static uint32_t noise_state = 1;
+
+//--- Uniform in [-amplitude, amplitude], same sequence for every run
+static double noise(double amplitude) {
+    noise_state = noise_state * 1664525u + 1013904223u;
+    return ((noise_state >> 8) / (double)(1u << 24) * 2.0 - 1.0) * amplitude;
+}
+
+static double clean_temperature(uint32_t i) {
+    return 21.0 + 2.0 * sin(2.0 * M_PI * i / SAMPLES);
+}
+
+//--- Temperature as last seen by HA, compared with the noise-free signal every sample
+static double shown_temperature = 0;
+
+static void shown_hook(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "pico_env_sensor/state") != 0) return;
+    const char* t = strstr(msg->payload, "\"temperature\":");
+    if (t) shown_temperature = atof(t + 14);
+}
+
+static void bench_policy(const char* name, void (*setup)()) {
+    mqtt_ha_register_channels(nullptr, 0);      // clears deadbands and aggregates
+    mqtt_ha_set_heartbeat(0);
+    bench_session_up();
+    if (setup) setup();
+    host_set_publish_hook(shown_hook, nullptr);
+
+    noise_state = 1;
+    HostStats         h0 = host_stats();
+    MqttHaReportStats r0 = mqtt_ha_report_stats();
+    BenchStat s;
+    double    err_sum = 0, err_max = 0;
+    for (uint32_t i = 0; i < SAMPLES; i++) {
+        double t   = clean_temperature(i) + noise(0.15);
+        double hum = 45.0 + 5.0 * cos(2.0 * M_PI * i / SAMPLES) + noise(0.6);
+        double co2 = 500.0 + 100.0 * sin(4.0 * M_PI * i / SAMPLES) + noise(10.0);
+        uint16_t tvoc = (uint16_t)(100 + 50 * ((i / 1200) % 2));
+        BENCH_TIME(s, mqtt_ha_publish_state(t, hum, (uint16_t)co2, tvoc, 1));
+        mqtt_poll();
+        host_advance_us(SAMPLE_MS * 1000);
+
+        double err = fabs(shown_temperature - clean_temperature(i));
+        err_sum += err;
+        if (err > err_max) err_max = err;
+    }
+    host_set_publish_hook(nullptr, nullptr);
+    bench_drain();
+    HostStats         h = host_stats();
+    MqttHaReportStats r = mqtt_ha_report_stats();
+
+    s.bytes = h.payload_bytes - h0.payload_bytes;
+    s.wire  = h.wire_bytes - h0.wire_bytes;
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_note("%.2f messages/s (%u sent, %u suppressed, %u heartbeats), triggers temp %u hum %u eco2 %u tvoc %u",
+               (h.publishes - h0.publishes) / (SAMPLES * SAMPLE_MS / 1000.0), r.sent - r0.sent,
+               r.suppressed - r0.suppressed, r.heartbeats - r0.heartbeats,
+               mqtt_ha_report_triggers(0), mqtt_ha_report_triggers(1), mqtt_ha_report_triggers(2),
+               mqtt_ha_report_triggers(3));
+    bench_note("temperature shown vs noise-free: %.3f °C mean error, %.3f °C max", err_sum / SAMPLES, err_max);
+    bench_quiet(true);
+}
+
+static void deadbands() {
+    mqtt_ha_set_deadband(0, 0.2);       // temperature °C
+    mqtt_ha_set_deadband(1, 1.0);       // humidity %
+    mqtt_ha_set_deadband(2, 25);        // eco2 ppm
+    mqtt_ha_set_deadband(3, 10);        // tvoc ppb
+    mqtt_ha_set_deadband(4, 0);         // aqi: any change
+    mqtt_ha_set_heartbeat(60000);
+}
+
+static void deadbands_mean() {
+    deadbands();
+    for (uint8_t ch = 0; ch < 4; ch++) mqtt_ha_set_aggregate(ch, MQTT_HA_AGG_MEAN, 0);
+}
+
+static void deadbands_ewma() {
+    deadbands();
+    for (uint8_t ch = 0; ch < 4; ch++) mqtt_ha_set_aggregate(ch, MQTT_HA_AGG_EWMA, 3);
+}
+
+void bench_exception() {
+    bench_header("report by exception, 10 samples/s for 10 min (host cycles per mqtt_ha_publish_state())");
+    bench_quiet(true);
+
+    bench_policy("every sample published", nullptr);
+    bench_policy("deadbands + heartbeat 60 s", deadbands);
+    bench_policy("deadbands, mean of the window", deadbands_mean);
+    bench_policy("deadbands, EWMA alpha 1/8", deadbands_ewma);
+
+    mqtt_ha_register_channels(nullptr, 0);
+    mqtt_ha_set_heartbeat(0);
+}
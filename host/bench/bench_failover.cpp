@@ -0,0 +1,114 @@
+//───────────────────────────────────────────────────────────────────
+//─── Broker DNS + failover benchmarks ──────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Two brokers by name: mqtt-a.lan (192.168.1.10) first, mqtt-b.lan (.11) as
+// standby, TTL 300 s, DNS server (the gateway) 20 ms away, broker round trip
+// 30 ms, mqtt_poll() every 10 ms. Virtual ms until ONLINE again:
+//  - cold boot: join, DHCP, lookup, ONLINE on mqtt-a
+//  - session drops within the TTL: lwIP's table answers, no query
+//  - a drop after the TTL: one query
+//  - mqtt-a dies: ONLINE on mqtt-b; mqtt-a back and a drop: still mqtt-b (sticky)
+//  - reboot: straight to mqtt-b (flash record)
+//  - mqtt-b dies: back to mqtt-a
+//  - DNS server down once the TTL ran out: last known address after DNS_TIMEOUT_MS
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+#define JOIN_MS  600
+#define DHCP_MS  900
+#define RTT_MS   30
+#define DNS_MS   20
+#define TTL_S    300
+
+static MqttHaBrokerStats last;
+static uint32_t          last_queries;
+
+static void boot() {
+    host_reset();
+    host_set_link_timing(JOIN_MS, DHCP_MS);
+    host_set_ack_delay_ms(RTT_MS);
+    host_set_dns_latency_ms(DNS_MS);
+    host_dns_set("mqtt-a.lan", "192.168.1.10", TTL_S);
+    host_dns_set("mqtt-b.lan", "192.168.1.11", TTL_S);
+    mqtt_ha_add_broker(nullptr, 0);
+    mqtt_ha_add_broker("mqtt-b.lan", 1883);
+    wifi_mqtt_init("bench_ssid", "bench_password", "mqtt-a.lan", 1883);
+    last         = {};
+    last_queries = 0;
+}
+
+//--- ONLINE for ms (long enough for a session to count as healthy)
+static void stay_online(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+}
+
+//--- What happened since the previous line
+static void line(const char* name, uint32_t ms) {
+    MqttHaBrokerStats b = mqtt_ha_broker_stats();
+    uint32_t queries = host_dns_queries();
+    bench_quiet(false);
+    bench_note("%-42s %5u ms on broker %u: lookups %u (%u cached, %u stale), DNS queries %u, switches %u%s",
+               name, ms, b.current, b.lookups - last.lookups, b.lookups_cached - last.lookups_cached,
+               b.lookups_stale - last.lookups_stale, queries - last_queries, b.switches - last.switches,
+               b.failovers != last.failovers ? ", failover" : "");
+    bench_quiet(true);
+    last         = b;
+    last_queries = queries;
+}
+
+void bench_failover() {
+    bench_header("broker DNS + failover, -> ONLINE (virtual ms)");
+    bench_quiet(true);
+    mqtt_ha_host_reset_stats();     // counters of the earlier suites
+
+    host_erase_flash();
+    boot();
+    line("cold boot, mqtt-a.lan", bench_until_online());
+    uint32_t total = 0;
+    for (int i = 0; i < 5; i++) {         // 200 s of the 300 s TTL
+        stay_online(40000);
+        host_drop_connection();
+        total += bench_until_online();
+    }
+    line("5 drops within the TTL (avg)", total / 5);
+    stay_online(TTL_S * 1000);
+    host_drop_connection();
+    line("drop after the TTL", bench_until_online());
+
+    stay_online(60000);
+    host_set_broker_down("192.168.1.10", true);
+    line("mqtt-a dies", bench_until_online());
+    MqttHaBrokerStats b = mqtt_ha_broker_stats();
+    host_set_broker_down("192.168.1.10", false);
+    stay_online(60000);
+    host_drop_connection();
+    line("mqtt-a back, a drop", bench_until_online());
+
+    boot();
+    line("reboot", bench_until_online());
+    stay_online(60000);
+    host_set_broker_down("192.168.1.11", true);
+    line("mqtt-b dies", bench_until_online());
+    MqttHaBrokerStats b2 = mqtt_ha_broker_stats();
+
+    stay_online(TTL_S * 1000);
+    host_set_dns_down(true);
+    host_drop_connection();
+    line("DNS down after the TTL", bench_until_online());
+
+    MqttHaBootStats boot_stats = mqtt_ha_boot_stats();
+    bench_quiet(false);
+    bench_note("failover time (session lost -> ONLINE on the standby): a -> b %u ms, b -> a %u ms",
+               b.failover_ms, b2.failover_ms);
+    bench_note("last lookup %u ms (max %u), last sequence: resolve %u ms of %u ms",
+               mqtt_ha_broker_stats().resolve_ms, mqtt_ha_broker_stats().resolve_max_ms,
+               boot_stats.resolve_ms, boot_stats.total_ms);
+    bench_quiet(true);
+
+    mqtt_ha_add_broker(nullptr, 0);
+    host_reset();
+}
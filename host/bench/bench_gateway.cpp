@@ -0,0 +1,162 @@
+//───────────────────────────────────────────────────────────────────
+//─── Gateway mode benchmarks ───────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// 10 to 128 bridged devices of 5 channels each (mqtt_ha_add_device()), one client:
+//  - announcement after a (re)connect: discovery + availability + state of every
+//    device, virtual time until all are sent (mqtt_poll() every 10 ms, PUBACK on
+//    the next poll), lwIP refusals (ERR_MEM) and the largest request window used
+//  - the gateway's own state (every 100 ms) while the devices are announced:
+//    mqtt_ha_publish_state() -> PUBLISH, in virtual ms
+//  - steady state: every device publishes every 10 s, mqtt_poll() cost
+// Devices cannot be removed: each step adds devices to the previous ones,
+// so this suite runs last.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_DEVICES 128
+
+static const MqttHaChannel node_channels[] = {
+    { "temperature", "temp", nullptr, "°C", "temperature", 1, MQTT_HA_I16 },
+    { "humidity",    "hum",  nullptr, "%",  "humidity",    1, MQTT_HA_U16 },
+    { "battery",     "batt", nullptr, "%",  "battery",     0, MQTT_HA_U8  },
+    { "voltage",     "volt", nullptr, "V",  "voltage",     2, MQTT_HA_U16 },
+    { "rssi",        "rssi", "RSSI",  "dBm", "signal_strength", 0, MQTT_HA_I16 },
+};
+#define NODE_CHANNELS (uint8_t)(sizeof(node_channels) / sizeof(node_channels[0]))
+
+static char         node_ids[BENCH_DEVICES][16];
+static char         node_names[BENCH_DEVICES][16];
+static MqttHaDevice nodes[BENCH_DEVICES];
+static int          handles[BENCH_DEVICES];
+static int          node_count = 0;
+
+//--- Gateway state: sent time of the pending one, latency once it is seen
+static uint64_t  gw_state_t0 = 0;
+static BenchStat gw_state_ms;
+
+static void gateway_hook(const HostPublish* msg, void* arg) {
+    if (gw_state_t0 != 0 && strcmp(msg->topic, "pico_env_sensor/state") == 0) {
+        gw_state_ms.add((time_us_64() - gw_state_t0) / 1000);
+        gw_state_t0 = 0;
+    }
+}
+
+static void node_values(int n, uint32_t i) {
+    mqtt_ha_device_set(handles[n], 0, 18.0 + ((n + i) % 80) * 0.1);
+    mqtt_ha_device_set(handles[n], 1, 40.0 + ((n + i) % 30) * 0.5);
+    mqtt_ha_device_set_scaled(handles[n], 2, 100 - (int32_t)((n + i) % 60));
+    mqtt_ha_device_set(handles[n], 3, 3.0 + ((n + i) % 20) * 0.01);
+    mqtt_ha_device_set_scaled(handles[n], 4, -40 - (int32_t)((n + i) % 50));
+}
+
+static void add_nodes(int total) {
+    for (; node_count < total; node_count++) {
+        int n = node_count;
+        snprintf(node_ids[n], sizeof(node_ids[n]), "node_%03d", n);
+        snprintf(node_names[n], sizeof(node_names[n]), "Node %d", n);
+        nodes[n]   = { node_ids[n], node_names[n], nullptr, node_channels, NODE_CHANNELS };
+        handles[n] = mqtt_ha_add_device(&nodes[n]);
+        node_values(n, 0);
+        mqtt_ha_device_publish(handles[n]);
+    }
+}
+
+static void bench_devices(int total) {
+    add_nodes(total);
+    if (handles[total - 1] < 0) {
+        bench_quiet(false);
+        bench_note("%d devices: refused (MQTT_HA_MAX_DEVICES / MQTT_HA_DEVICE_VALUES)", total);
+        bench_quiet(true);
+        return;
+    }
+    //--- New session: the gateway's own discovery, then the devices
+    host_drop_connection();
+    bench_until_connect_pending();
+    mqtt_poll();        // CONNACK
+    HostStats             h0 = host_stats();
+    MqttHaGatewayStats    g0 = mqtt_ha_gateway_stats();
+    host_set_publish_hook(gateway_hook, nullptr);
+    gw_state_ms = BenchStat();
+    BenchStat poll;
+    int       window  = 0;
+    uint32_t  elapsed = 0;
+    for (; elapsed < 600000; elapsed += 10) {
+        if (elapsed % 100 == 0 && gw_state_t0 == 0 && mqtt_ha_state() == MQTT_HA_ONLINE) {
+            gw_state_t0 = time_us_64();
+            mqtt_ha_publish_state(21.5, 45.0, 400, 10, 1);
+        }
+        BENCH_TIME(poll, mqtt_poll());
+        if (host_in_flight() > window) window = host_in_flight();
+        if (mqtt_ha_state() == MQTT_HA_ONLINE && mqtt_ha_gateway_stats().pending == 0 && host_in_flight() == 0) break;
+        host_advance_us(10000);
+    }
+    gw_state_t0 = 0;
+    host_set_publish_hook(nullptr, nullptr);
+    HostStats          h = host_stats();
+    MqttHaGatewayStats g = mqtt_ha_gateway_stats();
+    bench_drain();
+
+    char name[48];
+    snprintf(name, sizeof(name), "%d devices, mqtt_poll() while announcing", total);
+    poll.bytes = h.payload_bytes - h0.payload_bytes;
+    poll.wire  = h.wire_bytes - h0.wire_bytes;
+    bench_quiet(false);
+    bench_report(name, poll);
+    bench_note("all announced in %u ms: %u messages (%u discovery, %u availability, %u states), "
+               "lwIP refusals %u, window %d/%d",
+               elapsed, h.publishes - h0.publishes, g.discovery - g0.discovery, g.availability - g0.availability,
+               g.states - g0.states, h.publish_rejected - h0.publish_rejected, window, MQTT_REQ_MAX_IN_FLIGHT);
+    bench_note("gateway state meanwhile: %llu sent, %.1f ms avg, %llu ms max",
+               (unsigned long long)gw_state_ms.n, gw_state_ms.n ? (double)gw_state_ms.total / gw_state_ms.n : 0.0,
+               (unsigned long long)gw_state_ms.max);
+    bench_quiet(true);
+}
+
+//--- Every device publishes every 10 s (spread over the period), one minute
+static void bench_steady(int total) {
+    const uint32_t period_ms = 10000;
+    HostStats          h0 = host_stats();
+    MqttHaGatewayStats g0 = mqtt_ha_gateway_stats();
+    BenchStat poll;
+    for (uint32_t t = 0; t < 60000; t += 10) {
+        uint32_t slot = t % period_ms;
+        for (int n = 0; n < total; n++) {
+            if ((uint32_t)n * period_ms / total / 10 * 10 == slot) {
+                node_values(n, t / period_ms + 1);
+                mqtt_ha_device_publish(handles[n]);
+            }
+        }
+        BENCH_TIME(poll, mqtt_poll());
+        host_advance_us(10000);
+    }
+    bench_drain();
+    HostStats          h = host_stats();
+    MqttHaGatewayStats g = mqtt_ha_gateway_stats();
+
+    char name[48];
+    snprintf(name, sizeof(name), "%d devices, mqtt_poll() steady", total);
+    poll.bytes = h.payload_bytes - h0.payload_bytes;
+    poll.wire  = h.wire_bytes - h0.wire_bytes;
+    bench_quiet(false);
+    bench_report(name, poll);
+    bench_note("%.1f messages/s, %u device states, %u coalesced, lwIP refusals %u",
+               (h.publishes - h0.publishes) / 60.0, g.states - g0.states, g.coalesced - g0.coalesced,
+               h.publish_rejected - h0.publish_rejected);
+    bench_quiet(true);
+}
+
+void bench_gateway() {
+    bench_header("gateway mode, devices of 5 channels (host cycles per mqtt_poll(), virtual ms)");
+    bench_quiet(true);
+    mqtt_ha_register_channels(nullptr, 0);
+    bench_session_up();
+
+    bench_devices(10);
+    bench_devices(50);
+    bench_devices(100);
+    bench_devices(BENCH_DEVICES);
+    bench_steady(BENCH_DEVICES);
+}
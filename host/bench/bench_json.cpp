@@ -0,0 +1,61 @@
+//───────────────────────────────────────────────────────────────────
+//─── State serializer benchmarks ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// JsonWriter (mqtt_ha_json.h) against the former snprintf("%.1f") path,
+// on the same values, compared byte for byte (host/test/test_json.cpp checks
+// the library's own payload). Same bytes, but for one documented difference:
+// values are scaled integers, so a negative value rounding to zero is "0.0"
+// where printf wrote "-0.0".
+#include "bench.h"
+#include <random>
+#include <stdio.h>
+#include <string.h>
+
+//--- The two paths, each in its own object for the json_size report (host/CMakeLists.txt)
+int    state_snprintf(char* buf, size_t size, double t, double h, uint16_t eco2, uint16_t tvoc, uint8_t aqi);
+size_t state_writer(char* buf, size_t size, double t, double h, uint16_t eco2, uint16_t tvoc, uint8_t aqi);
+
+//--- printf's payload with every ":-0.0" written ":0.0", like the scaled values
+static size_t without_negative_zero(char* s, size_t len) {
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (i > 0 && s[i - 1] == ':' && strncmp(s + i, "-0.0", 4) == 0 && (s[i + 4] == ',' || s[i + 4] == '}')) continue;
+        s[n++] = s[i];
+    }
+    s[n] = '\0';
+    return n;
+}
+
+void bench_json() {
+    bench_header("state serializer (host cycles per payload)");
+
+    std::mt19937_64 rng(12345);
+    std::uniform_real_distribution<double> temp(-40.0, 125.0);
+    std::uniform_real_distribution<double> hum(0.0, 100.0);
+
+    BenchStat old_path, new_path;
+    uint32_t  negative_zero = 0, mismatches = 0;
+    char a[256], b[256];
+    for (uint32_t i = 0; i < 200000; i++) {
+        double   t    = temp(rng);
+        double   h    = hum(rng);
+        uint16_t eco2 = (uint16_t)rng();
+        uint16_t tvoc = (uint16_t)rng();
+        uint8_t  aqi  = (uint8_t)rng();
+        int    la = 0;
+        size_t lb = 0;
+        BENCH_TIME(old_path, la = state_snprintf(a, sizeof(a), t, h, eco2, tvoc, aqi));
+        BENCH_TIME(new_path, lb = state_writer(b, sizeof(b), t, h, eco2, tvoc, aqi));
+        old_path.bytes += la;
+        new_path.bytes += lb;
+        if ((size_t)la == lb && memcmp(a, b, lb) == 0) continue;
+        size_t n = without_negative_zero(a, (size_t)la);
+        if (n == lb && memcmp(a, b, lb) == 0) negative_zero++;
+        else                                  mismatches++;
+    }
+    bench_report("snprintf(\"%.1f\") state payload", old_path);
+    bench_report("JsonWriter state payload", new_path);
+    bench_note("payloads with \"0.0\" where printf wrote \"-0.0\": %u of 200000", negative_zero);
+    bench_note("payloads with any other difference: %u (must be 0)", mismatches);
+    bench_note("code size: cmake --build <build> --target json_size (text of each path and what it pulls in)");
+}
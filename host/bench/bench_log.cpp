@@ -0,0 +1,73 @@
+//───────────────────────────────────────────────────────────────────
+//─── Deferred logging benchmarks ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// What a log line costs INSIDE an lwIP callback:
+//  - printf() as the callbacks used to do, stdout unbuffered like the Pico stdio
+//    (each call is a blocking write, /dev/null here: the USB / UART time is not even counted)
+//  - LOG_INFO(): a record in the ring, formatted later by mqtt_poll()
+// then the incoming command path with the two lines it used to print, and without.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_log.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+#include <string.h>
+
+static void bench_toggle() {}
+static const CmdEntry bench_cmds[] = { { "toggle", bench_toggle } };
+
+#define TOPIC "pico_env_sensor/led/brightness"
+
+void bench_log() {
+    bench_header("deferred logging (host cycles per call)");
+    bench_quiet(true);
+    fflush(stdout);
+    setvbuf(stdout, nullptr, _IONBF, 0);
+
+    mqtt_register_commands(bench_cmds, 1);
+    bench_session_up();
+    mqtt_ha_log_flush();
+
+    //--- One line, printf vs record
+    BenchStat p, r, f;
+    for (uint32_t i = 0; i < 20000; i++) {
+        BENCH_TIME(p, printf("MQTT: Incoming message on topic: %s (%lu bytes)\n", TOPIC, (unsigned long)i));
+        BENCH_TIME(r, LOG_INFO("MQTT: Incoming message on topic: %s (%lu bytes)\n", TOPIC, (unsigned long)i));
+        BENCH_TIME(f, mqtt_ha_log_flush());
+    }
+
+    //--- Incoming command: former printf lines (topic + payload received) vs today's callbacks
+    BenchStat before, after;
+    for (uint32_t i = 0; i < 20000; i++) {
+        BENCH_TIME(before, {
+            host_deliver(TOPIC, "toggle", 6);
+            printf("MQTT: Incoming message on topic: %s (%lu bytes)\n", TOPIC, 6ul);
+            printf("MQTT: Payload received (%lu bytes)\n", 6ul);
+        });
+        BENCH_TIME(after, host_deliver(TOPIC, "toggle", 6));
+        mqtt_poll();
+    }
+
+    //--- Discovery used to dump its whole payload from the CONNACK callback
+    static char discovery[1024];
+    memset(discovery, 'x', sizeof(discovery) - 1);
+    BenchStat d;
+    for (uint32_t i = 0; i < 2000; i++) {
+        BENCH_TIME(d, printf("MQTT: Discovery payload (%u bytes):\n%s\n", 1023u, discovery));
+    }
+
+    fflush(stdout);
+    setvbuf(stdout, nullptr, _IOLBF, BUFSIZ);
+    bench_quiet(false);
+    bench_report("printf, one callback line", p);
+    bench_report("LOG_INFO record, one callback line", r);
+    bench_report("mqtt_ha_log_flush (main loop, 1 record)", f);
+    bench_report("incoming command + former printf lines", before);
+    bench_report("incoming command, deferred logs", after);
+    bench_report("printf of the 1 KB discovery (removed)", d);
+    bench_note("record %u bytes, ring %u records (peak %u), compiled level %d, dropped %u",
+               (unsigned)sizeof(MqttHaLogRecord), MQTT_HA_LOG_SLOTS, mqtt_ha_log_peak(), MQTT_HA_LOG_LEVEL,
+               mqtt_ha_log_dropped());
+    bench_note("on the Pico printf also waits for USB / UART: the gap is much larger there");
+    mqtt_register_commands(nullptr, 0);
+}
@@ -0,0 +1,72 @@
+//───────────────────────────────────────────────────────────────────
+//─── mqtt_ha host benchmarks ───────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Usage: mqtt_ha_bench [suite...]   (no argument: run every suite)
+#include <stdio.h>
+#include <string.h>
+
+void bench_publish();
+void bench_backlog();
+void bench_reconnect();
+void bench_json();
+void bench_channels();
+void bench_router();
+void bench_stream();
+void bench_outbox();
+void bench_metrics();
+void bench_log();
+void bench_batch();
+void bench_exception();
+void bench_discovery();
+void bench_boot();
+void bench_failover();
+void bench_gateway();
+void bench_ram();
+void bench_tls();
+
+struct BenchSuite {
+    const char* name;
+    void      (*run)();
+};
+
+static const BenchSuite suites[] = {
+    { "publish", bench_publish },
+    { "backlog", bench_backlog },
+    { "reconnect", bench_reconnect },
+    { "json",      bench_json },
+    { "channels",  bench_channels },
+    { "router",    bench_router },
+    { "stream",    bench_stream },
+    { "outbox",    bench_outbox },
+    { "metrics",   bench_metrics },
+    { "log",       bench_log },
+    { "batch",     bench_batch },
+    { "exception", bench_exception },
+    { "discovery", bench_discovery },
+    { "boot",      bench_boot },
+    { "failover",  bench_failover },
+    { "gateway",   bench_gateway },     // its devices stay added
+    { "ram",       bench_ram },         // reuses the gateway devices
+    { "tls",       bench_tls },         // last: TLS stays on
+};
+
+int main(int argc, char** argv) {
+    int ran = 0;
+    for (const auto& s : suites) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], s.name) == 0) selected = true;
+        }
+        if (selected) {
+            s.run();
+            ran++;
+        }
+    }
+    if (ran == 0) {
+        fprintf(stderr, "Unknown suite. Available:");
+        for (const auto& s : suites) fprintf(stderr, " %s", s.name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return 0;
+}
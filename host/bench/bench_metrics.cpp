@@ -0,0 +1,80 @@
+//───────────────────────────────────────────────────────────────────
+//─── Runtime metrics benchmarks ────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// 10 minutes of virtual time, mqtt_poll() every 10 ms and a state every 100 ms,
+// against a broker whose PUBACK delay changes over time (and one HA command per second):
+//  - minutes 0-3 : PUBACK within 20 ms, cyw43_arch_poll() takes 30 us
+//  - minutes 3-6 : PUBACK within 400 ms (congested AP), poll 700 us, 1 s of ERR_TIMEOUT
+//  - minute 6    : broker connection lost, reconnect
+// Shows what the diagnostics entities report for each period, and the cost of mqtt_poll().
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+static uint32_t diag_count = 0;
+static char     diag_last[512];
+
+static void diag_hook(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "pico_env_sensor/diagnostics") != 0) return;
+    diag_count++;
+    size_t n = msg->len < sizeof(diag_last) - 1 ? msg->len : sizeof(diag_last) - 1;
+    memcpy(diag_last, msg->payload, n);
+    diag_last[n] = '\0';
+}
+
+//--- One minute of main loop, acks every ack_ms, a command from HA every second
+static void run_minute(BenchStat& s, uint32_t ack_ms) {
+    for (uint32_t t = 0; t < 60000; t += 10) {
+        if (t % 100 == 0)           mqtt_ha_publish_state(21.5, 40.0, 400, 10, 1);
+        if (t % 1000 == 500)        host_deliver("pico_env_sensor/led/brightness", "toggle", 6);
+        BENCH_TIME(s, mqtt_poll());
+        if (t % ack_ms == ack_ms - 10) host_ack_all();
+        host_advance_us(10000);
+    }
+}
+
+void bench_metrics() {
+    bench_header("runtime metrics, 10 min virtual (host cycles per mqtt_poll)");
+    bench_quiet(true);
+
+    bench_session_up();
+    host_set_publish_hook(diag_hook, nullptr);
+    host_set_auto_ack(false);
+    diag_count = 0;
+    MqttHaMetrics m0 = mqtt_ha_metrics();
+
+    BenchStat s;
+    const char* periods[10];
+    char        payloads[10][512];
+    for (int minute = 0; minute < 10; minute++) {
+        bool slow = (minute >= 3 && minute < 6);
+        host_set_poll_cost_us(slow ? 700 : 30);
+        host_set_request_result((minute == 4) ? ERR_TIMEOUT : ERR_OK);
+        if (minute == 6) host_drop_connection();
+        run_minute(s, slow ? 400 : 20);
+        host_set_request_result(ERR_OK);
+        periods[minute] = slow ? "slow broker" : (minute == 6 ? "reconnect" : "normal");
+        strcpy(payloads[minute], diag_last);
+    }
+    host_set_publish_hook(nullptr, nullptr);
+    host_set_auto_ack(true);
+    host_set_poll_cost_us(0);
+    bench_drain();
+
+    MqttHaMetrics m = mqtt_ha_metrics();
+    uint32_t errors = 0;
+    for (int i = 0; i < MQTT_HA_ERR_CODES; i++) errors += m.errors[i] - m0.errors[i];
+
+    bench_quiet(false);
+    bench_report("mqtt_poll (metrics counted)", s);
+    bench_note("diagnostics messages: %u (one per minute online)", diag_count);
+    bench_note("publishes %u, errors %u (timeout %u), reconnects %u, overflows %u",
+               m.publishes - m0.publishes, errors, m.errors[-ERR_TIMEOUT] - m0.errors[-ERR_TIMEOUT],
+               m.reconnects - m0.reconnects, m.overflows - m0.overflows);
+    bench_note("bytes sent %u, received %u", m.bytes_sent - m0.bytes_sent, m.bytes_received - m0.bytes_received);
+    static const int shown[] = { 2, 5, 9 };
+    for (int minute : shown) {
+        bench_note("end of minute %d (%s): %s", minute + 1, periods[minute], payloads[minute]);
+    }
+}
@@ -0,0 +1,60 @@
+//───────────────────────────────────────────────────────────────────
+//─── Outbound queue benchmarks ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// A state every loop iteration while the broker is slow to acknowledge
+// (PUBACKs only every 20 states, mqtt_poll() every 4): what reaches the
+// broker, what is coalesced, and whether lwIP ever refuses a request.
+// Run with the state topic in QoS 1, then QoS 0 (no PUBACK round trip).
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+static void bench_burst(const char* name, uint8_t qos) {
+    bench_session_up();
+    mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, qos, false);
+    host_set_auto_ack(false);
+
+    MqttHaOutboxStats before = mqtt_ha_outbox_stats();
+    HostStats         h0     = host_stats();
+    BenchStat s;
+    for (uint32_t i = 0; i < 2000; i++) {
+        uint64_t pb = host_stats().payload_bytes;
+        uint64_t wb = host_stats().wire_bytes;
+        BENCH_TIME(s, mqtt_ha_publish_state(20.0 + (i % 50) * 0.1, 45.0, 400 + i, i % 500, 1));
+        s.bytes += host_stats().payload_bytes - pb;
+        s.wire  += host_stats().wire_bytes - wb;
+        if (i % 4 == 3)   mqtt_poll();
+        if (i % 20 == 19) host_ack_all();
+    }
+    host_set_auto_ack(true);
+    bench_drain();
+
+    MqttHaOutboxStats after = mqtt_ha_outbox_stats();
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_note("states sent %u / 2000, coalesced %u, retried %u, dropped %u, lwIP refusals %u",
+               host_stats().publishes - h0.publishes,
+               after.coalesced - before.coalesced, after.retried - before.retried,
+               after.dropped - before.dropped, host_stats().publish_rejected - h0.publish_rejected);
+    bench_quiet(true);
+    mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 1, false);
+}
+
+void bench_outbox() {
+    bench_header("outbound queue, slow broker (host cycles per state)");
+    bench_quiet(true);
+
+    //--- Connect sequence: discovery + button + availability + subscribe share the window
+    MqttHaOutboxStats o0 = mqtt_ha_outbox_stats();
+    mqtt_ha_discovery_invalidate();     // the full discovery, not the cached one
+    bench_session_up();
+    MqttHaOutboxStats o = mqtt_ha_outbox_stats();
+    uint32_t refused = host_stats().publish_rejected;
+
+    bench_burst("mqtt_ha_publish_state, QoS 1", 1);
+    bench_burst("mqtt_ha_publish_state, QoS 0", 0);
+
+    bench_quiet(false);
+    bench_note("connect sequence: %u messages queued, max depth %u, lwIP refusals %u",
+               o.queued - o0.queued, o.max_depth, refused);
+}
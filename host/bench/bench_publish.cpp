@@ -0,0 +1,87 @@
+//───────────────────────────────────────────────────────────────────
+//─── Publish path benchmarks ───────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Baseline numbers for the three hot paths of the library:
+//  - mqtt_ha_publish_state()     : every sample
+//  - mqtt_ha_publish_discovery() : every (re)connect
+//  - incoming data -> dispatch_command() : every command from HA
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+static uint32_t toggles = 0;
+static void bench_toggle() { toggles++; }
+
+static const CmdEntry bench_cmds[] = {
+    { "on",     bench_toggle },
+    { "off",    bench_toggle },
+    { "toggle", bench_toggle },
+};
+
+static void bench_state() {
+    BenchStat s;
+    for (uint32_t i = 0; i < 20000; i++) {
+        double   t   = 18.0 + (i % 200) * 0.05;
+        double   h   = 35.0 + (i % 300) * 0.1;
+        uint64_t pb  = host_stats().payload_bytes;
+        uint64_t wb  = host_stats().wire_bytes;
+        BENCH_TIME(s, mqtt_ha_publish_state(t, h, 400 + i % 1600, i % 1000, 1 + i % 5));
+        s.bytes += host_stats().payload_bytes - pb;
+        s.wire  += host_stats().wire_bytes - wb;
+        bench_drain();
+    }
+    bench_quiet(false);
+    bench_report("mqtt_ha_publish_state", s);
+    bench_quiet(true);
+}
+
+static void bench_discovery() {
+    BenchStat s;
+    for (uint32_t i = 0; i < 2000; i++) {
+        mqtt_ha_discovery_invalidate();     // the full discovery, not the cached one
+        host_drop_connection();
+        bench_until_connect_pending();
+        uint64_t pb = host_stats().payload_bytes;
+        uint64_t wb = host_stats().wire_bytes;
+        //--- CONNACK fires mqtt_connection_callback -> mqtt_ha_publish_discovery()
+        BENCH_TIME(s, cyw43_arch_poll());
+        s.bytes += host_stats().payload_bytes - pb;
+        s.wire  += host_stats().wire_bytes - wb;
+        bench_drain();
+    }
+    bench_quiet(false);
+    bench_report("mqtt_ha_publish_discovery (on connect)", s);
+    bench_quiet(true);
+}
+
+static void bench_incoming(const char* name, const char* payload, u16_t fragment) {
+    BenchStat s;
+    size_t len = strlen(payload);
+    for (uint32_t i = 0; i < 20000; i++) {
+        BENCH_TIME(s, host_deliver("pico_env_sensor/led/brightness", payload, len, fragment));
+        s.bytes += len;
+        mqtt_ha_log_flush();        // mqtt_poll() of the main loop between two messages
+    }
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_quiet(true);
+}
+
+void bench_publish() {
+    bench_header("publish path (host cycles per call)");
+    bench_quiet(true);
+    bench_session_up();
+    mqtt_register_commands(bench_cmds, sizeof(bench_cmds) / sizeof(bench_cmds[0]));
+
+    bench_state();
+    bench_discovery();
+    bench_incoming("incoming -> dispatch_command (hit)", "toggle", 0);
+    bench_incoming("incoming -> dispatch_command (miss)", "brightness_up", 0);
+
+    static char big[400];
+    memset(big, 'x', sizeof(big) - 1);
+    bench_incoming("incoming 399 B in 64 B fragments", big, 64);
+    bench_quiet(false);
+    bench_note("handler calls: %u", toggles);
+}
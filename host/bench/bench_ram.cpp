@@ -0,0 +1,133 @@
+//───────────────────────────────────────────────────────────────────
+//─── RAM benchmarks (scratch arena, stack high-water) ──────────────
+//───────────────────────────────────────────────────────────────────
+// Each path starts from a blank flash with wifi_mqtt_init() (stack painted,
+// arena peak reset), mqtt_poll() every 10 ms, then mqtt_ha_ram_stats():
+//  - built-in table: discovery, a state every second, diagnostics every minute
+//  - 48 channels: 4 discovery chunks, every channel in the state
+//  - 48 channels, 5 minutes offline, then the backlog replayed
+//  - 48 channels batched (K = 8)
+//  - JSON commands through the router (tokenizer, handler)
+//  - gateway: 16 bridged devices announced, a state each
+// Stack bytes are counted below the frame of wifi_mqtt_init() and are x86-64 frames:
+// compare the paths with each other, they are not Pico figures.
+// Runs after the gateway suite (devices cannot be removed, its devices are reused).
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BIG_CHANNELS 48
+#define RAM_DEVICES  16
+#define CMD_TOPIC    "pico_env_sensor/bench/config"
+
+static char          big_keys[BIG_CHANNELS][16];
+static char          big_ids[BIG_CHANNELS][8];
+static MqttHaChannel big_table[BIG_CHANNELS];
+
+static const MqttHaChannel node_channels[] = {
+    { "temperature", "temp", nullptr, "°C", "temperature", 1, MQTT_HA_I16 },
+    { "humidity",    "hum",  nullptr, "%",  "humidity",    1, MQTT_HA_U16 },
+    { "battery",     "batt", nullptr, "%",  "battery",     0, MQTT_HA_U8  },
+};
+static char         node_ids[RAM_DEVICES][16];
+static MqttHaDevice nodes[RAM_DEVICES];
+
+static uint32_t commands = 0;
+static void on_command(const MqttHaCommand* cmd) { commands++; }
+static const MqttHaRoute routes[] = {
+    { CMD_TOPIC, nullptr, on_command, nullptr, 1, nullptr },
+};
+
+static void boot() {
+    host_erase_flash();
+    bench_session_up();
+}
+
+//--- mqtt_poll() every 10 ms for ms, a sample every second (all channels of the table)
+static void run(uint32_t ms, uint8_t channels) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        if (t % 1000 == 0) {
+            for (uint8_t i = 0; i < channels; i++) mqtt_ha_set(i, 20.0 + i + (t / 1000) % 7 * 0.1);
+            mqtt_ha_publish_channels();
+        }
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+}
+
+static void line(const char* name) {
+    MqttHaRamStats r = mqtt_ha_ram_stats();
+    bench_quiet(false);
+    bench_note("%-40s stack %5u bytes, scratch %4u / %u bytes, %u refused",
+               name, r.stack_peak, r.scratch_peak, r.scratch_size, r.scratch_failures);
+    bench_quiet(true);
+}
+
+void bench_ram() {
+    bench_header("RAM: stack high-water (x86-64) and scratch arena, per path");
+    bench_quiet(true);
+    mqtt_ha_register_channels(nullptr, 0);
+
+    boot();
+    run(180000, 5);
+    line("built-in table, states + diagnostics");
+
+    for (int i = 0; i < BIG_CHANNELS; i++) {
+        snprintf(big_keys[i], sizeof(big_keys[i]), "probe_%02d", i);
+        snprintf(big_ids[i], sizeof(big_ids[i]), "p%02d", i);
+        big_table[i] = { big_keys[i], big_ids[i], nullptr, "°C", "temperature", 1, MQTT_HA_I16 };
+    }
+    mqtt_ha_register_channels(big_table, BIG_CHANNELS);
+    boot();
+    run(60000, BIG_CHANNELS);
+    line("48 channels, discovery chunks + states");
+
+    boot();
+    host_set_broker_down("127.0.0.1", true);
+    host_drop_connection();
+    run(300000, BIG_CHANNELS);
+    host_set_broker_down("127.0.0.1", false);
+    bench_until_online();
+    bench_drain();
+    run(60000, BIG_CHANNELS);
+    line("48 channels, offline 5 min + replay");
+
+    mqtt_ha_set_batching(8, 10000);
+    boot();
+    run(120000, BIG_CHANNELS);
+    line("48 channels, batched (K = 8)");
+    mqtt_ha_set_batching(0, 0);
+    mqtt_ha_register_channels(nullptr, 0);
+
+    mqtt_ha_register_routes(routes, 1);
+    boot();
+    static const char payload[] = "{\"mode\":\"auto\",\"setpoint\":21.5,\"fan\":{\"speed\":3},\"on\":true}";
+    for (int i = 0; i < 1000; i++) {
+        host_deliver(CMD_TOPIC, payload, sizeof(payload) - 1, i % 2 ? 16 : 0);
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+    line("JSON commands, whole and in fragments");
+    mqtt_ha_register_routes(nullptr, 0);
+
+    if (mqtt_ha_gateway_stats().devices == 0) {
+        for (int n = 0; n < RAM_DEVICES; n++) {
+            snprintf(node_ids[n], sizeof(node_ids[n]), "ram_node_%02d", n);
+            nodes[n] = { node_ids[n], node_ids[n], nullptr, node_channels, 3 };
+            int h = mqtt_ha_add_device(&nodes[n]);
+            for (uint8_t c = 0; c < 3; c++) mqtt_ha_device_set(h, c, 20.0 + n + c);
+            mqtt_ha_device_publish(h);
+        }
+    }
+    boot();
+    run(60000, 5);
+    line("gateway, devices announced");
+
+    MqttHaRamStats r = mqtt_ha_ram_stats();
+    bench_quiet(false);
+    bench_note("%u commands handled, stack watched over %u bytes (MQTT_HA_STACK_WATCH)", commands, r.stack_watch);
+    bench_quiet(true);
+    host_reset();
+}
@@ -0,0 +1,70 @@
+//───────────────────────────────────────────────────────────────────
+//─── Connection state machine benchmarks ───────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Virtual time: the main loop calls mqtt_poll() every 10 ms.
+//  - cold boot with a 2.5 s join and a 0.8 s DHCP lease
+//  - 30 s WiFi outage (AP gone), then AP back
+//  - broker refusing connections for 20 s
+// mqtt_poll() host cycles show the loop is never blocked.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+static void report_states(const char* title) {
+    MqttHaConnStats st = mqtt_ha_conn_stats();
+    bench_note("%s: connects %u, failures %u, last backoff %u ms", title, st.connects, st.failures, st.backoff_ms);
+    for (int i = MQTT_HA_WIFI_JOIN; i < MQTT_HA_STATE_COUNT; i++) {
+        if (st.time_in_state_ms[i] == 0) continue;
+        bench_note("    %-13s %8u ms", mqtt_ha_state_name((MqttHaState)i), st.time_in_state_ms[i]);
+    }
+}
+
+//--- Run the main loop for ms of virtual time, timing every mqtt_poll()
+static void run_loop(BenchStat& s, uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        BENCH_TIME(s, mqtt_poll());
+        host_advance_us(10000);
+    }
+}
+
+void bench_reconnect() {
+    bench_header("connection state machine (host cycles per mqtt_poll)");
+    bench_quiet(true);
+    mqtt_ha_host_reset_stats();     // counters of the earlier suites
+
+    //--- COLD BOOT (blank flash: no cached AP / lease)
+    host_reset();
+    host_erase_flash();
+    host_set_link_timing(2500, 800);
+    wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883);
+    uint32_t boot_ms = bench_until_online();
+    bench_quiet(false);
+    bench_note("cold boot to ONLINE: %u ms (virtual)", boot_ms);
+    report_states("cold boot");
+    bench_quiet(true);
+
+    //--- WIFI OUTAGE: AP gone for 30 s
+    BenchStat outage;
+    host_drop_wifi();
+    host_set_wifi_result(CYW43_LINK_NONET);
+    run_loop(outage, 30000);
+    host_set_wifi_result(0);
+    uint32_t recover_ms = bench_until_online();
+    bench_quiet(false);
+    bench_report("mqtt_poll during 30 s WiFi outage", outage);
+    bench_note("AP back -> ONLINE: %u ms (virtual)", recover_ms);
+    report_states("after outage");
+    bench_quiet(true);
+
+    //--- BROKER REFUSING for 20 s, WiFi stays up
+    BenchStat refused;
+    host_set_connect_status(MQTT_CONNECT_REFUSED_SERVER);
+    host_drop_connection();
+    run_loop(refused, 20000);
+    host_set_connect_status(MQTT_CONNECT_ACCEPTED);
+    recover_ms = bench_until_online();
+    bench_quiet(false);
+    bench_report("mqtt_poll while broker refuses", refused);
+    bench_note("broker back -> ONLINE: %u ms (virtual)", recover_ms);
+    report_states("after broker outage");
+}
@@ -0,0 +1,92 @@
+//───────────────────────────────────────────────────────────────────
+//─── Command router benchmarks ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// 48 commands on one topic, delivered end to end (host_deliver):
+//  - "linear": one "any payload" route whose handler runs the former
+//    dispatch_command() loop (strcmp over the whole table)
+//  - "router": the same 48 names as exact routes (hash lookup)
+// plus 8 HA number topics (payload parsed into a scaled value)
+// and the cost of subscribing 10 topics on connect.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdio.h>
+#include <string.h>
+
+#define BENCH_COMMANDS 48
+#define BENCH_NUMBERS  8
+
+static char        names[BENCH_COMMANDS][16];
+static char        number_topics[BENCH_NUMBERS][32];
+static MqttHaRoute routes[BENCH_COMMANDS + 1 + BENCH_NUMBERS];
+static uint32_t    hits      = 0;
+static int32_t     value_sum = 0;
+
+static void on_command(const MqttHaCommand* cmd) { hits++; }
+
+//--- The former dispatch_command(): linear strcmp over the table
+static void on_linear(const MqttHaCommand* cmd) {
+    for (int i = 0; i < BENCH_COMMANDS; i++) {
+        if (strcmp(cmd->payload, names[i]) == 0) {
+            hits++;
+            return;
+        }
+    }
+}
+
+static void on_number(const MqttHaCommand* cmd) {
+    if (cmd->has_value) value_sum += cmd->value;
+}
+
+static void bench_deliver(const char* name, const char* topic, const char* payload) {
+    BenchStat s;
+    size_t len = strlen(payload);
+    for (uint32_t i = 0; i < 20000; i++) {
+        BENCH_TIME(s, host_deliver(topic, payload, len));
+        s.bytes += len;
+        mqtt_ha_log_flush();        // mqtt_poll() of the main loop between two messages
+    }
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_quiet(true);
+}
+
+void bench_router() {
+    bench_header("command router, 48 commands (host cycles per message)");
+    bench_quiet(true);
+
+    uint8_t n = 0;
+    for (int i = 0; i < BENCH_COMMANDS; i++) {
+        snprintf(names[i], sizeof(names[i]), "scene_%02d", i);
+        routes[n++] = { "bench/cmd", names[i], on_command, nullptr, 0 };
+    }
+    routes[n++] = { "bench/linear", nullptr, on_linear, nullptr, 0 };
+    for (int i = 0; i < BENCH_NUMBERS; i++) {
+        snprintf(number_topics[i], sizeof(number_topics[i]), "bench/number/%d/set", i);
+        routes[n++] = { number_topics[i], nullptr, on_number, nullptr, 1 };
+    }
+    mqtt_register_commands(nullptr, 0);
+    if (!mqtt_ha_register_routes(routes, n)) {
+        bench_quiet(false);
+        bench_note("route registration failed");
+        return;
+    }
+
+    bench_session_up();
+    uint32_t subs = host_stats().subscribes;     // host_reset() in bench_session_up() cleared the count
+
+    bench_deliver("linear strcmp, first command",  "bench/linear", names[0]);
+    bench_deliver("linear strcmp, last command",   "bench/linear", names[BENCH_COMMANDS - 1]);
+    bench_deliver("linear strcmp, unknown",        "bench/linear", "scene_99");
+    bench_deliver("router, first command",         "bench/cmd",    names[0]);
+    bench_deliver("router, last command",          "bench/cmd",    names[BENCH_COMMANDS - 1]);
+    bench_deliver("router, unknown",               "bench/cmd",    "scene_99");
+    bench_deliver("router, number value",          number_topics[3], "21.45");
+    bench_deliver("unknown topic",                 "bench/other",  "scene_00");
+
+    bench_quiet(false);
+    bench_note("topics subscribed on connect: %u, handler calls: %u", subs, hits);
+
+    //--- Leave no route behind for the other suites
+    mqtt_ha_register_routes(nullptr, 0);
+}
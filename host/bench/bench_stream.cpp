@@ -0,0 +1,68 @@
+//───────────────────────────────────────────────────────────────────
+//─── Streaming tokenizer benchmarks ────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// End-to-end cost of large messages through PayloadTokenizer
+// (mqtt_ha_stream.h): a 4 KB JSON config and a 64 KB OTA-style blob
+// that the former 512-byte buffer dropped. The fragment split checks
+// are in host/test/test_stream.cpp.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include "mqtt_ha_stream.h"
+#include <random>
+#include <stdio.h>
+#include <string>
+#include <string.h>
+
+static uint64_t blob_bytes = 0;
+static void on_config(const MqttHaCommand* cmd) {}
+static void on_blob(const MqttHaCommand* cmd) {}
+static void on_blob_data(const uint8_t* data, uint16_t len, uint32_t offset, uint32_t total, void* arg) {
+    blob_bytes += len;
+}
+
+static const MqttHaRoute stream_routes[] = {
+    { "bench/config", nullptr, on_config, nullptr, 1, nullptr },
+    { "bench/ota",    nullptr, on_blob,   nullptr, 0, on_blob_data },
+};
+
+static void bench_large(const char* name, const char* topic, const std::string& payload, u16_t fragment) {
+    BenchStat s;
+    for (uint32_t i = 0; i < 200; i++) {
+        BENCH_TIME(s, host_deliver(topic, payload.data(), payload.size(), fragment));
+        s.bytes += payload.size();
+        mqtt_ha_log_flush();        // mqtt_poll() of the main loop between two messages
+    }
+    bench_quiet(false);
+    bench_report(name, s);
+    bench_quiet(true);
+}
+
+void bench_stream() {
+    bench_header("streaming tokenizer (host cycles per message)");
+
+    std::mt19937 rng(2024);
+    //--- Large messages end to end, in 1 KB fragments like lwIP hands them over
+    bench_quiet(true);
+    mqtt_register_commands(nullptr, 0);
+    mqtt_ha_register_routes(stream_routes, 2);
+    bench_session_up();
+
+    std::string config = "{";
+    for (int i = 0; config.size() < 4000; i++) {
+        if (i) config += ",";
+        config += "\"param_" + std::to_string(i) + "\":" + std::to_string(i * 7) + ".5";
+    }
+    config += "}";
+    std::string blob(65536, '\0');
+    for (size_t i = 0; i < blob.size(); i++) blob[i] = (char)rng();
+
+    bench_large("4 KB JSON config (1 call per member)", "bench/config", config, 1024);
+    bench_large("64 KB OTA-style blob (raw fragments)", "bench/ota", blob, 1024);
+    bench_quiet(false);
+    bench_note("blob bytes handed to the data handler: %llu (expected %llu)",
+               (unsigned long long)blob_bytes, (unsigned long long)blob.size() * 200);
+    bench_note("tokenizer state: %u bytes (former payload buffer: 512)", (unsigned)sizeof(PayloadTokenizer));
+
+    mqtt_ha_register_routes(nullptr, 0);
+}
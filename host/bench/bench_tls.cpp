@@ -0,0 +1,129 @@
+//───────────────────────────────────────────────────────────────────
+//─── TLS session resumption benchmarks ─────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Broker round trip 30 ms, mqtt_poll() every 10 ms, handshake CPU time of a
+// Pico W with mbedTLS (ECDHE P-256 + RSA-2048 chain): 1800 ms full, 40 ms resumed.
+// Virtual ms from mqtt_client_connect() until ONLINE: the backoff before the
+// connect (random, up to a second) would hide the handshake, so it is left out.
+//  - plaintext reference (before mqtt_ha_set_tls())
+//  - cold boot on a blank flash: full handshake, the session goes to the flash
+//  - session drops: the session is offered and resumed
+//  - broker restarted (new ticket keys): refused, full, then resumed again
+//  - broker without resumption: a full handshake each time, the flash is left alone
+//  - reboot: the session comes back from the flash; on a blank flash: full
+// Runs last: TLS stays on for the process once set.
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+
+#define RTT_MS        30
+#define FULL_MS       1800
+#define RESUMED_MS    40
+
+static const uint8_t bench_ca[] = "-----BEGIN CERTIFICATE-----\n(bench CA)\n-----END CERTIFICATE-----\n";
+
+static MqttHaTlsStats last;
+static uint32_t       last_erases;
+
+static void boot() {
+    host_reset();
+    host_set_ack_delay_ms(RTT_MS);
+    host_set_tls_cost(FULL_MS, RESUMED_MS);
+    wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883);
+    last        = mqtt_ha_tls_stats();
+    last_erases = host_flash_erases();
+}
+
+//--- Virtual ms from the next mqtt_client_connect() until ONLINE: the handshake CPU time passes inside a poll
+static uint32_t until_online() {
+    uint32_t connects = host_stats().connects;
+    while (host_stats().connects == connects) {
+        mqtt_poll();
+        if (host_stats().connects != connects) break;
+        host_advance_us(10000);
+    }
+    uint64_t t0 = time_us_64();
+    while (mqtt_ha_state() != MQTT_HA_ONLINE) {
+        host_advance_us(10000);
+        mqtt_poll();
+    }
+    return (uint32_t)((time_us_64() - t0) / 1000);
+}
+
+static void stay_online(uint32_t ms) {
+    for (uint32_t t = 0; t < ms; t += 10) {
+        mqtt_poll();
+        host_advance_us(10000);
+    }
+}
+
+static uint32_t drop() {
+    stay_online(30000);
+    host_drop_connection();
+    return until_online();
+}
+
+//--- What happened since the previous line (settle first: announcements in flight, the flash write)
+static void line(const char* name, uint32_t ms) {
+    bench_until_online();
+    stay_online(2000);
+    MqttHaTlsStats s = mqtt_ha_tls_stats();
+    bench_quiet(false);
+    bench_note("%-42s %5u ms: full %u, resumed %u, refused %u, flash writes %u",
+               name, ms, s.full - last.full, s.resumed - last.resumed,
+               s.rejected - last.rejected, host_flash_erases() - last_erases);
+    bench_quiet(true);
+    last        = s;
+    last_erases = host_flash_erases();
+}
+
+void bench_tls() {
+    bench_header("TLS session resumption, connect -> ONLINE (virtual ms)");
+    bench_quiet(true);
+    mqtt_ha_host_reset_stats();     // counters of the earlier suites
+
+    host_erase_flash();
+    boot();
+    until_online();
+    stay_online(2000);              // the boot's flash write
+    last        = mqtt_ha_tls_stats();
+    last_erases = host_flash_erases();
+    line("plaintext, a drop", drop());
+
+    if (!mqtt_ha_tls_stats().enabled && !mqtt_ha_set_tls(bench_ca, sizeof(bench_ca))) {
+        bench_quiet(false);
+        bench_note("mqtt_ha_set_tls() failed");
+        return;
+    }
+    host_erase_flash();
+    boot();
+    line("cold boot, blank flash", until_online());
+    uint32_t total = 0;
+    for (int i = 0; i < 5; i++) total += drop();
+    line("5 drops (avg)", total / 5);
+
+    host_tls_new_keys();
+    line("broker restarted, a drop", drop());
+    line("... and another", drop());
+
+    host_set_tls_resumption(false);
+    total = 0;
+    for (int i = 0; i < 5; i++) total += drop();
+    line("broker without resumption, 5 drops (avg)", total / 5);
+    host_set_tls_resumption(true);
+    line("resumption back, a drop", drop());
+    line("... and another", drop());
+
+    MqttHaTlsStats s = mqtt_ha_tls_stats();
+    bench_quiet(false);
+    bench_note("since the cold boot, connect -> CONNACK: full %u ms (max %u), resumed %u ms (max %u), sessions saved %u",
+               s.full_ms, s.full_max_ms, s.resumed_ms, s.resumed_max_ms, s.saves);
+    bench_quiet(true);
+
+    boot();
+    line("reboot, session in flash", until_online());
+    host_erase_flash();
+    boot();
+    line("reboot, blank flash", until_online());
+    host_reset();
+}
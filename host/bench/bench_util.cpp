@@ -0,0 +1,79 @@
+#include "bench.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <unistd.h>
+
+static int saved_stdout = -1;
+
+void bench_quiet(bool quiet) {
+    fflush(stdout);
+    if (quiet && saved_stdout < 0) {
+        saved_stdout = dup(STDOUT_FILENO);
+        int devnull = open("/dev/null", O_WRONLY);
+        dup2(devnull, STDOUT_FILENO);
+        close(devnull);
+    } else if (!quiet && saved_stdout >= 0) {
+        dup2(saved_stdout, STDOUT_FILENO);
+        close(saved_stdout);
+        saved_stdout = -1;
+    }
+}
+
+void bench_header(const char* suite) {
+    printf("\n=== %s ===\n", suite);
+    printf("%-44s %8s %10s %10s %10s %8s %8s\n",
+           "operation", "iters", "mean", "min", "max", "bytes", "wire");
+}
+
+void bench_report(const char* name, const BenchStat& s) {
+    if (s.n == 0) return;
+    printf("%-44s %8llu %10llu %10llu %10llu %8llu %8llu\n", name,
+           (unsigned long long)s.n,
+           (unsigned long long)(s.total / s.n),
+           (unsigned long long)s.min,
+           (unsigned long long)s.max,
+           (unsigned long long)(s.bytes / s.n),
+           (unsigned long long)(s.wire / s.n));
+}
+
+void bench_note(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    printf("  - ");
+    vprintf(fmt, ap);
+    printf("\n");
+    va_end(ap);
+}
+
+void bench_session_up() {
+    host_reset();
+    mqtt_ha_host_reset_stats();
+    wifi_mqtt_init("bench_ssid", "bench_password", "127.0.0.1", 1883);
+    bench_until_online();
+}
+
+uint32_t bench_until_online(uint32_t max_ms) {
+    for (uint32_t t = 0; t <= max_ms; t += 10) {
+        mqtt_poll();
+        if (mqtt_ha_state() == MQTT_HA_ONLINE && host_in_flight() == 0) return t;
+        host_advance_us(10000);
+    }
+    return UINT32_MAX;
+}
+
+void bench_until_connect_pending() {
+    uint32_t connects = host_stats().connects;
+    for (int i = 0; i < 100000 && host_stats().connects == connects; i++) {
+        host_advance_us(10000);
+        mqtt_poll();
+    }
+}
+
+void bench_drain() {
+    for (int i = 0; i < 100 && host_in_flight() > 0; i++) {
+        mqtt_poll();
+    }
+}
@@ -0,0 +1,18 @@
+//───────────────────────────────────────────────────────────────────
+//─── State payload, former snprintf("%.1f") path ───────────────────
+//───────────────────────────────────────────────────────────────────
+// Alone in its object for the json_size report (mqtt_ha_size.cmake):
+// its text, and the float printf it leaves to the C library.
+#include <stdint.h>
+#include <stdio.h>
+
+//--- The state payload exactly as mqtt_ha_publish_state() built it before JsonWriter
+int state_snprintf(char* buf, size_t size, double t, double h, uint16_t eco2, uint16_t tvoc, uint8_t aqi) {
+    return snprintf(buf, size,
+        "{\"temperature\":%.1f,"
+         "\"humidity\":%.1f,"
+         "\"eco2\":%u,"
+         "\"tvoc\":%u,"
+         "\"aqi\":%u}",
+        t, h, eco2, tvoc, aqi);
+}
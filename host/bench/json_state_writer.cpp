@@ -0,0 +1,25 @@
+//───────────────────────────────────────────────────────────────────
+//─── State payload, JsonWriter path ────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Alone in its object for the json_size report (mqtt_ha_size.cmake):
+// its text, plus mqtt_ha_json.cpp that it pulls from the library.
+#include "mqtt_ha_json.h"
+
+//--- Rounded like printf, scaled by 10 (how mqtt_ha_set() stores a 1-decimal channel)
+static int32_t tenths(double v) {
+    uint64_t mag;
+    bool     neg;
+    if (!json_round_scaled(v, 1, &mag, &neg) || mag > INT32_MAX) mag = INT32_MAX;
+    return neg ? -(int32_t)mag : (int32_t)mag;
+}
+
+size_t state_writer(char* buf, size_t size, double t, double h, uint16_t eco2, uint16_t tvoc, uint8_t aqi) {
+    JsonWriter json(buf, size);
+    json.raw("{\"temperature\":").fixed(tenths(t), 1)
+        .raw(",\"humidity\":").fixed(tenths(h), 1)
+        .raw(",\"eco2\":").uinteger(eco2)
+        .raw(",\"tvoc\":").uinteger(tvoc)
+        .raw(",\"aqi\":").uinteger(aqi)
+        .raw("}");
+    return json.length();
+}
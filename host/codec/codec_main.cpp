@@ -0,0 +1,355 @@
+//───────────────────────────────────────────────────────────────────
+//─── Codec bench: built-in MQTT client vs lwIP's MQTT app ──────────
+//───────────────────────────────────────────────────────────────────
+// The unchanged library against a broker on this machine, built twice:
+//  - mqtt_ha_codec: host_net.cpp's lwIP MQTT app, the mqtt_publish() path
+//    of the Pico today (MQTT 3.1.1, packets built in the output ring)
+//  - mqtt_ha_codec_builtin: mqtt_ha_mqtt.cpp over host_net.cpp's altcp
+//    (MQTT 5 topic aliases, or 3.1.1 with -P 4 or a 3.1.1 broker)
+//
+// A child process is the instance: ONLINE first (discovery, availability,
+// subscriptions are not measured), then n states of c channels, each one
+// published once the previous one completed (PUBACK, or sent for QoS 0).
+// Per state it measures the PUBLISH bytes on the wire (host_stats().wire_bytes),
+// the CPU time of the process (getrusage: library, encoding and the socket
+// syscalls), the time in mqtt_ha_publish_channels() (JSON, then the packet
+// written for the socket) and publish -> completion.
+//
+// The parent process is the observer: its own client subscribes to the state
+// topic and checks that every state arrives under its full topic (the broker
+// resolved the aliases) and with its payload.
+//
+// -T ca.pem: MQTT over TLS (instance and observer, OpenSSL in host_net.cpp). After
+// the states the instance drops its connection once: the reconnect should resume
+// the session (mqtt_ha_tls_stats(): one full handshake, one resumed).
+//
+// Usage: mqtt_ha_codec[_builtin] [-b host[:port]] [-n states] [-c channels] [-P 4|5] [-T ca.pem] [-v]
+#include "host_net.h"
+#include "mqtt_ha.h"
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CODEC_DEVICE_ID   "pico_env_sensor"
+#define CODEC_STATE_TOPIC CODEC_DEVICE_ID "/state"
+
+struct CodecOptions {
+    char        host[64]  = "127.0.0.1";
+    uint16_t    port      = 1883;
+    int         states    = 2000;
+    int         channels  = 5;
+    uint8_t     level     = 5;          // built-in client only
+    bool        verbose   = false;
+};
+static CodecOptions opt;
+static uint8_t      ca_pem[8192];       // -T: CA certificate, '\0' included
+static size_t       ca_len = 0;
+
+static uint64_t codec_clock_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+static uint64_t codec_clock_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000u + (uint64_t)ts.tv_nsec;
+}
+
+static uint64_t codec_cpu_us(uint64_t* user, uint64_t* sys) {
+    struct rusage r;
+    getrusage(RUSAGE_SELF, &r);
+    *user = (uint64_t)r.ru_utime.tv_sec * 1000000u + (uint64_t)r.ru_utime.tv_usec;
+    *sys  = (uint64_t)r.ru_stime.tv_sec * 1000000u + (uint64_t)r.ru_stime.tv_usec;
+    return *user + *sys;
+}
+
+//--- Instance -> parent, through a pipe once it is done
+struct CodecReport {
+    int32_t         ok;                 // 0: not ONLINE, or a state never completed
+    uint32_t        states;
+    uint64_t        wire_bytes;         // host_stats(): PUBLISH packets over the run
+    uint32_t        publishes;
+    uint64_t        user_us;            // CPU over the run
+    uint64_t        sys_us;
+    uint64_t        wall_us;
+    uint32_t        ack_max_us;         // longest publish -> completion
+    uint64_t        call_ns;            // in mqtt_ha_publish_channels(): JSON, encoding, write
+    MqttHaMqttStats mqtt;               // at the end
+    uint32_t        aliased;            // over the run
+    uint64_t        publish_bytes;
+    uint64_t        publish_bytes_311;
+    MqttHaTlsStats  tls;                // -T: after the drop and the reconnect
+};
+
+//───────────────────────────────────────────────────────────────────
+//─── Instance (child process) ──────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// The built-in table of the library (mqtt_ha_register_channels(nullptr, 0)), then more
+static const MqttHaChannel codec_channels[] = {
+    { "temperature", "temp",     nullptr, "°C",  "temperature",      1, MQTT_HA_I16 },
+    { "humidity",    "hum",      nullptr, "%",   "humidity",         1, MQTT_HA_U16 },
+    { "eco2",        "eco2",     "eCO2",  "ppm", "carbon_dioxide",   0, MQTT_HA_U16 },
+    { "tvoc",        "tvoc",     "TVOC",  "ppb", "volatile_organic_compounds_parts", 0, MQTT_HA_U16 },
+    { "aqi",         "aqi",      "AQI",   "",    "aqi",              0, MQTT_HA_U8  },
+    { "pressure",    "pressure", nullptr, "hPa", "atmospheric_pressure", 1, MQTT_HA_U16 },
+    { "lux",         "lux",      nullptr, "lx",  "illuminance",      0, MQTT_HA_U16 },
+    { "battery",     "battery",  nullptr, "%",   "battery",          0, MQTT_HA_U8  },
+};
+#define CODEC_MAX_CHANNELS (int)(sizeof(codec_channels) / sizeof(codec_channels[0]))
+
+static void codec_values(int i) {
+    for (int c = 0; c < opt.channels; c++) mqtt_ha_set((uint8_t)c, 20.0 + ((i + c * 7) % 100) * 0.1);
+}
+
+//--- mqtt_poll() until ONLINE. @return false after ms
+static bool codec_until_online(uint32_t ms) {
+    uint64_t deadline = codec_clock_us() + ms * 1000ull;
+    while (mqtt_ha_state() != MQTT_HA_ONLINE && codec_clock_us() < deadline) {
+        mqtt_poll();
+        host_net_wait(1);
+    }
+    return mqtt_ha_state() == MQTT_HA_ONLINE;
+}
+
+static void instance_main(int fd) {
+    CodecReport r = {};
+    if (!opt.verbose) freopen("/dev/null", "w", stdout);
+    mqtt_ha_register_channels(codec_channels, (uint8_t)opt.channels);
+    mqtt_ha_set_mqtt_version(opt.level);
+    if (ca_len && !mqtt_ha_set_tls(ca_pem, ca_len)) _exit(1);
+    if (!wifi_mqtt_init("codec", "codec", opt.host, opt.port)) _exit(1);
+
+    //--- ONLINE, then the session traffic settles (discovery, availability, SUBACKs)
+    codec_until_online(10000);
+    for (uint64_t end = codec_clock_us() + 500000; codec_clock_us() < end;) {
+        mqtt_poll();
+        host_net_wait(1);
+    }
+    if (mqtt_ha_state() == MQTT_HA_ONLINE) {
+        HostStats       h0 = host_stats();
+        MqttHaMqttStats s0 = mqtt_ha_mqtt_stats();
+        uint64_t        u0, y0, u1, y1;
+        codec_cpu_us(&u0, &y0);
+        uint64_t t0 = codec_clock_us();
+        r.ok = 1;
+        for (int i = 0; i < opt.states && r.ok; i++) {
+            codec_values(i);
+            uint32_t done = mqtt_ha_metrics().publishes;
+            uint64_t sent = codec_clock_us();
+            uint64_t c0   = codec_clock_ns();
+            mqtt_ha_publish_channels();
+            r.call_ns += codec_clock_ns() - c0;
+            uint64_t deadline = sent + 5000000;
+            while (mqtt_ha_metrics().publishes == done && (r.ok = codec_clock_us() < deadline)) {
+                mqtt_poll();
+                host_net_wait(1);
+            }
+            uint32_t ack_us = (uint32_t)(codec_clock_us() - sent);
+            if (ack_us > r.ack_max_us) r.ack_max_us = ack_us;
+            r.states += r.ok;
+        }
+        r.wall_us = codec_clock_us() - t0;
+        codec_cpu_us(&u1, &y1);
+        HostStats h1 = host_stats();
+        r.user_us    = u1 - u0;
+        r.sys_us     = y1 - y0;
+        r.wire_bytes = h1.wire_bytes - h0.wire_bytes;
+        r.publishes  = h1.publishes - h0.publishes;
+        r.mqtt       = mqtt_ha_mqtt_stats();
+        r.aliased           = r.mqtt.aliased - s0.aliased;
+        r.publish_bytes     = r.mqtt.publish_bytes - s0.publish_bytes;
+        r.publish_bytes_311 = r.mqtt.publish_bytes_311 - s0.publish_bytes_311;
+        //--- -T: one drop, the reconnect offers the session of the first handshake
+        if (ca_len && r.ok) {
+            host_drop_connection();
+            for (uint64_t end = codec_clock_us() + 100000; codec_clock_us() < end;) {
+                mqtt_poll();
+                host_net_wait(1);
+            }
+            r.ok = codec_until_online(30000);
+        }
+        r.tls = mqtt_ha_tls_stats();
+    }
+    ssize_t w = write(fd, &r, sizeof(r));
+    _exit(w == (ssize_t)sizeof(r) ? 0 : 1);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Observer (parent process) ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static mqtt_client_t* observer;
+static bool           observer_up;
+static bool           state_topic;      // topic of the message being received
+static uint32_t       states_rx, wrong_topic, payload_rx;
+static uint64_t       payload_bytes;
+
+static void observer_connection(mqtt_client_t* client, void* arg, mqtt_connection_status_t status) {
+    observer_up = (status == MQTT_CONNECT_ACCEPTED);
+    if (!observer_up) fprintf(stderr, "codec: observer lost the broker (%d)\n", (int)status);
+}
+
+static void observer_publish(void* arg, const char* topic, u32_t tot_len) {
+    state_topic = strcmp(topic, CODEC_STATE_TOPIC) == 0;
+    if (!state_topic) {
+        wrong_topic++;
+        return;
+    }
+    states_rx++;
+    payload_bytes += tot_len;
+}
+
+static void observer_data(void* arg, const u8_t* data, u16_t len, u8_t flags) {
+    if (state_topic && (flags & MQTT_DATA_FLAG_LAST)) payload_rx++;
+}
+
+static void observer_run(uint32_t ms) {
+    uint64_t end = codec_clock_us() + ms * 1000ull;
+    while (codec_clock_us() < end) {
+        cyw43_arch_poll();
+        host_net_wait(1);
+    }
+}
+
+static bool observer_start() {
+    ip_addr_t addr;
+    if (!ipaddr_aton(opt.host, &addr)) {
+        fprintf(stderr, "codec: -b takes an IP address\n");
+        return false;
+    }
+    struct mqtt_connect_client_info_t ci = {};
+    ci.client_id  = "codec_observer";
+    ci.keep_alive = 60;
+#if MQTT_HA_TLS
+    if (ca_len && !(ci.tls_config = altcp_tls_create_config_client(ca_pem, ca_len))) return false;
+#endif
+    observer = mqtt_client_new();
+    mqtt_set_inpub_callback(observer, observer_publish, observer_data, nullptr);
+    if (mqtt_client_connect(observer, &addr, opt.port, observer_connection, nullptr, &ci) != ERR_OK) return false;
+    for (int i = 0; i < 300 && !observer_up; i++) observer_run(10);
+    if (!observer_up) {
+        fprintf(stderr, "codec: no broker on %s:%u\n", opt.host, opt.port);
+        return false;
+    }
+    if (mqtt_subscribe(observer, CODEC_STATE_TOPIC, 0, nullptr, nullptr) != ERR_OK) return false;
+    observer_run(300);      // SUBACK, then the retained state of an earlier run
+    states_rx = wrong_topic = payload_rx = 0;
+    payload_bytes = 0;
+    return true;
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: mqtt_ha_codec[_builtin] [options]\n"
+        "  -b ip[:port] broker (127.0.0.1:1883)\n"
+        "  -n states    states published, one at a time (2000)\n"
+        "  -c channels  channels per state (5, max %d)\n"
+        "  -P level     built-in client: 5 (MQTT 5, 3.1.1 when refused) or 4 (3.1.1) (5)\n"
+        "  -T file      MQTT over TLS, broker certificate checked against this CA (PEM)\n"
+        "  -v           instance logs on stdout\n", CODEC_MAX_CHANNELS);
+}
+
+int main(int argc, char** argv) {
+    int o;
+    while ((o = getopt(argc, argv, "b:n:c:P:T:vh")) != -1) {
+        switch (o) {
+        case 'b': {
+            snprintf(opt.host, sizeof(opt.host), "%s", optarg);
+            char* colon = strchr(opt.host, ':');
+            if (colon) {
+                *colon   = '\0';
+                opt.port = (uint16_t)atoi(colon + 1);
+            }
+            break;
+        }
+        case 'n': opt.states   = atoi(optarg); break;
+        case 'c': opt.channels = atoi(optarg); break;
+        case 'P': opt.level    = (uint8_t)atoi(optarg); break;
+        case 'T': {
+            FILE* f = fopen(optarg, "rb");
+            if (!f) { perror(optarg); return 1; }
+            ca_len = fread(ca_pem, 1, sizeof(ca_pem) - 1, f);
+            fclose(f);
+            ca_pem[ca_len++] = '\0';       // PEM: the terminating '\0' included, like mbedTLS wants it
+#if !MQTT_HA_TLS
+            fprintf(stderr, "codec: built without TLS (OpenSSL not found)\n");
+            return 1;
+#endif
+            break;
+        }
+        case 'v': opt.verbose  = true; break;
+        default:  usage(); return 1;
+        }
+    }
+    if (opt.states < 1 || opt.channels < 1 || opt.channels > CODEC_MAX_CHANNELS ||
+        (opt.level != 4 && opt.level != 5)) { usage(); return 1; }
+    if (!observer_start()) return 1;
+
+    fflush(stdout);
+    int p[2];
+    if (pipe(p) < 0) { perror("pipe"); return 1; }
+    pid_t pid = fork();
+    if (pid < 0) { perror("fork"); return 1; }
+    if (pid == 0) {
+        close(p[0]);
+        mqtt_client_free(observer);     // the parent's socket, not ours
+        instance_main(p[1]);
+    }
+    close(p[1]);
+
+    //--- Observe until the instance reports, then a little longer for the last state
+    struct pollfd pf = { p[0], POLLIN, 0 };
+    while (poll(&pf, 1, 0) == 0) {
+        cyw43_arch_poll();
+        host_net_wait(1);
+    }
+    CodecReport r = {};
+    ssize_t got = 0, n;
+    while (got < (ssize_t)sizeof(r) && (n = read(p[0], (char*)&r + got, sizeof(r) - got)) > 0) got += n;
+    close(p[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    observer_run(300);
+    if (got != (ssize_t)sizeof(r) || !r.ok) {
+        fprintf(stderr, "codec: the instance did not %s\n", got != (ssize_t)sizeof(r) ? "report" : "finish");
+        return 1;
+    }
+
+    double      states  = r.states;
+#if MQTT_HA_MQTT_BUILTIN
+    const char* backend = "built-in MQTT client";
+#else
+    const char* backend = "lwIP MQTT app (mqtt_publish)";
+#endif
+    printf("codec: %s, %s, broker %s:%u, %u states of %d channels\n\n", backend,
+           r.mqtt.level == 5 ? "MQTT 5" : "MQTT 3.1.1", opt.host, opt.port, r.states, opt.channels);
+    printf("per state\n");
+    printf("%-30s %10.1f\n", "PUBLISH on the wire (bytes)", r.wire_bytes / states);
+    printf("%-30s %10.1f\n", "  payload (bytes)", states_rx ? (double)payload_bytes / states_rx : 0.0);
+    printf("%-30s %10.1f\n", "  MQTT overhead (bytes)",
+           r.wire_bytes / states - (states_rx ? (double)payload_bytes / states_rx : 0.0));
+    printf("%-30s %10.2f\n", "CPU, user + sys (us)", (r.user_us + r.sys_us) / states);
+    printf("%-30s %10.2f\n", "  user (us)", r.user_us / states);
+    printf("%-30s %10.2f\n", "  in the publish call (us)", r.call_ns / states / 1000.0);
+    printf("%-30s %10.1f\n", "publish -> completion (us)", r.wall_us / states);
+    printf("\nobserver:   %u states under %s, %u under another topic, %u payloads complete\n",
+           states_rx, CODEC_STATE_TOPIC, wrong_topic, payload_rx);
+#if MQTT_HA_MQTT_BUILTIN
+    printf("mqtt:       %u of %u topic aliases, %u fallbacks to 3.1.1, %u of %u PUBLISH aliased, "
+           "%.1f %% of their 3.1.1 size\n", r.mqtt.aliases, r.mqtt.alias_max, r.mqtt.fallbacks, r.aliased,
+           r.publishes, r.publish_bytes_311 ? 100.0 * r.publish_bytes / r.publish_bytes_311 : 100.0);
+#endif
+    if (ca_len) {
+        printf("tls:        %u full handshakes, %u resumed (a drop after the states), connect -> CONNACK %u / %u ms\n",
+               r.tls.full, r.tls.resumed, r.tls.full_max_ms, r.tls.resumed_max_ms);
+    }
+    bool ok = wrong_topic == 0 && states_rx >= r.states && payload_rx == states_rx;
+    if (!ok) printf("warning: the observer did not get every state under its topic\n");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,662 @@
+//───────────────────────────────────────────────────────────────────
+//─── Fleet load test against a real broker ─────────────────────────
+//───────────────────────────────────────────────────────────────────
+// N instances of the unchanged library (mqtt_ha.cpp over host_net.cpp),
+// one process each (the library state is static), against a broker on
+// this machine. host_net_rename() turns the compiled DEVICE_ID into
+// <prefix>_0000 ... so every instance has its own client id, Last Will,
+// discovery and topics, like a fleet of Pico W.
+//
+// Each instance: channels t_us (send time), seq, ack, temperature,
+// one state every 1/rate s, and a "<id>/fleet/ping" route that copies the
+// ping number into "ack" and publishes at once. SIGUSR1 drops its TCP
+// connection (reconnect storm): the library backs off and reconnects.
+//
+// The parent process is the observer (HA side): its own client on the
+// same lwIP API subscribes to +/state, +/state/replay, +/availability and
+// homeassistant/#, pings the online instances and measures, with the
+// monotonic clock shared by all the processes:
+//  - state latency: set in the instance -> received by the observer
+//  - command round trip: ping published -> state carrying its ack
+//  - states not received (coalesced in the outbox or lost), backlog replays (age_ms)
+// Every instance reports its own connect -> ONLINE and drop -> ONLINE.
+//
+// -b takes the broker list of the library (wifi_mqtt_init() + mqtt_ha_add_broker()):
+// names go through dns_gethostbyname() (-D: a stub resolver such as dnsmasq, see
+// README), and the observer has one client per broker. Killing the first broker
+// during a run shows the failover time of every instance.
+//
+// -T ca.pem: MQTT over TLS (instances and observer, OpenSSL in host_net.cpp),
+// the broker certificate checked against that CA. Storm drops then show full
+// and resumed handshakes apart (connect -> CONNACK, mqtt_ha_tls_stats()).
+//
+// Usage: mqtt_ha_fleet [-b host[:port],...] [-p port] [-D ip[:port]] [-T ca.pem]
+//                      [-n instances] [-r states/s] [-c pings/s] [-d seconds]
+//                      [-s storm_ms] [-f storm_%] [-F] [-u ramp_ms] [-i prefix] [-v]
+#include "host_net.h"
+#include "mqtt_ha.h"
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define FLEET_MAX         1000
+#define FLEET_SAMPLES     256           // connect / drop -> ONLINE samples kept per instance
+#define FLEET_PINGS       16            // pings in flight per instance
+#define FLEET_DEVICE_ID   "pico_env_sensor"
+#define FLEET_BROKERS     4             // MQTT_HA_MAX_BROKERS
+
+struct FleetBroker {
+    char     host[64];
+    uint16_t port;
+};
+
+struct FleetOptions {
+    const char* broker      = "127.0.0.1";
+    uint16_t    port        = 1883;
+    const char* dns         = nullptr;  // nullptr: host resolver
+    const char* ca          = nullptr;  // nullptr: plain MQTT
+    int         instances   = 10;
+    double      rate        = 1.0;      // states per second per instance
+    double      pings       = 1.0;      // pings per second per instance
+    uint32_t    duration_s  = 30;
+    uint32_t    storm_ms    = 0;        // 0: no storm
+    uint32_t    storm_pct   = 10;
+    bool        full        = false;    // full discovery after every drop
+    uint32_t    ramp_ms     = 1000;     // instances started over this time
+    const char* prefix      = "fleet";
+    bool        verbose     = false;
+};
+static FleetOptions opt;
+static FleetBroker  brokers[FLEET_BROKERS];
+static int          broker_count = 0;
+static char         dns_ip[16];
+static uint16_t     dns_port     = 53;
+static uint8_t      ca_pem[16384];
+static size_t       ca_len       = 0;
+
+//--- "host[:port],..." -> brokers[]. @return false on a bad list
+static bool parse_brokers(const char* list) {
+    for (const char* p = list; *p;) {
+        const char* end = strchr(p, ',');
+        size_t      len = end ? (size_t)(end - p) : strlen(p);
+        if (broker_count == FLEET_BROKERS || len == 0 || len >= sizeof(brokers[0].host)) return false;
+        FleetBroker& b = brokers[broker_count++];
+        memcpy(b.host, p, len);
+        b.host[len] = '\0';
+        b.port      = opt.port;
+        char* colon = strchr(b.host, ':');
+        if (colon) {
+            *colon = '\0';
+            b.port = (uint16_t)atoi(colon + 1);
+        }
+        p += len + (end ? 1 : 0);
+    }
+    return broker_count > 0;
+}
+
+//--- Shared by every process: CLOCK_MONOTONIC is system wide
+static uint64_t fleet_clock_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+//--- Latency from a 31-bit timestamp (what fits an I32 channel)
+static uint32_t fleet_since(int32_t t_us) {
+    return ((uint32_t)fleet_clock_us() - (uint32_t)t_us) & 0x7fffffffu;
+}
+
+//--- Instance -> parent, through a pipe once it stops
+struct FleetReport {
+    int32_t  instance;
+    uint32_t online;                    // sessions that reached ONLINE
+    uint32_t online_us[FLEET_SAMPLES];  // MQTT connect -> ONLINE, each session
+    uint32_t drops;
+    uint32_t drop_us[FLEET_SAMPLES];    // storm drop -> ONLINE (backoff included)
+    uint32_t states;                    // mqtt_ha_publish_channels() calls
+    uint32_t pings;                     // ping commands handled
+    uint32_t failures;                  // MqttHaConnStats::failures
+    uint32_t discovery_sent;            // sessions with a full discovery
+    uint32_t discovery_skipped;
+    uint32_t publish_rejected;          // ERR_MEM / ERR_CONN from mqtt_publish()
+    uint8_t  broker;                    // MqttHaBrokerStats, at the end
+    uint32_t failovers;
+    uint32_t failover_ms;               // longest
+    uint32_t lookups;
+    uint32_t lookups_cached;
+    uint32_t lookups_failed;
+    uint32_t resolve_ms;                // longest
+    uint32_t tls_full;                  // MqttHaTlsStats
+    uint32_t tls_resumed;
+    uint32_t tls_full_ms;               // longest
+    uint32_t tls_resumed_ms;            // longest
+};
+
+//───────────────────────────────────────────────────────────────────
+//─── Instance (child process) ──────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+enum { CH_T_US, CH_SEQ, CH_ACK, CH_TEMP };
+
+static const MqttHaChannel fleet_channels[] = {
+    { "t_us",        "t_us", nullptr, "",   nullptr,       0, MQTT_HA_I32 },
+    { "seq",         "seq",  nullptr, "",   nullptr,       0, MQTT_HA_I32 },
+    { "ack",         "ack",  nullptr, "",   nullptr,       0, MQTT_HA_I32 },
+    { "temperature", "temp", nullptr, "°C", "temperature", 1, MQTT_HA_I16 },
+};
+
+static volatile sig_atomic_t drop_req = 0;
+static volatile sig_atomic_t stop_req = 0;
+static FleetReport           report;
+
+static void on_usr1(int) { drop_req = 1; }
+static void on_term(int) { stop_req = 1; }
+
+static void on_ping(const MqttHaCommand* cmd) {
+    if (!cmd->has_value) return;
+    report.pings++;
+    mqtt_ha_set_scaled(CH_T_US, (int32_t)(fleet_clock_us() & 0x7fffffff));
+    mqtt_ha_set_scaled(CH_ACK, cmd->value);
+    mqtt_ha_publish_channels();
+}
+
+static const MqttHaRoute fleet_routes[] = {
+    { FLEET_DEVICE_ID "/fleet/ping", nullptr, on_ping, nullptr, 0 },
+};
+
+static void instance_main(int n, int fd) {
+    char id[32];
+    snprintf(id, sizeof(id), "%s_%04d", opt.prefix, n);
+    signal(SIGUSR1, on_usr1);
+    signal(SIGTERM, on_term);
+    if (!opt.verbose) freopen("/dev/null", "w", stdout);
+    sleep_ms((uint32_t)((uint64_t)opt.ramp_ms * n / opt.instances));
+
+    host_net_rename(FLEET_DEVICE_ID, id);
+    mqtt_ha_register_channels(fleet_channels, sizeof(fleet_channels) / sizeof(fleet_channels[0]));
+    mqtt_ha_register_routes(fleet_routes, 1);
+    report.instance = n;
+    if (opt.dns) host_net_set_dns(dns_ip, dns_port);
+    for (int i = 1; i < broker_count; i++) mqtt_ha_add_broker(brokers[i].host, brokers[i].port);
+    if (ca_len && !mqtt_ha_set_tls(ca_pem, ca_len)) _exit(1);
+    if (!wifi_mqtt_init("fleet", "fleet", brokers[0].host, brokers[0].port)) _exit(1);
+
+    uint64_t period_us  = opt.rate > 0 ? (uint64_t)(1e6 / opt.rate) : 0;
+    uint64_t next_state = fleet_clock_us() + period_us;
+    uint64_t connect_us = 0, drop_us = 0;
+    int32_t  seq        = 0;
+    MqttHaState last    = mqtt_ha_state();
+    while (!stop_req) {
+        if (drop_req) {
+            drop_req = 0;
+            if (opt.full) mqtt_ha_discovery_invalidate();
+            host_drop_connection();
+            drop_us = fleet_clock_us();
+        }
+        mqtt_poll();
+
+        //--- Sessions: MQTT connect -> ONLINE, drop -> ONLINE
+        MqttHaState state = mqtt_ha_state();
+        uint64_t    now   = fleet_clock_us();
+        if (state != last) {
+            if (state == MQTT_HA_MQTT_CONNECT) connect_us = now;
+            if (state == MQTT_HA_ONLINE) {
+                if (report.online < FLEET_SAMPLES) report.online_us[report.online] = (uint32_t)(now - connect_us);
+                report.online++;
+                if (drop_us) {
+                    if (report.drops < FLEET_SAMPLES) report.drop_us[report.drops] = (uint32_t)(now - drop_us);
+                    report.drops++;
+                    drop_us = 0;
+                }
+            }
+            last = state;
+        }
+        //--- Samples, also while offline (backlog, replayed with age_ms)
+        if (period_us && now >= next_state) {
+            mqtt_ha_set_scaled(CH_T_US, (int32_t)(now & 0x7fffffff));
+            mqtt_ha_set_scaled(CH_SEQ, ++seq);
+            mqtt_ha_set(CH_TEMP, 20.0 + (seq % 50) * 0.1);
+            mqtt_ha_publish_channels();
+            report.states++;
+            next_state += period_us;
+            if (next_state < now) next_state = now + period_us;    // late: no burst to catch up
+        }
+        uint64_t wait_us = !period_us ? 10000 : next_state > now ? next_state - now : 0;
+        host_net_wait(wait_us > 10000 ? 10 : (uint32_t)(wait_us / 1000));
+    }
+
+    MqttHaConnStats      c = mqtt_ha_conn_stats();
+    MqttHaDiscoveryStats d = mqtt_ha_discovery_stats();
+    report.failures          = c.failures;
+    report.discovery_sent    = d.published;
+    report.discovery_skipped = d.skipped;
+    report.publish_rejected  = host_stats().publish_rejected;
+    MqttHaBrokerStats    b = mqtt_ha_broker_stats();
+    report.broker            = b.current;
+    report.failovers         = b.failovers;
+    report.failover_ms       = b.failover_max_ms;
+    report.lookups           = b.lookups;
+    report.lookups_cached    = b.lookups_cached;
+    report.lookups_failed    = b.lookups_failed;
+    report.resolve_ms        = b.resolve_max_ms;
+    MqttHaTlsStats       t = mqtt_ha_tls_stats();
+    report.tls_full          = t.full;
+    report.tls_resumed       = t.resumed;
+    report.tls_full_ms       = t.full_max_ms;
+    report.tls_resumed_ms    = t.resumed_max_ms;
+    ssize_t w = write(fd, &report, sizeof(report));
+    _exit(w == (ssize_t)sizeof(report) ? 0 : 1);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Observer (parent process) ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Growing array of samples, sorted once for the percentiles
+struct FleetSamples {
+    uint32_t* v   = nullptr;
+    size_t    n   = 0;
+    size_t    cap = 0;
+
+    void add(uint32_t x) {
+        if (n == cap) {
+            cap = cap ? cap * 2 : 1024;
+            v   = (uint32_t*)realloc(v, cap * sizeof(uint32_t));
+        }
+        v[n++] = x;
+    }
+};
+
+struct FleetInstance {
+    pid_t    pid;
+    int      fd;
+    bool     online;
+    int      broker;                    // observer that last heard from it (pings go there)
+    int32_t  last_seq;
+    int32_t  ping_seq;
+    uint64_t ping_us[FLEET_PINGS];
+};
+
+static FleetInstance fleet[FLEET_MAX];
+static mqtt_client_t* observers[FLEET_BROKERS];   // one per broker
+static bool           observer_up[FLEET_BROKERS];
+static bool           counting    = false;     // retained messages of earlier runs are not counted
+static char           in_topic[256];
+
+static FleetSamples state_us, ping_us;
+static uint32_t     states_rx, samples_rx, replays, pings_tx, pings_rx;
+static uint32_t     discovery_rx, online_rx, offline_rx, storm_drops;
+
+static void observer_connection(mqtt_client_t* client, void* arg, mqtt_connection_status_t status) {
+    int b = (int)(intptr_t)arg;
+    observer_up[b] = (status == MQTT_CONNECT_ACCEPTED);
+    if (!observer_up[b]) fprintf(stderr, "fleet: observer lost %s (%d)\n", brokers[b].host, (int)status);
+}
+
+static void observer_publish(void* arg, const char* topic, u32_t tot_len) {
+    snprintf(in_topic, sizeof(in_topic), "%s", topic);
+}
+
+//--- "<prefix>_0042/..." -> 42, -1 for anything else
+static int observer_instance(const char* topic) {
+    size_t plen = strlen(opt.prefix);
+    if (strncmp(topic, opt.prefix, plen) != 0 || topic[plen] != '_') return -1;
+    char* end;
+    long  n = strtol(topic + plen + 1, &end, 10);
+    if (end == topic + plen + 1 || *end != '/' || n < 0 || n >= opt.instances) return -1;
+    return (int)n;
+}
+
+static bool json_int(const char* json, const char* key, int32_t* v) {
+    const char* p = strstr(json, key);
+    if (!p) return false;
+    *v = (int32_t)strtol(p + strlen(key), nullptr, 10);
+    return true;
+}
+
+static void observer_state(FleetInstance& f, const char* json) {
+    int32_t t, seq, ack;
+    states_rx++;
+    //--- Backlog replay (state/replay): stored while offline, old on purpose, one sample each
+    if (strstr(json, "\"age_ms\":")) {
+        replays++;
+        samples_rx++;
+        return;
+    }
+    if (json_int(json, "\"t_us\":", &t)) state_us.add(fleet_since(t));
+    //--- A new sample, or the last one again with a ping ack
+    if (json_int(json, "\"seq\":", &seq) && seq > f.last_seq) {
+        samples_rx++;
+        f.last_seq = seq;
+    }
+    if (json_int(json, "\"ack\":", &ack) && ack > f.ping_seq - FLEET_PINGS && ack <= f.ping_seq) {
+        uint64_t& t0 = f.ping_us[ack % FLEET_PINGS];
+        if (t0) {
+            ping_us.add((uint32_t)(fleet_clock_us() - t0));
+            pings_rx++;
+            t0 = 0;
+        }
+    }
+}
+
+static void observer_data(void* arg, const u8_t* data, u16_t len, u8_t flags) {
+    if (!counting || !(flags & MQTT_DATA_FLAG_LAST)) return;    // one piece: host_net delivers whole messages
+    char json[1024];
+    size_t n = len < sizeof(json) - 1 ? len : sizeof(json) - 1;
+    memcpy(json, data, n);
+    json[n] = '\0';
+
+    if (strncmp(in_topic, "homeassistant/", 14) == 0) { discovery_rx++; return; }
+    int i = observer_instance(in_topic);
+    if (i < 0) return;
+    fleet[i].broker = (int)(intptr_t)arg;
+    const char* leaf = strchr(in_topic, '/') + 1;
+    if (strcmp(leaf, "state") == 0 || strcmp(leaf, "state/replay") == 0) {
+        observer_state(fleet[i], json);
+    } else if (strcmp(leaf, "availability") == 0) {
+        fleet[i].online = strcmp(json, "online") == 0;
+        if (fleet[i].online) online_rx++;
+        else                 offline_rx++;
+    }
+}
+
+//--- Keep polling the observer for ms
+static void observer_run(uint32_t ms) {
+    uint64_t end = fleet_clock_us() + ms * 1000ull;
+    while (fleet_clock_us() < end) {
+        cyw43_arch_poll();
+        host_net_wait(1);
+    }
+}
+
+//--- Same lookup as the instances (dns_gethostbyname), waited for here
+static int       resolve_state;     // 0: waiting, 1: found, -1: failed
+static ip_addr_t resolve_addr;
+
+static void observer_found(const char* name, const ip_addr_t* ipaddr, void* arg) {
+    if (ipaddr) resolve_addr = *ipaddr;
+    resolve_state = ipaddr ? 1 : -1;
+}
+
+static bool observer_resolve(const char* host, ip_addr_t* addr) {
+    resolve_state = 0;
+    err_t err = dns_gethostbyname(host, addr, observer_found, nullptr);
+    if (err == ERR_OK) return true;
+    if (err != ERR_INPROGRESS) return false;
+    for (int i = 0; i < 600 && resolve_state == 0; i++) observer_run(10);
+    *addr = resolve_addr;
+    return resolve_state > 0;
+}
+
+//--- One observer per broker: the instances may be on any of them. At least one has to answer.
+static bool observer_start() {
+    int up = 0;
+    for (int b = 0; b < broker_count; b++) {
+        ip_addr_t addr;
+        if (!observer_resolve(brokers[b].host, &addr)) {
+            fprintf(stderr, "fleet: %s not resolved\n", brokers[b].host);
+            continue;
+        }
+        char id[32];
+        snprintf(id, sizeof(id), "fleet_observer_%d", b);
+        struct mqtt_connect_client_info_t ci = {};
+        ci.client_id  = id;
+        ci.keep_alive = 60;
+#if MQTT_HA_TLS
+        static struct altcp_tls_config* tls = nullptr;
+        if (ca_len && !tls && !(tls = altcp_tls_create_config_client(ca_pem, ca_len))) return false;
+        ci.tls_config = tls;
+#endif
+        observers[b] = mqtt_client_new();
+        mqtt_set_inpub_callback(observers[b], observer_publish, observer_data, (void*)(intptr_t)b);
+        if (mqtt_client_connect(observers[b], &addr, brokers[b].port, observer_connection, (void*)(intptr_t)b, &ci) != ERR_OK) return false;
+        for (int i = 0; i < 300 && !observer_up[b]; i++) observer_run(10);
+        if (!observer_up[b]) {
+            fprintf(stderr, "fleet: no broker on %s:%u\n", brokers[b].host, brokers[b].port);
+            continue;
+        }
+        static const char* const topics[] = { "+/state", "+/state/replay", "+/availability", "homeassistant/#" };
+        for (const char* t : topics) {
+            if (mqtt_subscribe(observers[b], t, 0, nullptr, nullptr) != ERR_OK) return false;
+        }
+        up++;
+    }
+    if (up == 0) return false;
+    observer_run(300);      // SUBACKs, then the retained messages of earlier runs
+    counting = true;
+    return true;
+}
+
+//--- One ping to the next online instance, round robin
+static void observer_ping() {
+    static int cursor = 0;
+    for (int k = 0; k < opt.instances; k++) {
+        FleetInstance& f = fleet[cursor];
+        int i = cursor;
+        cursor = (cursor + 1) % opt.instances;
+        if (!f.online) continue;
+        char topic[64], payload[12];
+        snprintf(topic, sizeof(topic), "%s_%04d/fleet/ping", opt.prefix, i);
+        int len = snprintf(payload, sizeof(payload), "%d", f.ping_seq + 1);
+        if (!observer_up[f.broker]) continue;
+        if (mqtt_publish(observers[f.broker], topic, payload, (u16_t)len, 0, 0, nullptr, nullptr) != ERR_OK) return;
+        f.ping_seq++;
+        f.ping_us[f.ping_seq % FLEET_PINGS] = fleet_clock_us();
+        pings_tx++;
+        return;
+    }
+}
+
+static void observer_storm() {
+    for (int i = 0; i < opt.instances; i++) {
+        if ((uint32_t)(rand() % 100) < opt.storm_pct) {
+            kill(fleet[i].pid, SIGUSR1);
+            storm_drops++;
+        }
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Report ────────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static int cmp_u32(const void* a, const void* b) {
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t percentile(const FleetSamples& s, uint32_t pct) {
+    return s.n ? s.v[(s.n - 1) * pct / 100] : 0;
+}
+
+//--- Samples in µs, shown in ms
+static void report_line(const char* name, FleetSamples& s, double scale) {
+    qsort(s.v, s.n, sizeof(uint32_t), cmp_u32);
+    printf("%-34s %8zu %9.2f %9.2f %9.2f %9.2f\n", name, s.n,
+           percentile(s, 50) / scale, percentile(s, 90) / scale, percentile(s, 99) / scale,
+           s.n ? s.v[s.n - 1] / scale : 0.0);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "Usage: mqtt_ha_fleet [options]\n"
+        "  -b list     brokers host[:port],... in order of preference, IPs or names (127.0.0.1)\n"
+        "  -p port     broker port when the list does not give one (1883)\n"
+        "  -D ip[:port] DNS server for the names (host resolver)\n"
+        "  -T file     MQTT over TLS, broker certificate checked against this CA (PEM)\n"
+        "  -n count    instances, one process each (10, max %d)\n"
+        "  -r rate     states per second per instance (1)\n"
+        "  -c rate     pings (command round trips) per second per instance (1)\n"
+        "  -d seconds  test duration (30)\n"
+        "  -s ms       reconnect storm period, 0 = none (0)\n"
+        "  -f pct      instances dropped by each storm (10)\n"
+        "  -F          full discovery after every drop (no discovery cache)\n"
+        "  -u ms       ramp: instances started over this time (1000)\n"
+        "  -i prefix   instance ids <prefix>_0000... (fleet)\n"
+        "  -v          instance logs on stdout\n", FLEET_MAX);
+}
+
+int main(int argc, char** argv) {
+    int o;
+    while ((o = getopt(argc, argv, "b:p:D:T:n:r:c:d:s:f:Fu:i:vh")) != -1) {
+        switch (o) {
+        case 'D': opt.dns        = optarg; break;
+        case 'T': opt.ca         = optarg; break;
+        case 'b': opt.broker     = optarg; break;
+        case 'p': opt.port       = (uint16_t)atoi(optarg); break;
+        case 'n': opt.instances  = atoi(optarg); break;
+        case 'r': opt.rate       = atof(optarg); break;
+        case 'c': opt.pings      = atof(optarg); break;
+        case 'd': opt.duration_s = (uint32_t)atoi(optarg); break;
+        case 's': opt.storm_ms   = (uint32_t)atoi(optarg); break;
+        case 'f': opt.storm_pct  = (uint32_t)atoi(optarg); break;
+        case 'F': opt.full       = true; break;
+        case 'u': opt.ramp_ms    = (uint32_t)atoi(optarg); break;
+        case 'i': opt.prefix     = optarg; break;
+        case 'v': opt.verbose    = true; break;
+        default:  usage(); return 1;
+        }
+    }
+    if (opt.instances < 1 || opt.instances > FLEET_MAX || !parse_brokers(opt.broker)) { usage(); return 1; }
+    if (opt.dns) {
+        snprintf(dns_ip, sizeof(dns_ip), "%s", opt.dns);
+        char* colon = strchr(dns_ip, ':');
+        if (colon) {
+            *colon   = '\0';
+            dns_port = (uint16_t)atoi(strchr(opt.dns, ':') + 1);
+        }
+        host_net_set_dns(dns_ip, dns_port);    // the observer's lookups too
+    }
+    if (opt.ca) {
+        FILE* f = fopen(opt.ca, "rb");
+        if (f) {
+            ca_len = fread(ca_pem, 1, sizeof(ca_pem) - 1, f);
+            fclose(f);
+        }
+        ca_pem[ca_len++] = '\0';       // PEM: the terminating '\0' included, like mbedTLS wants it
+#if !MQTT_HA_TLS
+        fprintf(stderr, "fleet: built without TLS (OpenSSL not found)\n");
+        return 1;
+#endif
+        if (ca_len < 2) { fprintf(stderr, "fleet: %s not read\n", opt.ca); return 1; }
+    }
+    if (!observer_start()) return 1;
+
+    //--- One process per instance
+    fflush(stdout);
+    for (int i = 0; i < opt.instances; i++) {
+        int p[2];
+        if (pipe(p) < 0) { perror("pipe"); return 1; }
+        pid_t pid = fork();
+        if (pid < 0) { perror("fork"); return 1; }
+        if (pid == 0) {
+            close(p[0]);
+            for (auto o : observers) {
+                if (o) mqtt_client_free(o);     // the parent's sockets, not ours
+            }
+            instance_main(i, p[1]);
+        }
+        close(p[1]);
+        fleet[i] = {};
+        fleet[i].pid = pid;
+        fleet[i].fd  = p[0];
+    }
+
+    //--- Test: pings spread over the second, storms, one progress line per second
+    uint64_t t0       = fleet_clock_us();
+    uint64_t end      = t0 + opt.duration_s * 1000000ull;
+    double   ping_gap = opt.pings > 0 ? 1e6 / (opt.pings * opt.instances) : 0;
+    uint64_t next_ping = t0, next_storm = t0 + opt.storm_ms * 1000ull, next_line = t0 + 1000000;
+    uint32_t line_states = 0;
+    while (fleet_clock_us() < end) {
+        cyw43_arch_poll();
+        uint64_t now = fleet_clock_us();
+        if (ping_gap > 0 && now >= next_ping) {
+            observer_ping();
+            next_ping += (uint64_t)ping_gap;
+            if (next_ping < now) next_ping = now;
+        }
+        if (opt.storm_ms && now >= next_storm) {
+            observer_storm();
+            next_storm += opt.storm_ms * 1000ull;
+        }
+        if (now >= next_line) {
+            int online = 0;
+            for (int i = 0; i < opt.instances; i++) online += fleet[i].online;
+            fprintf(stderr, "fleet: %3us  online %d/%d  %u states/s\n",
+                    (unsigned)((now - t0) / 1000000), online, opt.instances, states_rx - line_states);
+            line_states = states_rx;
+            next_line  += 1000000;
+        }
+        host_net_wait(ping_gap > 0 && ping_gap < 1000 ? 0 : 1);
+    }
+
+    //--- Stop the instances, keep listening while they report
+    uint32_t offline_test = offline_rx;     // the stop sends one Last Will each
+    for (int i = 0; i < opt.instances; i++) kill(fleet[i].pid, SIGTERM);
+    observer_run(500);
+    FleetSamples online_us, drop_us, failover_ms, resolve_ms, tls_full_ms, tls_resumed_ms;
+    uint32_t states_tx = 0, handled = 0, failures = 0, sent = 0, skipped = 0, rejected = 0, lost = 0;
+    uint32_t failovers = 0, lookups = 0, cached = 0, failed = 0, on_broker[FLEET_BROKERS] = {};
+    uint32_t tls_full = 0, tls_resumed = 0;
+    for (int i = 0; i < opt.instances; i++) {
+        FleetReport r = {};
+        ssize_t got = 0, n;
+        while (got < (ssize_t)sizeof(r) && (n = read(fleet[i].fd, (char*)&r + got, sizeof(r) - got)) > 0) got += n;
+        close(fleet[i].fd);
+        int status;
+        waitpid(fleet[i].pid, &status, 0);
+        if (got != (ssize_t)sizeof(r)) { lost++; continue; }
+        for (uint32_t k = 0; k < r.online && k < FLEET_SAMPLES; k++) online_us.add(r.online_us[k]);
+        for (uint32_t k = 0; k < r.drops && k < FLEET_SAMPLES; k++) drop_us.add(r.drop_us[k]);
+        states_tx += r.states;
+        handled   += r.pings;
+        failures  += r.failures;
+        sent      += r.discovery_sent;
+        skipped   += r.discovery_skipped;
+        rejected  += r.publish_rejected;
+        failovers += r.failovers;
+        lookups   += r.lookups;
+        cached    += r.lookups_cached;
+        failed    += r.lookups_failed;
+        if (r.broker < FLEET_BROKERS) on_broker[r.broker]++;
+        if (r.failovers) failover_ms.add(r.failover_ms);
+        if (r.lookups > r.lookups_cached) resolve_ms.add(r.resolve_ms);
+        tls_full    += r.tls_full;
+        tls_resumed += r.tls_resumed;
+        if (r.tls_full) tls_full_ms.add(r.tls_full_ms);
+        if (r.tls_resumed) tls_resumed_ms.add(r.tls_resumed_ms);
+    }
+
+    double seconds = (fleet_clock_us() - t0) / 1e6;
+    printf("fleet: %d instances on %s%s, %.1f states/s + %.1f pings/s each, %u s",
+           opt.instances, opt.broker, ca_len ? " (TLS)" : "", opt.rate, opt.pings, opt.duration_s);
+    if (opt.storm_ms) printf(", storm every %u ms (%u %%)%s", opt.storm_ms, opt.storm_pct, opt.full ? ", full discovery" : "");
+    printf("\n\n%-34s %8s %9s %9s %9s %9s\n", "ms", "n", "p50", "p90", "p99", "max");
+    report_line("state latency (set -> observer)", state_us, 1000.0);
+    report_line("command round trip (ping -> ack)", ping_us, 1000.0);
+    report_line("connect -> ONLINE", online_us, 1000.0);
+    report_line("storm drop -> ONLINE (backoff)", drop_us, 1000.0);
+    report_line("failover (lost -> ONLINE, longest)", failover_ms, 1.0);
+    report_line("DNS lookup (longest per instance)", resolve_ms, 1.0);
+    if (ca_len) {
+        report_line("TLS full -> CONNACK (longest)", tls_full_ms, 1.0);
+        report_line("TLS resumed -> CONNACK (longest)", tls_resumed_ms, 1.0);
+    }
+    printf("\nthroughput: %.1f states/s received, %u samples taken, %u received (%u replayed from the backlog), "
+           "%u not received (coalesced or lost)\n", states_rx / seconds, states_tx, samples_rx, replays,
+           states_tx > samples_rx ? states_tx - samples_rx : 0);
+    printf("commands:   %u pings sent, %u handled, %u round trips seen\n", pings_tx, handled, pings_rx);
+    printf("sessions:   %u storm drops, %u failures, availability %u online / %u offline (Last Will)\n",
+           storm_drops, failures, online_rx, offline_test);
+    printf("discovery:  %u full, %u skipped (hash unchanged), %u messages received; publish refusals %u\n",
+           sent, skipped, discovery_rx, rejected);
+    printf("brokers:   ");
+    for (int b = 0; b < broker_count; b++) printf(" %s:%u %u instances,", brokers[b].host, brokers[b].port, on_broker[b]);
+    printf(" %u failovers, %u lookups (%u cached, %u failed)\n", failovers, lookups, cached, failed);
+    if (ca_len) printf("tls:        %u full handshakes, %u resumed\n", tls_full, tls_resumed);
+    if (lost) printf("warning: %u instances did not report\n", lost);
+    return lost ? 1 : 0;
+}
@@ -0,0 +1,144 @@
+//───────────────────────────────────────────────────────────────────
+//─── Host (Linux) SDK pieces shared by both lwIP backends ──────────
+//───────────────────────────────────────────────────────────────────
+// host_platform.cpp (fake broker, virtual time) and host_net.cpp (real
+// broker over TCP, real time) both link this file: IP helpers, netif,
+// DNS servers, multicore (core 1 is a thread) and the flash image.
+#include "host_platform.h"
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+static struct netif   netif_g          = { { 0x6401A8C0u }, { 0x00FFFFFFu }, { 0x0101A8C0u } };  // 192.168.1.100/24, gw .1
+struct netif*         netif_default    = &netif_g;
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP IP helpers ───────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+int ipaddr_aton(const char* cp, ip_addr_t* addr) {
+    unsigned a, b, c, d;
+    char tail;
+    if (sscanf(cp, "%u.%u.%u.%u%c", &a, &b, &c, &d, &tail) != 4) return 0;
+    if (a > 255 || b > 255 || c > 255 || d > 255) return 0;
+    addr->addr = a | (b << 8) | (c << 16) | (d << 24);   // network order, like lwIP
+    return 1;
+}
+
+char* ipaddr_ntoa_r(const ip_addr_t* addr, char* buf, int buflen) {
+    u32_t v = addr->addr;
+    snprintf(buf, buflen, "%u.%u.%u.%u", v & 0xff, (v >> 8) & 0xff, (v >> 16) & 0xff, v >> 24);
+    return buf;
+}
+
+void netif_set_addr(struct netif* netif, const ip4_addr_t* ipaddr, const ip4_addr_t* netmask, const ip4_addr_t* gw) {
+    netif->ip_addr = *ipaddr;
+    netif->netmask = *netmask;
+    netif->gw      = *gw;
+}
+
+//--- DNS servers: from the lease (fake) or host_net_set_dns() (real), lookups are backend specific
+static ip_addr_t dns_servers[2];
+
+void dns_setserver(u8_t numdns, const ip_addr_t* dnsserver) {
+    if (numdns < 2) dns_servers[numdns].addr = dnsserver ? dnsserver->addr : 0;
+}
+
+const ip_addr_t* dns_getserver(u8_t numdns) {
+    return &dns_servers[numdns < 2 ? numdns : 0];
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── pico multicore: core 1 is a thread ────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static std::thread core1;
+static thread_local uint32_t core_num = 0;
+
+uint32_t get_core_num(void) { return core_num; }
+void     tight_loop_contents(void) { std::this_thread::yield(); }
+
+void multicore_launch_core1(void (*entry)(void)) {
+    if (core1.joinable()) core1.join();
+    core1 = std::thread([entry] {
+        core_num = 1;
+        entry();
+    });
+}
+
+//--- On the Pico this stops core 1 at once; here the entry function has to return by itself
+void multicore_reset_core1(void) {
+    if (core1.joinable()) core1.join();
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── pico flash: RAM image, optionally backed by a file ────────────
+//───────────────────────────────────────────────────────────────────
+// Survives host_reset() like the real flash survives a reboot.
+static uint8_t     flash_image[PICO_FLASH_SIZE_BYTES];
+static bool        flash_ready = false;
+static const char* flash_file  = nullptr;
+static uint32_t    flash_erases   = 0;
+static uint32_t    flash_programs = 0;
+
+static void flash_init() {
+    if (flash_ready) return;
+    memset(flash_image, 0xff, sizeof(flash_image));     // erased flash reads 0xFF
+    flash_ready = true;
+}
+
+static void flash_sync() {
+    if (!flash_file) return;
+    FILE* f = fopen(flash_file, "wb");
+    if (!f) return;
+    fwrite(flash_image, 1, sizeof(flash_image), f);
+    fclose(f);
+}
+
+uintptr_t host_flash_base(void) {
+    flash_init();
+    return (uintptr_t)flash_image;
+}
+
+void flash_range_erase(uint32_t flash_offs, size_t count) {
+    flash_init();
+    if (flash_offs % FLASH_SECTOR_SIZE || count % FLASH_SECTOR_SIZE || flash_offs + count > sizeof(flash_image)) return;
+    memset(flash_image + flash_offs, 0xff, count);
+    flash_erases++;
+    flash_sync();
+}
+
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count) {
+    flash_init();
+    if (flash_offs % FLASH_PAGE_SIZE || count % FLASH_PAGE_SIZE || flash_offs + count > sizeof(flash_image)) return;
+    for (size_t i = 0; i < count; i++) flash_image[flash_offs + i] &= data[i];     // bits only go 1 -> 0
+    flash_programs++;
+    flash_sync();
+}
+
+int flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms) {
+    (void)enter_exit_timeout_ms;
+    func(param);
+    return PICO_OK;
+}
+
+bool flash_safe_execute_core_init(void) { return true; }
+
+//--- Host control API (host_platform.h), flash part
+void host_set_flash_file(const char* path) {
+    flash_init();
+    flash_file = path;
+    if (!path) return;
+    FILE* f = fopen(path, "rb");
+    if (!f) return;         // new file: blank flash, written on the first erase / program
+    size_t n = fread(flash_image, 1, sizeof(flash_image), f);
+    (void)n;
+    fclose(f);
+}
+
+void host_erase_flash() {
+    flash_init();
+    memset(flash_image, 0xff, sizeof(flash_image));
+    flash_sync();
+}
+
+uint32_t host_flash_erases()   { return flash_erases; }
+uint32_t host_flash_programs() { return flash_programs; }
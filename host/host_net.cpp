@@ -0,0 +1,1274 @@
+//───────────────────────────────────────────────────────────────────
+//─── Host (Linux) lwIP MQTT app over a real TCP socket ─────────────
+//───────────────────────────────────────────────────────────────────
+// See host_net.h for the behaviour. Same single threaded, callback driven
+// model as NO_SYS lwIP: nothing happens outside cyw43_arch_poll(), and no
+// callback is ever fired from inside an mqtt_*() call.
+#include "host_net.h"
+#include "mqtt_ha_mqtt.h"       // mqtt_ha_mqtt_pcb(): the TLS of the built-in client
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+#if MQTT_HA_TLS
+#include <openssl/err.h>
+#include <openssl/ssl.h>
+#include <openssl/x509.h>
+#endif
+
+static HostStats      stats;
+cyw43_t               cyw43_state;
+
+#if MQTT_HA_TLS
+//--- OpenSSL stands in for mbedTLS: TLS 1.2 (session ID or ticket), like the Pico SDK's mbedTLS
+struct altcp_tls_config  { SSL_CTX* ctx; bool verify; };
+struct altcp_tls_session { SSL_SESSION* session; };
+#else
+struct SSL;
+#endif
+
+static uint64_t net_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+#if !MQTT_HA_MQTT_BUILTIN
+enum HostNetConn : uint8_t {
+    NET_IDLE,
+    NET_TCP_CONNECT,        // non-blocking connect() in progress, CONNECT waits in tx
+    NET_TLS_HANDSHAKE,      // TLS client handshake in progress, CONNECT still waits
+    NET_CONNACK,            // CONNECT sent, waiting for CONNACK
+    NET_CONNECTED,
+};
+
+struct HostNetRequest {
+    mqtt_request_cb_t cb;
+    void*             arg;
+    u16_t             pkt_id;   // 0: QoS 0 publish, done once tx_sent reaches tx_end
+    uint64_t          tx_end;
+    uint64_t          sent_us;
+};
+
+struct mqtt_client_s {
+    int                        fd;
+    HostNetConn                conn;
+    SSL*                       ssl;         // nullptr: plain TCP
+    mqtt_connection_cb_t       conn_cb;
+    void*                      conn_arg;
+    mqtt_incoming_publish_cb_t pub_cb;
+    mqtt_incoming_data_cb_t    data_cb;
+    void*                      inpub_arg;
+    u16_t                      keep_alive;
+    uint64_t                   last_tx_us;
+    uint64_t                   last_rx_us;
+    u16_t                      next_id;
+
+    HostNetRequest             req[MQTT_REQ_MAX_IN_FLIGHT];
+    int                        req_count;
+
+    //--- tx: bytes not taken by the socket yet (the lwIP output ring buffer)
+    uint8_t                    tx[MQTT_OUTPUT_RINGBUF_SIZE];
+    size_t                     tx_len;
+    uint64_t                   tx_queued;   // total bytes queued / written since the connect
+    uint64_t                   tx_sent;
+    //--- rx: start of the next packet
+    uint8_t                    rx[HOST_NET_RX_SIZE];
+    size_t                     rx_len;
+};
+
+static mqtt_client_s* clients[HOST_NET_CLIENTS];
+
+static const char*    rename_from = nullptr;
+static const char*    rename_to   = nullptr;
+
+//───────────────────────────────────────────────────────────────────
+//─── Renaming (one firmware, many instances) ───────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Copy src -> dst, every from replaced by to. @return length, or (size_t)-1 if dst is too small
+static size_t net_rename(char* dst, size_t cap, const char* src, size_t len, const char* from, const char* to) {
+    if (!from || !*from) {      // no renaming: a plain copy (the mqtt_publish() path of the codec bench)
+        if (len > cap) return (size_t)-1;
+        memcpy(dst, src, len);
+        return len;
+    }
+    size_t flen = strlen(from);
+    size_t tlen = to ? strlen(to) : 0;
+    size_t out  = 0;
+    for (size_t i = 0; i < len;) {
+        if (flen && i + flen <= len && memcmp(src + i, from, flen) == 0) {
+            if (out + tlen > cap) return (size_t)-1;
+            memcpy(dst + out, to, tlen);
+            out += tlen;
+            i   += flen;
+        } else {
+            if (out + 1 > cap) return (size_t)-1;
+            dst[out++] = src[i++];
+        }
+    }
+    return out;
+}
+
+void host_net_rename(const char* from, const char* to) {
+    rename_from = from;
+    rename_to   = to;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── MQTT 3.1.1 packets ────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Fixed header: type/flags + remaining length (1..4 bytes). @return header size
+static size_t net_fixed_header(uint8_t* p, uint8_t type, size_t remaining) {
+    size_t n = 0;
+    p[n++] = type;
+    do {
+        uint8_t b = remaining & 0x7f;
+        remaining >>= 7;
+        p[n++] = b | (remaining ? 0x80 : 0);
+    } while (remaining);
+    return n;
+}
+
+//--- Room in the tx buffer for a packet of `remaining` bytes after its fixed header
+static bool net_tx_room(const mqtt_client_s* c, size_t remaining) {
+    return c->tx_len + 5 + remaining <= sizeof(c->tx);
+}
+
+static void net_put(mqtt_client_s* c, const void* data, size_t len) {
+    memcpy(c->tx + c->tx_len, data, len);
+    c->tx_len    += len;
+    c->tx_queued += len;
+}
+
+static void net_put_u16(mqtt_client_s* c, u16_t v) {
+    uint8_t b[2] = { (uint8_t)(v >> 8), (uint8_t)v };
+    net_put(c, b, 2);
+}
+
+static void net_put_str(mqtt_client_s* c, const char* s, size_t len) {
+    net_put_u16(c, (u16_t)len);
+    net_put(c, s, len);
+}
+
+static void net_put_header(mqtt_client_s* c, uint8_t type, size_t remaining) {
+    uint8_t h[5];
+    net_put(c, h, net_fixed_header(h, type, remaining));
+}
+
+static u16_t net_packet_id(mqtt_client_s* c) {
+    if (++c->next_id == 0) c->next_id = 1;
+    return c->next_id;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Socket ────────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- lwIP frees the pending requests without calling them, then reports (reason != 0)
+static void net_close(mqtt_client_s* c, int reason) {
+#if MQTT_HA_TLS
+    //--- Without close_notify OpenSSL would mark the session not resumable (mbedTLS does not)
+    if (c->ssl) SSL_set_shutdown(c->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    if (c->ssl) SSL_free(c->ssl);
+#endif
+    c->ssl = nullptr;
+    if (c->fd >= 0) close(c->fd);
+    c->fd        = -1;
+    c->conn      = NET_IDLE;
+    c->req_count = 0;
+    c->tx_len    = 0;
+    c->rx_len    = 0;
+    if (reason && c->conn_cb) c->conn_cb(c, c->conn_arg, (mqtt_connection_status_t)reason);
+}
+
+//--- As much of tx as the socket takes. @return false on a socket error
+static bool net_flush(mqtt_client_s* c) {
+    if (c->conn == NET_TCP_CONNECT || c->conn == NET_TLS_HANDSHAKE || c->tx_len == 0) return true;
+    ssize_t n;
+#if MQTT_HA_TLS
+    if (c->ssl) {
+        n = SSL_write(c->ssl, c->tx, (int)c->tx_len);
+        if (n <= 0) {
+            int e = SSL_get_error(c->ssl, (int)n);
+            return e == SSL_ERROR_WANT_WRITE || e == SSL_ERROR_WANT_READ;
+        }
+    } else
+#endif
+    n = send(c->fd, c->tx, c->tx_len, MSG_NOSIGNAL);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    memmove(c->tx, c->tx + n, c->tx_len - (size_t)n);
+    c->tx_len    -= (size_t)n;
+    c->tx_sent   += (uint64_t)n;
+    c->last_tx_us = net_now_us();
+    return true;
+}
+
+static err_t net_queue_request(mqtt_client_s* c, mqtt_request_cb_t cb, void* arg, u16_t pkt_id) {
+    if (c->req_count >= MQTT_REQ_MAX_IN_FLIGHT) return ERR_MEM;
+    HostNetRequest& r = c->req[c->req_count++];
+    r.cb      = cb;
+    r.arg     = arg;
+    r.pkt_id  = pkt_id;
+    r.tx_end  = c->tx_queued;
+    r.sent_us = net_now_us();
+    return ERR_OK;
+}
+
+//--- Request of pkt_id (or every QoS 0 publish written out, pkt_id 0) -> callback
+static void net_complete(mqtt_client_s* c, u16_t pkt_id, err_t err) {
+    HostNetRequest done[MQTT_REQ_MAX_IN_FLIGHT];
+    int n = 0, kept = 0;
+    for (int i = 0; i < c->req_count; i++) {
+        const HostNetRequest& r = c->req[i];
+        bool match = pkt_id ? r.pkt_id == pkt_id : (r.pkt_id == 0 && c->tx_sent >= r.tx_end);
+        if (match) done[n++]       = r;
+        else       c->req[kept++] = r;
+    }
+    c->req_count = kept;
+    //--- Callbacks may queue new requests: the list is consistent before they run
+    for (int i = 0; i < n; i++) {
+        stats.completions++;
+        if (done[i].cb) done[i].cb(done[i].arg, err);
+    }
+}
+
+//--- One complete packet from the broker
+static void net_packet(mqtt_client_s* c, uint8_t type, const uint8_t* p, size_t len) {
+    switch (type >> 4) {
+    case 2: {   // CONNACK
+        if (c->conn != NET_CONNACK || len < 2) break;
+        int status = p[1];
+        if (status == MQTT_CONNECT_ACCEPTED) c->conn = NET_CONNECTED;
+        if (c->conn_cb) c->conn_cb(c, c->conn_arg, (mqtt_connection_status_t)status);
+        if (status != MQTT_CONNECT_ACCEPTED) net_close(c, 0);
+        break;
+    }
+    case 3: {   // PUBLISH
+        uint8_t qos = (type >> 1) & 3;
+        if (len < 2) break;
+        size_t tlen = (size_t)(p[0] << 8 | p[1]);
+        size_t off  = 2 + tlen + (qos ? 2 : 0);
+        if (off > len) break;
+        u16_t id = qos ? (u16_t)(p[2 + tlen] << 8 | p[3 + tlen]) : 0;
+        char  topic[256];
+        char  renamed[256];
+        if (tlen >= sizeof(topic)) tlen = sizeof(topic) - 1;
+        memcpy(topic, p + 2, tlen);
+        topic[tlen] = '\0';
+        const char* t = topic;
+        if (rename_to) {
+            size_t r = net_rename(renamed, sizeof(renamed) - 1, topic, tlen, rename_to, rename_from);
+            if (r != (size_t)-1) { renamed[r] = '\0'; t = renamed; }
+        }
+        size_t plen = len - off;
+        if (c->pub_cb) c->pub_cb(c->inpub_arg, t, (u32_t)plen);
+        if (c->data_cb) {
+            size_t done = 0;
+            do {
+                size_t n = plen - done < 0xffff ? plen - done : 0xffff;
+                c->data_cb(c->inpub_arg, p + off + done, (u16_t)n, done + n == plen ? MQTT_DATA_FLAG_LAST : 0);
+                done += n;
+            } while (done < plen);
+        }
+        if (qos == 1 && c->conn == NET_CONNECTED && net_tx_room(c, 2)) {
+            net_put_header(c, 0x40, 2);     // PUBACK
+            net_put_u16(c, id);
+        }
+        break;
+    }
+    case 4:     // PUBACK
+        if (len >= 2) net_complete(c, (u16_t)(p[0] << 8 | p[1]), ERR_OK);
+        break;
+    case 9:     // SUBACK: return code 0x80 = refused
+        if (len >= 3) net_complete(c, (u16_t)(p[0] << 8 | p[1]), p[2] < 3 ? ERR_OK : ERR_ABRT);
+        break;
+    case 11:    // UNSUBACK
+        if (len >= 2) net_complete(c, (u16_t)(p[0] << 8 | p[1]), ERR_OK);
+        break;
+    default:    // PINGRESP: last_rx_us is enough
+        break;
+    }
+}
+
+//--- Socket -> rx -> packets. @return false when the connection is gone
+static bool net_receive(mqtt_client_s* c) {
+    while (true) {
+        ssize_t n;
+#if MQTT_HA_TLS
+        if (c->ssl) {
+            n = SSL_read(c->ssl, c->rx + c->rx_len, (int)(sizeof(c->rx) - c->rx_len));
+            if (n <= 0) {
+                int e = SSL_get_error(c->ssl, (int)n);
+                return e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE;
+            }
+        } else
+#endif
+        n = recv(c->fd, c->rx + c->rx_len, sizeof(c->rx) - c->rx_len, 0);
+        if (n == 0) return false;
+        if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+        c->rx_len    += (size_t)n;
+        c->last_rx_us = net_now_us();
+
+        size_t pos = 0;
+        while (c->rx_len - pos >= 2) {
+            //--- Remaining length, up to 4 bytes
+            size_t remaining = 0, hdr = 1;
+            bool   complete  = false;
+            for (int shift = 0; hdr < c->rx_len - pos && shift <= 21; shift += 7) {
+                uint8_t b = c->rx[pos + hdr++];
+                remaining |= (size_t)(b & 0x7f) << shift;
+                if (!(b & 0x80)) { complete = true; break; }
+            }
+            if (!complete) break;
+            if (hdr + remaining > sizeof(c->rx)) {
+                fprintf(stderr, "host_net: incoming packet of %zu bytes > HOST_NET_RX_SIZE\n", remaining);
+                return false;
+            }
+            if (c->rx_len - pos < hdr + remaining) break;
+            net_packet(c, c->rx[pos], c->rx + pos + hdr, remaining);
+            if (c->fd < 0) return true;     // closed by a callback
+            pos += hdr + remaining;
+        }
+        memmove(c->rx, c->rx + pos, c->rx_len - pos);
+        c->rx_len -= pos;
+    }
+}
+
+static void net_service(mqtt_client_s* c) {
+    uint64_t now = net_now_us();
+    if (c->conn == NET_TCP_CONNECT) {
+        struct pollfd pfd = { c->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) <= 0) return;
+        int       err = 0;
+        socklen_t len = sizeof(err);
+        getsockopt(c->fd, SOL_SOCKET, SO_ERROR, &err, &len);
+        if (err) { net_close(c, MQTT_CONNECT_DISCONNECTED); return; }
+        c->conn       = c->ssl ? NET_TLS_HANDSHAKE : NET_CONNACK;
+        c->last_rx_us = now;
+    }
+#if MQTT_HA_TLS
+    if (c->conn == NET_TLS_HANDSHAKE) {
+        int r = SSL_connect(c->ssl);
+        if (r <= 0) {
+            int e = SSL_get_error(c->ssl, r);
+            if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) return;
+            char reason[128];
+            ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+            fprintf(stderr, "host_net: TLS handshake failed: %s\n", reason);
+            ERR_clear_error();
+            net_close(c, MQTT_CONNECT_DISCONNECTED);
+            return;
+        }
+        if (SSL_session_reused(c->ssl)) stats.tls_resumed++;
+        else                            stats.tls_full++;
+        c->conn = NET_CONNACK;
+    }
+#endif
+    if (!net_flush(c) || !net_receive(c)) {
+        net_close(c, MQTT_CONNECT_DISCONNECTED);
+        return;
+    }
+    if (c->fd < 0) return;
+    net_flush(c);               // PUBACKs of the incoming messages
+    net_complete(c, 0, ERR_OK); // QoS 0 publishes written out
+    now = net_now_us();
+
+    //--- Request timeouts (lwIP cyclic timer)
+    for (int i = 0; i < c->req_count; i++) {
+        if (now - c->req[i].sent_us < HOST_NET_REQ_TIMEOUT_S * 1000000ull) continue;
+        HostNetRequest r = c->req[i];
+        c->req[i] = c->req[--c->req_count];
+        if (r.cb) r.cb(r.arg, ERR_TIMEOUT);
+        i--;
+    }
+    //--- Keep alive: PINGREQ after keep_alive s without output, gone after 1.5 x without input
+    if (c->conn == NET_CONNECTED && c->keep_alive) {
+        uint64_t ka = c->keep_alive * 1000000ull;
+        if (now - c->last_rx_us > ka + ka / 2) {
+            net_close(c, MQTT_CONNECT_TIMEOUT);
+            return;
+        }
+        if (now - c->last_tx_us > ka && net_tx_room(c, 0)) {
+            net_put_header(c, 0xc0, 0);
+            net_flush(c);
+        }
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP MQTT app ─────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+mqtt_client_t* mqtt_client_new(void) {
+    for (auto& slot : clients) {
+        if (slot) continue;
+        slot = new mqtt_client_s();
+        slot->fd = -1;
+        return slot;
+    }
+    return nullptr;
+}
+
+void mqtt_client_free(mqtt_client_t* client) {
+    for (auto& slot : clients) {
+        if (slot != client) continue;
+        net_close(client, 0);
+        delete client;
+        slot = nullptr;
+    }
+}
+
+err_t mqtt_client_connect(mqtt_client_t* client, const ip_addr_t* ipaddr, u16_t port,
+                          mqtt_connection_cb_t cb, void* arg,
+                          const struct mqtt_connect_client_info_t* client_info) {
+    mqtt_client_s* c = client;
+    if (c->conn != NET_IDLE) return ERR_ISCONN;
+
+    //--- CONNECT, renamed: client id and will topic carry the instance
+    char   id[128], will[256];
+    size_t id_len   = net_rename(id, sizeof(id), client_info->client_id, strlen(client_info->client_id), rename_from, rename_to);
+    size_t will_len = 0, msg_len = 0;
+    if (client_info->will_topic) {
+        will_len = net_rename(will, sizeof(will), client_info->will_topic, strlen(client_info->will_topic), rename_from, rename_to);
+        msg_len  = strlen(client_info->will_msg);
+    }
+    if (id_len == (size_t)-1 || will_len == (size_t)-1) return ERR_VAL;
+    size_t user_len = client_info->client_user ? strlen(client_info->client_user) : 0;
+    size_t pass_len = client_info->client_pass ? strlen(client_info->client_pass) : 0;
+
+    c->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (c->fd < 0) return ERR_MEM;
+#if MQTT_HA_TLS
+    if (client_info->tls_config) {
+        c->ssl = SSL_new(client_info->tls_config->ctx);
+        if (!c->ssl || !SSL_set_fd(c->ssl, c->fd)) {
+            net_close(c, 0);
+            return ERR_MEM;
+        }
+    }
+#endif
+    fcntl(c->fd, F_SETFL, fcntl(c->fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));   // small packets: no Nagle wait for the ack
+    struct sockaddr_in sa = {};
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = ipaddr->addr;      // both in network order
+    if (connect(c->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+        net_close(c, 0);
+        return ERR_RTE;
+    }
+
+    c->conn_cb    = cb;
+    c->conn_arg   = arg;
+    c->keep_alive = client_info->keep_alive;
+    c->conn       = NET_TCP_CONNECT;
+    c->req_count  = 0;
+    c->tx_len     = 0;
+    c->rx_len     = 0;
+    c->tx_queued  = 0;
+    c->tx_sent    = 0;
+
+    uint8_t flags = 0x02;   // clean session, like lwIP
+    size_t  remaining = 10 + 2 + id_len;
+    if (will_len) {
+        flags     |= 0x04 | (client_info->will_qos & 3) << 3 | (client_info->will_retain ? 0x20 : 0);
+        remaining += 2 + will_len + 2 + msg_len;
+    }
+    if (user_len) { flags |= 0x80; remaining += 2 + user_len; }
+    if (pass_len) { flags |= 0x40; remaining += 2 + pass_len; }
+    net_put_header(c, 0x10, remaining);
+    net_put_str(c, "MQTT", 4);
+    uint8_t level_flags[2] = { 4, flags };
+    net_put(c, level_flags, 2);
+    net_put_u16(c, c->keep_alive);
+    net_put_str(c, id, id_len);
+    if (will_len) {
+        net_put_str(c, will, will_len);
+        net_put_str(c, client_info->will_msg, msg_len);
+    }
+    if (user_len) net_put_str(c, client_info->client_user, user_len);
+    if (pass_len) net_put_str(c, client_info->client_pass, pass_len);
+    stats.connects++;
+    return ERR_OK;
+}
+
+void mqtt_disconnect(mqtt_client_t* client) {
+    net_close(client, 0);
+}
+
+u8_t mqtt_client_is_connected(mqtt_client_t* client) {
+    return client->conn == NET_CONNECTED ? 1 : 0;
+}
+
+void mqtt_set_inpub_callback(mqtt_client_t* client, mqtt_incoming_publish_cb_t pub_cb,
+                             mqtt_incoming_data_cb_t data_cb, void* arg) {
+    client->pub_cb    = pub_cb;
+    client->data_cb   = data_cb;
+    client->inpub_arg = arg;
+}
+
+err_t mqtt_sub_unsub(mqtt_client_t* client, const char* topic, u8_t qos,
+                     mqtt_request_cb_t cb, void* arg, u8_t sub) {
+    mqtt_client_s* c = client;
+    if (c->conn != NET_CONNECTED) return ERR_CONN;
+    char   t[256];
+    size_t tlen = net_rename(t, sizeof(t), topic, strlen(topic), rename_from, rename_to);
+    if (tlen == (size_t)-1) return ERR_VAL;
+    size_t remaining = 2 + 2 + tlen + (sub ? 1 : 0);
+    if (c->req_count >= MQTT_REQ_MAX_IN_FLIGHT || !net_tx_room(c, remaining)) return ERR_MEM;
+
+    u16_t id = net_packet_id(c);
+    net_put_header(c, sub ? 0x82 : 0xa2, remaining);
+    net_put_u16(c, id);
+    net_put_str(c, t, tlen);
+    if (sub) net_put(c, &qos, 1);
+    net_queue_request(c, cb, arg, id);
+    if (sub) stats.subscribes++;
+    net_flush(c);
+    return ERR_OK;
+}
+
+err_t mqtt_publish(mqtt_client_t* client, const char* topic, const void* payload, u16_t payload_length,
+                   u8_t qos, u8_t retain, mqtt_request_cb_t cb, void* arg) {
+    mqtt_client_s* c = client;
+    if (c->conn != NET_CONNECTED) { stats.publish_rejected++; return ERR_CONN; }
+
+    static char t[256];
+    static char p[MQTT_OUTPUT_RINGBUF_SIZE];
+    size_t tlen = net_rename(t, sizeof(t), topic, strlen(topic), rename_from, rename_to);
+    size_t plen = net_rename(p, sizeof(p), (const char*)payload, payload_length, rename_from, rename_to);
+    size_t remaining = 2 + tlen + (qos ? 2 : 0) + plen;
+    if (tlen == (size_t)-1 || plen == (size_t)-1 || c->req_count >= MQTT_REQ_MAX_IN_FLIGHT || !net_tx_room(c, remaining)) {
+        stats.publish_rejected++;
+        return ERR_MEM;
+    }
+
+    uint8_t h[5];
+    size_t  hlen = net_fixed_header(h, 0x30 | (qos & 3) << 1 | (retain ? 1 : 0), remaining);
+    net_put(c, h, hlen);
+    net_put_str(c, t, tlen);
+    u16_t id = 0;
+    if (qos) {
+        id = net_packet_id(c);
+        net_put_u16(c, id);
+    }
+    net_put(c, p, plen);
+    net_queue_request(c, cb, arg, id);
+
+    stats.publishes++;
+    stats.payload_bytes += plen;
+    stats.wire_bytes    += hlen + remaining;
+    net_flush(c);
+    return ERR_OK;
+}
+
+#if MQTT_HA_TLS
+//--- TLS of the connection (glue below), nullptr: plain TCP
+static SSL* net_ssl(mqtt_client_t* client) {
+    return client->ssl;
+}
+#endif
+
+#else   // MQTT_HA_MQTT_BUILTIN
+//───────────────────────────────────────────────────────────────────
+//─── lwIP altcp over a socket (built-in MQTT client) ───────────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha_mqtt.cpp brings the MQTT client, this is the TCP under it:
+//  - altcp_write() copies into tx (TCP_SND_BUF bytes: lwIP's send buffer),
+//    altcp_output() and cyw43_arch_poll() hand it to the socket. What the socket
+//    took is reported by sent() on the next cyw43_arch_poll() (the kernel stands
+//    for the TCP ack), never from inside an altcp_*() call.
+//  - cyw43_arch_poll(): connected(), then recv() with what was read, a chain
+//    of TCP_MSS pbufs; recv(nullptr) on EOF, err(ERR_RST) on a socket error.
+//  - poll() every interval x 500 ms of the real clock.
+//  - the PUBLISH packets of the stream are counted in host_stats() (publishes, wire_bytes).
+//  - altcp_tls_new() (MQTT_HA_TLS): an OpenSSL client over the socket, its handshake
+//    between the TCP connect and connected(), like altcp_tls_mbedtls.c; writes,
+//    sent() and recv() count the plain bytes.
+// No renaming: one instance.
+struct altcp_pcb {
+    int                fd;
+    SSL*               ssl;         // altcp_tls_new(), nullptr: plain TCP
+    bool               connecting;
+    bool               handshake;   // TCP is up, TLS handshake in progress
+    bool               closed;      // altcp_close() / altcp_abort() / error: freed at the end of cyw43_arch_poll()
+    void*              arg;
+    altcp_connected_fn connected;
+    altcp_recv_fn      recv;
+    altcp_sent_fn      sent;
+    altcp_poll_fn      poll;
+    altcp_err_fn       err;
+    u8_t               poll_interval;
+    uint64_t           poll_due_us;
+    size_t             unreported;  // taken by the socket, not yet told to sent()
+    uint8_t            tx[TCP_SND_BUF];
+    size_t             tx_len;
+    //--- MQTT framing of the stream, to count the PUBLISH packets
+    uint8_t            pkt_hdr[5];
+    size_t             pkt_hdr_len;
+    size_t             pkt_left;
+};
+
+static altcp_pcb*  pcbs[HOST_NET_CLIENTS];
+static uint8_t     net_rx[HOST_NET_RX_SIZE];
+static struct pbuf net_rx_pbufs[HOST_NET_RX_SIZE / TCP_MSS + 1];
+
+void host_net_rename(const char* from, const char* to) {
+    if (from) fprintf(stderr, "host_net: no renaming under the built-in MQTT client\n");
+}
+
+//--- Written bytes -> MQTT packets: PUBLISH counted with their fixed header
+static void net_count(altcp_pcb* pcb, const uint8_t* p, size_t len) {
+    while (len) {
+        if (pcb->pkt_left) {
+            size_t n = pcb->pkt_left < len ? pcb->pkt_left : len;
+            pcb->pkt_left -= n;
+            p   += n;
+            len -= n;
+            continue;
+        }
+        pcb->pkt_hdr[pcb->pkt_hdr_len++] = *p++;
+        len--;
+        if (pcb->pkt_hdr_len < 2 || ((pcb->pkt_hdr[pcb->pkt_hdr_len - 1] & 0x80) && pcb->pkt_hdr_len < 5)) continue;
+        size_t remaining = 0;
+        for (size_t i = 1; i < pcb->pkt_hdr_len; i++) remaining |= (size_t)(pcb->pkt_hdr[i] & 0x7f) << (7 * (i - 1));
+        if ((pcb->pkt_hdr[0] >> 4) == 3) {
+            stats.publishes++;
+            stats.wire_bytes += pcb->pkt_hdr_len + remaining;
+        }
+        pcb->pkt_left    = remaining;
+        pcb->pkt_hdr_len = 0;
+    }
+}
+
+//--- As much of tx as the socket takes. @return false on a socket error
+static bool net_pcb_flush(altcp_pcb* pcb) {
+    if (pcb->connecting || pcb->handshake || pcb->fd < 0 || pcb->tx_len == 0) return true;
+    ssize_t n;
+#if MQTT_HA_TLS
+    if (pcb->ssl) {
+        n = SSL_write(pcb->ssl, pcb->tx, (int)pcb->tx_len);
+        if (n <= 0) {
+            int e = SSL_get_error(pcb->ssl, (int)n);
+            return e == SSL_ERROR_WANT_WRITE || e == SSL_ERROR_WANT_READ;
+        }
+    } else
+#endif
+    n = send(pcb->fd, pcb->tx, pcb->tx_len, MSG_NOSIGNAL);
+    if (n < 0) return errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR;
+    memmove(pcb->tx, pcb->tx + n, pcb->tx_len - (size_t)n);
+    pcb->tx_len     -= (size_t)n;
+    pcb->unreported += (size_t)n;
+    return true;
+}
+
+static void net_pcb_release(altcp_pcb* pcb) {
+#if MQTT_HA_TLS
+    //--- Without close_notify OpenSSL would mark the session not resumable (mbedTLS does not)
+    if (pcb->ssl) SSL_set_shutdown(pcb->ssl, SSL_SENT_SHUTDOWN | SSL_RECEIVED_SHUTDOWN);
+    if (pcb->ssl) SSL_free(pcb->ssl);
+#endif
+    pcb->ssl = nullptr;
+    if (pcb->fd >= 0) close(pcb->fd);
+    pcb->fd     = -1;
+    pcb->closed = true;
+}
+
+//--- Connection lost: lwIP frees the pcb, then err()
+static void net_pcb_error(altcp_pcb* pcb, err_t err) {
+    net_pcb_release(pcb);
+    if (pcb->err) pcb->err(pcb->arg, err);
+}
+
+static void net_pcb_service(altcp_pcb* pcb) {
+    if (pcb->connecting) {
+        struct pollfd pfd = { pcb->fd, POLLOUT, 0 };
+        if (poll(&pfd, 1, 0) > 0) {
+            int       e   = 0;
+            socklen_t len = sizeof(e);
+            getsockopt(pcb->fd, SOL_SOCKET, SO_ERROR, &e, &len);
+            if (e) { net_pcb_error(pcb, ERR_RST); return; }
+            pcb->connecting = false;
+            pcb->handshake  = pcb->ssl != nullptr;
+            if (!pcb->handshake && pcb->connected) pcb->connected(pcb->arg, pcb, ERR_OK);
+            if (pcb->closed) return;
+        }
+    }
+#if MQTT_HA_TLS
+    //--- altcp_tls: connected() once the handshake is done, a failed one aborts the pcb
+    if (pcb->handshake) {
+        int r = SSL_connect(pcb->ssl);
+        if (r <= 0) {
+            int e = SSL_get_error(pcb->ssl, r);
+            if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) return;
+            char reason[128];
+            ERR_error_string_n(ERR_get_error(), reason, sizeof(reason));
+            fprintf(stderr, "host_net: TLS handshake failed: %s\n", reason);
+            ERR_clear_error();
+            net_pcb_error(pcb, ERR_ABRT);
+            return;
+        }
+        if (SSL_session_reused(pcb->ssl)) stats.tls_resumed++;
+        else                              stats.tls_full++;
+        pcb->handshake = false;
+        if (pcb->connected) pcb->connected(pcb->arg, pcb, ERR_OK);
+        if (pcb->closed) return;
+    }
+#endif
+    if (!net_pcb_flush(pcb)) { net_pcb_error(pcb, ERR_RST); return; }
+    while (pcb->unreported && !pcb->closed) {
+        u16_t n = pcb->unreported < 0xffff ? (u16_t)pcb->unreported : 0xffff;
+        pcb->unreported -= n;
+        if (pcb->sent) pcb->sent(pcb->arg, pcb, n);
+    }
+    //--- Socket -> pbuf chain of TCP_MSS pieces -> recv()
+    while (!pcb->closed && !pcb->connecting) {
+        ssize_t n;
+#if MQTT_HA_TLS
+        if (pcb->ssl) {
+            n = SSL_read(pcb->ssl, net_rx, (int)sizeof(net_rx));
+            int e = n > 0 ? SSL_ERROR_NONE : SSL_get_error(pcb->ssl, (int)n);
+            if (e == SSL_ERROR_WANT_READ || e == SSL_ERROR_WANT_WRITE) break;
+            if (e == SSL_ERROR_ZERO_RETURN) n = 0;          // close_notify: a FIN
+            else if (e != SSL_ERROR_NONE) {
+                ERR_clear_error();
+                net_pcb_error(pcb, ERR_RST);
+                break;
+            }
+        } else
+#endif
+        n = recv(pcb->fd, net_rx, sizeof(net_rx), 0);
+        if (n < 0) {
+            if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) net_pcb_error(pcb, ERR_RST);
+            break;
+        }
+        if (n == 0) {           // FIN: recv(nullptr), the client closes
+            if (pcb->recv) pcb->recv(pcb->arg, pcb, nullptr, ERR_OK);
+            if (!pcb->closed) net_pcb_release(pcb);
+            break;
+        }
+        size_t count = 0;
+        for (size_t off = 0; off < (size_t)n; off += TCP_MSS) {
+            struct pbuf& q = net_rx_pbufs[count++];
+            q.payload = net_rx + off;
+            q.len     = (u16_t)((size_t)n - off < TCP_MSS ? (size_t)n - off : TCP_MSS);
+            q.tot_len = (u16_t)((size_t)n - off);
+            q.next    = nullptr;
+            if (count > 1) net_rx_pbufs[count - 2].next = &q;
+        }
+        if (pcb->recv) pcb->recv(pcb->arg, pcb, net_rx_pbufs, ERR_OK);
+        if (!pcb->ssl && (size_t)n < sizeof(net_rx)) break;    // OpenSSL may hold more: read until WANT_READ
+    }
+    if (pcb->closed || !pcb->poll || !pcb->poll_interval) return;
+    uint64_t now = net_now_us();
+    if (now >= pcb->poll_due_us) {
+        pcb->poll_due_us = now + pcb->poll_interval * 500000ull;
+        pcb->poll(pcb->arg, pcb);
+    }
+}
+
+struct altcp_pcb* altcp_tcp_new_ip_type(u8_t ip_type) {
+    for (auto& slot : pcbs) {
+        if (slot) continue;
+        slot = new altcp_pcb();
+        slot->fd = -1;
+        return slot;
+    }
+    return nullptr;
+}
+
+#if MQTT_HA_TLS
+//--- The TLS context exists at once: the server name and the session go in before the connect completes
+struct altcp_pcb* altcp_tls_new(struct altcp_tls_config* config, u8_t ip_type) {
+    struct altcp_pcb* pcb = altcp_tcp_new_ip_type(ip_type);
+    if (!pcb) return nullptr;
+    pcb->ssl = SSL_new(config->ctx);
+    if (!pcb->ssl) {
+        pcb->closed = true;     // freed by the next cyw43_arch_poll()
+        return nullptr;
+    }
+    return pcb;
+}
+
+//--- TLS of the connection (glue below), nullptr: plain TCP
+static SSL* net_ssl(mqtt_client_t* client) {
+    struct altcp_pcb* pcb = mqtt_ha_mqtt_pcb(client);
+    return pcb && !pcb->closed ? pcb->ssl : nullptr;
+}
+#endif
+
+void altcp_arg(struct altcp_pcb* conn, void* arg)              { conn->arg  = arg; }
+void altcp_recv(struct altcp_pcb* conn, altcp_recv_fn recv)    { conn->recv = recv; }
+void altcp_sent(struct altcp_pcb* conn, altcp_sent_fn sent)    { conn->sent = sent; }
+void altcp_err(struct altcp_pcb* conn, altcp_err_fn err)       { conn->err  = err; }
+void altcp_recved(struct altcp_pcb* conn, u16_t len)           {}
+
+void altcp_poll(struct altcp_pcb* conn, altcp_poll_fn poll, u8_t interval) {
+    conn->poll          = poll;
+    conn->poll_interval = interval;
+    conn->poll_due_us   = net_now_us() + interval * 500000ull;
+}
+
+err_t altcp_connect(struct altcp_pcb* conn, const ip_addr_t* ipaddr, u16_t port, altcp_connected_fn connected) {
+    conn->fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (conn->fd < 0) return ERR_MEM;
+    fcntl(conn->fd, F_SETFL, fcntl(conn->fd, F_GETFL) | O_NONBLOCK);
+    int one = 1;
+    setsockopt(conn->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    struct sockaddr_in sa = {};
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(port);
+    sa.sin_addr.s_addr = ipaddr->addr;      // both in network order
+    if (connect(conn->fd, (struct sockaddr*)&sa, sizeof(sa)) < 0 && errno != EINPROGRESS) {
+        close(conn->fd);
+        conn->fd = -1;
+        return ERR_RTE;
+    }
+#if MQTT_HA_TLS
+    if (conn->ssl && !SSL_set_fd(conn->ssl, conn->fd)) return ERR_MEM;
+#endif
+    conn->connected  = connected;
+    conn->connecting = true;
+    stats.connects++;
+    return ERR_OK;
+}
+
+//--- What is queued still goes out (lwIP sends it before the FIN)
+err_t altcp_close(struct altcp_pcb* conn) {
+    net_pcb_flush(conn);
+    net_pcb_release(conn);
+    return ERR_OK;
+}
+
+void altcp_abort(struct altcp_pcb* conn) {
+    net_pcb_error(conn, ERR_ABRT);
+}
+
+err_t altcp_write(struct altcp_pcb* conn, const void* dataptr, u16_t len, u8_t apiflags) {
+    if (conn->closed) return ERR_CONN;
+    if (conn->tx_len + len > sizeof(conn->tx)) return ERR_MEM;
+    memcpy(conn->tx + conn->tx_len, dataptr, len);
+    conn->tx_len += len;
+    net_count(conn, (const uint8_t*)dataptr, len);
+    return ERR_OK;
+}
+
+err_t altcp_output(struct altcp_pcb* conn) {
+    return net_pcb_flush(conn) ? ERR_OK : ERR_RST;
+}
+
+u16_t altcp_sndbuf(struct altcp_pcb* conn)      { return (u16_t)(sizeof(conn->tx) - conn->tx_len); }
+u16_t altcp_sndqueuelen(struct altcp_pcb* conn) { return (u16_t)((conn->tx_len + TCP_MSS - 1) / TCP_MSS); }
+
+//--- The pbufs are net_rx's, read again on the next recv()
+u8_t pbuf_free(struct pbuf* p) {
+    u8_t n = 0;
+    for (; p; p = p->next) n++;
+    return n;
+}
+#endif
+
+#if MQTT_HA_TLS
+//───────────────────────────────────────────────────────────────────
+//─── lwIP altcp TLS over OpenSSL ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- CA certificate(s) in PEM (one or more, '\0' included or not) or DER, nullptr: no verification
+struct altcp_tls_config* altcp_tls_create_config_client(const u8_t* cert, size_t cert_len) {
+    SSL_CTX* ctx = SSL_CTX_new(TLS_client_method());
+    if (!ctx) return nullptr;
+    SSL_CTX_set_max_proto_version(ctx, TLS1_2_VERSION);
+    SSL_CTX_set_mode(ctx, SSL_MODE_ENABLE_PARTIAL_WRITE | SSL_MODE_ACCEPT_MOVING_WRITE_BUFFER);
+    bool verify = cert && cert_len;
+    if (verify) {
+        X509_STORE* store = SSL_CTX_get_cert_store(ctx);
+        int         added = 0;
+        BIO*        bio   = BIO_new_mem_buf(cert, (int)cert_len);
+        while (X509* x = PEM_read_bio_X509(bio, nullptr, nullptr, nullptr)) {
+            added += X509_STORE_add_cert(store, x);
+            X509_free(x);
+        }
+        BIO_free(bio);
+        if (added == 0) {
+            const unsigned char* p = cert;
+            if (X509* x = d2i_X509(nullptr, &p, (long)cert_len)) {
+                added = X509_STORE_add_cert(store, x);
+                X509_free(x);
+            }
+        }
+        ERR_clear_error();
+        if (added == 0) {
+            SSL_CTX_free(ctx);
+            return nullptr;
+        }
+        SSL_CTX_set_verify(ctx, SSL_VERIFY_PEER, nullptr);
+    }
+    return new altcp_tls_config{ ctx, verify };
+}
+
+struct altcp_tls_session* altcp_tls_alloc_session(void) {
+    return new altcp_tls_session{ nullptr };
+}
+
+err_t mqtt_ha_tls_start(mqtt_client_t* client, const char* host, struct altcp_tls_session* session,
+                        const uint8_t* saved, size_t saved_len) {
+    SSL* ssl = net_ssl(client);
+    if (!ssl) return ERR_CONN;
+    if (host) {
+        SSL_set_tlsext_host_name(ssl, host);
+        if (SSL_get_verify_mode(ssl) & SSL_VERIFY_PEER) SSL_set1_host(ssl, host);
+    }
+    if (session) return session->session && !SSL_set_session(ssl, session->session) ? ERR_VAL : ERR_OK;
+    if (saved == nullptr) return ERR_OK;
+    const unsigned char* p = saved;
+    SSL_SESSION*         s = d2i_SSL_SESSION(nullptr, &p, (long)saved_len);
+    bool ok = s && SSL_set_session(ssl, s);
+    if (s) SSL_SESSION_free(s);     // SSL_set_session() took its own reference
+    return ok ? ERR_OK : ERR_VAL;
+}
+
+err_t mqtt_ha_tls_session_get(mqtt_client_t* client, struct altcp_tls_session* session) {
+    SSL* ssl = net_ssl(client);
+    if (!ssl || !SSL_is_init_finished(ssl)) return ERR_CONN;
+    SSL_SESSION* s = SSL_get1_session(ssl);
+    if (!s) return ERR_VAL;
+    if (session->session) SSL_SESSION_free(session->session);
+    session->session = s;
+    return ERR_OK;
+}
+
+//--- Session of the connection once its handshake is done (mbedTLS: the live one of the context)
+static SSL_SESSION* tls_live(mqtt_client_t* client) {
+    SSL* ssl = net_ssl(client);
+    return ssl && SSL_is_init_finished(ssl) ? SSL_get_session(ssl) : nullptr;
+}
+
+uint32_t mqtt_ha_tls_fingerprint(mqtt_client_t* client) {
+    SSL_SESSION* s = tls_live(client);
+    if (!s) return 0;
+    uint8_t key[SSL_MAX_MASTER_KEY_LENGTH];
+    size_t  len = SSL_SESSION_get_master_key(s, key, sizeof(key));
+    uint32_t h = 2166136261u;   // FNV-1a
+    bool     set = false;
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ key[i]) * 16777619u;
+        set |= key[i] != 0;
+    }
+    return set ? (h ? h : 1) : 0;
+}
+
+size_t mqtt_ha_tls_session_save(mqtt_client_t* client, uint8_t* buf, size_t len) {
+    SSL_SESSION* s = tls_live(client);
+    if (!s) return 0;
+    int n = i2d_SSL_SESSION(s, nullptr);
+    if (n <= 0 || (size_t)n > len) return 0;
+    unsigned char* p = buf;
+    return (size_t)i2d_SSL_SESSION(s, &p);
+}
+#endif
+
+//───────────────────────────────────────────────────────────────────
+//─── cyw43_arch: the link is the host's, always up ─────────────────
+//───────────────────────────────────────────────────────────────────
+int  cyw43_arch_init(void)            { return 0; }
+void cyw43_arch_deinit(void)          {}
+void cyw43_arch_enable_sta_mode(void) {}
+
+int cyw43_arch_wifi_connect_timeout_ms(const char* ssid, const char* pw, uint32_t auth, uint32_t timeout_ms) {
+    return 0;
+}
+
+int cyw43_arch_wifi_connect_async(const char* ssid, const char* pw, uint32_t auth) {
+    return 0;
+}
+
+int cyw43_wifi_join(cyw43_t* self, size_t ssid_len, const uint8_t* ssid, size_t key_len, const uint8_t* key,
+                    uint32_t auth_type, const uint8_t* bssid, uint32_t channel) {
+    return 0;
+}
+
+//--- No AP to report: the library caches no BSSID / channel on this backend
+int cyw43_wifi_get_bssid(cyw43_t* self, uint8_t bssid[6])                          { return -1; }
+int cyw43_ioctl(cyw43_t* self, uint32_t cmd, size_t len, uint8_t* buf, uint32_t iface) { return -1; }
+
+int cyw43_tcpip_link_status(cyw43_t* self, int itf) {
+    return CYW43_LINK_UP;
+}
+
+err_t dhcp_start(struct netif* netif) { return ERR_OK; }
+void  dhcp_stop(struct netif* netif)  {}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP DNS: UDP queries, answers kept for their TTL ─────────────
+//───────────────────────────────────────────────────────────────────
+// Like lwIP's dns.c: one A query per name to the server of host_net_set_dns(),
+// resent every second, given up (found(nullptr)) after HOST_NET_DNS_TRIES;
+// an answer stays in the table for its TTL. Without a server the host
+// resolver (getaddrinfo: /etc/hosts...) answers at once, nothing is kept.
+struct NetDnsEntry {
+    char               name[64];
+    u32_t              ip;
+    uint64_t           expires_us;      // table: end of the TTL
+    //--- query in flight
+    dns_found_callback found;
+    void*              arg;
+    u16_t              id;              // 0: no query
+    uint8_t            tries;
+    uint64_t           sent_us;
+};
+static NetDnsEntry dns_table[HOST_NET_DNS_TABLE];
+static int         dns_fd   = -1;
+static u16_t       dns_port = 53;
+static u16_t       dns_id   = 0;
+
+static void net_dns_send(NetDnsEntry& e) {
+    uint8_t q[12 + 66 + 4] = {};
+    q[0] = (uint8_t)(e.id >> 8);
+    q[1] = (uint8_t)e.id;
+    q[2] = 0x01;                        // recursion desired
+    q[5] = 1;                           // one question
+    size_t n = 12;
+    for (const char* label = e.name; *label;) {
+        const char* dot = strchr(label, '.');
+        size_t      len = dot ? (size_t)(dot - label) : strlen(label);
+        if (len == 0 || len > 63 || n + 1 + len + 5 > sizeof(q)) return;       // never answered: given up
+        q[n++] = (uint8_t)len;
+        memcpy(q + n, label, len);
+        n    += len;
+        label += len + (dot ? 1 : 0);
+    }
+    q[n++] = 0;
+    q[n++] = 0; q[n++] = 1;             // type A
+    q[n++] = 0; q[n++] = 1;             // class IN
+    struct sockaddr_in sa = {};
+    sa.sin_family      = AF_INET;
+    sa.sin_port        = htons(dns_port);
+    sa.sin_addr.s_addr = dns_getserver(0)->addr;
+    sendto(dns_fd, q, n, 0, (struct sockaddr*)&sa, sizeof(sa));
+    e.sent_us = net_now_us();
+    e.tries++;
+}
+
+//--- Past a (possibly compressed) name. @return offset after it, 0 if truncated
+static size_t net_dns_skip_name(const uint8_t* p, size_t len, size_t at) {
+    while (at < len) {
+        if ((p[at] & 0xc0) == 0xc0) return at + 2 <= len ? at + 2 : 0;
+        if (p[at] == 0) return at + 1;
+        at += 1 + p[at];
+    }
+    return 0;
+}
+
+//--- Response -> first A record. @return false: no such name / no A record
+static bool net_dns_parse(const uint8_t* p, size_t len, u32_t* ip, uint32_t* ttl) {
+    if (len < 12 || (p[3] & 0x0f) != 0) return false;     // rcode (3: NXDOMAIN)
+    unsigned qd = p[4] << 8 | p[5], an = p[6] << 8 | p[7];
+    size_t at = 12;
+    for (unsigned i = 0; i < qd && at; i++) at = net_dns_skip_name(p, len, at) + 4;
+    for (unsigned i = 0; i < an && at && at < len; i++) {
+        at = net_dns_skip_name(p, len, at);
+        if (!at || at + 10 > len) return false;
+        unsigned type = p[at] << 8 | p[at + 1], rdlen = p[at + 8] << 8 | p[at + 9];
+        if (type == 1 && rdlen == 4 && at + 14 <= len) {
+            *ttl = (uint32_t)p[at + 4] << 24 | p[at + 5] << 16 | p[at + 6] << 8 | p[at + 7];
+            memcpy(ip, p + at + 10, 4);                     // network order, like ip_addr_t
+            return true;
+        }
+        at += 10 + rdlen;
+    }
+    return false;
+}
+
+static void net_dns_done(NetDnsEntry& e, bool ok) {
+    NetDnsEntry done = e;
+    e.id = 0;
+    if (!ok) e.name[0] = '\0';             // entry free again
+    ip_addr_t addr = { done.ip };
+    if (done.found) done.found(done.name, ok ? &addr : nullptr, done.arg);
+}
+
+//--- cyw43_arch_poll(): answers, resends, give-ups
+static void net_dns_poll() {
+    uint8_t buf[512];
+    ssize_t n;
+    while (dns_fd >= 0 && (n = recv(dns_fd, buf, sizeof(buf), 0)) >= 12) {
+        u16_t id = (u16_t)(buf[0] << 8 | buf[1]);
+        for (NetDnsEntry& e : dns_table) {
+            if (e.id == 0 || e.id != id) continue;
+            uint32_t ttl = 0;
+            bool ok = net_dns_parse(buf, (size_t)n, &e.ip, &ttl);
+            if (ttl > HOST_NET_DNS_MAX_TTL_S) ttl = HOST_NET_DNS_MAX_TTL_S;
+            e.expires_us = net_now_us() + ttl * 1000000ull;
+            net_dns_done(e, ok);
+        }
+    }
+    uint64_t now = net_now_us();
+    for (NetDnsEntry& e : dns_table) {
+        if (e.id == 0 || now - e.sent_us < 1000000) continue;
+        if (e.tries >= HOST_NET_DNS_TRIES) net_dns_done(e, false);
+        else                               net_dns_send(e);
+    }
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg) {
+    if (ipaddr_aton(hostname, addr)) return ERR_OK;
+    if (strlen(hostname) >= sizeof(dns_table[0].name)) return ERR_ARG;
+    if (dns_getserver(0)->addr == 0) {
+        struct addrinfo hints = {}, *res = nullptr;
+        hints.ai_family = AF_INET;
+        if (getaddrinfo(hostname, nullptr, &hints, &res) != 0 || !res) return ERR_ARG;
+        addr->addr = ((struct sockaddr_in*)res->ai_addr)->sin_addr.s_addr;
+        freeaddrinfo(res);
+        return ERR_OK;
+    }
+    //--- In the table: TTL running -> at once. Query in flight -> its answer (last caller only)
+    uint64_t     now = net_now_us();
+    NetDnsEntry* e   = nullptr;
+    for (NetDnsEntry& t : dns_table) {
+        if (strcmp(t.name, hostname) != 0) continue;
+        if (t.id == 0 && now < t.expires_us) {
+            addr->addr = t.ip;
+            return ERR_OK;
+        }
+        if (t.id != 0) {
+            t.found = found;
+            t.arg   = callback_arg;
+            return ERR_INPROGRESS;
+        }
+        e = &t;
+        break;
+    }
+    //--- Else a free entry, else the one that expires first (no query in flight)
+    for (NetDnsEntry& t : dns_table) {
+        if (e && (e->name[0] == '\0' || strcmp(e->name, hostname) == 0)) break;
+        if (t.id != 0) continue;
+        if (!e || t.name[0] == '\0' || t.expires_us < e->expires_us) e = &t;
+    }
+    if (!e) return ERR_MEM;
+    if (dns_fd < 0) {
+        dns_fd = socket(AF_INET, SOCK_DGRAM, 0);
+        if (dns_fd < 0) return ERR_MEM;
+        fcntl(dns_fd, F_SETFL, fcntl(dns_fd, F_GETFL) | O_NONBLOCK);
+    }
+    strcpy(e->name, hostname);
+    e->found = found;
+    e->arg   = callback_arg;
+    e->tries = 0;
+    if (++dns_id == 0) dns_id = 1;
+    e->id = dns_id;
+    net_dns_send(*e);
+    return ERR_INPROGRESS;
+}
+
+void host_net_set_dns(const char* ip, u16_t port) {
+    ip_addr_t addr = {};
+    if (ip && !ipaddr_aton(ip, &addr)) return;
+    dns_setserver(0, &addr);
+    dns_port = port;
+    //--- Own socket and empty table (e.g. a forked instance: nothing shared with the parent)
+    if (dns_fd >= 0) close(dns_fd);
+    dns_fd = -1;
+    memset(dns_table, 0, sizeof(dns_table));
+}
+
+void cyw43_arch_poll(void) {
+    stats.polls++;
+#if MQTT_HA_MQTT_BUILTIN
+    for (auto pcb : pcbs) {
+        if (pcb && !pcb->closed) net_pcb_service(pcb);
+    }
+    for (auto& pcb : pcbs) {
+        if (!pcb || !pcb->closed) continue;
+        delete pcb;
+        pcb = nullptr;
+    }
+#else
+    for (auto c : clients) {
+        if (c && c->conn != NET_IDLE) net_service(c);
+    }
+#endif
+    net_dns_poll();
+}
+
+void host_net_wait(uint32_t ms) {
+    struct pollfd pfd[HOST_NET_CLIENTS + 1];
+    int n = 0;
+    if (dns_fd >= 0) {
+        pfd[n].fd      = dns_fd;
+        pfd[n].events  = POLLIN;
+        pfd[n].revents = 0;
+        n++;
+    }
+#if MQTT_HA_MQTT_BUILTIN
+    for (auto pcb : pcbs) {
+        if (!pcb || pcb->closed) continue;
+        pfd[n].fd      = pcb->fd;
+        bool out = pcb->connecting || pcb->tx_len;
+#if MQTT_HA_TLS
+        if (pcb->handshake) out = SSL_want_write(pcb->ssl);
+#endif
+        pfd[n].events  = POLLIN | (out ? POLLOUT : 0);
+        pfd[n].revents = 0;
+        n++;
+    }
+#else
+    for (auto c : clients) {
+        if (!c || c->conn == NET_IDLE) continue;
+        pfd[n].fd      = c->fd;
+        bool out = c->conn == NET_TCP_CONNECT || c->tx_len;
+#if MQTT_HA_TLS
+        if (c->conn == NET_TLS_HANDSHAKE) out = SSL_want_write(c->ssl);
+#endif
+        pfd[n].events  = POLLIN | (out ? POLLOUT : 0);
+        pfd[n].revents = 0;
+        n++;
+    }
+#endif
+    poll(pfd, n, (int)ms);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── pico time: the real clock, since the start of the process ─────
+//───────────────────────────────────────────────────────────────────
+static const uint64_t boot_us = net_now_us();
+
+void sleep_ms(uint32_t ms) {
+    struct timespec ts = { (time_t)(ms / 1000), (long)(ms % 1000) * 1000000L };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR) {}
+}
+uint64_t        time_us_64(void)           { return net_now_us() - boot_us; }
+uint32_t        time_us_32(void)           { return (uint32_t)time_us_64(); }
+absolute_time_t get_absolute_time(void)    { return time_us_64(); }
+
+//───────────────────────────────────────────────────────────────────
+//─── Host control API (the subset that makes sense on a real broker)
+//───────────────────────────────────────────────────────────────────
+const HostStats& host_stats()   { return stats; }
+
+//--- Built-in MQTT client: its requests are its own, not seen from here
+int host_in_flight() {
+    int n = 0;
+#if !MQTT_HA_MQTT_BUILTIN
+    for (auto c : clients) n += c ? c->req_count : 0;
+#endif
+    return n;
+}
+
+//--- Connection lost (reset by the peer, WiFi gone...): the broker sends the Last Will
+void host_drop_connection() {
+#if MQTT_HA_MQTT_BUILTIN
+    for (auto pcb : pcbs) {
+        if (pcb && !pcb->closed) net_pcb_error(pcb, ERR_RST);
+    }
+#else
+    for (auto c : clients) {
+        if (c && c->conn != NET_IDLE) net_close(c, MQTT_CONNECT_DISCONNECTED);
+    }
+#endif
+}
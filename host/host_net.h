@@ -0,0 +1,70 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Host (Linux) lwIP MQTT over a real TCP socket ─────────────────
+//───────────────────────────────────────────────────────────────────
+// host_net.cpp implements the lwIP MQTT / cyw43 / time subset of
+// host_platform.h against a real broker (MQTT 3.1.1), so the unchanged
+// library runs on Linux next to mosquitto & co (host/fleet, load tests).
+//
+// Behaviour (same contract as lwIP 2.1 on the Pico):
+//  - everything happens in cyw43_arch_poll(): socket reads / writes,
+//    CONNACK -> connection callback, PUBACK / SUBACK -> request callbacks,
+//    incoming PUBLISH -> pub_cb then data_cb (one piece, MQTT_DATA_FLAG_LAST),
+//    QoS 1 PUBACK sent back, PINGREQ every keep_alive seconds.
+//  - MQTT_REQ_MAX_IN_FLIGHT requests and MQTT_OUTPUT_RINGBUF_SIZE bytes
+//    waiting for the socket, ERR_MEM beyond; a request without its ack
+//    after HOST_NET_REQ_TIMEOUT_S fails with ERR_TIMEOUT.
+//  - QoS 0 publishes complete once written to the socket.
+//  - mqtt_disconnect() closes the socket without callback (and without
+//    DISCONNECT, like lwIP 2.1: the broker sends the Last Will).
+//  - the WiFi link is always up, the time is the real monotonic clock
+//    and sleep_ms() really sleeps.
+//  - several clients per process (an observer next to the library's own).
+//  - dns_gethostbyname(): A queries over UDP to host_net_set_dns(), answers
+//    kept for their TTL (capped like lwIP's DNS_MAX_TTL); without a server,
+//    the host resolver (getaddrinfo) answers at once.
+//  - MQTT_HA_TLS (OpenSSL found): ci.tls_config runs a TLS 1.2 client handshake
+//    (OpenSSL in place of mbedTLS) after the TCP connect and before CONNECT;
+//    the altcp_tls / mqtt_ha_tls_*() subset of host_platform.h, sessions
+//    (ID or ticket) offered again and serialized with i2d_SSL_SESSION().
+//  - MQTT_HA_MQTT_BUILTIN: the altcp (TCP) and pbuf subset of host_platform.h in
+//    place of the MQTT app, for mqtt_ha_mqtt.cpp: one socket per pcb, writes kept
+//    in TCP_SND_BUF bytes, sent() once the socket took them, received bytes in pbuf
+//    chains of TCP_MSS. altcp_tls_new() runs the same OpenSSL handshake before
+//    connected(), the mqtt_ha_tls_*() glue reaches it through mqtt_ha_mqtt_pcb().
+//    No renaming (host_net_rename() only warns).
+// Of the host_*() controls of host_platform.h only host_stats(),
+// host_in_flight() and host_drop_connection() exist in this backend.
+#include "host_platform.h"
+
+#ifndef HOST_NET_CLIENTS
+#define HOST_NET_CLIENTS        8
+#endif
+#ifndef HOST_NET_RX_SIZE
+#define HOST_NET_RX_SIZE        16384   // largest incoming packet
+#endif
+#ifndef HOST_NET_REQ_TIMEOUT_S
+#define HOST_NET_REQ_TIMEOUT_S  30      // lwIP MQTT_REQ_TIMEOUT
+#endif
+#ifndef HOST_NET_DNS_TABLE
+#define HOST_NET_DNS_TABLE      4       // lwIP DNS_TABLE_SIZE
+#endif
+#ifndef HOST_NET_DNS_TRIES
+#define HOST_NET_DNS_TRIES      4       // lwIP DNS_MAX_RETRIES, one per second
+#endif
+#ifndef HOST_NET_DNS_MAX_TTL_S
+#define HOST_NET_DNS_MAX_TTL_S  604800  // lwIP DNS_MAX_TTL
+#endif
+
+//--- Every occurrence of from (topics, payloads, client id, will) is sent as to,
+//--- incoming topics get the reverse: one compiled DEVICE_ID, many instances.
+//--- nullptr: no renaming. Call before wifi_mqtt_init().
+void host_net_rename(const char* from, const char* to);
+
+//--- DNS server of dns_gethostbyname() (e.g. a dnsmasq stub on 127.0.0.1:5353), nullptr: host resolver.
+//--- Starts with an empty table and a new socket: call it again in a forked process.
+void host_net_set_dns(const char* ip, u16_t port = 53);
+
+//--- Block until one of the sockets has something to do, or ms elapsed.
+//--- Nothing is processed here: cyw43_arch_poll() (mqtt_poll()) does it.
+void host_net_wait(uint32_t ms);
@@ -0,0 +1,635 @@
+//───────────────────────────────────────────────────────────────────
+//─── Host (Linux) fake of the Pico SDK + lwIP MQTT app ─────────────
+//───────────────────────────────────────────────────────────────────
+// See host_platform.h for the behaviour. Everything is single threaded
+// and callback driven, like NO_SYS lwIP with cyw43_arch_poll on the Pico.
+// In dual-core mode the whole fake belongs to the "core 1" thread, only the
+// virtual clock is read from both threads.
+#include "host_platform.h"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+
+//--- A session as the client keeps it: the secret stands for the 48-byte master
+//--- secret, the ticket for the broker's (opaque, typical RFC 5077 size)
+struct altcp_tls_session {
+    uint32_t secret;            // 0: none
+    u32_t    broker_ip;         // issued by
+    uint32_t keys;              // generation of that broker's ticket keys
+    uint8_t  ticket[160];
+};
+struct altcp_tls_config { int unused; };
+
+struct mqtt_client_s {
+    bool                       connected;
+    bool                       connect_pending;
+    mqtt_connection_cb_t       conn_cb;
+    void*                      conn_arg;
+    mqtt_incoming_publish_cb_t pub_cb;
+    mqtt_incoming_data_cb_t    data_cb;
+    void*                      inpub_arg;
+    u32_t                      broker_ip;   // host_set_broker_down()
+    bool                       tls;
+    uint64_t                   connect_us;
+    altcp_tls_session          offered;     // mqtt_ha_tls_start()
+    altcp_tls_session          session;     // of the connection
+};
+
+struct HostRequest {
+    mqtt_request_cb_t cb;
+    void*             arg;
+    bool              needs_ack;    // false: QoS 0 publish, done once sent
+    uint64_t          sent_us;      // for host_set_ack_delay_ms()
+};
+
+static mqtt_client_s  client_g;
+static bool           client_used      = false;
+
+static HostRequest    in_flight[MQTT_REQ_MAX_IN_FLIGHT];
+static int            in_flight_count  = 0;
+static int            request_limit    = MQTT_REQ_MAX_IN_FLIGHT;   // host_set_request_limit()
+static HostStats      stats;
+static HostPublish    last_publish;
+static std::atomic<uint64_t> now_us{0};
+
+static int                       wifi_result     = 0;
+static uint32_t                  join_ms         = 0;
+static uint32_t                  dhcp_ms         = 0;
+static bool                      join_started    = false;
+static uint64_t                  join_start_us   = 0;
+static uint32_t                  join_time_ms    = 0;       // current join: join_ms, + scan_ms without BSSID / channel
+static int                       join_result     = 0;       // current join: wifi_result, or NONET (AP not where expected)
+static uint32_t                  scan_ms         = 0;
+static uint8_t                   ap_channel      = 6;
+static uint8_t                   ap_bssid[6]     = { 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 };
+static bool                      dhcp_running    = true;
+static uint64_t                  dhcp_from_us    = 0;       // lease dhcp_ms after this
+static u32_t                     lease_ip        = 0x6401A8C0u;     // 192.168.1.100
+cyw43_t                          cyw43_state;
+static mqtt_connection_status_t  connect_status  = MQTT_CONNECT_ACCEPTED;
+static bool                      auto_ack        = true;
+static err_t                     request_result  = ERR_OK;
+static uint32_t                  poll_cost_us    = 0;
+static uint32_t                  ack_delay_us    = 0;
+static void (*poll_hook)(void*)  = nullptr;
+static void*                     poll_hook_arg   = nullptr;
+static void (*publish_hook)(const HostPublish*, void*) = nullptr;
+static void*                     publish_hook_arg = nullptr;
+
+//--- DNS: stub zone, lwIP's table (answers kept for their TTL), queries waiting for an answer
+#define HOST_DNS_RECORDS    8
+#define HOST_DNS_QUERIES    4
+#define HOST_DNS_GIVE_UP_MS 10000   // server down: lwIP gives up after its retries
+struct HostDnsRecord {
+    char     name[64];
+    u32_t    ip;                    // zone: 0 = no such name
+    uint32_t ttl_s;
+    uint64_t expires_us;            // table
+};
+struct HostDnsQuery {
+    char               name[64];
+    dns_found_callback found;
+    void*              arg;
+    uint64_t           sent_us;
+};
+static HostDnsRecord             dns_zone[HOST_DNS_RECORDS];
+static HostDnsRecord             dns_table[HOST_DNS_RECORDS];
+static HostDnsQuery              dns_queries[HOST_DNS_QUERIES];
+static int                       dns_query_count = 0;
+static uint32_t                  dns_latency_us  = 0;
+static bool                      dns_down        = false;
+static uint32_t                  dns_query_total = 0;
+static u32_t                     brokers_down[4] = {};     // 0: free slot
+
+//--- TLS: handshake costs, the broker's ticket keys (not reset by host_reset(): a device reboot)
+static uint32_t                  tls_full_us     = 0;
+static uint32_t                  tls_resumed_us  = 0;
+static bool                      tls_resumption  = true;
+static uint32_t                  tls_keys        = 1;
+static uint32_t                  tls_secrets     = 0;       // sessions issued
+static altcp_tls_config          tls_config_g;
+static altcp_tls_session         tls_sessions[2];
+static int                       tls_sessions_used = 0;
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP MQTT app ─────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+mqtt_client_t* mqtt_client_new(void) {
+    if (client_used) return nullptr;   // single static client is enough for the library
+    client_used = true;
+    memset(&client_g, 0, sizeof(client_g));
+    return &client_g;
+}
+
+void mqtt_client_free(mqtt_client_t* client) {
+    if (client == &client_g) client_used = false;
+}
+
+err_t mqtt_client_connect(mqtt_client_t* client, const ip_addr_t* ipaddr, u16_t port,
+                          mqtt_connection_cb_t cb, void* arg,
+                          const struct mqtt_connect_client_info_t* client_info) {
+    (void)port;
+    if (client->connected || client->connect_pending) return ERR_ISCONN;
+    client->broker_ip       = ipaddr->addr;
+    client->conn_cb         = cb;
+    client->conn_arg        = arg;
+    client->connect_pending = true;
+    client->tls             = client_info->tls_config != nullptr;
+    client->connect_us      = now_us;
+    client->offered         = {};
+    client->session         = {};
+    stats.connects++;
+    return ERR_OK;
+}
+
+void mqtt_disconnect(mqtt_client_t* client) {
+    client->connected       = false;
+    client->connect_pending = false;
+    in_flight_count         = 0;
+}
+
+u8_t mqtt_client_is_connected(mqtt_client_t* client) {
+    return client->connected ? 1 : 0;
+}
+
+void mqtt_set_inpub_callback(mqtt_client_t* client, mqtt_incoming_publish_cb_t pub_cb,
+                             mqtt_incoming_data_cb_t data_cb, void* arg) {
+    client->pub_cb    = pub_cb;
+    client->data_cb   = data_cb;
+    client->inpub_arg = arg;
+}
+
+static err_t host_queue_request(mqtt_request_cb_t cb, void* arg, bool needs_ack) {
+    if (in_flight_count >= request_limit) return ERR_MEM;
+    in_flight[in_flight_count].cb        = cb;
+    in_flight[in_flight_count].arg       = arg;
+    in_flight[in_flight_count].needs_ack = needs_ack;
+    in_flight[in_flight_count].sent_us   = now_us;
+    in_flight_count++;
+    return ERR_OK;
+}
+
+err_t mqtt_sub_unsub(mqtt_client_t* client, const char* topic, u8_t qos,
+                     mqtt_request_cb_t cb, void* arg, u8_t sub) {
+    (void)topic; (void)qos;
+    if (!client->connected) return ERR_CONN;
+    err_t err = host_queue_request(cb, arg, true);
+    if (err == ERR_OK && sub) stats.subscribes++;
+    return err;
+}
+
+// Size of the PUBLISH packet on the wire:
+// fixed header (1) + remaining length (1..4) + topic (2 + n) + packet id (qos > 0) + payload
+static uint32_t host_publish_wire_size(size_t topic_len, u16_t payload_len, u8_t qos) {
+    uint32_t remaining = 2 + (uint32_t)topic_len + (qos ? 2 : 0) + payload_len;
+    uint32_t len_bytes = remaining < 128 ? 1 : remaining < 16384 ? 2 : 3;
+    return 1 + len_bytes + remaining;
+}
+
+err_t mqtt_publish(mqtt_client_t* client, const char* topic, const void* payload, u16_t payload_length,
+                   u8_t qos, u8_t retain, mqtt_request_cb_t cb, void* arg) {
+    if (!client->connected) { stats.publish_rejected++; return ERR_CONN; }
+    size_t topic_len = strlen(topic);
+    if (host_publish_wire_size(topic_len, payload_length, qos) > MQTT_OUTPUT_RINGBUF_SIZE) {
+        stats.publish_rejected++;
+        return ERR_MEM;
+    }
+    err_t err = host_queue_request(cb, arg, qos > 0);
+    if (err != ERR_OK) { stats.publish_rejected++; return err; }
+
+    stats.publishes++;
+    stats.payload_bytes += payload_length;
+    stats.wire_bytes    += host_publish_wire_size(topic_len, payload_length, qos);
+
+    size_t tcopy = topic_len < sizeof(last_publish.topic) - 1 ? topic_len : sizeof(last_publish.topic) - 1;
+    size_t pcopy = payload_length < sizeof(last_publish.payload) - 1 ? payload_length : sizeof(last_publish.payload) - 1;
+    memcpy(last_publish.topic, topic, tcopy);
+    last_publish.topic[tcopy] = '\0';
+    memcpy(last_publish.payload, payload, pcopy);
+    last_publish.payload[pcopy] = '\0';
+    last_publish.len    = payload_length;
+    last_publish.qos    = qos;
+    last_publish.retain = retain;
+    if (publish_hook) publish_hook(&last_publish, publish_hook_arg);
+    return ERR_OK;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP altcp TLS ────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+struct altcp_tls_config* altcp_tls_create_config_client(const u8_t* cert, size_t cert_len) {
+    (void)cert; (void)cert_len;
+    return &tls_config_g;
+}
+
+struct altcp_tls_session* altcp_tls_alloc_session(void) {
+    if (tls_sessions_used == (int)(sizeof(tls_sessions) / sizeof(tls_sessions[0]))) return nullptr;
+    altcp_tls_session* s = &tls_sessions[tls_sessions_used++];
+    *s = {};
+    return s;
+}
+
+err_t mqtt_ha_tls_start(mqtt_client_t* client, const char* host, struct altcp_tls_session* session,
+                        const uint8_t* saved, size_t saved_len) {
+    (void)host;
+    if (!client->tls || !client->connect_pending) return ERR_CONN;
+    if (session) {
+        client->offered = *session;
+    } else if (saved) {
+        if (saved_len != sizeof(client->offered)) return ERR_VAL;
+        memcpy(&client->offered, saved, saved_len);
+    }
+    return ERR_OK;
+}
+
+err_t mqtt_ha_tls_session_get(mqtt_client_t* client, struct altcp_tls_session* session) {
+    if (!client->tls || !client->connected) return ERR_CONN;
+    *session = client->session;
+    return ERR_OK;
+}
+
+uint32_t mqtt_ha_tls_fingerprint(mqtt_client_t* client) {
+    return client->tls && client->connected ? client->session.secret : 0;
+}
+
+size_t mqtt_ha_tls_session_save(mqtt_client_t* client, uint8_t* buf, size_t len) {
+    if (!client->tls || !client->connected || len < sizeof(client->session)) return 0;
+    memcpy(buf, &client->session, sizeof(client->session));
+    return sizeof(client->session);
+}
+
+//--- cyw43_arch_poll(), broker accepting: @return false while the handshake is in progress.
+//--- The poll that completes it spends its CPU time (mbedTLS runs in the lwIP callbacks).
+static bool tls_handshake(mqtt_client_s* c) {
+    if (!c->tls) return true;
+    const altcp_tls_session& o = c->offered;
+    bool resume = tls_resumption && o.secret != 0 && o.broker_ip == c->broker_ip && o.keys == tls_keys;
+    if (now_us - c->connect_us < (uint64_t)(resume ? 1 : 2) * ack_delay_us) return false;
+    now_us += resume ? tls_resumed_us : tls_full_us;
+    if (resume) {
+        c->session = o;
+        stats.tls_resumed++;
+    } else {
+        c->session           = {};
+        c->session.secret    = ++tls_secrets;
+        c->session.broker_ip = c->broker_ip;
+        c->session.keys      = tls_keys;
+        memset(c->session.ticket, (int)tls_secrets, sizeof(c->session.ticket));
+        stats.tls_full++;
+    }
+    return true;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── cyw43_arch ────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+int  cyw43_arch_init(void)            { return 0; }
+void cyw43_arch_deinit(void)          {}
+void cyw43_arch_enable_sta_mode(void) {}
+
+static void join_start(uint64_t start_us, uint32_t time_ms, int result) {
+    join_started  = true;
+    join_start_us = start_us;
+    join_time_ms  = time_ms;
+    join_result   = result;
+    dhcp_from_us  = start_us + (uint64_t)time_ms * 1000;
+}
+
+int cyw43_arch_wifi_connect_timeout_ms(const char* ssid, const char* pw, uint32_t auth, uint32_t timeout_ms) {
+    (void)ssid; (void)pw; (void)auth;
+    if (wifi_result != 0) now_us += (uint64_t)timeout_ms * 1000;   // a failed join burns its whole timeout
+    join_start(now_us - (uint64_t)(join_ms + scan_ms + dhcp_ms) * 1000, join_ms + scan_ms, wifi_result);
+    join_started = (wifi_result == 0);
+    return wifi_result;
+}
+
+int cyw43_arch_wifi_connect_async(const char* ssid, const char* pw, uint32_t auth) {
+    (void)ssid; (void)pw; (void)auth;
+    join_start(now_us, join_ms + scan_ms, wifi_result);
+    return 0;
+}
+
+//--- With BSSID + channel: no scan, and NONET if the AP is not that one any more
+int cyw43_wifi_join(cyw43_t* self, size_t ssid_len, const uint8_t* ssid, size_t key_len, const uint8_t* key,
+                    uint32_t auth_type, const uint8_t* bssid, uint32_t channel) {
+    (void)self; (void)ssid_len; (void)ssid; (void)key_len; (void)key; (void)auth_type;
+    bool targeted = bssid != nullptr && channel != CYW43_CHANNEL_NONE;
+    bool found    = !targeted || (memcmp(bssid, ap_bssid, sizeof(ap_bssid)) == 0 && channel == ap_channel);
+    join_start(now_us, targeted ? join_ms : join_ms + scan_ms, wifi_result != 0 ? wifi_result : found ? 0 : CYW43_LINK_NONET);
+    return 0;
+}
+
+int cyw43_wifi_get_bssid(cyw43_t* self, uint8_t bssid[6]) {
+    int link = cyw43_tcpip_link_status(self, CYW43_ITF_STA);
+    if (link != CYW43_LINK_NOIP && link != CYW43_LINK_UP) return -1;
+    memcpy(bssid, ap_bssid, sizeof(ap_bssid));
+    return 0;
+}
+
+int cyw43_ioctl(cyw43_t* self, uint32_t cmd, size_t len, uint8_t* buf, uint32_t iface) {
+    (void)iface;
+    int link = cyw43_tcpip_link_status(self, CYW43_ITF_STA);
+    if (cmd != CYW43_IOCTL_GET_CHANNEL || len < 4 || (link != CYW43_LINK_NOIP && link != CYW43_LINK_UP)) return -1;
+    uint32_t channel = ap_channel;      // channel_info_t.hw_channel, little endian like the Pico
+    memcpy(buf, &channel, sizeof(channel));
+    return 0;
+}
+
+//--- DOWN until a join is started, JOIN for the join time, then NOIP for dhcp_ms, then UP
+//--- (the lease is set on the netif). With DHCP stopped, UP as soon as the netif has an address.
+//--- A failing join (host_set_wifi_result, AP moved) reports its failure status after the join time.
+int cyw43_tcpip_link_status(cyw43_t* self, int itf) {
+    (void)self; (void)itf;
+    if (!join_started) return CYW43_LINK_DOWN;
+    uint64_t elapsed_ms = (now_us - join_start_us) / 1000;
+    if (elapsed_ms < join_time_ms) return CYW43_LINK_JOIN;
+    if (join_result != 0)          return join_result;
+    if (!dhcp_running)             return netif_default->ip_addr.addr != 0 ? CYW43_LINK_UP : CYW43_LINK_NOIP;
+    if (now_us < dhcp_from_us + (uint64_t)dhcp_ms * 1000) return CYW43_LINK_NOIP;
+    netif_default->ip_addr.addr = lease_ip;
+    netif_default->netmask.addr = 0x00FFFFFFu;                          // /24
+    netif_default->gw.addr      = (lease_ip & 0x00FFFFFFu) | 0x01000000u; // .1 of it
+    dns_setserver(0, &netif_default->gw);       // the lease names the gateway as DNS server
+    return CYW43_LINK_UP;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP DHCP ─────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+err_t dhcp_start(struct netif* netif) {
+    (void)netif;
+    dhcp_running = true;
+    dhcp_from_us = now_us;
+    return ERR_OK;
+}
+
+void dhcp_stop(struct netif* netif) {
+    dhcp_running        = false;
+    netif->ip_addr.addr = 0;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP DNS ──────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static HostDnsRecord* dns_find(HostDnsRecord* records, const char* name) {
+    for (int i = 0; i < HOST_DNS_RECORDS; i++) {
+        if (records[i].name[0] && strcmp(records[i].name, name) == 0) return &records[i];
+    }
+    return nullptr;
+}
+
+//--- Same name, else a free entry, else the one that expires first
+static HostDnsRecord* dns_slot(HostDnsRecord* records, const char* name) {
+    HostDnsRecord* r = dns_find(records, name);
+    if (r) return r;
+    HostDnsRecord* oldest = &records[0];
+    for (int i = 0; i < HOST_DNS_RECORDS; i++) {
+        if (!records[i].name[0]) return &records[i];
+        if (records[i].expires_us < oldest->expires_us) oldest = &records[i];
+    }
+    return oldest;
+}
+
+err_t dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg) {
+    if (ipaddr_aton(hostname, addr)) return ERR_OK;
+    HostDnsRecord* r = dns_find(dns_table, hostname);
+    if (r && now_us < r->expires_us) {
+        addr->addr = r->ip;
+        return ERR_OK;
+    }
+    if (strlen(hostname) >= sizeof(r->name)) return ERR_ARG;
+    if (dns_query_count >= HOST_DNS_QUERIES) return ERR_MEM;
+    HostDnsQuery& q = dns_queries[dns_query_count++];
+    strcpy(q.name, hostname);
+    q.found   = found;
+    q.arg     = callback_arg;
+    q.sent_us = now_us;
+    return ERR_INPROGRESS;
+}
+
+//--- cyw43_arch_poll(): answers due, from the zone (no DNS server: no answer, lwIP reports a failure)
+static void dns_poll() {
+    HostDnsQuery done[HOST_DNS_QUERIES];
+    bool         answered[HOST_DNS_QUERIES];
+    int n = 0, kept = 0;
+    for (int i = 0; i < dns_query_count; i++) {
+        uint64_t age = now_us - dns_queries[i].sent_us;
+        if (!dns_down && age >= dns_latency_us) {
+            answered[n] = dns_getserver(0)->addr != 0;
+            done[n++]   = dns_queries[i];
+        } else if (age >= (uint64_t)HOST_DNS_GIVE_UP_MS * 1000) {
+            answered[n] = false;
+            done[n++]   = dns_queries[i];
+        } else {
+            dns_queries[kept++] = dns_queries[i];
+        }
+    }
+    dns_query_count = kept;
+    for (int i = 0; i < n; i++) {
+        HostDnsRecord* z = nullptr;
+        if (answered[i]) {
+            dns_query_total++;
+            z = dns_find(dns_zone, done[i].name);
+        }
+        if (!z || z->ip == 0) {
+            if (done[i].found) done[i].found(done[i].name, nullptr, done[i].arg);
+            continue;
+        }
+        HostDnsRecord* t = dns_slot(dns_table, done[i].name);
+        *t = *z;
+        t->expires_us = now_us + (uint64_t)z->ttl_s * 1000000;
+        ip_addr_t addr = { z->ip };
+        if (done[i].found) done[i].found(done[i].name, &addr, done[i].arg);
+    }
+}
+
+static bool broker_down(u32_t ip) {
+    for (u32_t d : brokers_down) {
+        if (d != 0 && d == ip) return true;
+    }
+    return false;
+}
+
+//--- Complete the requests in flight: all of them (broker acks), or only the QoS 0 publishes (sent).
+//--- rtt: acks only for the requests sent at least ack_delay_us ago.
+static void host_complete(bool acked, bool rtt) {
+    //--- Callbacks may queue new requests (discovery -> availability -> subscribe),
+    //--- so only complete the ones in flight when we started.
+    HostRequest done[MQTT_REQ_MAX_IN_FLIGHT];
+    int n = 0, kept = 0;
+    for (int i = 0; i < in_flight_count; i++) {
+        bool due = !rtt || now_us - in_flight[i].sent_us >= ack_delay_us;
+        if ((acked && due) || !in_flight[i].needs_ack) done[n++]        = in_flight[i];
+        else                                           in_flight[kept++] = in_flight[i];
+    }
+    in_flight_count = kept;
+    for (int i = 0; i < n; i++) {
+        stats.completions++;
+        if (done[i].cb) done[i].cb(done[i].arg, request_result);
+    }
+}
+
+void host_ack_all() {
+    host_complete(true, false);
+}
+
+void cyw43_arch_poll(void) {
+    stats.polls++;
+    now_us += poll_cost_us;
+    bool link_up = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) == CYW43_LINK_UP;
+    //--- an address DHCP did not hand out (stale lease): the SYN never gets an answer
+    if (client_g.connect_pending && !(link_up && netif_default->ip_addr.addr != lease_ip)) {
+        //--- no route to the broker without WiFi: the TCP connect times out; broker down: RST
+        mqtt_connection_status_t status = !link_up ? MQTT_CONNECT_TIMEOUT
+                                        : broker_down(client_g.broker_ip) ? MQTT_CONNECT_DISCONNECTED : connect_status;
+        if (status != MQTT_CONNECT_ACCEPTED || tls_handshake(&client_g)) {
+            client_g.connect_pending = false;
+            client_g.connected       = (status == MQTT_CONNECT_ACCEPTED);
+            if (client_g.conn_cb) client_g.conn_cb(&client_g, client_g.conn_arg, status);
+        }
+    }
+    if (client_g.connected) host_complete(auto_ack, true);
+    if (dns_query_count) dns_poll();
+    if (poll_hook) poll_hook(poll_hook_arg);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── pico time ─────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Virtual time, but the thread still gives the CPU away like a real sleep (dual-core mode)
+void            sleep_ms(uint32_t ms)      { now_us += (uint64_t)ms * 1000; std::this_thread::yield(); }
+uint64_t        time_us_64(void)           { return now_us; }
+uint32_t        time_us_32(void)           { return (uint32_t)now_us; }
+absolute_time_t get_absolute_time(void)    { return now_us; }
+
+//───────────────────────────────────────────────────────────────────
+//─── Host control API ──────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+void host_reset() {
+    memset(&client_g, 0, sizeof(client_g));
+    client_used      = false;
+    in_flight_count  = 0;
+    request_limit    = MQTT_REQ_MAX_IN_FLIGHT;
+    memset(&stats, 0, sizeof(stats));
+    memset(&last_publish, 0, sizeof(last_publish));
+    now_us           = 0;
+    wifi_result      = 0;
+    join_ms          = 0;
+    dhcp_ms          = 0;
+    join_started     = false;
+    join_start_us    = 0;
+    join_time_ms     = 0;
+    join_result      = 0;
+    scan_ms          = 0;
+    ap_channel       = 6;
+    ap_bssid[5]      = 0x01;
+    dhcp_running     = true;
+    dhcp_from_us     = 0;
+    lease_ip         = 0x6401A8C0u;
+    netif_default->ip_addr.addr = 0;    // reboot: no address before the lease
+    connect_status   = MQTT_CONNECT_ACCEPTED;
+    auto_ack         = true;
+    request_result   = ERR_OK;
+    poll_cost_us     = 0;
+    ack_delay_us     = 0;
+    poll_hook        = nullptr;
+    poll_hook_arg    = nullptr;
+    publish_hook     = nullptr;
+    publish_hook_arg = nullptr;
+    memset(dns_zone, 0, sizeof(dns_zone));
+    memset(dns_table, 0, sizeof(dns_table));    // lwIP's table is in RAM
+    dns_query_count  = 0;
+    dns_latency_us   = 0;
+    dns_down         = false;
+    dns_query_total  = 0;
+    memset(brokers_down, 0, sizeof(brokers_down));
+    dns_setserver(0, nullptr);
+    tls_full_us      = 0;
+    tls_resumed_us   = 0;
+    tls_resumption   = true;
+}
+
+void host_set_wifi_result(int result)                       { wifi_result = result; }
+void host_set_link_timing(uint32_t join, uint32_t dhcp)     { join_ms = join; dhcp_ms = dhcp; }
+void host_set_scan_ms(uint32_t ms)                          { scan_ms = ms; }
+void host_set_ap(uint8_t channel, uint8_t bssid_last)       { ap_channel = channel; ap_bssid[5] = bssid_last; }
+void host_set_connect_status(mqtt_connection_status_t s)    { connect_status = s; }
+void host_set_auto_ack(bool enabled)                        { auto_ack = enabled; }
+void host_set_request_result(err_t result)                  { request_result = result; }
+void host_set_request_limit(int max) {
+    request_limit = max > 0 && max < MQTT_REQ_MAX_IN_FLIGHT ? max : MQTT_REQ_MAX_IN_FLIGHT;
+}
+void host_set_poll_cost_us(uint32_t us)                     { poll_cost_us = us; }
+void host_set_ack_delay_ms(uint32_t ms)                     { ack_delay_us = ms * 1000; }
+void host_set_poll_hook(void (*hook)(void*), void* arg)     { poll_hook = hook; poll_hook_arg = arg; }
+void host_advance_us(uint64_t us)                           { now_us += us; }
+void host_set_tls_cost(uint32_t full_ms, uint32_t resumed_ms) { tls_full_us = full_ms * 1000; tls_resumed_us = resumed_ms * 1000; }
+void host_set_tls_resumption(bool enabled)                  { tls_resumption = enabled; }
+void host_tls_new_keys()                                    { tls_keys++; }
+int  host_in_flight()                                       { return in_flight_count; }
+const HostStats&   host_stats()                             { return stats; }
+const HostPublish& host_last_publish()                      { return last_publish; }
+
+void host_set_publish_hook(void (*hook)(const HostPublish*, void*), void* arg) {
+    publish_hook     = hook;
+    publish_hook_arg = arg;
+}
+
+void host_drop_connection() {
+    if (!client_g.connected) return;
+    //--- lwIP frees pending requests without calling them, then reports the disconnect
+    mqtt_disconnect(&client_g);
+    if (client_g.conn_cb) client_g.conn_cb(&client_g, client_g.conn_arg, MQTT_CONNECT_DISCONNECTED);
+}
+
+void host_set_dhcp_lease(const char* ip) {
+    ip_addr_t addr;
+    if (ipaddr_aton(ip, &addr)) lease_ip = addr.addr;
+}
+
+void host_dns_set(const char* name, const char* ip, uint32_t ttl_s) {
+    ip_addr_t addr = {};
+    if (strlen(name) >= sizeof(dns_zone[0].name) || (ip && !ipaddr_aton(ip, &addr))) return;
+    HostDnsRecord* z = dns_slot(dns_zone, name);
+    strcpy(z->name, name);
+    z->ip    = addr.addr;
+    z->ttl_s = ttl_s;
+}
+
+void host_set_dns_latency_ms(uint32_t ms)   { dns_latency_us = ms * 1000; }
+void host_set_dns_down(bool down)           { dns_down = down; }
+uint32_t host_dns_queries()                 { return dns_query_total; }
+
+void host_set_broker_down(const char* ip, bool down) {
+    ip_addr_t addr;
+    if (!ipaddr_aton(ip, &addr)) return;
+    for (u32_t& d : brokers_down) {
+        if (d == addr.addr) d = 0;
+    }
+    if (!down) return;
+    for (u32_t& d : brokers_down) {
+        if (d == 0) { d = addr.addr; break; }
+    }
+    if (client_g.broker_ip == addr.addr) host_drop_connection();    // nothing if not connected
+}
+
+void host_drop_wifi() {
+    join_started = false;
+    host_drop_connection();
+}
+
+void host_deliver(const char* topic, const void* payload, size_t len, u16_t fragment) {
+    if (!client_g.connected || !client_g.pub_cb) return;
+    client_g.pub_cb(client_g.inpub_arg, topic, (u32_t)len);
+    if (!client_g.data_cb) return;
+    if (fragment == 0) fragment = 0xffff;
+    const u8_t* p = (const u8_t*)payload;
+    size_t off = 0;
+    do {
+        size_t n = len - off < fragment ? len - off : fragment;
+        u8_t flags = (off + n == len) ? MQTT_DATA_FLAG_LAST : 0;
+        client_g.data_cb(client_g.inpub_arg, p + off, (u16_t)n, flags);
+        off += n;
+    } while (off < len);
+}
@@ -0,0 +1,338 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Host (Linux) stand-in for the Pico SDK + lwIP MQTT app ────────
+//───────────────────────────────────────────────────────────────────
+// Only the subset used by mqtt_ha.cpp is declared here, with the same
+// names and signatures as pico-sdk / lwIP 2.1, so the library compiles
+// unchanged with -DMQTT_HA_HOST.
+//
+// Behaviour of the fake:
+//  - mqtt_publish() / mqtt_subscribe() are recorded and queued as
+//    "in flight" requests, limited to MQTT_REQ_MAX_IN_FLIGHT like lwIP
+//    (ERR_MEM is returned when the window is full).
+//  - a PUBLISH larger than MQTT_OUTPUT_RINGBUF_SIZE is refused with ERR_MEM.
+//  - cyw43_arch_poll() fires the pending callbacks: connection result,
+//    then the completion of every queued request (PUBACK / SUBACK).
+//    QoS 0 publishes complete on the next poll even when acks are held
+//    (host_set_auto_ack(false)): lwIP frees them once sent, no PUBACK.
+//  - one AP: a join takes join_ms, plus scan_ms without its BSSID + channel,
+//    then DHCP dhcp_ms; an address set by hand (dhcp_stop() + netif_set_addr())
+//    is UP as soon as the join is done.
+//  - DNS: a stub zone (host_dns_set()) served by the DNS server of the lease
+//    (the gateway) after dns_latency_ms; answers are kept for their TTL like
+//    lwIP's table. Brokers are told apart by address: host_set_broker_down().
+//  - TLS (ci.tls_config): the handshake takes 2 round trips (1 resumed) of
+//    host_set_ack_delay_ms(), then its CPU time (host_set_tls_cost()) inside
+//    the cyw43_arch_poll() that completes it, like mbedTLS in the lwIP callbacks.
+//    The broker resumes a session it issued with its current ticket keys.
+//  - sleep_ms() does not sleep, it advances a virtual clock (and yields the CPU).
+//  - multicore_launch_core1() starts a thread (dual-core mode of the library).
+//  - the flash is a RAM image kept across host_reset() (a reboot), optionally
+//    mirrored to a file (host_set_flash_file()).
+//  - host_*() functions drive the fake from a bench or a harness.
+// host_net.cpp implements the same declarations over a real TCP socket
+// (host_net.h), host_common.cpp holds the parts shared by both.
+#include <stddef.h>
+#include <stdint.h>
+
+//─── lwIP base types ───────────────────────────────────────────────
+typedef uint8_t  u8_t;
+typedef uint16_t u16_t;
+typedef uint32_t u32_t;
+typedef int8_t   err_t;
+
+enum {
+    ERR_OK         = 0,
+    ERR_MEM        = -1,
+    ERR_BUF        = -2,
+    ERR_TIMEOUT    = -3,
+    ERR_RTE        = -4,
+    ERR_INPROGRESS = -5,
+    ERR_VAL        = -6,
+    ERR_WOULDBLOCK = -7,
+    ERR_USE        = -8,
+    ERR_ALREADY    = -9,
+    ERR_ISCONN     = -10,
+    ERR_CONN       = -11,
+    ERR_IF         = -12,
+    ERR_ABRT       = -13,
+    ERR_RST        = -14,
+    ERR_CLSD       = -15,
+    ERR_ARG        = -16,
+};
+
+//─── lwIP IP address / netif ───────────────────────────────────────
+typedef struct ip4_addr { u32_t addr; } ip4_addr_t;
+typedef ip4_addr_t ip_addr_t;
+
+struct netif {
+    ip4_addr_t ip_addr;
+    ip4_addr_t netmask;
+    ip4_addr_t gw;
+};
+extern struct netif* netif_default;
+#define netif_ip4_addr(netif)    ((const ip4_addr_t*)&((netif)->ip_addr))
+#define netif_ip4_netmask(netif) ((const ip4_addr_t*)&((netif)->netmask))
+#define netif_ip4_gw(netif)      ((const ip4_addr_t*)&((netif)->gw))
+#define ip_2_ip4(ipaddr)         (ipaddr)
+
+void  netif_set_addr(struct netif* netif, const ip4_addr_t* ipaddr, const ip4_addr_t* netmask, const ip4_addr_t* gw);
+err_t dhcp_start(struct netif* netif);
+void  dhcp_stop(struct netif* netif);
+
+int   ipaddr_aton(const char* cp, ip_addr_t* addr);
+char* ipaddr_ntoa_r(const ip_addr_t* addr, char* buf, int buflen);
+#define IPADDR4_INIT(u32val)     { u32val }
+
+//─── lwIP DNS (lwip/dns.h) ─────────────────────────────────────────
+typedef void (*dns_found_callback)(const char* name, const ip_addr_t* ipaddr, void* callback_arg);
+
+void             dns_setserver(u8_t numdns, const ip_addr_t* dnsserver);
+const ip_addr_t* dns_getserver(u8_t numdns);
+//--- ERR_OK: literal or in the table (TTL not expired), *addr set. ERR_INPROGRESS: found() from cyw43_arch_poll()
+err_t            dns_gethostbyname(const char* hostname, ip_addr_t* addr, dns_found_callback found, void* callback_arg);
+
+//─── lwIP MQTT app (lwip/apps/mqtt.h) ──────────────────────────────
+#ifndef MQTT_REQ_MAX_IN_FLIGHT
+#define MQTT_REQ_MAX_IN_FLIGHT 4
+#endif
+//--- lwIP default is 256, too small for the HA discovery message:
+//--- the firmware's lwipopts.h has to raise it the same way.
+#ifndef MQTT_OUTPUT_RINGBUF_SIZE
+#define MQTT_OUTPUT_RINGBUF_SIZE 2048
+#endif
+
+typedef struct mqtt_client_s mqtt_client_t;
+
+typedef enum {
+    MQTT_CONNECT_ACCEPTED                 = 0,
+    MQTT_CONNECT_REFUSED_PROTOCOL_VERSION = 1,
+    MQTT_CONNECT_REFUSED_IDENTIFIER       = 2,
+    MQTT_CONNECT_REFUSED_SERVER           = 3,
+    MQTT_CONNECT_REFUSED_USERNAME_PASS    = 4,
+    MQTT_CONNECT_REFUSED_NOT_AUTHORIZED_  = 5,
+    MQTT_CONNECT_DISCONNECTED             = 256,
+    MQTT_CONNECT_TIMEOUT                  = 257
+} mqtt_connection_status_t;
+
+enum { MQTT_DATA_FLAG_LAST = 1 };
+
+struct altcp_tls_config;
+
+struct mqtt_connect_client_info_t {
+    const char* client_id;
+    const char* client_user;
+    const char* client_pass;
+    u16_t       keep_alive;
+    const char* will_topic;
+    const char* will_msg;
+    u8_t        will_qos;
+    u8_t        will_retain;
+    struct altcp_tls_config* tls_config;
+};
+
+typedef void (*mqtt_connection_cb_t)(mqtt_client_t* client, void* arg, mqtt_connection_status_t status);
+typedef void (*mqtt_request_cb_t)(void* arg, err_t err);
+typedef void (*mqtt_incoming_publish_cb_t)(void* arg, const char* topic, u32_t tot_len);
+typedef void (*mqtt_incoming_data_cb_t)(void* arg, const u8_t* data, u16_t len, u8_t flags);
+
+mqtt_client_t* mqtt_client_new(void);
+void  mqtt_client_free(mqtt_client_t* client);
+err_t mqtt_client_connect(mqtt_client_t* client, const ip_addr_t* ipaddr, u16_t port,
+                          mqtt_connection_cb_t cb, void* arg,
+                          const struct mqtt_connect_client_info_t* client_info);
+void  mqtt_disconnect(mqtt_client_t* client);
+u8_t  mqtt_client_is_connected(mqtt_client_t* client);
+void  mqtt_set_inpub_callback(mqtt_client_t* client, mqtt_incoming_publish_cb_t pub_cb,
+                              mqtt_incoming_data_cb_t data_cb, void* arg);
+err_t mqtt_sub_unsub(mqtt_client_t* client, const char* topic, u8_t qos,
+                     mqtt_request_cb_t cb, void* arg, u8_t sub);
+err_t mqtt_publish(mqtt_client_t* client, const char* topic, const void* payload, u16_t payload_length,
+                   u8_t qos, u8_t retain, mqtt_request_cb_t cb, void* arg);
+
+#define mqtt_subscribe(client, topic, qos, cb, arg)  mqtt_sub_unsub(client, topic, qos, cb, arg, 1)
+#define mqtt_unsubscribe(client, topic, cb, arg)     mqtt_sub_unsub(client, topic, 0, cb, arg, 0)
+
+//─── lwIP altcp + pbuf (lwip/altcp.h, altcp_tcp.h, pbuf.h) ─────────
+//--- Only the built-in MQTT client (mqtt_ha_mqtt.cpp, MQTT_HA_MQTT_BUILTIN) uses them:
+//--- host_net.cpp implements them over a socket, the fake does not.
+#ifndef TCP_MSS
+#define TCP_MSS                  1460
+#endif
+#ifndef TCP_SND_BUF
+#define TCP_SND_BUF              (8 * TCP_MSS)          // pico-examples lwipopts.h
+#endif
+#ifndef TCP_SND_QUEUELEN
+#define TCP_SND_QUEUELEN         ((4 * TCP_SND_BUF + TCP_MSS - 1) / TCP_MSS)
+#endif
+#define TCP_WRITE_FLAG_COPY      0x01
+#define TCP_WRITE_FLAG_MORE      0x02
+#define IPADDR_TYPE_ANY          46
+
+struct altcp_pcb;
+struct pbuf {
+    struct pbuf* next;
+    void*        payload;
+    u16_t        tot_len;
+    u16_t        len;
+};
+
+typedef err_t (*altcp_connected_fn)(void* arg, struct altcp_pcb* conn, err_t err);
+typedef err_t (*altcp_recv_fn)(void* arg, struct altcp_pcb* conn, struct pbuf* p, err_t err);
+typedef err_t (*altcp_sent_fn)(void* arg, struct altcp_pcb* conn, u16_t len);
+typedef err_t (*altcp_poll_fn)(void* arg, struct altcp_pcb* conn);
+typedef void  (*altcp_err_fn)(void* arg, err_t err);
+
+struct altcp_pcb* altcp_tcp_new_ip_type(u8_t ip_type);
+void  altcp_arg(struct altcp_pcb* conn, void* arg);
+void  altcp_recv(struct altcp_pcb* conn, altcp_recv_fn recv);
+void  altcp_sent(struct altcp_pcb* conn, altcp_sent_fn sent);
+void  altcp_poll(struct altcp_pcb* conn, altcp_poll_fn poll, u8_t interval);   // interval: 500 ms ticks
+void  altcp_err(struct altcp_pcb* conn, altcp_err_fn err);
+void  altcp_recved(struct altcp_pcb* conn, u16_t len);
+err_t altcp_connect(struct altcp_pcb* conn, const ip_addr_t* ipaddr, u16_t port, altcp_connected_fn connected);
+err_t altcp_close(struct altcp_pcb* conn);
+void  altcp_abort(struct altcp_pcb* conn);
+err_t altcp_write(struct altcp_pcb* conn, const void* dataptr, u16_t len, u8_t apiflags);
+err_t altcp_output(struct altcp_pcb* conn);
+u16_t altcp_sndbuf(struct altcp_pcb* conn);
+u16_t altcp_sndqueuelen(struct altcp_pcb* conn);
+u8_t  pbuf_free(struct pbuf* p);
+
+//─── lwIP altcp TLS (lwip/altcp_tls.h) ─────────────────────────────
+//--- The mqtt_ha_tls_*() glue is inline in mqtt_ha_platform.h on the Pico (mbedTLS),
+//--- the fake and host_net.cpp (OpenSSL) implement it.
+struct altcp_tls_session;
+
+struct altcp_tls_config*  altcp_tls_create_config_client(const u8_t* cert, size_t cert_len);
+struct altcp_pcb*         altcp_tls_new(struct altcp_tls_config* config, u8_t ip_type);
+struct altcp_tls_session* altcp_tls_alloc_session(void);
+err_t    mqtt_ha_tls_start(mqtt_client_t* client, const char* host, struct altcp_tls_session* session,
+                           const uint8_t* saved, size_t saved_len);
+err_t    mqtt_ha_tls_session_get(mqtt_client_t* client, struct altcp_tls_session* session);
+uint32_t mqtt_ha_tls_fingerprint(mqtt_client_t* client);
+size_t   mqtt_ha_tls_session_save(mqtt_client_t* client, uint8_t* buf, size_t len);
+
+//─── pico/cyw43_arch.h ─────────────────────────────────────────────
+#define CYW43_AUTH_OPEN          0
+#define CYW43_AUTH_WPA2_AES_PSK  0x00400004
+
+#define CYW43_ITF_STA            0
+
+#define CYW43_LINK_DOWN          (0)
+#define CYW43_LINK_JOIN          (1)
+#define CYW43_LINK_NOIP          (2)
+#define CYW43_LINK_UP            (3)
+#define CYW43_LINK_FAIL          (-1)
+#define CYW43_LINK_NONET         (-2)
+#define CYW43_LINK_BADAUTH       (-3)
+
+typedef struct _cyw43_t { int unused; } cyw43_t;
+extern cyw43_t cyw43_state;
+
+int  cyw43_arch_init(void);
+void cyw43_arch_deinit(void);
+void cyw43_arch_enable_sta_mode(void);
+int  cyw43_arch_wifi_connect_timeout_ms(const char* ssid, const char* pw, uint32_t auth, uint32_t timeout_ms);
+int  cyw43_arch_wifi_connect_async(const char* ssid, const char* pw, uint32_t auth);
+int  cyw43_tcpip_link_status(cyw43_t* self, int itf);
+void cyw43_arch_poll(void);
+//--- cyw43.h (driver)
+#define CYW43_CHANNEL_NONE       (0xffffffffu)
+#define CYW43_IOCTL_GET_CHANNEL  (0x3a)
+int  cyw43_wifi_join(cyw43_t* self, size_t ssid_len, const uint8_t* ssid, size_t key_len, const uint8_t* key,
+                     uint32_t auth_type, const uint8_t* bssid, uint32_t channel);
+int  cyw43_wifi_get_bssid(cyw43_t* self, uint8_t bssid[6]);
+int  cyw43_ioctl(cyw43_t* self, uint32_t cmd, size_t len, uint8_t* buf, uint32_t iface);   // CYW43_IOCTL_GET_CHANNEL only
+
+//─── pico/multicore.h ──────────────────────────────────────────────
+//--- core 1 is a std::thread: the library's network loop (MQTT_HA_DUAL_CORE)
+void multicore_launch_core1(void (*entry)(void));
+void multicore_reset_core1(void);                       // waits for the entry function to return
+uint32_t get_core_num(void);                            // 1 on the core 1 thread, 0 elsewhere
+void tight_loop_contents(void);                          // yields: both "cores" may share one CPU
+//--- Stack bottom of the pico linker script: none here, MQTT_HA_STACK_WATCH bytes are painted
+static inline const void* mqtt_ha_stack_limit() { return nullptr; }
+
+//─── hardware/flash.h + pico/flash.h ───────────────────────────────
+#define PICO_OK                 0
+#define PICO_FLASH_SIZE_BYTES   (2 * 1024 * 1024)
+#define FLASH_SECTOR_SIZE       4096u
+#define FLASH_PAGE_SIZE         256u
+uintptr_t host_flash_base(void);
+#define XIP_BASE                host_flash_base()      // flash is read through the XIP window
+
+void flash_range_erase(uint32_t flash_offs, size_t count);
+void flash_range_program(uint32_t flash_offs, const uint8_t* data, size_t count);
+int  flash_safe_execute(void (*func)(void*), void* param, uint32_t enter_exit_timeout_ms);
+bool flash_safe_execute_core_init(void);
+
+//─── pico/stdlib.h (time) ──────────────────────────────────────────
+typedef uint64_t absolute_time_t;
+
+void            sleep_ms(uint32_t ms);
+uint64_t        time_us_64(void);
+uint32_t        time_us_32(void);
+absolute_time_t get_absolute_time(void);
+static inline uint32_t to_ms_since_boot(absolute_time_t t) { return (uint32_t)(t / 1000); }
+
+//───────────────────────────────────────────────────────────────────
+//─── Host control API (harness / benches only) ─────────────────────
+//───────────────────────────────────────────────────────────────────
+struct HostStats {
+    uint32_t connects;          // mqtt_client_connect() calls
+    uint32_t publishes;         // accepted mqtt_publish() calls
+    uint32_t publish_rejected;  // mqtt_publish() refused (ERR_MEM / ERR_CONN)
+    uint32_t subscribes;        // accepted mqtt_subscribe() calls
+    uint32_t polls;             // cyw43_arch_poll() calls
+    uint32_t completions;       // request callbacks fired
+    uint64_t payload_bytes;     // sum of published payload lengths
+    uint64_t wire_bytes;        // MQTT PUBLISH packet bytes (fixed header + topic + id + payload)
+    uint32_t tls_full;          // TLS handshakes without resumption
+    uint32_t tls_resumed;       // ... that resumed a session
+};
+
+//--- Last published message, kept in fixed buffers (no allocation in the hot path)
+struct HostPublish {
+    char  topic[256];
+    char  payload[4096];
+    u16_t len;
+    u8_t  qos;
+    u8_t  retain;
+};
+
+void host_reset();                                      // forget everything, new clean broker
+void host_set_wifi_result(int result);                  // 0 = join succeeds, else a CYW43_LINK_xxx failure status
+void host_set_link_timing(uint32_t join_ms, uint32_t dhcp_ms); // virtual time to join the AP, then to get a DHCP lease
+void host_drop_wifi();                                  // AP lost: link goes down and the MQTT session with it
+void host_set_scan_ms(uint32_t ms);                     // extra join time without BSSID + channel (full scan)
+void host_set_ap(uint8_t channel, uint8_t bssid_last);  // the AP moved: targeted joins to the old one fail (NONET)
+void host_set_dhcp_lease(const char* ip);               // address DHCP hands out; any other one gets no answer from the broker
+void host_dns_set(const char* name, const char* ip, uint32_t ttl_s); // stub zone record, ip nullptr: no such name (NXDOMAIN)
+void host_set_dns_latency_ms(uint32_t ms);              // query -> answer
+void host_set_dns_down(bool down);                      // queries get no answer at all
+void host_set_broker_down(const char* ip, bool down);   // connects to ip refused, its session (if any) dropped
+uint32_t host_dns_queries();                            // queries that reached the DNS server
+void host_set_connect_status(mqtt_connection_status_t); // status delivered on next poll after connect
+void host_set_auto_ack(bool enabled);                   // false: requests (but QoS 0 publishes) stay in flight until host_ack_all()
+void host_set_request_result(err_t result);             // result passed to request callbacks
+void host_set_request_limit(int max);                   // lwIP request slots left to the library (0: MQTT_REQ_MAX_IN_FLIGHT), beyond: ERR_MEM
+void host_set_poll_cost_us(uint32_t us);                // virtual time spent in each cyw43_arch_poll() (busy radio)
+void host_set_ack_delay_ms(uint32_t ms);                // broker round trip: acks come on the first poll ms after the request
+void host_set_poll_hook(void (*hook)(void* arg), void* arg); // called at the end of each cyw43_arch_poll(), lwIP thread
+void host_set_publish_hook(void (*hook)(const HostPublish* msg, void* arg), void* arg);
+void host_ack_all();                                    // complete every in-flight request now
+void host_drop_connection();                            // broker / WiFi lost: fires MQTT_CONNECT_DISCONNECTED
+void host_deliver(const char* topic, const void* payload, size_t len,
+                  u16_t fragment = 0);                  // incoming PUBLISH, split into fragments (0 = one piece)
+void host_advance_us(uint64_t us);                      // move the virtual clock forward
+int  host_in_flight();
+void host_set_tls_cost(uint32_t full_ms, uint32_t resumed_ms); // handshake CPU time (ECDHE + certificates / key derivation only)
+void host_set_tls_resumption(bool enabled);             // false: the broker never resumes a session
+void host_tls_new_keys();                               // broker restarted: its earlier sessions are unknown (kept across host_reset())
+void host_set_flash_file(const char* path);             // load the flash image from path, write it back on every change (nullptr: RAM only)
+void host_erase_flash();                                // blank chip
+uint32_t host_flash_erases();                           // sector erases since start
+uint32_t host_flash_programs();                         // page programs since start
+const HostStats&   host_stats();
+const HostPublish& host_last_publish();
@@ -0,0 +1,34 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Host tests ────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Correctness checks of the real mqtt_ha.cpp against the fake lwIP of
+// host_platform.cpp: one suite per ctest test (mqtt_ha_test <suite>).
+// The built-in MQTT client has its own binary (mqtt_ha_test_mqtt, suite
+// mqtt) over a scripted altcp in place of the library.
+// A failed TEST_CHECK prints its location and the suite fails; the
+// benchmarks (host/bench) only time the same paths.
+#include <stdint.h>
+#include <stdio.h>
+#include "mqtt_ha_platform.h"
+
+extern uint32_t test_checks;
+extern uint32_t test_failures;
+
+//--- Failures are printed (up to a few per suite), every one is counted
+bool test_report_failure(const char* file, int line);
+
+#define TEST_CHECK(cond, ...)                                           \
+    do {                                                                \
+        test_checks++;                                                  \
+        if (!(cond) && test_report_failure(__FILE__, __LINE__)) {       \
+            printf("    " __VA_ARGS__);                                 \
+            printf("\n");                                               \
+        }                                                               \
+    } while (0)
+
+//--- wifi_mqtt_init() against a new fake broker, counters at zero, polls until ONLINE with nothing in flight.
+//--- hook: sees every publish of the session, discovery included (host_reset() clears it)
+void test_session_up(void (*hook)(const HostPublish* msg, void* arg) = nullptr);
+//--- Poll until nothing is left in flight (acks every pending request)
+void test_drain();
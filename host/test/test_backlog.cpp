@@ -0,0 +1,72 @@
+//───────────────────────────────────────────────────────────────────
+//─── Offline backlog tests ─────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Samples stored while offline are all replayed, even when the
+// connection drops again while replays wait for their PUBACK: a sample
+// only leaves the backlog once the broker acknowledged it.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define TEST_SAMPLES 60
+
+static uint8_t  seen[TEST_SAMPLES];     // replays received per sample (eco2 = sample number)
+static uint32_t replays = 0;
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "pico_env_sensor/state/replay") != 0) return;
+    const char* eco2 = strstr(msg->payload, "\"eco2\":");
+    if (eco2 == nullptr) return;
+    int i = atoi(eco2 + 7) - 400;
+    if (i >= 0 && i < TEST_SAMPLES) seen[i]++;
+    replays++;
+}
+
+//--- Poll (virtual time running) until the library sent `count` replays, or it gave up
+static void poll_until_replays(uint32_t count) {
+    for (int i = 0; i < 100000 && replays < count; i++) {
+        host_advance_us(1000);
+        mqtt_poll();
+    }
+}
+
+void test_backlog() {
+    test_session_up();
+    memset(seen, 0, sizeof(seen));
+    replays = 0;
+    host_set_publish_hook(on_publish, nullptr);
+    MqttHaBacklogStats before = mqtt_ha_backlog_stats();
+
+    host_drop_connection();
+    for (int i = 0; i < TEST_SAMPLES; i++) {
+        host_advance_us(1000000);
+        mqtt_ha_publish_state(20.0, 50.0, (uint16_t)(400 + i), 0, 1);
+    }
+    TEST_CHECK(mqtt_ha_backlog_stats().pending == TEST_SAMPLES, "%u samples stored", mqtt_ha_backlog_stats().pending);
+
+    //--- Broker round trip: replays are accepted by lwIP, then the link drops before their PUBACK
+    host_set_ack_delay_ms(50);
+    poll_until_replays(3);
+    TEST_CHECK(replays >= 3, "replay did not start (%u)", replays);
+    TEST_CHECK(host_in_flight() > 0, "nothing waiting for a PUBACK when the link drops");
+    uint32_t acked = mqtt_ha_backlog_stats().replayed - before.replayed;
+    host_drop_connection();
+    TEST_CHECK(mqtt_ha_backlog_stats().pending == TEST_SAMPLES - acked,
+               "%u pending after the drop, %u acknowledged", mqtt_ha_backlog_stats().pending, acked);
+
+    //--- Reconnect and drain everything
+    host_set_ack_delay_ms(0);
+    for (int i = 0; i < 1000000 && (mqtt_ha_backlog_stats().pending > 0 || host_in_flight() > 0); i++) {
+        host_advance_us(1000);
+        mqtt_poll();
+    }
+    MqttHaBacklogStats st = mqtt_ha_backlog_stats();
+    TEST_CHECK(st.pending == 0, "%u samples left", st.pending);
+    TEST_CHECK(st.replayed - before.replayed == TEST_SAMPLES, "%u replays acknowledged", st.replayed - before.replayed);
+    for (int i = 0; i < TEST_SAMPLES; i++) {
+        TEST_CHECK(seen[i] >= 1, "sample %d never replayed", i);
+    }
+    host_set_publish_hook(nullptr, nullptr);
+}
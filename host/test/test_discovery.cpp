@@ -0,0 +1,73 @@
+//───────────────────────────────────────────────────────────────────
+//─── Discovery tests ───────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// The compile-time payload of the built-in table must hold the same
+// bytes as the runtime builder given the same channels. A channel whose
+// component cannot fit a discovery message is refused at registration.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string>
+#include <string.h>
+
+static std::string config;      // last homeassistant/sensor/pico_env_sensor/config payload
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "homeassistant/sensor/pico_env_sensor/config") != 0) return;
+    config.assign(msg->payload, msg->len);
+}
+
+//--- Same channels as the built-in table, at another address: built at runtime
+static const MqttHaChannel builtin_copy[] = {
+    {"temperature", "temp",   nullptr,   "°C",     "temperature",                         1,           MQTT_HA_I16 },
+    {"humidity",    "hum",    nullptr,   "%",      "humidity",                            1,           MQTT_HA_U16 },
+    {"eco2",        "eco2",   nullptr,   "ppm",    "carbon_dioxide",                      0,           MQTT_HA_U16 },
+    {"tvoc",        "tvoc",   nullptr,   "ppb",    "volatile_organic_compounds_parts",    0,           MQTT_HA_U16 },
+    {"aqi",         "aqi",    nullptr,   "",       "aqi",                                 0,           MQTT_HA_U8  },
+};
+
+//--- Full discovery of the current table: @return its first chunk
+static std::string discovery_payload() {
+    config.clear();
+    mqtt_ha_discovery_invalidate();
+    test_session_up(on_publish);
+    return config;
+}
+
+static void test_builtin() {
+    mqtt_ha_register_channels(nullptr, 0);
+    std::string compiled = discovery_payload();
+    TEST_CHECK(!compiled.empty(), "built-in discovery not published");
+    TEST_CHECK(compiled.front() == '{' && compiled.back() == '}', "%s", compiled.c_str());
+
+    mqtt_ha_register_channels(builtin_copy, 5);
+    std::string runtime = discovery_payload();
+    TEST_CHECK(compiled == runtime, "compile time:\n%s\n    runtime:\n%s", compiled.c_str(), runtime.c_str());
+
+    mqtt_ha_register_channels(nullptr, 0);
+    host_set_publish_hook(nullptr, nullptr);
+}
+
+static char long_name[1024];
+
+static void test_too_large() {
+    memset(long_name, 'n', sizeof(long_name) - 1);
+    static const MqttHaChannel table[] = {
+        { "ok",    "ok",    nullptr,   "", nullptr, 0, MQTT_HA_U8 },
+        { "large", "large", long_name, "", nullptr, 0, MQTT_HA_U8 },
+    };
+    TEST_CHECK(mqtt_ha_register_channels(table, 1), "small channel refused");
+    TEST_CHECK(!mqtt_ha_register_channels(table, 2), "channel larger than DISCOVERY_CHUNK_MAX accepted");
+
+    static const MqttHaChannel device_channels[] = {
+        { "large", "large", long_name, "", nullptr, 0, MQTT_HA_U8 },
+    };
+    static const MqttHaDevice device = { "test_node", "Test node", nullptr, device_channels, 1 };
+    TEST_CHECK(mqtt_ha_add_device(&device) < 0, "device channel larger than DISCOVERY_CHUNK_MAX accepted");
+    mqtt_ha_register_channels(nullptr, 0);
+}
+
+void test_discovery() {
+    test_builtin();
+    test_too_large();
+}
@@ -0,0 +1,114 @@
+//───────────────────────────────────────────────────────────────────
+//─── State serializer tests ────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// The state payload published by mqtt_ha_publish_state() must hold the
+// same bytes as the former snprintf("%.1f") path, and json_round_scaled()
+// + JsonWriter::fixed() must round like printf (ties to even).
+// One documented difference: values are scaled integers, so a negative
+// value rounding to zero is written "0.0" where printf wrote "-0.0".
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_json.h"
+#include "mqtt_ha_platform.h"
+#include <random>
+#include <string.h>
+
+static HostPublish last_state;
+static uint32_t    states = 0;
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "pico_env_sensor/state") != 0) return;
+    last_state = *msg;
+    states++;
+}
+
+//--- printf("%.<decimals>f", v), with "-0.0" written "0.0" like the scaled values
+static void printf_fixed(char* buf, size_t size, double v, uint8_t decimals) {
+    snprintf(buf, size, "%.*f", decimals, v);
+    bool zero = true;
+    for (const char* p = buf + 1; *p; p++) {
+        if (*p != '0' && *p != '.') zero = false;
+    }
+    if (buf[0] == '-' && zero) memmove(buf, buf + 1, strlen(buf));
+}
+
+//--- The state payload exactly as mqtt_ha_publish_state() built it before JsonWriter
+static void state_snprintf(char* buf, size_t size, double t, double h, uint16_t eco2, uint16_t tvoc, uint8_t aqi) {
+    char ts[32], hs[32];
+    printf_fixed(ts, sizeof(ts), t, 1);
+    printf_fixed(hs, sizeof(hs), h, 1);
+    snprintf(buf, size, "{\"temperature\":%s,\"humidity\":%s,\"eco2\":%u,\"tvoc\":%u,\"aqi\":%u}",
+             ts, hs, eco2, tvoc, aqi);
+}
+
+static void test_state_payload() {
+    test_session_up();
+    host_set_publish_hook(on_publish, nullptr);
+
+    std::mt19937_64 rng(12345);
+    std::uniform_real_distribution<double> temp(-40.0, 125.0);
+    std::uniform_real_distribution<double> hum(0.0, 100.0);
+    //--- Ties, x.x5 decimals and the values around zero first, then random readings
+    const double corners[] = { 0.0, -0.0, 0.05, -0.05, 0.25, -0.25, 0.75, -0.04, 21.45, 21.55, -12.35, 124.95 };
+    char expected[256];
+    for (uint32_t i = 0; i < 20000; i++) {
+        double   t    = i < sizeof(corners) / sizeof(corners[0]) ? corners[i] : temp(rng);
+        double   h    = hum(rng);
+        uint16_t eco2 = (uint16_t)rng();
+        uint16_t tvoc = (uint16_t)rng();
+        uint8_t  aqi  = (uint8_t)rng();
+        uint32_t before = states;
+        mqtt_ha_publish_state(t, h, eco2, tvoc, aqi);
+        test_drain();
+        state_snprintf(expected, sizeof(expected), t, h, eco2, tvoc, aqi);
+        TEST_CHECK(states == before + 1, "state %u not published", i);
+        TEST_CHECK(last_state.len == strlen(expected) && memcmp(last_state.payload, expected, last_state.len) == 0,
+                   "state %u: %.*s, expected %s", i, (int)last_state.len, last_state.payload, expected);
+    }
+    host_set_publish_hook(nullptr, nullptr);
+}
+
+//--- json_round_scaled() + fixed() against printf on one value, for 0..3 decimals
+static void check_fixed(double v) {
+    for (uint8_t d = 0; d <= 3; d++) {
+        uint64_t mag;
+        bool     neg;
+        bool     ok = json_round_scaled(v, d, &mag, &neg);
+        if (!ok) {
+            TEST_CHECK(v != v || v >= 4503599627370496.0 || v <= -4503599627370496.0,
+                       "json_round_scaled(%.17g, %u) refused", v, d);
+            continue;
+        }
+        if (mag > INT32_MAX) continue;      // not a scaled channel value
+        char a[512], b[64];
+        printf_fixed(a, sizeof(a), v, d);
+        JsonWriter w(b, sizeof(b));
+        w.fixed(neg ? -(int32_t)mag : (int32_t)mag, d);
+        TEST_CHECK(strcmp(a, b) == 0, "%.17g, %u decimals: %s, printf %s", v, d, b, a);
+    }
+}
+
+static void test_rounding() {
+    for (int k = -4000; k <= 4000; k++) {
+        const double vals[] = { k * 0.25, k * 0.05, k * 0.01, k * 0.005, k + 0.05, k + 0.95, k * 1e-3, k * 1e-4, k * 1e5 };
+        for (double v : vals) check_fixed(v);
+    }
+    const double specials[] = { 0.0, -0.0, 0.05, -0.05, 0.04999999999999999, 0.0005, 1e-300, -1e-300,
+                                214748364.75, -214748364.85, 4503599627370495.5, 4503599627370496.0, 1e300 };
+    for (double v : specials) check_fixed(v);
+
+    std::mt19937_64 rng(2024);
+    for (uint32_t i = 0; i < 1000000; i++) {
+        uint64_t bits = rng();
+        double v;
+        memcpy(&v, &bits, sizeof(v));
+        check_fixed(v);
+    }
+    std::uniform_real_distribution<double> sensor(-100000.0, 100000.0);
+    for (uint32_t i = 0; i < 1000000; i++) check_fixed(sensor(rng));
+}
+
+void test_json() {
+    test_state_payload();
+    test_rounding();
+}
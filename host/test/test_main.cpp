@@ -0,0 +1,96 @@
+//───────────────────────────────────────────────────────────────────
+//─── mqtt_ha host tests ────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Usage: mqtt_ha_test [suite...]   (no argument: run every suite)
+// Exit status 1 when a check failed: ctest runs one suite per test.
+// mqtt_ha_test_mqtt (MQTT_HA_MQTT_BUILTIN) is the built-in client alone,
+// without the library: its only suite brings its own altcp.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+struct TestSuite {
+    const char* name;
+    void      (*run)();
+};
+
+#if MQTT_HA_MQTT_BUILTIN
+void test_mqtt();
+
+static const TestSuite suites[] = {
+    { "mqtt",      test_mqtt },
+};
+#else
+void test_backlog();
+void test_discovery();
+void test_json();
+void test_outbox();
+void test_report();
+void test_router();
+void test_stream();
+
+static const TestSuite suites[] = {
+    { "backlog",   test_backlog },
+    { "discovery", test_discovery },
+    { "json",      test_json },
+    { "outbox",    test_outbox },
+    { "report",    test_report },
+    { "router",    test_router },
+    { "stream",    test_stream },
+};
+#endif
+
+uint32_t test_checks   = 0;
+uint32_t test_failures = 0;
+
+bool test_report_failure(const char* file, int line) {
+    if (test_failures++ >= 10) return false;
+    printf("  FAILED %s:%d\n", file, line);
+    return true;
+}
+
+#if !MQTT_HA_MQTT_BUILTIN
+void test_session_up(void (*hook)(const HostPublish* msg, void* arg)) {
+    host_reset();
+    mqtt_ha_host_reset_stats();
+    host_set_publish_hook(hook, nullptr);
+    wifi_mqtt_init("test_ssid", "test_password", "127.0.0.1", 1883);
+    for (uint32_t t = 0; t <= 600000; t += 10) {
+        mqtt_poll();
+        if (mqtt_ha_state() == MQTT_HA_ONLINE && host_in_flight() == 0) return;
+        host_advance_us(10000);
+    }
+}
+
+void test_drain() {
+    for (int i = 0; i < 100 && host_in_flight() > 0; i++) {
+        mqtt_poll();
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    int ran = 0, failed = 0;
+    for (const auto& s : suites) {
+        bool selected = (argc < 2);
+        for (int i = 1; i < argc; i++) {
+            if (strcmp(argv[i], s.name) == 0) selected = true;
+        }
+        if (!selected) continue;
+        printf("=== %s ===\n", s.name);
+        test_checks   = 0;
+        test_failures = 0;
+        s.run();
+        printf("  %u checks, %u failed\n", test_checks, test_failures);
+        failed += test_failures > 0;
+        ran++;
+    }
+    if (ran == 0) {
+        fprintf(stderr, "Unknown suite. Available:");
+        for (const auto& s : suites) fprintf(stderr, " %s", s.name);
+        fprintf(stderr, "\n");
+        return 1;
+    }
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,373 @@
+//───────────────────────────────────────────────────────────────────
+//─── Built-in MQTT client tests ────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha_mqtt.cpp alone (mqtt_ha_test_mqtt, MQTT_HA_MQTT_BUILTIN=1) over
+// a scripted altcp: the test plays the broker, byte for byte, through the
+// recv / sent callbacks, and reads what the client wrote. Covered: CONNACK
+// properties in pieces, malformed and oversized packets, the 3.1.1
+// fallback, the broker's limits and the topic aliases of a session.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include "mqtt_ha_mqtt.h"
+#include <string.h>
+
+//───────────────────────────────────────────────────────────────────
+//─── Scripted altcp ────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+struct altcp_pcb {
+    void*              arg;
+    altcp_connected_fn connected;
+    altcp_recv_fn      recv;
+    altcp_sent_fn      sent;
+    altcp_err_fn       err;
+    bool               closed;
+    uint8_t            out[1024];   // written since the last take_out(), what does not fit is counted only
+    size_t             out_len;
+    u32_t              written;
+    u32_t              acked;
+};
+
+static altcp_pcb pcbs[4];           // reused in turn: the client holds one at a time
+static uint32_t  pcb_count = 0;
+
+struct altcp_pcb* altcp_tcp_new_ip_type(u8_t ip_type) {
+    altcp_pcb* pcb = &pcbs[pcb_count++ % 4];
+    memset(pcb, 0, sizeof(*pcb));
+    return pcb;
+}
+
+void  altcp_arg(struct altcp_pcb* conn, void* arg)                { conn->arg = arg; }
+void  altcp_recv(struct altcp_pcb* conn, altcp_recv_fn recv)      { conn->recv = recv; }
+void  altcp_sent(struct altcp_pcb* conn, altcp_sent_fn sent)      { conn->sent = sent; }
+void  altcp_poll(struct altcp_pcb* conn, altcp_poll_fn poll, u8_t interval) {}
+void  altcp_err(struct altcp_pcb* conn, altcp_err_fn err)         { conn->err = err; }
+void  altcp_recved(struct altcp_pcb* conn, u16_t len)             {}
+err_t altcp_close(struct altcp_pcb* conn)                         { conn->closed = true; return ERR_OK; }
+void  altcp_abort(struct altcp_pcb* conn)                         { conn->closed = true; }
+err_t altcp_output(struct altcp_pcb* conn)                        { return ERR_OK; }
+u16_t altcp_sndbuf(struct altcp_pcb* conn)                        { return (u16_t)(TCP_SND_BUF - (conn->written - conn->acked)); }
+u16_t altcp_sndqueuelen(struct altcp_pcb* conn)                   { return 0; }
+u8_t  pbuf_free(struct pbuf* p)                                   { return 1; }   // the test's own pbufs
+absolute_time_t get_absolute_time(void)                           { return 0; }   // log records (fallback)
+
+err_t altcp_connect(struct altcp_pcb* conn, const ip_addr_t* ipaddr, u16_t port, altcp_connected_fn connected) {
+    conn->connected = connected;
+    return ERR_OK;
+}
+
+err_t altcp_write(struct altcp_pcb* conn, const void* dataptr, u16_t len, u8_t apiflags) {
+    size_t n = len < sizeof(conn->out) - conn->out_len ? len : sizeof(conn->out) - conn->out_len;
+    memcpy(conn->out + conn->out_len, dataptr, n);
+    conn->out_len += n;
+    conn->written += len;
+    return ERR_OK;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Broker side ───────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static mqtt_client_t*           client = nullptr;
+static mqtt_connection_status_t last_status;
+static uint32_t                 conn_calls = 0;
+static char                     rx_topic[64];
+static char                     rx_data[64];
+static size_t                   rx_data_len = 0;
+static uint32_t                 rx_publishes = 0;
+static err_t                    last_result;
+static uint32_t                 results = 0;
+
+static void on_connection(mqtt_client_t* c, void* arg, mqtt_connection_status_t status) {
+    last_status = status;
+    conn_calls++;
+}
+
+static void on_publish(void* arg, const char* topic, u32_t tot_len) {
+    snprintf(rx_topic, sizeof(rx_topic), "%s", topic);
+    rx_data_len = 0;
+    rx_publishes++;
+}
+
+static void on_data(void* arg, const u8_t* data, u16_t len, u8_t flags) {
+    size_t n = len < sizeof(rx_data) - 1 - rx_data_len ? len : sizeof(rx_data) - 1 - rx_data_len;
+    memcpy(rx_data + rx_data_len, data, n);
+    rx_data_len += n;
+    rx_data[rx_data_len] = '\0';
+}
+
+static void on_result(void* arg, err_t err) {
+    last_result = err;
+    results++;
+}
+
+static altcp_pcb* pcb() {
+    return mqtt_ha_mqtt_pcb(client);
+}
+
+//--- Bytes the client wrote since the last call
+static size_t take_out(uint8_t* buf) {
+    altcp_pcb* p = pcb();
+    if (p == nullptr) return 0;
+    size_t     n = p->out_len;
+    memcpy(buf, p->out, n);
+    p->out_len = 0;
+    return n;
+}
+
+//--- data into the recv callback as one pbuf chain of `piece` bytes per pbuf (none once closed)
+static err_t feed(const uint8_t* data, size_t len, size_t piece) {
+    altcp_pcb* p = pcb();
+    if (p == nullptr) return ERR_CONN;
+    static struct pbuf chain[512];
+    size_t count = 0;
+    for (size_t at = 0; at < len && count < 512; at += piece, count++) {
+        chain[count].payload = (void*)(data + at);
+        chain[count].len     = (u16_t)(len - at < piece ? len - at : piece);
+        chain[count].next    = nullptr;
+        if (count) chain[count - 1].next = &chain[count];
+    }
+    for (size_t i = count; i-- > 0;) chain[i].tot_len = (u16_t)(chain[i].len + (i + 1 < count ? chain[i + 1].tot_len : 0));
+    return p->recv(p->arg, p, chain, ERR_OK);
+}
+
+//--- TCP up: the client writes CONNECT. @return its protocol level
+static uint8_t tcp_up() {
+    altcp_pcb* p = pcb();
+    if (p == nullptr) return 0;
+    p->connected(p->arg, p, ERR_OK);
+    uint8_t out[256];
+    size_t  n = take_out(out);
+    return n > 8 && out[0] == 0x10 ? out[8] : 0;
+}
+
+//--- TCP acks everything written: the QoS 0 publishes are done
+static void tcp_ack() {
+    altcp_pcb* p = pcb();
+    if (p == nullptr) return;
+    u32_t      n = p->written - p->acked;
+    p->acked = p->written;
+    p->sent(p->arg, p, (u16_t)n);
+}
+
+//--- New connection up to its CONNACK, fed in pbufs of `piece` bytes. @return level of the CONNECT
+static uint8_t connect(const uint8_t* connack, size_t len, size_t piece = 0) {
+    static const mqtt_connect_client_info_t ci = { "test_client", nullptr, nullptr, 60, nullptr, nullptr, 0, 0, nullptr };
+    ip_addr_t ip = IPADDR4_INIT(0x0100007fu);
+    mqtt_disconnect(client);                        // a failed check may have left the last one up
+    mqtt_client_connect(client, &ip, 1883, on_connection, nullptr, &ci);
+    uint8_t level = tcp_up();
+    feed(connack, len, piece ? piece : len);
+    return level;
+}
+
+static err_t publish(const char* topic, u8_t qos = 0, const char* payload = "1") {
+    return mqtt_publish(client, topic, payload, (u16_t)strlen(payload), qos, 0, on_result, nullptr);
+}
+
+static MqttHaMqttStats stats() {
+    MqttHaMqttStats st;
+    mqtt_ha_mqtt_get_stats(client, &st);
+    return st;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Cases ─────────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Receive Maximum 2, Topic Alias Maximum 100 (above MQTT_HA_MQTT_ALIASES), Maximum Packet
+//--- Size 4096, with an assigned client id, a user property and Server Keep Alive to skip past
+static const uint8_t connack_limits[] = {
+    0x20, 0x1e, 0x00, 0x00, 0x1b,
+    0x21, 0x00, 0x02,
+    0x22, 0x00, 0x64,
+    0x27, 0x00, 0x00, 0x10, 0x00,
+    0x12, 0x00, 0x03, 'c', 'i', 'd',
+    0x26, 0x00, 0x01, 'k', 0x00, 0x01, 'v',
+    0x13, 0x00, 0x3c,
+};
+static const uint8_t connack_aliases_2[] = { 0x20, 0x06, 0x00, 0x00, 0x03, 0x22, 0x00, 0x02 };
+
+
+static void test_connack_limits() {
+    uint32_t calls = conn_calls;
+    TEST_CHECK(connect(connack_limits, sizeof(connack_limits), 4) == 5, "first CONNECT not in MQTT 5");
+    TEST_CHECK(conn_calls == calls + 1 && last_status == MQTT_CONNECT_ACCEPTED,
+               "CONNACK in 4 byte pbufs: status %d", (int)last_status);
+    TEST_CHECK(mqtt_client_is_connected(client), "not connected");
+    MqttHaMqttStats st = stats();
+    TEST_CHECK(st.level == 5, "level %u", st.level);
+    TEST_CHECK(st.alias_max == MQTT_HA_MQTT_ALIASES, "Topic Alias Maximum 100 taken as %u", st.alias_max);
+
+    //--- Receive Maximum: two QoS 1 publishes in flight, QoS 0 not counted
+    TEST_CHECK(publish("rm/a", 1) == ERR_OK, "first QoS 1 refused");
+    TEST_CHECK(publish("rm/b", 1) == ERR_OK, "second QoS 1 refused");
+    TEST_CHECK(publish("rm/c", 1) == ERR_MEM, "third QoS 1 above Receive Maximum 2 accepted");
+    TEST_CHECK(publish("rm/d", 0) == ERR_OK, "QoS 0 held back by Receive Maximum");
+    tcp_ack();
+    uint32_t before = results;
+    static const uint8_t puback[] = { 0x40, 0x02, 0x00, 0x01 };
+    feed(puback, sizeof(puback), 1);
+    TEST_CHECK(results == before + 1 && last_result == ERR_OK, "PUBACK of id 1 not reported");
+    TEST_CHECK(publish("rm/c", 1) == ERR_OK, "QoS 1 refused once a PUBACK freed a slot");
+
+    //--- Maximum Packet Size 4096
+    static char big[4100];
+    memset(big, 'x', sizeof(big) - 1);
+    TEST_CHECK(publish("rm/big", 0, big) == ERR_VAL, "PUBLISH above Maximum Packet Size accepted");
+    mqtt_disconnect(client);
+}
+
+//--- A property cut short: refused, nothing taken
+static void test_connack_malformed() {
+    static const uint8_t connack[] = { 0x20, 0x05, 0x00, 0x00, 0x02, 0x22, 0x00 };
+    uint32_t calls = conn_calls;
+    connect(connack, sizeof(connack));
+    TEST_CHECK(conn_calls == calls + 1 && last_status == MQTT_CONNECT_REFUSED_SERVER,
+               "CONNACK with a truncated property: status %d", (int)last_status);
+    TEST_CHECK(!mqtt_client_is_connected(client), "connected on a malformed CONNACK");
+}
+
+//--- Topic Alias Maximum 2: the second use of a topic sets its alias up, the third sends none
+static void test_aliases() {
+    connect(connack_aliases_2, sizeof(connack_aliases_2));
+    TEST_CHECK(stats().alias_max == 2, "Topic Alias Maximum %u", stats().alias_max);
+    MqttHaMqttStats before = stats();
+    static const char* const topics[] = { "t/a", "t/b", "t/c" };
+    uint8_t out[64];
+    size_t  n;
+    for (int round = 0; round < 3; round++) {
+        for (const char* topic : topics) {
+            TEST_CHECK(publish(topic) == ERR_OK, "publish %s, round %d", topic, round);
+            n = take_out(out);
+            tcp_ack();
+            if (strcmp(topic, "t/a") != 0) continue;
+            //--- round 0: full topic, 1: full topic + alias 1, 2: alias 1 alone
+            static const uint8_t expected[3][12] = {
+                { 0x30, 0x07, 0x00, 0x03, 't', '/', 'a', 0x00, '1' },
+                { 0x30, 0x0a, 0x00, 0x03, 't', '/', 'a', 0x03, 0x23, 0x00, 0x01, '1' },
+                { 0x30, 0x07, 0x00, 0x00, 0x03, 0x23, 0x00, 0x01, '1' },
+            };
+            static const size_t expected_len[3] = { 9, 12, 9 };
+            TEST_CHECK(n == expected_len[round] && memcmp(out, expected[round], n) == 0,
+                       "PUBLISH t/a of round %d: %u bytes", round, (unsigned)n);
+        }
+    }
+    MqttHaMqttStats st = stats();
+    TEST_CHECK(st.aliases == 2, "%u aliases for a Topic Alias Maximum of 2", st.aliases);
+    TEST_CHECK(st.aliased - before.aliased == 2, "%u PUBLISH without their topic",
+               (unsigned)(st.aliased - before.aliased));
+
+    //--- A new session starts without aliases: the broker forgot them
+    mqtt_disconnect(client);
+    connect(connack_aliases_2, sizeof(connack_aliases_2));
+    TEST_CHECK(stats().aliases == 0, "%u aliases left after the reconnect", stats().aliases);
+    publish("t/a");
+    n = take_out(out);
+    static const uint8_t full[] = { 0x30, 0x07, 0x00, 0x03, 't', '/', 'a', 0x00, '1' };
+    TEST_CHECK(n == sizeof(full) && memcmp(out, full, n) == 0, "first PUBLISH of the session without its topic");
+    tcp_ack();
+    publish("t/a");
+    n = take_out(out);
+    TEST_CHECK(n == 12 && out[3] == 3 && out[8] == 0x23, "second PUBLISH of the session does not set the alias up");
+    tcp_ack();
+    mqtt_disconnect(client);
+}
+
+//--- A PUBLISH whose variable header exceeds MQTT_HA_MQTT_RX_HEADER is dropped, the next one arrives
+static void test_rx_oversized() {
+    connect(connack_aliases_2, sizeof(connack_aliases_2));
+    static uint8_t stream[320];
+    size_t n = 0;
+    stream[n++] = 0x30;
+    stream[n++] = 0xb0;                             // remaining 304: topic 300, properties 0, payload 'p'
+    stream[n++] = 0x02;
+    stream[n++] = 0x01;
+    stream[n++] = 0x2c;
+    memset(stream + n, 'x', 300);
+    n += 300;
+    stream[n++] = 0x00;
+    stream[n++] = 'p';
+    static const uint8_t next[] = { 0x30, 0x09, 0x00, 0x04, 't', '/', 'o', 'k', 0x00, 'o', 'n' };
+    memcpy(stream + n, next, sizeof(next));
+    n += sizeof(next);
+    static_assert(2 + 300 + 1 > MQTT_HA_MQTT_RX_HEADER, "the variable header must not fit rx[]");
+
+    uint32_t before = rx_publishes;
+    feed(stream, n, 7);
+    TEST_CHECK(rx_publishes == before + 1, "%u PUBLISH reported", rx_publishes - before);
+    TEST_CHECK(strcmp(rx_topic, "t/ok") == 0 && strcmp(rx_data, "on") == 0,
+               "after the skipped PUBLISH: topic '%s' payload '%s'", rx_topic, rx_data);
+    TEST_CHECK(mqtt_client_is_connected(client), "connection closed on an oversized PUBLISH");
+    mqtt_disconnect(client);
+}
+
+//--- Remaining length: 4 bytes at most. A 5th closes the connection, the longest valid one does not
+static void test_rx_length() {
+    connect(connack_aliases_2, sizeof(connack_aliases_2));
+    static const uint8_t longest[] = { 0x30, 0x80, 0x80, 0x80, 0x01 };
+    feed(longest, sizeof(longest), 1);
+    TEST_CHECK(mqtt_client_is_connected(client), "closed on a 4 byte remaining length");
+    mqtt_disconnect(client);
+
+    connect(connack_aliases_2, sizeof(connack_aliases_2));
+    altcp_pcb* p     = pcb();
+    uint32_t   calls = conn_calls;
+    static const uint8_t malformed[] = { 0x30, 0xff, 0xff, 0xff, 0xff, 0x00 };
+    feed(malformed, sizeof(malformed), 1);
+    TEST_CHECK(conn_calls == calls + 1 && last_status == MQTT_CONNECT_DISCONNECTED,
+               "5 byte remaining length: status %d", (int)last_status);
+    TEST_CHECK(p->closed && !mqtt_client_is_connected(client), "connection kept on a 5 byte remaining length");
+}
+
+//--- "Unacceptable protocol version" in 3.1.1 (0x01) or MQTT 5 (0x84): reconnected at once in 3.1.1
+static void test_fallback(const uint8_t* connack, size_t len) {
+    MqttHaMqttStats before = stats();
+    uint32_t        calls  = conn_calls;
+    mqtt_ha_mqtt_set_level(client, 5);
+    TEST_CHECK(connect(connack, len) == 5, "CONNECT not in MQTT 5");
+    TEST_CHECK(stats().fallbacks == before.fallbacks + 1, "CONNACK 0x%02x: no fallback", connack[3]);
+    TEST_CHECK(conn_calls == calls, "fallback reported to the application (status %d)", (int)last_status);
+    TEST_CHECK(tcp_up() == 4, "no 3.1.1 CONNECT after CONNACK 0x%02x", connack[3]);
+    static const uint8_t accepted[] = { 0x20, 0x02, 0x00, 0x00 };
+    feed(accepted, sizeof(accepted), 1);
+    TEST_CHECK(conn_calls == calls + 1 && last_status == MQTT_CONNECT_ACCEPTED, "3.1.1 CONNACK: status %d", (int)last_status);
+    TEST_CHECK(stats().level == 4 && stats().alias_max == 0, "level %u, %u aliases", stats().level, stats().alias_max);
+
+    //--- 3.1.1 from now on: no properties byte, no alias
+    uint8_t out[32];
+    for (int i = 0; i < 3; i++) {
+        publish("t/a");
+        size_t n = take_out(out);
+        static const uint8_t v311[] = { 0x30, 0x06, 0x00, 0x03, 't', '/', 'a', '1' };
+        TEST_CHECK(n == sizeof(v311) && memcmp(out, v311, n) == 0, "3.1.1 PUBLISH %d: %u bytes", i, (unsigned)n);
+        tcp_ack();
+    }
+    mqtt_disconnect(client);
+}
+
+//--- A 3.1.1 CONNECT refused for its protocol version is final
+static void test_refused_311() {
+    uint32_t before = stats().fallbacks;
+    uint32_t calls  = conn_calls;
+    static const uint8_t refused[] = { 0x20, 0x02, 0x00, 0x01 };
+    TEST_CHECK(connect(refused, sizeof(refused)) == 4, "CONNECT after the fallback not in 3.1.1");
+    TEST_CHECK(conn_calls == calls + 1 && last_status == MQTT_CONNECT_REFUSED_PROTOCOL_VERSION,
+               "3.1.1 CONNACK 0x01: status %d", (int)last_status);
+    TEST_CHECK(stats().fallbacks == before, "fallback from 3.1.1");
+    mqtt_ha_mqtt_set_level(client, 5);
+}
+
+void test_mqtt() {
+    client = mqtt_client_new();
+    mqtt_set_inpub_callback(client, on_publish, on_data, nullptr);
+    test_connack_limits();
+    test_connack_malformed();
+    test_aliases();
+    test_rx_oversized();
+    test_rx_length();
+    static const uint8_t connack_311[] = { 0x20, 0x02, 0x00, 0x01 };
+    static const uint8_t connack_v5[]  = { 0x20, 0x03, 0x00, 0x84, 0x00 };
+    test_fallback(connack_311, sizeof(connack_311));
+    test_refused_311();
+    test_fallback(connack_v5, sizeof(connack_v5));
+    mqtt_client_free(client);
+}
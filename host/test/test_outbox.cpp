@@ -0,0 +1,188 @@
+//───────────────────────────────────────────────────────────────────
+//─── Outbound queue tests ──────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// outbox_push() + outbox_flush() of mqtt_ha.cpp, seen from the fake's
+// mqtt_publish() (host_set_publish_hook) and mqtt_ha_outbox_stats():
+// a newer state replaces the one still queued, ERR_MEM is retried and
+// not dropped, PUBLISH_IN_FLIGHT leaves lwIP's last request slot to the
+// SUBSCRIBEs, and every topic gets its QoS and retain flag.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define STATE_TOPIC "pico_env_sensor/state"
+#define AVAIL_TOPIC "pico_env_sensor/availability"
+
+struct Seen {
+    int      count;
+    int      eco2;          // of the last one: tells the states apart
+    uint8_t  qos;
+    uint8_t  retain;
+    bool     mixed;         // not every one had the same qos / retain
+};
+static Seen states, avail, discovery;
+static int  max_in_flight = 0;
+
+static void seen(Seen& s, const HostPublish* msg) {
+    if (s.count > 0 && (s.qos != msg->qos || s.retain != msg->retain)) s.mixed = true;
+    s.count++;
+    s.qos    = msg->qos;
+    s.retain = msg->retain;
+}
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (host_in_flight() > max_in_flight) max_in_flight = host_in_flight();
+    if (strcmp(msg->topic, STATE_TOPIC) == 0) {
+        char payload[256];
+        snprintf(payload, sizeof(payload), "%.*s", (int)msg->len, msg->payload);
+        const char* p = strstr(payload, "\"eco2\":");
+        states.eco2 = p ? atoi(p + 7) : -1;
+        seen(states, msg);
+    } else if (strcmp(msg->topic, AVAIL_TOPIC) == 0) {
+        seen(avail, msg);
+    } else if (strncmp(msg->topic, "homeassistant/", 14) == 0) {
+        seen(discovery, msg);
+    }
+}
+
+static void session_up() {
+    states = avail = discovery = {};
+    max_in_flight = 0;
+    test_session_up(on_publish);
+}
+
+//--- eco2 tells the states apart: every call changes it, so none is filtered out
+static void publish(int eco2) {
+    mqtt_ha_publish_state(20.0, 50.0, (uint16_t)eco2, 0, 1);
+}
+
+//--- Acks held: 3 states in flight, a 4th queued, a 5th replaces it before it is sent
+static void test_coalescing() {
+    session_up();
+    host_set_auto_ack(false);
+    MqttHaOutboxStats before = mqtt_ha_outbox_stats();
+
+    for (int i = 1; i <= 3; i++) publish(400 + i);
+    TEST_CHECK(states.count == 3 && states.eco2 == 403, "%d states, last eco2 %d", states.count, states.eco2);
+    publish(404);
+    MqttHaOutboxStats st = mqtt_ha_outbox_stats();
+    TEST_CHECK(states.count == 3, "4th state sent past the window");
+    TEST_CHECK(st.pending == 1 && st.coalesced == before.coalesced, "%u pending, %u coalesced",
+               st.pending, st.coalesced - before.coalesced);
+    publish(405);
+    st = mqtt_ha_outbox_stats();
+    TEST_CHECK(st.pending == 1 && st.coalesced == before.coalesced + 1, "newer state: %u pending, %u coalesced",
+               st.pending, st.coalesced - before.coalesced);
+
+    host_ack_all();
+    TEST_CHECK(states.count == 4, "%d states after the acks, expected 4", states.count);
+    TEST_CHECK(states.eco2 == 405, "queued state sent with eco2 %d, expected the newer 405", states.eco2);
+    st = mqtt_ha_outbox_stats();
+    TEST_CHECK(st.pending == 0 && st.dropped == before.dropped, "%u pending, %u dropped",
+               st.pending, st.dropped - before.dropped);
+    host_set_auto_ack(true);
+    test_drain();
+}
+
+//--- Acks held through a burst with polls: never more than PUBLISH_IN_FLIGHT (3) publishes,
+//--- lwIP's 4th request slot stays free for a SUBSCRIBE
+static void test_window() {
+    session_up();
+    host_set_auto_ack(false);
+    max_in_flight = 0;
+    for (int i = 0; i < 20; i++) {
+        publish(500 + i);
+        mqtt_poll();
+        MqttHaOutboxStats st = mqtt_ha_outbox_stats();
+        TEST_CHECK(st.in_flight <= 3 && host_in_flight() <= 3, "call %d: %u publishes in flight, %d lwIP requests",
+                   i, st.in_flight, host_in_flight());
+    }
+    TEST_CHECK(max_in_flight == 3, "%d lwIP requests at most, expected 3", max_in_flight);
+    TEST_CHECK(host_stats().publish_rejected == 0, "%u publishes refused by lwIP", host_stats().publish_rejected);
+    TEST_CHECK(states.count == 3, "%d states sent without an ack, expected 3", states.count);
+
+    //--- Each completion sends what waits: the latest values
+    host_ack_all();
+    TEST_CHECK(states.count == 4 && states.eco2 == 519, "%d states, last eco2 %d", states.count, states.eco2);
+    host_set_auto_ack(true);
+    test_drain();
+    TEST_CHECK(mqtt_ha_outbox_stats().in_flight == 0, "%u publishes left in flight", mqtt_ha_outbox_stats().in_flight);
+}
+
+//--- lwIP with one free request slot (the application holds the others): ERR_MEM is retried,
+//--- from the next completion, then from mqtt_poll(), and nothing is dropped
+static void test_err_mem() {
+    session_up();
+    host_set_auto_ack(false);
+    host_set_request_limit(1);
+    MqttHaOutboxStats before   = mqtt_ha_outbox_stats();
+    uint32_t          rejected = host_stats().publish_rejected;
+
+    publish(601);
+    publish(602);
+    MqttHaOutboxStats st = mqtt_ha_outbox_stats();
+    TEST_CHECK(states.count == 1, "%d states with one lwIP slot", states.count);
+    TEST_CHECK(host_stats().publish_rejected == rejected + 1, "%u ERR_MEM", host_stats().publish_rejected - rejected);
+    TEST_CHECK(st.retried == before.retried + 1 && st.pending == 1, "%u retried, %u pending",
+               st.retried - before.retried, st.pending);
+    publish(603);
+
+    //--- The completion of the first one frees the slot
+    host_ack_all();
+    TEST_CHECK(states.count == 2 && states.eco2 == 603, "after the ack: %d states, eco2 %d", states.count, states.eco2);
+
+    //--- Refused again, then sent by mqtt_poll() once lwIP has room
+    publish(604);
+    TEST_CHECK(states.count == 2, "state sent past the lwIP limit");
+    mqtt_poll();
+    TEST_CHECK(states.count == 2, "state sent by mqtt_poll() past the lwIP limit");
+    host_set_request_limit(0);
+    mqtt_poll();
+    TEST_CHECK(states.count == 3 && states.eco2 == 604, "after mqtt_poll(): %d states, eco2 %d", states.count, states.eco2);
+
+    st = mqtt_ha_outbox_stats();
+    TEST_CHECK(st.retried >= before.retried + 3, "%u retried", st.retried - before.retried);
+    TEST_CHECK(st.dropped == before.dropped && st.pending == 0, "%u dropped, %u pending",
+               st.dropped - before.dropped, st.pending);
+    host_set_auto_ack(true);
+    test_drain();
+}
+
+//--- Default policies during the session start (blank flash: discovery is sent), then the state's own
+static void test_policy() {
+    host_erase_flash();
+    session_up();
+    TEST_CHECK(avail.count > 0 && avail.qos == 1 && avail.retain == 1 && !avail.mixed,
+               "availability: %d sent, qos %u, retain %u", avail.count, avail.qos, avail.retain);
+    TEST_CHECK(discovery.count > 0 && discovery.qos == 1 && discovery.retain == 1 && !discovery.mixed,
+               "discovery: %d sent, qos %u, retain %u", discovery.count, discovery.qos, discovery.retain);
+
+    publish(701);
+    test_drain();
+    TEST_CHECK(states.count == 1 && states.qos == 1 && states.retain == 0, "default state: qos %u, retain %u",
+               states.qos, states.retain);
+    TEST_CHECK(mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 0, true), "state policy 0 / retained refused");
+    publish(702);
+    test_drain();
+    TEST_CHECK(states.count == 2 && states.qos == 0 && states.retain == 1, "state 0 / retained: qos %u, retain %u",
+               states.qos, states.retain);
+    TEST_CHECK(mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 2, false), "state policy 2 refused");
+    publish(703);
+    test_drain();
+    TEST_CHECK(states.count == 3 && states.qos == 2 && states.retain == 0, "state 2: qos %u, retain %u",
+               states.qos, states.retain);
+
+    TEST_CHECK(!mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 3, false), "QoS 3 accepted");
+    TEST_CHECK(!mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_COUNT, 1, false), "MQTT_HA_TOPIC_COUNT accepted");
+    mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 1, false);
+}
+
+void test_outbox() {
+    test_coalescing();
+    test_window();
+    test_err_mem();
+    test_policy();
+    host_set_publish_hook(nullptr, nullptr);
+}
@@ -0,0 +1,199 @@
+//───────────────────────────────────────────────────────────────────
+//─── Report by exception tests ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha_set() + mqtt_ha_publish_channels() through the filter of
+// mqtt_ha_report.cpp, checked on the published states and on
+// mqtt_ha_report_stats(): deadbands (counted from the last state sent,
+// negative: never by itself), the heartbeat, MIN / MAX / MEAN over the
+// window of samples since the last state sent, and the EWMA across them.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+enum { CH_TEMP, CH_HUM, CH_LVL };
+
+static const MqttHaChannel table[] = {
+    { "temp", "temp", nullptr, "°C", "temperature", 1, MQTT_HA_I16 },
+    { "hum",  "hum",  nullptr, "%",  "humidity",    1, MQTT_HA_U16 },
+    { "lvl",  "lvl",  nullptr, nullptr, nullptr,    0, MQTT_HA_I32 },
+};
+
+static char     last_state[256];
+static uint32_t states = 0;
+
+static void on_publish(const HostPublish* msg, void* arg) {
+    if (strcmp(msg->topic, "pico_env_sensor/state") != 0) return;
+    snprintf(last_state, sizeof(last_state), "%.*s", (int)msg->len, msg->payload);
+    states++;
+}
+
+//--- Channels of this suite, then a session: the filter starts blank
+static void session_up(uint32_t heartbeat_ms) {
+    mqtt_ha_register_channels(table, 3);
+    mqtt_ha_set_heartbeat(heartbeat_ms);
+    test_session_up(on_publish);
+}
+
+//--- @return true when a state was published
+static bool publish() {
+    uint32_t before = states;
+    mqtt_ha_publish_channels();
+    test_drain();
+    return states == before + 1;
+}
+
+//--- Value of key in the last state, NAN if absent
+static double sent(const char* key) {
+    char pattern[32];
+    snprintf(pattern, sizeof(pattern), "\"%s\":", key);
+    const char* p = strstr(last_state, pattern);
+    return p ? atof(p + strlen(pattern)) : NAN;
+}
+
+static bool near(double a, double b) {
+    return a > b - 0.001 && a < b + 0.001;
+}
+
+//--- temp: deadband 0.5, hum: negative (never), counted from the last state sent
+static void test_deadband() {
+    session_up(0);
+    mqtt_ha_set_deadband(CH_TEMP, 0.5);
+    mqtt_ha_set_deadband(CH_HUM, -1);
+    MqttHaReportStats before = mqtt_ha_report_stats();
+
+    mqtt_ha_set(CH_TEMP, 20.0);
+    mqtt_ha_set(CH_HUM, 50.0);
+    TEST_CHECK(publish(), "first values not sent");
+    TEST_CHECK(mqtt_ha_report_triggers(CH_TEMP) == 1 && mqtt_ha_report_triggers(CH_HUM) == 1,
+               "first values: triggers %u %u", mqtt_ha_report_triggers(CH_TEMP), mqtt_ha_report_triggers(CH_HUM));
+
+    mqtt_ha_set(CH_TEMP, 20.3);
+    TEST_CHECK(!publish(), "0.3 below the 0.5 deadband sent");
+    mqtt_ha_set(CH_TEMP, 20.5);
+    TEST_CHECK(publish(), "0.5 on the 0.5 deadband suppressed");
+    TEST_CHECK(near(sent("temp"), 20.5), "temp %s", last_state);
+    //--- From the last state sent, not from the last sample: 20.8 then 20.9 stay below 21.0
+    mqtt_ha_set(CH_TEMP, 20.8);
+    TEST_CHECK(!publish(), "20.8 sent (deadband from 20.5)");
+    mqtt_ha_set(CH_TEMP, 20.9);
+    TEST_CHECK(!publish(), "20.9 sent (deadband from 20.5, not 20.8)");
+
+    //--- Negative deadband: any jump rides along with the next state, never triggers one
+    mqtt_ha_set(CH_HUM, 95.0);
+    TEST_CHECK(!publish(), "humidity with a negative deadband triggered a state");
+    mqtt_ha_set(CH_TEMP, 21.0);
+    TEST_CHECK(publish(), "temp 21.0 suppressed");
+    TEST_CHECK(near(sent("hum"), 95.0), "humidity did not ride along: %s", last_state);
+    TEST_CHECK(mqtt_ha_report_triggers(CH_HUM) == 1, "humidity triggers %u", mqtt_ha_report_triggers(CH_HUM));
+    TEST_CHECK(mqtt_ha_report_triggers(CH_TEMP) == 3, "temp triggers %u", mqtt_ha_report_triggers(CH_TEMP));
+
+    MqttHaReportStats st = mqtt_ha_report_stats();
+    TEST_CHECK(st.sent - before.sent == 3 && st.suppressed - before.suppressed == 4 && st.heartbeats == before.heartbeats,
+               "%u sent, %u suppressed, %u heartbeats", st.sent - before.sent, st.suppressed - before.suppressed,
+               st.heartbeats - before.heartbeats);
+}
+
+//--- 10 s without a state: the next call sends one, and mqtt_poll() does when no call comes
+static void test_heartbeat() {
+    session_up(10000);
+    mqtt_ha_set_deadband(CH_TEMP, 0.5);
+    MqttHaReportStats before = mqtt_ha_report_stats();
+
+    mqtt_ha_set(CH_TEMP, 20.0);
+    TEST_CHECK(publish(), "first value not sent");
+    host_advance_us(9000000);
+    TEST_CHECK(!publish(), "state before max_silence_ms");
+    host_advance_us(1000000);
+    TEST_CHECK(publish(), "no heartbeat after max_silence_ms");
+    TEST_CHECK(mqtt_ha_report_stats().heartbeats == before.heartbeats + 1, "heartbeat not counted");
+
+    uint32_t sent_before = states;
+    for (int i = 0; i < 1000; i++) {
+        host_advance_us(10000);
+        mqtt_poll();
+    }
+    TEST_CHECK(states == sent_before + 1, "%u states from mqtt_poll() in 10 s", states - sent_before);
+    TEST_CHECK(mqtt_ha_report_stats().heartbeats == before.heartbeats + 2, "heartbeat from mqtt_poll() not counted");
+    TEST_CHECK(near(sent("temp"), 20.0), "heartbeat state: %s", last_state);
+    mqtt_ha_set_heartbeat(0);
+}
+
+//--- MEAN rounded half away from zero, MIN / MAX / MEAN windows reset by a state sent only
+static void test_windows() {
+    session_up(0);
+    mqtt_ha_set_aggregate(CH_LVL, MQTT_HA_AGG_MEAN, 0);
+    mqtt_ha_set_aggregate(CH_TEMP, MQTT_HA_AGG_MAX, 0);
+    struct {
+        int32_t samples[3];
+        int     count;
+        int32_t mean;
+    } const means[] = {
+        { { 1, 2 },      2, 2 },
+        { { -1, -2 },    2, -2 },
+        { { 1, 1, 2 },   3, 1 },
+        { { 1, 2, 2 },   3, 2 },
+        { { -1, -1, -2 }, 3, -1 },
+        { { 10 },        1, 10 },   // nothing left of the earlier windows
+    };
+    for (const auto& m : means) {
+        for (int i = 0; i < m.count; i++) mqtt_ha_set_scaled(CH_LVL, m.samples[i]);
+        TEST_CHECK(publish(), "no state without a filter");
+        TEST_CHECK(near(sent("lvl"), m.mean), "mean of %d samples from %d: %s, expected %d",
+                   m.count, (int)m.samples[0], last_state, (int)m.mean);
+    }
+
+    mqtt_ha_set(CH_TEMP, 25.0);
+    mqtt_ha_set(CH_TEMP, 22.0);
+    publish();
+    TEST_CHECK(near(sent("temp"), 25.0), "max of 25.0 and 22.0: %s", last_state);
+    mqtt_ha_set(CH_TEMP, 21.0);
+    mqtt_ha_set(CH_TEMP, 20.0);
+    publish();
+    TEST_CHECK(near(sent("temp"), 21.0), "max window not reset by the state sent: %s", last_state);
+
+    //--- A suppressed call keeps the window: the mean covers every sample since the last state sent
+    mqtt_ha_set_deadband(CH_LVL, 5);
+    mqtt_ha_set_deadband(CH_TEMP, -1);
+    mqtt_ha_set_scaled(CH_LVL, 10);
+    TEST_CHECK(!publish(), "mean 10 (unchanged) sent");
+    mqtt_ha_set_scaled(CH_LVL, 12);
+    TEST_CHECK(!publish(), "mean of 10, 12 sent (deadband 5)");
+    mqtt_ha_set_scaled(CH_LVL, 23);
+    TEST_CHECK(publish(), "mean of 10, 12, 23 suppressed (deadband 5)");
+    TEST_CHECK(near(sent("lvl"), 15), "mean of the window since the last state: %s", last_state);
+}
+
+//--- EWMA alpha 1/8: continues across the states sent, reaches a constant input exactly
+static void test_ewma() {
+    session_up(0);
+    mqtt_ha_set_aggregate(CH_HUM, MQTT_HA_AGG_EWMA, 3);
+    mqtt_ha_set(CH_HUM, 0.0);
+    publish();
+    TEST_CHECK(near(sent("hum"), 0.0), "first sample: %s", last_state);
+    mqtt_ha_set(CH_HUM, 80.0);
+    publish();
+    TEST_CHECK(near(sent("hum"), 10.0), "one step of 80 from 0 (alpha 1/8), not restarted by the state: %s", last_state);
+    for (int i = 0; i < 7; i++) mqtt_ha_set(CH_HUM, 80.0);
+    publish();
+    double expected = 80.0 * (1.0 - pow(7.0 / 8.0, 8));
+    TEST_CHECK(sent("hum") > expected - 0.11 && sent("hum") < expected + 0.11, "8 steps: %s, expected %.2f",
+               last_state, expected);
+    for (int i = 0; i < 200; i++) mqtt_ha_set(CH_HUM, 80.0);
+    publish();
+    TEST_CHECK(near(sent("hum"), 80.0), "no convergence to 80.0: %s", last_state);
+
+    TEST_CHECK(!mqtt_ha_set_aggregate(CH_HUM, MQTT_HA_AGG_EWMA, 0), "EWMA shift 0 accepted");
+    TEST_CHECK(!mqtt_ha_set_aggregate(CH_HUM, MQTT_HA_AGG_EWMA, 9), "EWMA shift 9 accepted");
+}
+
+void test_report() {
+    test_deadband();
+    test_heartbeat();
+    test_windows();
+    test_ewma();
+    mqtt_ha_register_channels(nullptr, 0);
+    host_set_publish_hook(nullptr, nullptr);
+}
@@ -0,0 +1,147 @@
+//───────────────────────────────────────────────────────────────────
+//─── Command router tests ──────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Messages delivered end to end (host_deliver) reach the right handler:
+// exact commands, "any payload" routes with their scaled value, legacy
+// CmdEntry commands; registrations the router cannot hold are refused
+// and leave the previous table in place.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+#define TEST_COMMANDS 48
+#define TEST_NUMBERS  8
+
+static char        names[TEST_COMMANDS][16];
+static char        number_topics[TEST_NUMBERS][32];
+static MqttHaRoute routes[TEST_COMMANDS + 2 + TEST_NUMBERS];
+static int         last_route = -1;     // MqttHaRoute::arg of the last handler call
+static int32_t     last_value = 0;
+static bool        last_has_value = false;
+static uint32_t    calls = 0;
+static uint32_t    legacy_calls = 0;
+
+static void on_route(const MqttHaCommand* cmd) {
+    last_route     = (int)(intptr_t)cmd->arg;
+    last_value     = cmd->value;
+    last_has_value = cmd->has_value;
+    calls++;
+}
+
+static void on_legacy() { legacy_calls++; }
+
+static const CmdEntry legacy_cmds[] = {
+    { "toggle", on_legacy },
+};
+
+//--- Deliver one message: @return arg of the route called, -1 if none
+static int deliver(const char* topic, const char* payload, u16_t fragment = 0) {
+    uint32_t before = calls;
+    last_route = -1;
+    host_deliver(topic, payload, strlen(payload), fragment);
+    return calls == before ? -1 : last_route;
+}
+
+static uint8_t build_routes() {
+    uint8_t n = 0;
+    for (int i = 0; i < TEST_COMMANDS; i++) {
+        snprintf(names[i], sizeof(names[i]), "scene_%02d", i);
+        routes[n++] = { "test/cmd", names[i], on_route, (void*)(intptr_t)i, 0, nullptr };
+    }
+    routes[n++] = { "test/cmd", nullptr, on_route, (void*)(intptr_t)100, 0, nullptr };
+    routes[n++] = { "test/plain", nullptr, on_route, (void*)(intptr_t)101, 2, nullptr };
+    for (int i = 0; i < TEST_NUMBERS; i++) {
+        snprintf(number_topics[i], sizeof(number_topics[i]), "test/number/%d/set", i);
+        routes[n++] = { number_topics[i], nullptr, on_route, (void*)(intptr_t)(200 + i), 1, nullptr };
+    }
+    return n;
+}
+
+static void test_dispatch() {
+    uint8_t n = build_routes();
+    mqtt_register_commands(legacy_cmds, 1);
+    TEST_CHECK(mqtt_ha_register_routes(routes, n), "registration of %u routes refused", n);
+    test_session_up();
+    //--- LED topic + test/cmd + test/plain + the number topics
+    TEST_CHECK(host_stats().subscribes == 3 + TEST_NUMBERS, "%u topics subscribed", host_stats().subscribes);
+
+    for (int i = 0; i < TEST_COMMANDS; i++) {
+        TEST_CHECK(deliver("test/cmd", names[i]) == i, "%s not routed", names[i]);
+    }
+    TEST_CHECK(deliver("test/cmd", names[7], 1) == 7, "fragmented command not routed");
+    TEST_CHECK(deliver("test/cmd", "scene_99") == 100, "unknown command must reach the any route");
+    TEST_CHECK(deliver("test/number/3/set", "21.4") == 203 && last_has_value && last_value == 214,
+               "number: route %d, value %d", last_route, (int)last_value);
+    TEST_CHECK(deliver("test/number/0/set", "-7") == 200 && last_has_value && last_value == -70,
+               "number: route %d, value %d", last_route, (int)last_value);
+    TEST_CHECK(deliver("test/plain", "1.25") == 101 && last_value == 125,
+               "precision 2: route %d, value %d", last_route, (int)last_value);
+    TEST_CHECK(deliver("test/other", "scene_00") == -1, "unknown topic routed");
+
+    uint32_t legacy = legacy_calls;
+    TEST_CHECK(deliver("pico_env_sensor/led/brightness", "toggle") == -1 && legacy_calls == legacy + 1,
+               "legacy command not called");
+    TEST_CHECK(deliver("pico_env_sensor/led/brightness", "other") == -1 && legacy_calls == legacy + 1,
+               "unknown legacy command called");
+}
+
+//--- A refused registration changes nothing: same routes, same topics on the next session
+static void test_refused_keeps_previous() {
+    static const MqttHaRoute duplicate[] = {
+        { "test/new", "on", on_route, (void*)(intptr_t)300, 0, nullptr },
+        { "test/new", "on", on_route, (void*)(intptr_t)301, 0, nullptr },
+    };
+    static const CmdEntry duplicate_cmds[] = {
+        { "toggle", on_legacy },
+        { "toggle", on_legacy },
+    };
+    TEST_CHECK(!mqtt_ha_register_routes(duplicate, 2), "duplicate command accepted");
+    mqtt_register_commands(duplicate_cmds, 2);
+    TEST_CHECK(deliver("test/cmd", names[3]) == 3, "previous routes lost");
+    TEST_CHECK(deliver("test/new", "on") == -1, "refused route installed");
+    uint32_t legacy = legacy_calls;
+    deliver("pico_env_sensor/led/brightness", "toggle");
+    TEST_CHECK(legacy_calls == legacy + 1, "previous commands lost");
+
+    test_session_up();
+    TEST_CHECK(host_stats().subscribes == 3 + TEST_NUMBERS, "%u topics subscribed after a refused registration",
+               host_stats().subscribes);
+}
+
+static void test_refused() {
+    static const MqttHaRoute duplicate[] = {
+        { "test/a", "on", on_route, nullptr, 0, nullptr },
+        { "test/a", "on", on_route, nullptr, 0, nullptr },
+    };
+    static const MqttHaRoute two_any[] = {
+        { "test/a", nullptr, on_route, nullptr, 0, nullptr },
+        { "test/a", nullptr, on_route, nullptr, 0, nullptr },
+    };
+    static const MqttHaRoute too_long[] = {
+        { "test/a", "a_command_of_thirty_two_bytes___", on_route, nullptr, 0, nullptr },
+    };
+    static const MqttHaRoute invalid[] = {
+        { "test/a", "on", nullptr, nullptr, 0, nullptr },
+    };
+    static MqttHaRoute many[65];
+    for (int i = 0; i < 65; i++) many[i] = { "test/many", names[i % TEST_COMMANDS], on_route, nullptr, 0, nullptr };
+    for (int i = TEST_COMMANDS; i < 65; i++) many[i].topic = number_topics[i % TEST_NUMBERS];
+
+    mqtt_register_commands(nullptr, 0);
+    TEST_CHECK(!mqtt_ha_register_routes(duplicate, 2), "duplicate command accepted");
+    TEST_CHECK(!mqtt_ha_register_routes(two_any, 2), "two any routes on one topic accepted");
+    TEST_CHECK(!mqtt_ha_register_routes(too_long, 1), "command of MQTT_HA_TOKEN_MAX bytes accepted");
+    TEST_CHECK(!mqtt_ha_register_routes(invalid, 1), "route without handler accepted");
+    TEST_CHECK(!mqtt_ha_register_routes(many, 65), "more than MQTT_HA_MAX_ROUTES accepted");
+    TEST_CHECK(mqtt_ha_register_routes(nullptr, 0), "empty table refused");
+}
+
+void test_router() {
+    test_dispatch();
+    test_refused_keeps_previous();
+    test_refused();
+    //--- Leave no route behind
+    mqtt_register_commands(nullptr, 0);
+    mqtt_ha_register_routes(nullptr, 0);
+}
@@ -0,0 +1,118 @@
+//───────────────────────────────────────────────────────────────────
+//─── Streaming tokenizer tests ─────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// PayloadTokenizer (mqtt_ha_stream.h) fed with random fragment splits,
+// down to 1 byte, must report exactly the same events as with the whole
+// payload in one piece. A large raw payload reaches the data handler
+// whole, in order.
+#include "test.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include "mqtt_ha_stream.h"
+#include <random>
+#include <string>
+#include <string.h>
+
+//--- Every event as one line of text, to compare two runs
+static void log_event(const PayloadEvent* ev, void* arg) {
+    std::string* log = (std::string*)arg;
+    char line[160];
+    snprintf(line, sizeof(line), "%s|%s|%u|%d|%d|%ld|%08lx\n",
+             ev->key ? ev->key : "-", ev->text, ev->len, ev->truncated, ev->has_value,
+             (long)ev->value, (unsigned long)(ev->truncated ? 0 : ev->hash));
+    *log += line;
+}
+
+static std::string tokenize(const std::string& payload, std::mt19937& rng, bool split) {
+    std::string log;
+    PayloadTokenizer tok;
+    tok.begin(MQTT_HA_FNV_OFFSET, 1, log_event, &log);
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        size_t n = payload.size() - pos;
+        if (split) n = 1 + rng() % (n < 16 ? n : 16);
+        tok.feed((const uint8_t*)payload.data() + pos, n);
+        pos += n;
+    }
+    log += tok.finish() ? "ok\n" : "malformed\n";
+    return log;
+}
+
+static const char* const samples[] = {
+    "toggle", "ON", "off", "21.45", "-3.96", "+7", "1e5", "", "  spaced  ",
+    "a_command_name_longer_than_the_thirty_one_bytes_kept",
+    "99999999999999999999",
+    "{}",
+    "{\"state\":\"ON\",\"brightness\":128}",
+    "{ \"state\" : \"OFF\" , \"color\" : {\"r\":255,\"g\":[1,2,{\"x\":\"}\"}]} , \"temp\" : 21.55 }",
+    "{\"msg\":\"quote \\\" backslash \\\\ tab \\t unicode \\u0041\\u00e9\",\"ok\":true,\"n\":null}",
+    "{\"a_very_long_key_that_does_not_fit_the_buffer\":\"and a very long string value as well\"}",
+    "{\"broken\":",
+    "{\"x\" 1}",
+    "{\"a\":1}  trailing",
+};
+
+//--- Random JSON object with nested values, escapes and long strings
+static std::string random_json(std::mt19937& rng) {
+    static const char* const values[] = {
+        "1", "-12.345", "true", "false", "null", "\"ON\"", "\"text with \\\"escapes\\\"\"",
+        "{\"nested\":[1,{\"deep\":\"}]\"}]}", "[]", "\"0123456789012345678901234567890123456789\"",
+    };
+    std::string s = "{";
+    int members = rng() % 12;
+    for (int i = 0; i < members; i++) {
+        if (i) s += (rng() % 2) ? "," : " , ";
+        s += "\"key" + std::to_string(i) + "\":";
+        if (rng() % 3 == 0) s += " ";
+        s += values[rng() % (sizeof(values) / sizeof(values[0]))];
+    }
+    return s + "}";
+}
+
+static void test_splits() {
+    std::mt19937 rng(2024);
+    for (const char* sample : samples) {
+        std::string whole = tokenize(sample, rng, false);
+        for (int k = 0; k < 200; k++) {
+            TEST_CHECK(tokenize(sample, rng, true) == whole, "split changed the events of %s", sample);
+        }
+    }
+    for (int k = 0; k < 20000; k++) {
+        std::string json  = random_json(rng);
+        std::string whole = tokenize(json, rng, false);
+        TEST_CHECK(whole.find("malformed") == std::string::npos, "valid JSON reported malformed: %s", json.c_str());
+        TEST_CHECK(tokenize(json, rng, true) == whole, "split changed the events of %s", json.c_str());
+    }
+}
+
+static std::string blob_received;
+static uint32_t    blob_total = 0;
+static void on_blob(const MqttHaCommand* cmd) {}
+static void on_blob_data(const uint8_t* data, uint16_t len, uint32_t offset, uint32_t total, void* arg) {
+    if (offset != blob_received.size()) return;     // out of order: the comparison below fails
+    blob_received.append((const char*)data, len);
+    blob_total = total;
+}
+
+static const MqttHaRoute stream_routes[] = {
+    { "test/ota", nullptr, on_blob, nullptr, 0, on_blob_data },
+};
+
+static void test_raw_data() {
+    mqtt_register_commands(nullptr, 0);
+    mqtt_ha_register_routes(stream_routes, 1);
+    test_session_up();
+
+    std::mt19937 rng(7);
+    std::string blob(65536, '\0');
+    for (size_t i = 0; i < blob.size(); i++) blob[i] = (char)rng();
+    host_deliver("test/ota", blob.data(), blob.size(), 1024);
+    TEST_CHECK(blob_received == blob, "64 KB blob: %zu bytes received", blob_received.size());
+    TEST_CHECK(blob_total == blob.size(), "total %u", blob_total);
+    mqtt_ha_register_routes(nullptr, 0);
+}
+
+void test_stream() {
+    test_splits();
+    test_raw_data();
+}
@@ -1,68 +1,338 @@
 #include "mqtt_ha.h"
+#include <atomic>
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
-#include "pico/stdlib.h"
-#include "pico/cyw43_arch.h"
-#include "lwip/apps/mqtt.h"
-#include "lwip/dns.h"
-
-//─── Configuration ─────────────────────────────────────────────────
-#define DEVICE_ID        "pico_env_sensor"
-#define DEVICE_NAME      "Pico Env Sensor"
-#define STATE_TOPIC      "pico_env_sensor/state"
-#define DISCOVERY_PREFIX "homeassistant"
-#define BUFFER_PAYLOAD_MAX 512
-//──── Commands ─────────────────────────────────────────────────────
-// Need to have a Command Topic if we want to perform actions from Home Assistant.
-#define LED_CMD_TOPIC    "pico_env_sensor/led/brightness"
-
-static mqtt_client_t* mqtt_client = nullptr;
+#include "mqtt_ha_internal.h"   // configuration, what the other mqtt_ha_*.cpp share with this file
+#include "mqtt_ha_ring.h"
+#include "mqtt_ha_ctstring.h"
+#include "mqtt_ha_stream.h"
+#include "mqtt_ha_spsc.h"    // core 0 <-> core 1 queues (MQTT_HA_DUAL_CORE)
+#include "mqtt_ha_store.h"   // record kept in flash across reboots
+#include "mqtt_ha_mqtt.h"    // built-in MQTT client (MQTT_HA_MQTT_BUILTIN)
+
+mqtt_client_t* mqtt_ha_lib::mqtt_client = nullptr;
 static ip_addr_t broker_addr;
-static bool connected = false;
-static bool discovery_done = false;
+std::atomic<bool> mqtt_ha_lib::connected{false};
+bool mqtt_ha_lib::discovery_done = false;
 static uint16_t broker_port_g = 1883;
-//--- Buffer for incoming MQTT payloads (e.g., commands)
-static char    buffer_payload[BUFFER_PAYLOAD_MAX];
-static size_t  buffer_size       = 0;
-//--- Buffer total length will be set when the first header/packet
+static char wifi_ssid_g[33];        // 32 chars max for an SSID
+static char wifi_password_g[64];    // 63 chars max for a WPA2 passphrase
+BrokerEndpoint mqtt_ha_lib::brokers[MQTT_HA_MAX_BROKERS];
+uint8_t        mqtt_ha_lib::broker_count   = 1;
+uint8_t        mqtt_ha_lib::broker_current = 0;   // the one used, sticky (see broker_on_failure())
+//--- Incoming MQTT payloads (e.g., commands) are tokenized as lwIP delivers them,
+//--- no payload buffer (see mqtt_ha_stream.h)
+static PayloadTokenizer in_stream;
+//--- Total length will be set when the first header/packet
 //--- is reveived in mqtt_incoming_publish_callback()
-static u32_t   buffer_total     = 0;
-static bool    buffer_overflow  = false;
+static u32_t   in_total   = 0;
+static u32_t   in_offset  = 0;
+
+static void backlog_on_disconnect();
+static void outbox_on_disconnect();
+
+//--- Connection state machine (see "CONNECTION STATE MACHINE" below)
+std::atomic<MqttHaState> mqtt_ha_lib::conn_state{MQTT_HA_IDLE};
+static uint32_t         state_since_ms = 0;
+static MqttHaConnStats  conn_stats     = {};
+//--- Errors reported by lwIP callbacks are only flagged here,
+//--- mqtt_poll() handles them (never tear down the client from inside lwIP).
+static bool             conn_error     = false;
+
+static void conn_set_state(MqttHaState next) {
+    uint32_t now = now_ms();
+    conn_stats.time_in_state_ms[conn_state] += now - state_since_ms;
+    state_since_ms = now;
+    conn_state     = next;
+}
+
+//--- lwIP callbacks only move the state machine forward while it waits for them
+static bool conn_in_session() {
+    return conn_state >= MQTT_HA_MQTT_CONNECT && conn_state <= MQTT_HA_ONLINE;
+}
+
+//--- Runtime metrics, counted from the callbacks (see "RUNTIME METRICS" below)
+MqttHaMetrics mqtt_ha_lib::metrics = {};
+static uint32_t      metrics_sessions = 0;
+static uint32_t      metrics_due_ms   = 0;     // next diagnostics message
+static const uint32_t hist_bounds[MQTT_HA_HIST_BUCKETS - 1] = { 10, 20, 50, 100, 200, 500, 1000 };
+
+static void hist_add(uint32_t* hist, uint32_t* max, uint32_t v) {
+    uint8_t b = 0;
+    while (b < MQTT_HA_HIST_BUCKETS - 1 && v >= hist_bounds[b]) b++;
+    hist[b]++;
+    if (v > *max) *max = v;
+}
+
+static void metrics_error(err_t err) {
+    uint32_t code = (err < 0) ? (uint32_t)-err : 0;
+    metrics.errors[code < MQTT_HA_ERR_CODES ? code : 0]++;
+}
 
 //───────────────────────────────────────────────────────────────────
-//─── MQTT COMMANDS DISPATCH ────────────────────────────────────────
+//─── MQTT COMMANDS ROUTER ──────────────────────────────────────────
 //───────────────────────────────────────────────────────────────────
-// mqtt_register_commands() must be called to register the command handlers for incoming MQTT commands.
-// The command handlers will be called if the incoming MQTT Command message matches the command name in the table.
-// Must be in the form of
-//      struct CmdEntry {
-//          name: string
-//          handler: function pointer
-//      };
-static const CmdEntry* cmd_table  = nullptr;
-static size_t          cmd_count  = 0;
+// Two ways to declare commands, both end up in the same index:
+//  - mqtt_register_commands() : CmdEntry {name, handler}, payload == name on LED_CMD_TOPIC (original API)
+//  - mqtt_ha_register_routes(): MqttHaRoute {topic, command, handler, arg, precision} on any topic.
+//    command nullptr matches any payload, parsed into a value for the handler
+//    (HA numbers, switches, selects, brightness...).
+//
+// The index is an open addressing hash table of ROUTER_SLOTS bytes, built once at registration:
+//      key FNV-1a(topic)                 -> topic entry   (one of ours? "any payload" route?)
+//      key FNV-1a(topic \x1f command)    -> command entry (exact payload)
+// The topic hash is computed once when a message starts and the payload continues it:
+// a lookup is one hash, usually one probe and one strcmp to confirm, whatever the number of routes.
+// A slot holds 0 (empty), 1..127 (command entry + 1) or 128 + topic index.
+static const CmdEntry*    cmd_table   = nullptr;
+static size_t             cmd_count   = 0;
+static const MqttHaRoute* route_table = nullptr;
+static uint8_t            route_count = 0;
 
-void mqtt_register_commands(const CmdEntry* table, uint8_t count) {
-    cmd_table = table;
-    cmd_count = count;
+struct RouterTopic {
+    const char* topic;
+    uint32_t    hash;
+    int8_t      any;        // command entry matching any payload, -1 if none
+};
+
+struct RouterEntry {
+    uint32_t    hash;       // FNV-1a(topic \x1f command)
+    const char* command;    // nullptr: any payload
+    uint8_t     topic;      // index in router_topics
+    bool        legacy;     // index in cmd_table (true) or route_table (false)
+    uint8_t     index;
+};
+
+static_assert(MQTT_HA_MAX_ROUTES < 128 && MQTT_HA_MAX_TOPICS <= 128, "router slots are one byte");
+static_assert((ROUTER_SLOTS & (ROUTER_SLOTS - 1)) == 0, "ROUTER_SLOTS must be a power of 2");
+static_assert(ROUTER_SLOTS >= 2 * (MQTT_HA_MAX_ROUTES + MQTT_HA_MAX_TOPICS), "ROUTER_SLOTS too small, keep the table half empty");
+
+static RouterTopic router_topics[MQTT_HA_MAX_TOPICS];
+static RouterEntry router_entries[MQTT_HA_MAX_ROUTES];
+static uint8_t     router_topic_count = 0;
+static uint8_t     router_entry_count = 0;
+static uint8_t     router_slots[ROUTER_SLOTS];
+static bool        router_ready       = false;
+
+#define ROUTER_SEPARATOR 0x1f       // ASCII unit separator, never in a topic
+
+static uint32_t fnv1a(uint32_t hash, const char* s, size_t len) {
+    for (size_t i = 0; i < len; i++) {
+        hash ^= (uint8_t)s[i];
+        hash *= MQTT_HA_FNV_PRIME;
+    }
+    return hash;
 }
 
-//--- Check if the cmd name is in the cmd_table,
-//--- then call the corresponding handler function.
-static void dispatch_command(const char* cmd) {
-    if (cmd_table == nullptr) {
-        printf("MQTT: No command table registered\n");
-        return;
+//--- Hash state after "topic \x1f": the tokenizer continues it with the payload
+static uint32_t router_command_seed(uint32_t topic_hash) {
+    return (topic_hash ^ ROUTER_SEPARATOR) * MQTT_HA_FNV_PRIME;
+}
+
+static uint32_t router_command_key(uint32_t topic_hash, const char* command, size_t len) {
+    return fnv1a(router_command_seed(topic_hash), command, len);
+}
+
+static void router_slot_insert(uint32_t hash, uint8_t ref) {
+    uint32_t i = hash & (ROUTER_SLOTS - 1);
+    while (router_slots[i] != 0) i = (i + 1) & (ROUTER_SLOTS - 1);
+    router_slots[i] = ref;
+}
+
+//--- @return topic index, -1 if it is not a command topic
+static int router_find_topic(const char* topic, uint32_t hash) {
+    for (uint32_t i = hash & (ROUTER_SLOTS - 1); router_slots[i] != 0; i = (i + 1) & (ROUTER_SLOTS - 1)) {
+        uint8_t ref = router_slots[i];
+        if (ref < 128) continue;
+        const RouterTopic& t = router_topics[ref - 128];
+        if (t.hash == hash && strcmp(t.topic, topic) == 0) return ref - 128;
+    }
+    return -1;
+}
+
+//--- @return command entry for this exact payload, -1 if none
+static int router_find_command(uint8_t topic, uint32_t key, const char* command) {
+    for (uint32_t i = key & (ROUTER_SLOTS - 1); router_slots[i] != 0; i = (i + 1) & (ROUTER_SLOTS - 1)) {
+        uint8_t ref = router_slots[i];
+        if (ref >= 128) continue;
+        const RouterEntry& e = router_entries[ref - 1];
+        if (e.hash == key && e.topic == topic && strcmp(e.command, command) == 0) return ref - 1;
+    }
+    return -1;
+}
+
+static int router_add_topic(const char* topic) {
+    uint32_t hash = fnv1a(MQTT_HA_FNV_OFFSET, topic, strlen(topic));
+    int t = router_find_topic(topic, hash);
+    if (t >= 0) return t;
+    if (router_topic_count >= MQTT_HA_MAX_TOPICS) return -1;
+
+    router_topics[router_topic_count] = { topic, hash, -1 };
+    router_slot_insert(hash, (uint8_t)(128 + router_topic_count));
+    return router_topic_count++;
+}
+
+//--- Entries are checked by router_check() first: adding one cannot fail
+static void router_add(const char* topic, const char* command, bool legacy, uint8_t index) {
+    int t = router_add_topic(topic);
+
+    RouterEntry& e = router_entries[router_entry_count];
+    e.command = command;
+    e.topic   = (uint8_t)t;
+    e.legacy  = legacy;
+    e.index   = index;
+    if (command == nullptr) {
+        e.hash = 0;
+        router_topics[t].any = (int8_t)router_entry_count;
+    } else {
+        e.hash = router_command_key(router_topics[t].hash, command, strlen(command));
+        router_slot_insert(e.hash, (uint8_t)(router_entry_count + 1));
+    }
+    router_entry_count++;
+}
+
+//--- Entry i of the candidate tables: the CmdEntry commands (on LED_CMD_TOPIC), then the routes
+static void router_entry_of(const CmdEntry* cmds, size_t ncmd, const MqttHaRoute* routes, size_t i,
+                            const char** topic, const char** command) {
+    if (i < ncmd) {
+        *topic   = LED_CMD_TOPIC;
+        *command = cmds[i].name;
+    } else {
+        *topic   = routes[i - ncmd].topic;
+        *command = routes[i - ncmd].command;
+    }
+}
+
+//--- Would both tables fit the index? Checked before touching it (a few dozen entries,
+//--- compared pairwise), so a refused registration leaves the previous one in place.
+static bool router_check(const CmdEntry* cmds, size_t ncmd, const MqttHaRoute* routes, size_t nroute) {
+    size_t n = ncmd + nroute;
+    if (n > MQTT_HA_MAX_ROUTES) return false;
+    size_t topics = 1;                  // LED_CMD_TOPIC
+    for (size_t i = 0; i < n; i++) {
+        const char *topic, *command;
+        router_entry_of(cmds, ncmd, routes, i, &topic, &command);
+        if (topic == nullptr) return false;
+        //--- Longer commands could not be compared: the tokenizer keeps MQTT_HA_TOKEN_MAX - 1 bytes
+        if (command != nullptr && strlen(command) >= MQTT_HA_TOKEN_MAX) return false;
+        bool new_topic = strcmp(topic, LED_CMD_TOPIC) != 0;
+        for (size_t j = 0; j < i; j++) {
+            const char *other_topic, *other_command;
+            router_entry_of(cmds, ncmd, routes, j, &other_topic, &other_command);
+            if (strcmp(topic, other_topic) != 0) continue;
+            new_topic = false;
+            //--- Only one "any payload" route per topic, no duplicate command
+            if (command == nullptr && other_command == nullptr) return false;
+            if (command != nullptr && other_command != nullptr && strcmp(command, other_command) == 0) return false;
+        }
+        if (new_topic && ++topics > MQTT_HA_MAX_TOPICS) return false;
+    }
+    return true;
+}
+
+//--- (Re)build the whole index from both tables, once they are known to fit.
+//--- @return false (tables and index unchanged) if they do not
+static bool router_build(const CmdEntry* cmds, size_t ncmd, const MqttHaRoute* routes, uint8_t nroute) {
+    if (!router_check(cmds, ncmd, routes, nroute)) {
+        LOG_ERROR("MQTT: Invalid or duplicate route, or router full (max %d routes, %d topics)\n",
+               MQTT_HA_MAX_ROUTES, MQTT_HA_MAX_TOPICS);
+        return false;
     }
+    cmd_table   = cmds;
+    cmd_count   = ncmd;
+    route_table = routes;
+    route_count = nroute;
+
+    memset(router_slots, 0, sizeof(router_slots));
+    router_topic_count = 0;
+    router_entry_count = 0;
+    //--- Always subscribed: the HA button of the LED (button discovery) publishes there
+    router_add_topic(LED_CMD_TOPIC);
     for (size_t i = 0; i < cmd_count; i++) {
-        if (strcmp(cmd, cmd_table[i].name) == 0) {
-            cmd_table[i].handler();
-            return;
+        router_add(LED_CMD_TOPIC, cmd_table[i].name, true, (uint8_t)i);
+    }
+    for (uint8_t i = 0; i < route_count; i++) {
+        router_add(route_table[i].topic, route_table[i].command, false, i);
+    }
+    router_ready = true;
+    return true;
+}
+
+void mqtt_register_commands(const CmdEntry* table, uint8_t count) {
+    router_build(table, table != nullptr ? count : 0, route_table, route_count);
+}
+
+bool mqtt_ha_register_routes(const MqttHaRoute* table, uint8_t count) {
+    for (uint8_t i = 0; table != nullptr && i < count; i++) {
+        if (table[i].handler == nullptr || table[i].precision > 3 ||
+            (table[i].data != nullptr && table[i].command != nullptr)) {
+            LOG_ERROR("MQTT: Invalid route %u\n", i);
+            return false;
         }
     }
-    printf("MQTT: Unknown command: %s\n", cmd);
+    return router_build(cmd_table, cmd_count, table, table != nullptr ? count : 0);
+}
+
+//--- Topic of the message being received (set by mqtt_incoming_publish_callback)
+static int in_topic = -1;
+
+//--- "any payload" route of in_topic, nullptr if none (or a CmdEntry)
+static const MqttHaRoute* router_any_route() {
+    int e = router_topics[in_topic].any;
+    if (e < 0 || router_entries[e].legacy) return nullptr;
+    return &route_table[router_entries[e].index];
+}
+
+static void command_call(uint8_t e, const char* topic, const PayloadEvent* ev);
+#if MQTT_HA_DUAL_CORE
+static void command_forward(uint8_t e, const char* topic, const PayloadEvent* ev);
+#endif
+
+//--- Called by the tokenizer: the whole plain payload, or one JSON member.
+//--- Find the route on in_topic, then call its handler.
+static void dispatch_command(const PayloadEvent* ev, void* arg) {
+    if (in_topic < 0) return;
+    const RouterTopic& t = router_topics[in_topic];
+
+    //--- Exact command (plain payloads only): the tokenizer hash continues the topic hash
+    int e = -1;
+    if (ev->key == nullptr && !ev->truncated) {
+        e = router_find_command((uint8_t)in_topic, ev->hash, ev->text);
+    }
+    if (e < 0) e = t.any;
+    if (e < 0) {
+        LOG_WARN("MQTT: Unknown command on %s (%u bytes)\n", t.topic, ev->len);
+        return;
+    }
+
+#if MQTT_HA_DUAL_CORE
+    //--- The handler runs on the application core (see "DUAL-CORE MODE" below)
+    command_forward((uint8_t)e, t.topic, ev);
+#else
+    command_call((uint8_t)e, t.topic, ev);
+#endif
 }
 
+//--- Router entry e -> its handler
+static void command_call(uint8_t e, const char* topic, const PayloadEvent* ev) {
+    const RouterEntry& entry = router_entries[e];
+    if (entry.legacy) {
+        cmd_table[entry.index].handler();
+        return;
+    }
+    const MqttHaRoute& r = route_table[entry.index];
+    MqttHaCommand cmd;
+    cmd.topic     = topic;
+    cmd.key       = ev->key;
+    cmd.payload   = ev->text;
+    cmd.len       = ev->len;
+    cmd.truncated = ev->truncated;
+    cmd.has_value = ev->has_value;
+    cmd.value     = ev->value;
+    cmd.arg       = r.arg;
+    r.handler(&cmd);
+}
 
 //───────────────────────────────────────────────────────────────────
 //─── MQTT Callbacks ────────────────────────────────────────────────
@@ -76,10 +346,13 @@ static void mqtt_connection_callback(
     mqtt_connection_status_t status     // connection status
 ) {
     if (status == MQTT_CONNECT_ACCEPTED) {
-        printf("MQTT: Connected to broker\n");
+        LOG_INFO("MQTT: Connected to broker\n");
+        tls_on_connack();
+        if (metrics_sessions++ > 0) metrics.reconnects++;
         connected = true;
         discovery_done = false;  // Trigger discovery in the main loop
-        printf("MQTT: Publish Discovery for HA\n");
+        conn_set_state(MQTT_HA_DISCOVERY);
+        LOG_DEBUG("MQTT: Publish Discovery for HA\n");
         // Publish discovery immediately upon connection
         // for now-on, mqtt networks events are Async using callbacks.
         mqtt_ha_publish_discovery();
@@ -87,8 +360,13 @@ static void mqtt_connection_callback(
         // to ensure the subscription is done after discovery, and not before.
         // As well to ensure lwIP max request is not reached...
     } else {
-        printf("MQTT: Connection failed, status=%d\n", status);
+        LOG_WARN("MQTT: Connection failed, status=%d\n", status);
         connected = false;
+        discovery_done = false;
+        outbox_on_disconnect();
+        backlog_on_disconnect();
+        //--- mqtt_poll() will back off and reconnect
+        if (conn_in_session()) conn_error = true;
     }
 }
 
@@ -99,7 +377,7 @@ static void mqtt_publish_request_callback(
     err_t result    // Result of the publish request (ERR_OK if successful)
 ) {
     if (result != ERR_OK) {
-        printf("MQTT: Publish error (%d)\n", result);
+        LOG_ERROR("MQTT: Publish error (%d)\n", result);
     }
 }
 
@@ -112,58 +390,102 @@ static void mqtt_publish_request_callback(
 //--- Callback for incoming messages on subscribed topics (e.g., command topic)
 //--- Callback trigger on first header/packet received by lwIP.
 static void mqtt_incoming_publish_callback(void *arg, const char *topic, u32_t tot_len) {
-    printf("MQTT: Incoming message on topic: %s (%lu bytes)\n", topic, tot_len);
-    //--- BUFFER RESET
-    buffer_size      = 0;
-    buffer_total  = tot_len;
-    buffer_overflow = (tot_len >= BUFFER_PAYLOAD_MAX); // détection dépassement
-
-    if (buffer_overflow) {
-        printf("MQTT: WARNING payload is too big (%lu > %d)!\n",
-               tot_len, BUFFER_PAYLOAD_MAX);
+    metrics.bytes_received += (uint32_t)strlen(topic) + tot_len;
+    //--- ROUTE: which command topic is it? (-1: not one of ours, the payload is ignored)
+    in_topic  = router_find_topic(topic, fnv1a(MQTT_HA_FNV_OFFSET, topic, strlen(topic)));
+    in_total  = tot_len;
+    in_offset = 0;
+    if (in_topic < 0) {
+        //--- the topic string belongs to lwIP: only its length is logged
+        LOG_WARN("MQTT: WARNING no route for incoming topic (%u chars, %lu bytes)\n", (unsigned)strlen(topic), (unsigned long)tot_len);
+        return;
     }
+    LOG_DEBUG("MQTT: Incoming message on topic: %s (%lu bytes)\n", router_topics[in_topic].topic, (unsigned long)tot_len);
+
+    //--- TOKENIZER RESET: no size limit, the payload is never stored
+    const MqttHaRoute* any = router_any_route();
+    in_stream.begin(router_command_seed(router_topics[in_topic].hash),
+                    any ? any->precision : 0, dispatch_command, nullptr);
 }
 
 //--- Callback for incoming message data (payload) on subscribed topics.
 //--- If payload is larger than packet size, will be called multiple times
 //--- until MQTT_DATA_FLAG_LAST is set, indicating the last fragment of the payload.
+//--- Each fragment is consumed in place, straight from the lwIP buffer.
 static void mqtt_incoming_data_callback(void *arg, const u8_t *data, u16_t packet_size, u8_t flags) {
-    //--- OVERFLOW check is done in mqtt_incoming_publish_callback()
-    if (!buffer_overflow) {
-        //--- Append incoming data/packet to buffer
-        size_t size_left = BUFFER_PAYLOAD_MAX - 1 - buffer_size;
-        // "if" checking may not be necessary...
-        size_t final_packet_size = (packet_size < size_left) ? packet_size : size_left;
-        //--- Append data to buffer_payload, given the current "offset" (buffer_size) and the "final_packet_size"
-        memcpy(buffer_payload + buffer_size, data, final_packet_size);
-        //--- Update actual buffer_size
-        buffer_size += final_packet_size;
-    } else {
-        printf("MQTT: Payload ignored (overflow)\n");
-        return;
+    if (in_topic < 0) return;   // no route, ignored
+
+    //--- Raw fragments first for the routes that want them (large config / OTA-style messages)
+    const MqttHaRoute* any = router_any_route();
+    if (any && any->data) {
+        any->data(data, packet_size, in_offset, in_total, any->arg);
     }
+    in_offset += packet_size;
+    //--- JSON members are dispatched from here as soon as they are complete
+    in_stream.feed(data, packet_size);
 
     //--- For the last packet/fragment of the payload containing the MQTT_DATA_FLAG_LAST flag
     if (flags & MQTT_DATA_FLAG_LAST) {
-        //--- Null-terminate the buffer to make it a valid C-string
-        buffer_payload[buffer_size] = '\0';
-        printf("MQTT: Payload received (%zu bytes): %s\n", buffer_size, buffer_payload);
-        //--- COMMAND DISPATCH
-        dispatch_command(buffer_payload);
+        LOG_DEBUG("MQTT: Payload received (%lu bytes)\n", (unsigned long)in_stream.bytes());
+        //--- COMMAND DISPATCH of a plain payload
+        if (!in_stream.finish()) {
+            LOG_WARN("MQTT: Malformed JSON payload on %s\n", router_topics[in_topic].topic);
+        }
+        in_topic = -1;
+    }
+}
+
+//--- Every command topic of the router is subscribed in one pass, at most
+//--- SUBSCRIBE_IN_FLIGHT at a time: the next ones are sent from the SUBACKs
+//--- (or from mqtt_poll() if lwIP had no free request slot).
+static uint8_t sub_next      = 0;   // next topic to subscribe
+static uint8_t sub_in_flight = 0;
+static uint8_t sub_acked     = 0;
+
+static void mqtt_subscribe_request_callback(void *arg, err_t result);
+
+static void subscribe_next_topics() {
+    while (sub_in_flight < SUBSCRIBE_IN_FLIGHT && sub_next < router_topic_count) {
+        //--- SUBSCRIBE to the Command Topic, with a callback to confirm subscription.
+        err_t err = mqtt_subscribe(
+            mqtt_client,                        // MQTT client (is a pointer)
+            router_topics[sub_next].topic,      // Topic to subscribe to (e.g., command topic)
+            1,                                  // QoS level for the subscription (0, 1, or 2)
+            mqtt_subscribe_request_callback,    // Callback to confirm subscription
+            nullptr                             // User supplied argument to subscription callback
+        );
+        //--- ERR_MEM: lwIP request slots are busy (states, replays), mqtt_poll() tries again
+        if (err != ERR_OK) return;
+        sub_next++;
+        sub_in_flight++;
     }
 }
 
 //--- Called when the subscription is confirmed by the broker
 static void mqtt_subscribe_request_callback(void *arg, err_t result) {
+    if (sub_in_flight > 0) sub_in_flight--;
     if (result == ERR_OK) {
-        printf("MQTT: Subscription confirmed\n");
+        sub_acked++;
+        LOG_DEBUG("MQTT: Subscription confirmed (%u/%u)\n", sub_acked, router_topic_count);
+        //--- Last step of the connection sequence
+        if (sub_acked >= router_topic_count) {
+            if (conn_state == MQTT_HA_SUBSCRIBE) {
+                conn_set_state(MQTT_HA_ONLINE);
+                discovery_on_online();
+            }
+        } else {
+            subscribe_next_topics();
+        }
     } else {
-        printf("MQTT: Subscription error (%d)\n", result);
+        LOG_ERROR("MQTT: Subscription error (%d)\n", result);
+        if (conn_state == MQTT_HA_SUBSCRIBE) conn_error = true;
     }
 }
 
-//--- SUBSCRIBE to Command Topic and set callbacks for incoming messages on that topic
+//--- SUBSCRIBE to every Command Topic and set callbacks for incoming messages on them
 void mqtt_subscribe_commands() {
+    if (!router_ready) router_build(cmd_table, cmd_count, route_table, route_count);
+
     //--- set Callbacks BEFORE subscribing to the topic, so they are ready to handle incoming messages immediately.
     mqtt_set_inpub_callback(
         mqtt_client,                    // MQTT client (is a pointer)
@@ -172,14 +494,11 @@ void mqtt_subscribe_commands() {
         nullptr                         // User supplied argument to both callbacks
     );
 
-    //--- Finally SUBSCRIBE to the Command Topic, with a callback to confirm subscription.
-    mqtt_subscribe(
-        mqtt_client,                        // MQTT client (is a pointer)
-        LED_CMD_TOPIC,                      // Topic to subscribe to (e.g., command topic)
-        1,                                  // QoS level for the subscription (0, 1, or 2)  
-        mqtt_subscribe_request_callback,    // Callback to confirm subscription
-        nullptr                             // User supplied argument to subscription callback
-    );
+    //--- Finally SUBSCRIBE to the Command Topics (the first ones now, the others from the SUBACKs).
+    sub_next      = 0;
+    sub_in_flight = 0;
+    sub_acked     = 0;
+    subscribe_next_topics();
 }
 
 //───────────────────────────────────────────────────────────────────
@@ -187,102 +506,441 @@ void mqtt_subscribe_commands() {
 //───────────────────────────────────────────────────────────────────
 // Publish a message (payload) to a specified MQTT topic via the broker.
 // The broker will then forward the message to any subscribed clients, like Home Assistant.
-// The retain flag indicates if the broker should keep the last message for new subscribers.
-static bool mqtt_publish_msg(const char* topic, const char* payload, bool retain, mqtt_request_cb_t cb = nullptr, void* arg = nullptr) {
+// QoS and retain flag come from the policy of the topic (mqtt_ha_set_topic_policy()):
+// the retain flag indicates if the broker should keep the last message for new subscribers.
+// payload_len is the exact payload length, when the caller already knows it (no strlen).
+//
+// lwIP accepts MQTT_REQ_MAX_IN_FLIGHT requests (publish + subscribe) at a time and fails
+// with ERR_MEM beyond. Our publishes use at most PUBLISH_IN_FLIGHT of them: each one holds
+// a PubSlot with the caller callback until lwIP completes it (PUBACK for QoS 1, sent for QoS 0).
+MqttHaTopicPolicy mqtt_ha_lib::topic_policy[MQTT_HA_TOPIC_COUNT] = {
+    { 1, true  },   // DISCOVERY     : HA must get it, and keep it for its restarts
+    { 1, true  },   // AVAILABILITY  : same retain as the Last Will
+    { 1, false },   // STATE
+    { 1, false },   // REPLAY
+    { 0, false },   // DIAGNOSTIC    : slow and periodic, the next one replaces a lost one
+    { 1, false },   // BATCH         : K samples each, worth a PUBACK
+};
+//--- For the logs: topic strings may be reused buffers (discovery chunks)
+static const char* const topic_class_name[MQTT_HA_TOPIC_COUNT] = {
+    "discovery", "availability", "state", "replay", "diagnostics", "batch",
+};
+
+struct PubSlot {
+    bool              used;
+    mqtt_request_cb_t cb;
+    void*             arg;
+    uint32_t          sent_us;  // mqtt_publish() time, for the publish -> ack latency
+};
+static PubSlot pub_slots[PUBLISH_IN_FLIGHT];
+uint8_t        mqtt_ha_lib::pub_in_flight = 0;
+
+static void outbox_flush();
+
+bool mqtt_ha_set_topic_policy(MqttHaTopic topic, uint8_t qos, bool retain) {
+    if (topic >= MQTT_HA_TOPIC_COUNT || qos > 2) return false;
+    topic_policy[topic].qos    = qos;
+    topic_policy[topic].retain = retain;
+    return true;
+}
+
+//--- lwIP completed one of our publishes: free its slot, call the caller callback,
+//--- then send what waits in the outbound queue.
+static void mqtt_publish_slot_callback(void *arg, err_t result) {
+    PubSlot* slot = (PubSlot*)arg;
+    if (!slot->used) return;
+    if (result == ERR_OK) {
+        metrics.publishes++;
+        hist_add(metrics.ack_ms, &metrics.ack_max_ms, (time_us_32() - slot->sent_us) / 1000);
+    } else {
+        metrics_error(result);
+    }
+    mqtt_request_cb_t cb     = slot->cb;
+    void*             cb_arg = slot->arg;
+    slot->used = false;
+    pub_in_flight--;
+    cb(cb_arg, result);
+    outbox_flush();
+}
+
+//--- lwIP drops its pending requests on disconnect, their callbacks will never fire.
+static void publish_slots_reset() {
+    memset(pub_slots, 0, sizeof(pub_slots));
+    pub_in_flight = 0;
+}
+
+//--- @return false if not connected, no free slot, or lwIP refused it (ERR_MEM: try again later)
+bool mqtt_ha_lib::mqtt_publish_msg(MqttHaTopic cls, const char* topic, const char* payload, size_t payload_len, mqtt_request_cb_t cb, void* arg) {
     if (!connected || !mqtt_client) return false;
-    
+
+    PubSlot* slot = nullptr;
+    for (uint8_t i = 0; i < PUBLISH_IN_FLIGHT && slot == nullptr; i++) {
+        if (!pub_slots[i].used) slot = &pub_slots[i];
+    }
+    if (slot == nullptr) return false;
+
     // Simple Default Callback: if no callback is provided.
-    mqtt_request_cb_t final_cb = (cb != nullptr) ? cb : mqtt_publish_request_callback;
+    slot->cb      = (cb != nullptr) ? cb : mqtt_publish_request_callback;
+    slot->arg     = arg;
+    slot->sent_us = time_us_32();
 
     err_t err = mqtt_publish(
-        mqtt_client,        // current MQTT client (is a pointer)
-        topic,              // topic – Publish topic string
-        payload,            // payload – Data to publish (NULL is allowed)
-        strlen(payload),    // payload_length – Length of payload (0 is allowed)
-        1,                  // qos – Quality of service, 0 1 or 2
-        retain ? 1 : 0,     // retain – MQTT retain flag
-        final_cb,           // cb – Callback to call when publish is complete or has timed out
-        arg                 // arg – User supplied argument to publish callback
+        mqtt_client,                        // current MQTT client (is a pointer)
+        topic,                              // topic – Publish topic string
+        payload,                            // payload – Data to publish (NULL is allowed)
+        (u16_t)payload_len,                 // payload_length – Length of payload (0 is allowed)
+        topic_policy[cls].qos,              // qos – Quality of service, 0 1 or 2
+        topic_policy[cls].retain ? 1 : 0,   // retain – MQTT retain flag
+        mqtt_publish_slot_callback,         // cb – Callback to call when publish is complete or has timed out
+        slot                                // arg – our slot, it holds the caller callback and argument
     );
 
     if (err != ERR_OK) {
-        printf("MQTT: Publish error %d on %s\n", err, topic);
+        if (err != ERR_MEM) LOG_ERROR("MQTT: Publish error %d (%s)\n", err, topic_class_name[cls]);
+        metrics_error(err);
         return false;
     }
+    slot->used = true;
+    pub_in_flight++;
+#if MQTT_HA_MQTT_BUILTIN
+    //--- As written: a topic alias makes it shorter than the 3.1.1 formula below
+    metrics.bytes_sent += (uint32_t)mqtt_ha_mqtt_last_publish(mqtt_client);
+#else
+    //--- PUBLISH packet: fixed header (1 + remaining length) + topic (2 + n) + packet id (QoS > 0) + payload
+    uint32_t remaining = 2 + (uint32_t)strlen(topic) + (topic_policy[cls].qos > 0 ? 2 : 0) + (uint32_t)payload_len;
+    metrics.bytes_sent += 1 + (remaining < 128 ? 1 : remaining < 16384 ? 2 : 3) + remaining;
+#endif
     return true;
 }
 
 //───────────────────────────────────────────────────────────────────
-//─── Flush and Wait (lwIP processing) ──────────────────────────────
+//─── RAM (scratch arena, stack high-water) ─────────────────────────
 //───────────────────────────────────────────────────────────────────
-static void mqtt_flush_and_wait(uint32_t ms) {
-    for (uint32_t i = 0; i < ms / 10; i++) {
-        cyw43_arch_poll();
-        sleep_ms(10);
+// Payloads and runtime topics are built in one arena, inside a ScratchScope
+// (mqtt_ha_arena.h) that ends once lwIP has copied the message: the arena only
+// has to hold the largest one. Nothing built there waits in the outbound queue,
+// queued messages are built when they are sent.
+// Stack: MQTT_HA_STACK_WATCH bytes below the frame of wifi_mqtt_init() (net_core_main()
+// in dual-core mode) are painted, the deepest byte overwritten since is the high-water
+// mark of the network side: lwIP and CYW43 callbacks, payload building, logs.
+static constexpr size_t size_max(size_t a, size_t b) { return a > b ? a : b; }
+//--- One message at a time: its topic (discovery, bridged devices) + the largest payload
+static constexpr size_t scratch_need = ScratchArena::round(TOPIC_MAX) + ScratchArena::round(
+    size_max(size_max(STATE_PAYLOAD_MAX, METRICS_PAYLOAD_MAX), size_max(BATCH_PAYLOAD_MAX, DISCOVERY_CHUNK_MAX)));
+static constexpr size_t scratch_size = MQTT_HA_SCRATCH_SIZE ? MQTT_HA_SCRATCH_SIZE : scratch_need;
+static_assert(scratch_size >= scratch_need, "MQTT_HA_SCRATCH_SIZE smaller than the largest payload + TOPIC_MAX");
+
+alignas(4) static uint8_t scratch_mem[scratch_size];
+ScratchArena              mqtt_ha_lib::scratch(scratch_mem, sizeof(scratch_mem));
+
+#define STACK_PAINT 0xA5u
+static const volatile uint8_t* stack_low  = nullptr;     // lowest painted byte
+static const volatile uint8_t* stack_high = nullptr;     // first byte above the painted ones
+static uintptr_t               stack_frame = 0;          // frame the depth is counted from
+
+//--- Paint the free stack below frame. Not inlined: the painted bytes are below its own
+//--- frame (and the 128-byte red zone of the host ABI), volatile: no memset() call down there.
+__attribute__((noinline)) static void stack_watch_start(const void* frame) {
+    scratch.reset_peak();               // both high-water marks count from wifi_mqtt_init()
+    if (MQTT_HA_STACK_WATCH == 0) return;
+    volatile uint8_t here = 0;
+    uintptr_t high  = ((uintptr_t)&here - 256) & ~(uintptr_t)3;
+    uintptr_t low   = high - MQTT_HA_STACK_WATCH;
+    uintptr_t limit = (uintptr_t)mqtt_ha_stack_limit();     // the core's stack ends there (nullptr on the host)
+    if (limit > low) low = (limit + 3) & ~(uintptr_t)3;
+    if (low >= high) return;
+    for (volatile uint32_t* p = (volatile uint32_t*)low; p < (volatile uint32_t*)high; p++) {
+        *p = STACK_PAINT * 0x01010101u;
     }
+    stack_low   = (const volatile uint8_t*)low;
+    stack_high  = (const volatile uint8_t*)high;
+    stack_frame = (uintptr_t)frame;
+}
+
+//--- Deepest byte overwritten since stack_watch_start(), in bytes below its frame
+static uint32_t stack_peak() {
+    if (stack_low == nullptr) return 0;
+    const volatile uint8_t* p = stack_low;
+    while (p < stack_high && *p == STACK_PAINT) p++;
+    return (uint32_t)(stack_frame - (uintptr_t)p);
+}
+
+MqttHaRamStats mqtt_ha_ram_stats() {
+    MqttHaRamStats s;
+    s.scratch_size     = (uint32_t)scratch.size();
+    s.scratch_peak     = (uint32_t)scratch.peak();
+    s.scratch_failures = scratch.failures();
+    s.stack_watch      = stack_low ? (uint32_t)(stack_frame - (uintptr_t)stack_low) : 0;
+    s.stack_peak       = stack_peak();
+    return s;
 }
 
 //───────────────────────────────────────────────────────────────────
-//─── WiFi Connection ───────────────────────────────────────────────
+//─── OUTBOUND QUEUE ────────────────────────────────────────────────
 //───────────────────────────────────────────────────────────────────
-static bool wifi_connect(const char* ssid, const char* password) {
-    // Initialize CYW43 architecture (WiFi chip)
-    if (cyw43_arch_init()) {
-        printf("WiFi: Error in cyw43_arch_init!\n");
+// Messages that must not be lost (discovery, availability, live state) wait here for a
+// free publish slot instead of failing with ERR_MEM. The queue is flushed right away
+// when possible, then from every publish completion and from mqtt_poll().
+// Payloads are NOT copied: static strings, or built in the scratch arena when sent:
+// the live state is written from the channel values at send time, so a newer
+// mqtt_ha_publish_channels() while one is still queued simply replaces it (coalescing).
+// The queue only lives for one MQTT session: cleared on disconnect, the queued state goes to the backlog.
+struct OutboxMsg {
+    const char*       topic;
+    const char*       payload;
+    uint16_t          len;
+    OutboxKind        kind;
+    MqttHaTopic       cls;
+    mqtt_request_cb_t cb;
+    void*             arg;
+};
+
+static OutboxMsg         outbox[OUTBOX_SLOTS];
+static uint8_t           outbox_head        = 0;
+uint8_t                  mqtt_ha_lib::outbox_count = 0;
+static bool              outbox_has_state   = false;
+static bool              outbox_has_metrics = false;
+bool                     mqtt_ha_lib::outbox_has_batch = false;
+static MqttHaOutboxStats outbox_stats       = {};
+static size_t  state_build_payload(char* buf);
+static size_t  metrics_build_payload(char* buf);
+static void    metrics_window_reset();
+static uint8_t discovery_build_chunk(char* buf, uint8_t first, size_t* len);
+static void    discovery_build_topic(char* buf, uint8_t chunk);
+static void    discovery_chunk_sent(uint8_t next, size_t len);
+static uint8_t discovery_next  = 0;     // first channel of the next chunk
+static uint8_t discovery_chunk = 0;     // number of chunks already sent
+static void   backlog_store();
+
+bool mqtt_ha_lib::outbox_push(MqttHaTopic cls, OutboxKind kind, const char* topic, const char* payload, size_t len,
+                              mqtt_request_cb_t cb, void* arg) {
+    if (kind == OUTBOX_STATE && outbox_has_state) {
+        outbox_stats.coalesced++;
+        return true;
+    }
+    if (kind == OUTBOX_METRICS && outbox_has_metrics) return true;
+    if (kind == OUTBOX_BATCH && outbox_has_batch) return true;
+    //--- Could never fit lwIP's output buffer: retrying would block the queue forever
+    if (kind == OUTBOX_STATIC && len + strlen(topic) + 9 > MQTT_OUTPUT_RINGBUF_SIZE) {
+        LOG_WARN("MQTT: Message too big for MQTT_OUTPUT_RINGBUF_SIZE, %s dropped\n", topic_class_name[cls]);
+        outbox_stats.dropped++;
+        metrics.overflows++;
         return false;
     }
-    
-    // Enable Station mode (WiFi client)
-    cyw43_arch_enable_sta_mode();
+    if (outbox_count >= OUTBOX_SLOTS) {
+        LOG_WARN("MQTT: Outbound queue full, %s dropped\n", topic_class_name[cls]);
+        outbox_stats.dropped++;
+        metrics.overflows++;
+        return false;
+    }
+
+    OutboxMsg& m = outbox[(outbox_head + outbox_count) % OUTBOX_SLOTS];
+    m.topic   = topic;
+    m.payload = payload;
+    m.len     = (uint16_t)len;
+    m.kind    = kind;
+    m.cls     = cls;
+    m.cb      = cb;
+    m.arg     = arg;
+    outbox_count++;
+    if (kind == OUTBOX_STATE)   outbox_has_state   = true;
+    if (kind == OUTBOX_METRICS) outbox_has_metrics = true;
+    if (kind == OUTBOX_BATCH)   outbox_has_batch   = true;
+    outbox_stats.queued++;
+    if (outbox_count > outbox_stats.max_depth) outbox_stats.max_depth = outbox_count;
+
+    outbox_flush();
+    return true;
+}
+
+static bool outbox_push(MqttHaTopic cls, const char* topic, const char* payload,
+                        mqtt_request_cb_t cb = nullptr, void* arg = nullptr) {
+    return outbox_push(cls, OUTBOX_STATIC, topic, payload, strlen(payload), cb, arg);
+}
 
-    printf("WiFi: connecting to %s...\n", ssid);
-    int retries = 3;
-    
-    // WiFi connection blocks the thread and can take a long time (10s+)
-    while (retries-- > 0) {
-        // Attempt to connect with a 15-second timeout
-        if (cyw43_arch_wifi_connect_timeout_ms(ssid, password, CYW43_AUTH_WPA2_AES_PSK, 15000) == 0) {
-            char ip_str[16];
-            // Get the IP from netif (cyw43 network interface -> netif_default) in binary
-            // and convert it to string (ipaddr_ntoa_r) for user readable output.
-            ipaddr_ntoa_r(netif_ip4_addr(netif_default), ip_str, sizeof(ip_str));
-            printf("WiFi: Connected! IP=%s\n", ip_str);
-            return true;
+//--- Room for a payload built when sent, nullptr if the arena is exhausted (the message stays queued).
+//--- scratch_need covers TOPIC_MAX + the largest payload: only a scope still open around
+//--- outbox_flush() can make it fail.
+static char* outbox_scratch(ScratchScope& scope, size_t size) {
+    char* buf = scope.alloc(size);
+    if (buf == nullptr) {
+        LOG_WARN("MQTT: Scratch arena full (MQTT_HA_SCRATCH_SIZE), message kept for later\n");
+        metrics.overflows++;
+    }
+    return buf;
+}
+
+static void outbox_flush() {
+    while (outbox_count > 0 && pub_in_flight < PUBLISH_IN_FLIGHT) {
+        OutboxMsg&   m       = outbox[outbox_head];
+        ScratchScope scope(scratch);        // this message only: lwIP has copied it when the scope ends
+        const char*  topic   = m.topic;
+        const char*  payload = m.payload;
+        size_t       len     = m.len;
+        uint16_t     samples = 0;
+        uint8_t      next    = 0;
+        if (m.kind == OUTBOX_STATE) {
+            char* buf = outbox_scratch(scope, STATE_PAYLOAD_MAX);
+            payload = buf;
+            len     = buf ? state_build_payload(buf) : 0;
+        } else if (m.kind == OUTBOX_METRICS) {
+            char* buf = outbox_scratch(scope, METRICS_PAYLOAD_MAX);
+            payload = buf;
+            len     = buf ? metrics_build_payload(buf) : 0;
+        } else if (m.kind == OUTBOX_BATCH) {
+            char* buf = outbox_scratch(scope, BATCH_PAYLOAD_MAX);
+            payload = buf;
+            len     = buf ? batch_build_payload(buf, &samples) : 0;
+        } else if (m.kind == OUTBOX_DISCOVERY) {
+            char* t   = outbox_scratch(scope, TOPIC_MAX);
+            char* buf = t ? outbox_scratch(scope, DISCOVERY_CHUNK_MAX) : nullptr;
+            topic   = t;
+            payload = buf;
+            len     = 0;
+            if (buf) {
+                discovery_build_topic(t, discovery_chunk);
+                next = discovery_build_chunk(buf, discovery_next, &len);
+            }
+        }
+        //--- No scratch or ERR_MEM: stays first in the queue, tried again on the next completion / mqtt_poll()
+        if (payload == nullptr) {
+            outbox_stats.retried++;
+            return;
+        }
+        if (len > 0 && !mqtt_publish_msg(m.cls, topic, payload, len, m.cb, m.arg)) {
+            outbox_stats.retried++;
+            return;
+        }
+        if (m.kind == OUTBOX_STATE) {
+            outbox_has_state = false;
+            if (len > 0) LOG_DEBUG("MQTT: State publié (%u bytes)\n", (unsigned)len);
         }
-        printf("WiFi: Connection attempt failed, retry...\n");
+        if (m.kind == OUTBOX_METRICS) {
+            outbox_has_metrics = false;
+            metrics_window_reset();     // histograms cover one diagnostics period
+        }
+        if (m.kind == OUTBOX_BATCH) {
+            outbox_has_batch = false;
+            batch_sent(samples);        // records leave the batch ring once lwIP has them
+        }
+        if (m.kind == OUTBOX_DISCOVERY) discovery_chunk_sent(next, len);
+        outbox_head = (outbox_head + 1) % OUTBOX_SLOTS;
+        outbox_count--;
     }
-    
-    // If we are here, all attempts failed !
-    printf("WiFi: Unable to connect after multiple attempts\n");
-    return false;
+}
+
+static void outbox_on_disconnect() {
+    //--- The latest state was not sent: keep it with the offline samples
+    //--- (when batching, every sample is already in the batch ring)
+    if (outbox_has_state && !batch_enabled()) backlog_store();
+    batch_on_disconnect();
+    outbox_head        = 0;
+    outbox_count       = 0;
+    outbox_has_state   = false;
+    outbox_has_metrics = false;
+    outbox_has_batch   = false;
+    publish_slots_reset();
+}
+
+MqttHaOutboxStats mqtt_ha_outbox_stats() {
+    MqttHaOutboxStats s = outbox_stats;
+    s.pending   = outbox_count;
+    s.in_flight = pub_in_flight;
+    return s;
 }
 
 //───────────────────────────────────────────────────────────────────
-//─── WiFi + MQTT Init ──────────────────────────────────────────────
+//─── CONNECTION STATE MACHINE ──────────────────────────────────────
 //───────────────────────────────────────────────────────────────────
-bool wifi_mqtt_init(
-    const char* ssid,               // Wifi SSID (pointer to string)
-    const char* password,           // Wifi password (pointer to string)
-    const char* mqtt_broker_ip,     // MQTT broker IP (pointer to string)
-    uint16_t mqtt_port              // MQTT broker port
-) {
-    broker_port_g = mqtt_port;
+// Nothing here blocks: mqtt_poll() calls conn_step() which only checks
+// where the current step is and moves to the next one when it is done.
+//
+//   WIFI_JOIN ─▶ DHCP ─▶ RESOLVE ─▶ MQTT_CONNECT ─▶ DISCOVERY ─▶ SUBSCRIBE ─▶ ONLINE
+//       │          │        │            │               │            │          │
+//       └──────────┴────────┴────────────┴─── failure ───┴────────────┴──────────┘
+//                                             │
+//                                             ▼
+//                                          BACKOFF ─▶ WIFI_JOIN (link down) or RESOLVE (link up)
+//
+// RESOLVE only for a broker given by name (see "BROKERS" below).
+// WIFI_JOIN and DHCP are followed with cyw43_tcpip_link_status(),
+// MQTT_CONNECT -> DISCOVERY -> SUBSCRIBE -> ONLINE are moved by the lwIP callbacks
+// (mqtt_connection_callback, mqtt_ha_availability_callback, mqtt_subscribe_request_callback).
+static uint8_t  backoff_attempt  = 0;
+static uint32_t backoff_until_ms = 0;
+static uint32_t rng_state        = 0;
 
-    // Connect to WiFi
-    if (!wifi_connect(ssid, password)) {
-        return false;
+//--- Fast boot (see "FAST BOOT" below)
+static bool     fast_join_start();
+static bool     fast_join_fallback();
+static uint32_t fast_join_timeout_ms();
+static bool     fast_ip_apply();
+static bool     fast_ip_fallback();
+static uint32_t fast_connect_timeout_ms();
+static void     fast_sequence_start();
+static void     fast_on_online();
+//--- Brokers (see "BROKERS" below)
+static void     conn_start_broker();
+static void     broker_resolve_step(uint32_t in_state_ms);
+static void     broker_on_failure();
+static void     broker_on_online();
+static bool     broker_parse(BrokerEndpoint* ep, const char* host, uint16_t port);
+static void     broker_boot();
+
+//--- xorshift32: enough randomness to spread the reconnects of a fleet of devices
+static uint32_t conn_random() {
+    uint32_t x = rng_state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    rng_state = x;
+    return x;
+}
+
+static void conn_fail(const char* reason) {
+    //--- Close whatever is left of the MQTT session (no callback is fired by lwIP)
+    if (mqtt_client) mqtt_disconnect(mqtt_client);
+    connected      = false;
+    discovery_done = false;
+    conn_error     = false;
+    outbox_on_disconnect();
+    backlog_on_disconnect();
+    broker_on_failure();                                        // next broker if this one keeps failing
+    if (conn_state == MQTT_HA_ONLINE) fast_sequence_start();   // the reconnect is timed from here
+    conn_stats.failures++;
+
+    //--- The cached lease never got a CONNACK: ask DHCP for one right away, no backoff
+    if (fast_ip_fallback()) {
+        LOG_WARN("NET: %s on the cached IP, back to DHCP\n", reason);
+        conn_set_state(MQTT_HA_DHCP);
+        return;
     }
 
-    // Resolve broker IP
-    // Convert broker IP string to binary format (ipaddr_aton) and store in broker_addr
-    ipaddr_aton(mqtt_broker_ip, &broker_addr);
+    //--- Exponential backoff with "equal jitter": half fixed, half random
+    uint32_t ceiling = BACKOFF_BASE_MS << (backoff_attempt < 10 ? backoff_attempt : 10);
+    if (ceiling > BACKOFF_MAX_MS) ceiling = BACKOFF_MAX_MS;
+    uint32_t delay = ceiling / 2 + conn_random() % (ceiling / 2 + 1);
+    if (backoff_attempt < 255) backoff_attempt++;
 
-    // Create MQTT client
-    mqtt_client = mqtt_client_new();
-    if (!mqtt_client) {
-        printf("MQTT: Client allocation failed\n");
-        return false;
+    conn_stats.backoff_ms = delay;
+    backoff_until_ms      = now_ms() + delay;
+    LOG_WARN("NET: %s, retry in %lu ms\n", reason, (unsigned long)delay);
+    conn_set_state(MQTT_HA_BACKOFF);
+}
+
+static void conn_start_wifi() {
+    conn_set_state(MQTT_HA_WIFI_JOIN);
+    // Only STARTS the join, cyw43_tcpip_link_status() tells us how it goes.
+    if (fast_join_start()) return;      // straight to the AP of the last session
+    LOG_INFO("WiFi: connecting to %s...\n", wifi_ssid_g);
+    if (cyw43_arch_wifi_connect_async(wifi_ssid_g, wifi_password_g, CYW43_AUTH_WPA2_AES_PSK) != 0) {
+        conn_fail("WiFi: join could not be started");
     }
+}
+
+static void conn_start_mqtt() {
+    conn_set_state(MQTT_HA_MQTT_CONNECT);
+    conn_stats.connects++;
 
     //--- https://www.nongnu.org/lwip/2_1_x/structmqtt__connect__client__info__t.html
     struct mqtt_connect_client_info_t ci = {};
@@ -290,7 +948,7 @@ bool wifi_mqtt_init(
     ci.client_user = NULL;
     ci.client_pass = NULL;
     ci.keep_alive  = 60;        // in seconds, 0 to disable
-    // ci.tls_config  = NULL;      // TLS configuration, NULL for no TLS
+    ci.tls_config  = tls_client_config();  // TLS configuration, NULL for no TLS (mqtt_ha_tls.cpp)
     //--- will stand for "Last Will and Testament"
     //--- message (will_msg) published (on will_topic) by the broker if the client is disconnected unexpectedly
     ci.will_topic   = DEVICE_ID "/availability";
@@ -311,22 +969,191 @@ bool wifi_mqtt_init(
         nullptr,                // arg – User supplied argument to connection callback
         &ci                     // client_info – Client identification and connection options  (as a pointer -> &)
     );
-    
+
     if (err != ERR_OK) {
-        printf("MQTT: Connect error (%d)\n", err);
+        LOG_ERROR("MQTT: Connect error (%d)\n", err);
+        conn_fail("MQTT: connect not started");
+        return;
+    }
+    tls_on_connect();
+}
+
+//--- One non-blocking step, called from mqtt_poll()
+static void conn_step() {
+    uint32_t in_state_ms = now_ms() - state_since_ms;
+    int      link        = cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA);
+
+    //--- WiFi lost while (re)connecting to the broker, or once ONLINE
+    if (conn_state >= MQTT_HA_RESOLVE && conn_state <= MQTT_HA_ONLINE && link != CYW43_LINK_UP) {
+        conn_fail("WiFi: link lost");
+        return;
+    }
+    //--- Error reported by an lwIP callback (refused, disconnected, publish/subscribe failure)
+    if (conn_error) {
+        conn_fail("MQTT: session lost");
+        return;
+    }
+
+    switch (conn_state) {
+    case MQTT_HA_WIFI_JOIN:
+        if (link == CYW43_LINK_NOIP || link == CYW43_LINK_UP) {
+            conn_set_state(MQTT_HA_DHCP);
+        } else if (link < 0) {
+            if (!fast_join_fallback()) conn_fail(link == CYW43_LINK_BADAUTH ? "WiFi: bad password" : "WiFi: join failed");
+        } else if (in_state_ms > fast_join_timeout_ms()) {
+            if (!fast_join_fallback()) conn_fail("WiFi: join timeout");
+        }
+        break;
+
+    case MQTT_HA_DHCP:
+        if (link == CYW43_LINK_UP) {
+            // Get the IP from netif (cyw43 network interface -> netif_default) in binary,
+            // network order: the first byte is the first number of the dotted notation.
+            uint32_t ip = netif_ip4_addr(netif_default)->addr;
+            LOG_INFO("WiFi: Connected! IP=%u.%u.%u.%u\n", ip & 0xff, (ip >> 8) & 0xff, (ip >> 16) & 0xff, ip >> 24);
+            conn_start_broker();
+        } else if (link != CYW43_LINK_NOIP) {
+            conn_fail("WiFi: link lost");
+        } else if (fast_ip_apply()) {
+            // cached lease set on the netif: link UP on the next step
+        } else if (in_state_ms > DHCP_TIMEOUT_MS) {
+            conn_fail("DHCP: timeout");
+        }
+        break;
+
+    case MQTT_HA_RESOLVE:
+        broker_resolve_step(in_state_ms);
+        break;
+
+    case MQTT_HA_MQTT_CONNECT:
+        if (in_state_ms > fast_connect_timeout_ms()) conn_fail("MQTT: connect timeout");
+        break;
+
+    case MQTT_HA_DISCOVERY:
+    case MQTT_HA_SUBSCRIBE:
+        if (in_state_ms > MQTT_SETUP_TIMEOUT_MS) {
+            conn_fail("MQTT: discovery/subscribe timeout");
+        } else if (conn_state == MQTT_HA_SUBSCRIBE) {
+            subscribe_next_topics();    // topics refused earlier with ERR_MEM
+        }
+        break;
+
+    case MQTT_HA_ONLINE:
+        backoff_attempt = 0;    // a full successful sequence resets the backoff
+        fast_on_online();       // once per sequence: phase times, broker health, AP and lease for the next boot
+        break;
+
+    case MQTT_HA_BACKOFF:
+        if ((int32_t)(now_ms() - backoff_until_ms) >= 0) {
+            if (link == CYW43_LINK_UP) {
+                conn_start_broker();    // only the broker was lost, WiFi is still fine
+            } else {
+                conn_start_wifi();
+            }
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+MqttHaState mqtt_ha_state() {
+    return conn_state;
+}
+
+const char* mqtt_ha_state_name(MqttHaState state) {
+    static const char* const names[MQTT_HA_STATE_COUNT] = {
+        "idle", "wifi_join", "dhcp", "resolve", "mqtt_connect", "discovery", "subscribe", "online", "backoff"
+    };
+    return state < MQTT_HA_STATE_COUNT ? names[state] : "?";
+}
+
+MqttHaConnStats mqtt_ha_conn_stats() {
+    MqttHaConnStats s = conn_stats;
+    s.time_in_state_ms[conn_state] += now_ms() - state_since_ms;   // include the current state
+    return s;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── WiFi + MQTT Init ──────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Does NOT wait for the connection anymore: it prepares the CYW43 chip
+// and the MQTT client, then starts the WiFi join.
+// mqtt_poll() drives the rest of the sequence (and every reconnect).
+// In dual-core mode the CYW43 / lwIP part runs on core 1 (net_core_start()).
+static bool net_init();
+#if MQTT_HA_DUAL_CORE
+static bool net_core_start();
+#endif
+
+static void fast_reset();
+static void mqtt_version_apply();
+
+bool wifi_mqtt_init(
+    const char* ssid,               // Wifi SSID (pointer to string)
+    const char* password,           // Wifi password (pointer to string)
+    const char* mqtt_broker,        // MQTT broker IP or host name (pointer to string)
+    uint16_t mqtt_port              // MQTT broker port
+) {
+    //--- Keep our own copy, the state machine needs them for every re-join
+    if (strlen(ssid) >= sizeof(wifi_ssid_g) || strlen(password) >= sizeof(wifi_password_g)) {
+        LOG_ERROR("WiFi: SSID or password too long\n");
         return false;
     }
+    strcpy(wifi_ssid_g, ssid);
+    strcpy(wifi_password_g, password);
 
-    // Wait for connection (connected defined in callback)
-    // by blocking with for loop and POLLING lwIP (cyw43_arch_poll)
-    // meaning letting cyw43_arch do whatever it has to...
-    // TODO: can be made into Async with management in main loop.
-    for (int i = 0; i < 500 && !connected; i++) {
-        cyw43_arch_poll();
-        sleep_ms(10);
+    //--- Dotted IP (ipaddr_aton) or host name, looked up in RESOLVE (see "BROKERS")
+    if (!broker_parse(&brokers[0], mqtt_broker, mqtt_port)) {
+        LOG_ERROR("MQTT: Invalid broker address\n");
+        return false;
     }
+    //--- Discovery hash, AP, lease and broker of the last boot (see "DISCOVERY CACHE", "FAST BOOT")
+    persist_load();
+    broker_boot();
+    tls_boot();
+#if MQTT_HA_DUAL_CORE
+    return net_core_start();
+#else
+    //--- mqtt_poll() runs about as deep as we are called: the stack below is watched (see "RAM")
+    stack_watch_start(__builtin_frame_address(0));
+    return net_init();
+#endif
+}
 
-    return connected;
+//--- CYW43 + MQTT client, then the WiFi join: on the core that will poll lwIP
+static bool net_init() {
+    // Initialize CYW43 architecture (WiFi chip)
+    if (cyw43_arch_init()) {
+        LOG_ERROR("WiFi: Error in cyw43_arch_init!\n");
+        return false;
+    }
+    // Enable Station mode (WiFi client)
+    cyw43_arch_enable_sta_mode();
+
+    // Create MQTT client
+    mqtt_client = mqtt_client_new();
+    if (!mqtt_client) {
+        LOG_ERROR("MQTT: Client allocation failed\n");
+        return false;
+    }
+    mqtt_version_apply();
+
+    //--- Fresh state machine
+    connected        = false;
+    discovery_done   = false;
+    conn_error       = false;
+    backoff_attempt  = 0;
+    conn_stats       = {};
+    conn_state       = MQTT_HA_IDLE;
+    state_since_ms   = now_ms();
+    rng_state        = time_us_32() | 1;   // never 0 for xorshift
+    metrics_due_ms   = state_since_ms + METRICS_PERIOD_MS;
+    fast_reset();
+
+    conn_start_wifi();
+    return true;
 }
 
 //───────────────────────────────────────────────────────────────────
@@ -334,25 +1161,55 @@ bool wifi_mqtt_init(
 //───────────────────────────────────────────────────────────────────
 void mqtt_ha_availability_callback(void *arg, err_t result) {
     if (result == ERR_OK) {
-        printf("MQTT: Availability message published successfully\n");
-        printf("Discovery is now ONLINE ^^\n");
+        LOG_DEBUG("MQTT: Availability message published successfully\n");
+        LOG_INFO("Discovery is now ONLINE ^^\n");
         discovery_done = true;
+        if (conn_state == MQTT_HA_DISCOVERY) conn_set_state(MQTT_HA_SUBSCRIBE);
         // Now that discovery is confirmed and lwIP is not overwhelmed with requests,
         // we can subscribe to the Command Topic to receive commands from Home Assistant.
-        printf("MQTT: Subscribing BTN for HA discovery\n");
+        LOG_DEBUG("MQTT: Subscribing BTN for HA discovery\n");
         mqtt_subscribe_commands();
     } else {
-        printf("MQTT: Failed to publish availability message (%d)\n", result);
+        LOG_ERROR("MQTT: Failed to publish availability message (%d)\n", result);
+        if (conn_state == MQTT_HA_DISCOVERY) conn_error = true;
+    }
+}
+
+static bool discovery_publish_next_chunk();
+
+//--- Discovery messages of this session not acknowledged yet (see "DISCOVERY CACHE")
+uint8_t mqtt_ha_lib::discovery_unacked = 0;
+bool    mqtt_ha_lib::discovery_failed  = false;
+
+static void discovery_track(bool queued) {
+    if (queued) discovery_unacked++;
+    else        discovery_failed = true;
+}
+
+static void discovery_ack_callback(void* arg, err_t result) {
+    if (discovery_unacked > 0) discovery_unacked--;
+    if (result != ERR_OK) discovery_failed = true;
+    discovery_try_save();
+}
+
+//--- Discovery sent (or already retained by the broker): the device goes online
+static void discovery_confirm() {
+    LOG_DEBUG("Sending availability message to confirm discovery\n");
+    if (!outbox_push(MQTT_HA_TOPIC_AVAILABILITY, DEVICE_ID "/availability", "online", mqtt_ha_availability_callback)) {
+        if (conn_state == MQTT_HA_DISCOVERY) conn_error = true;
     }
 }
 
 void mqtt_ha_discovery_callback(void *arg, err_t result) {
+    discovery_ack_callback(arg, result);
     if (result == ERR_OK) {
-        printf("MQTT: Discovery message published successfully\n");
-        printf("Sending availability message to confirm discovery\n");
-        mqtt_publish_msg(DEVICE_ID "/availability", "online", true, mqtt_ha_availability_callback);
+        LOG_DEBUG("MQTT: Discovery message published successfully\n");
+        //--- More channels than one message can hold: send the next chunk first
+        if (discovery_publish_next_chunk()) return;
+        discovery_confirm();
     } else {
-        printf("MQTT: Failed to publish discovery message (%d)\n", result);
+        LOG_ERROR("MQTT: Failed to publish discovery message (%d)\n", result);
+        if (conn_state == MQTT_HA_DISCOVERY) conn_error = true;
     }
 }
 
@@ -362,168 +1219,1367 @@ void mqtt_ha_discovery_callback(void *arg, err_t result) {
 // Tell Home Assistant to make a button in the UI, which can send data
 // to the specified Command Topic.
 // Will be send as part of the discovery process at the end of mqtt_ha_publish_discovery().
+#define BUTTON_DISCOVERY_TOPIC DISCOVERY_PREFIX "/button/" DEVICE_ID "/led_brightness/config"
+static const char button_discovery_payload[] =
+    "{"
+        "\"name\":\"Led Brightness Pico\","
+        "\"cmd_t\":\"" LED_CMD_TOPIC "\","
+        "\"payload_press\":\"toggle\","
+        "\"uniq_id\":\"pico_env_sensor_led_brightness\","
+        "\"dev\":{\"ids\":[\"" DEVICE_ID "\"]}"
+    "}";
+
 static void mqtt_ha_publish_button_discovery() {
-    const char* payload =
-        "{"
-            "\"name\":\"Led Brightness Pico\","
-            "\"cmd_t\":\"" LED_CMD_TOPIC "\","
-            "\"payload_press\":\"toggle\","
-            "\"uniq_id\":\"pico_env_sensor_led_brightness\","
-            "\"dev\":{\"ids\":[\"" DEVICE_ID "\"]}"
-        "}";
-    
-    mqtt_publish_msg(
-        DISCOVERY_PREFIX "/button/" DEVICE_ID "/led_brightness/config",
-        payload, true
-    );
+    discovery_track(outbox_push(
+        MQTT_HA_TOPIC_DISCOVERY,
+        BUTTON_DISCOVERY_TOPIC,
+        button_discovery_payload,
+        discovery_ack_callback
+    ));
 }
 
 //───────────────────────────────────────────────────────────────────
-//─── Auto-Discovery Home Assistant ─────────────────────────────────
+//─── SENSOR CHANNELS (registry) ────────────────────────────────────
 //───────────────────────────────────────────────────────────────────
-// @see https://github.com/simonpra/Pico-W-Wifi-and-MQTT/blob/main/mqtt_discovery_exemple.json
-// for the expected discovery payload for Home-Assistant
-void mqtt_ha_publish_discovery() {
-    if (!connected || discovery_done) return;
+// One table describes every sensor value of the device (MqttHaChannel, see mqtt_ha.h):
+// discovery, state payloads and backlog records are all generated from it.
+// Values are kept as integers scaled by 10^precision: 23.4 °C with precision 1 is 234,
+// so publishing never needs floating point.
+// The built-in table is the original Pico Env Sensor (ENS160 + AHT2x).
+static constexpr MqttHaChannel default_channels[] = {
+    // key          // id     // name    // unit   // dev_cla                             // precision // storage
+    {"temperature", "temp",   nullptr,   "°C",     "temperature",                         1,           MQTT_HA_I16 },
+    {"humidity",    "hum",    nullptr,   "%",      "humidity",                            1,           MQTT_HA_U16 },
+    {"eco2",        "eco2",   nullptr,   "ppm",    "carbon_dioxide",                      0,           MQTT_HA_U16 },
+    {"tvoc",        "tvoc",   nullptr,   "ppb",    "volatile_organic_compounds_parts",    0,           MQTT_HA_U16 },
+    {"aqi",         "aqi",    nullptr,   "",       "aqi",                                 0,           MQTT_HA_U8  },
+};
+//--- Handles of the built-in table, used by mqtt_ha_publish_state()
+enum { CH_TEMPERATURE, CH_HUMIDITY, CH_ECO2, CH_TVOC, CH_AQI };
 
-    const char* device_block =
-        "\"dev\":{"                                     // DEVICE info block, used by Home Assistant to display device info and group entities
-            "\"ids\":[\"" DEVICE_ID "\"],"                  // Unique ID for the device, used by Home Assistant to identify it (can be used to link entities)
-            "\"name\":\"" DEVICE_NAME "\","                 // Name of the device, used by Home Assistant to display it
-            "\"mf\":\"DIY\","                               // Manufacturer, used by Home Assistant to display it
-            "\"mdl\":\"Pico W + ENS160 + AHT2x\","          // Model, used by Home Assistant to display it
-            "\"sw\":\"1.1\","                               // Software version, used by Home Assistant to display it
-            "\"hw\":\"rev0.85\""                            // Hardware version, used by Home Assistant to display it
-        "},"
-        "\"avty_t\":\"" DEVICE_ID "/availability\"";    // Availability topic, used by Home Assistant to know if the device is online or offline
-                                                        // Availability topic need to be the same as the WILL topic defined in mqtt_connect_client_info_t
-
-    //--- Struct to define the sensors[] array.
-    struct SensorConfig {
-        const char* type;
-        const char* name;
-        const char* uid_suffix;
-        const char* val_tpl;
-        const char* unit;
-        const char* dev_cla;
-    };
+const MqttHaChannel*        mqtt_ha_lib::channels      = default_channels;
+uint8_t                     mqtt_ha_lib::channel_count = sizeof(default_channels) / sizeof(default_channels[0]);
+static int32_t              channel_value[MQTT_HA_MAX_CHANNELS];
+static uint8_t              channel_set[(MQTT_HA_MAX_CHANNELS + 7) / 8];  // bit i: channel i has a value
+#if MQTT_HA_DUAL_CORE
+//--- Application core copy, written by mqtt_ha_set(): channel_value / channel_set belong to the network core
+int32_t                     mqtt_ha_lib::app_value[MQTT_HA_MAX_CHANNELS];
+uint8_t                     mqtt_ha_lib::app_set[(MQTT_HA_MAX_CHANNELS + 7) / 8];
+#else
+int32_t* const              mqtt_ha_lib::app_value = channel_value;
+uint8_t* const              mqtt_ha_lib::app_set   = channel_set;
+#endif
 
-    const SensorConfig sensors[] = {
-        // type         // name         // uid_suffix   // val_tpl      // unit     // dev_cla
-        {"temperature", "Température",  "_temp",        "temperature",  "°C",       "temperature"                       },
-        {"humidity",    "Humidité",     "_hum",         "humidity",     "%",        "humidity"                          },
-        {"eco2",        "eCO2",         "_eco2",        "eco2",         "ppm",      "carbon_dioxide"                    },
-        {"tvoc",        "TVOC",         "_tvoc",        "tvoc",         "ppb",      "volatile_organic_compounds_parts"  },
-        {"aqi",         "AQI",          "_aqi",         "aqi",          "",         "aqi"                               },
-    };
+//--- Bytes and range of each MqttHaStorage type
+const uint8_t        mqtt_ha_lib::storage_size[] = { 1, 1, 2, 2, 4 };
+static const int32_t storage_min[]  = { 0,   -128, 0,     -32768, INT32_MIN };
+static const int32_t storage_max[]  = { 255,  127, 65535,  32767, INT32_MAX };
 
-    // cmps_block is used to build the "cmps" block of the discovery payload, which contains the list of components (sensors) to be published.
-    // offset and max_len are used to "append" to cmps_block without overflowing it,
-    // which is done by keeping track of the current length (offset) and the maximum allowed length (max_len).
-    // 1024 bytes/char is "just enough" to hold the discovery payload for 5 sensors, but need to be increased if more sensors are added.
-    char cmps_block[1024];
-    size_t offset = 0;
-    size_t max_len = sizeof(cmps_block);
-
-    //--- Start the "cmps" block with "cmps:{" string, and update the offset accordingly.
-    offset += snprintf(cmps_block + offset, max_len - offset, "\"cmps\":{");
-
-    //--- Keep track for the last sensor
-    int i = 0;
-    const int nb_sensors = sizeof(sensors) / sizeof(sensors[0]);
-    char uid[64];
-
-    //--- Build the payload for each sensor
-    for (const auto& s : sensors) {
-        
-        //--- Unique Component ID for this sensor
-        snprintf(uid, sizeof(uid), "sensor_component_%s", s.uid_suffix);
-
-        //--- Unit_of_measurement is only added if the unit is not empty, to avoid HomeAssistant errors.
-        char unit_block[64] = "";
-        if (strlen(s.unit) > 0) {
-            snprintf(unit_block, sizeof(unit_block), "\"unit_of_meas\":\"%s\",", s.unit);
-        }
+static void backlog_reset();
+static void discovery_reset();
+static bool discovery_fits(const MqttHaChannel& c);
 
-        //--- Build the Composant payload for this sensor
-        offset += snprintf(
-            cmps_block + offset,    // append to current offset in cmps_block
-            max_len - offset,       // check for remaining space in cmps_block
-            "\"sensor%s\":{"                            // component unique Key (sensor_temp, ...)
-                "\"p\":\"sensor\","                     // platform (type of component, here sensor)
-                "\"dev_cla\":\"%s\","                   // device class (used by Home Assistant to display the right icon and unit, and for some automations)
-                "%s"                                    // unit_of_measurement, only added if unit is not empty
-                "\"val_tpl\":\"{{ value_json.%s }}\","  // value template, used by Home Assistant to extract the value from the JSON payload published on the state topic
-                "\"uniq_id\":\"" DEVICE_ID "%s\""       // unique ID for this component, used by Home Assistant to identify it (can be used to link entities)
-            "}",
-            s.uid_suffix, s.dev_cla, unit_block, s.val_tpl, s.uid_suffix
-        );
-        
-        // add a comma only if it's not the last sensor, to avoid JSON syntax error in the "cmps" block.
-        if (i < nb_sensors - 1) {
-            offset += snprintf(cmps_block + offset, max_len - offset, ",");
+bool mqtt_ha_register_channels(const MqttHaChannel* table, uint8_t count) {
+    if (table == nullptr && count == 0) {
+        table = default_channels;
+        count = sizeof(default_channels) / sizeof(default_channels[0]);
+    }
+    if (table == nullptr || count == 0 || count > MQTT_HA_MAX_CHANNELS) {
+        LOG_ERROR("MQTT: Invalid channel table (%u channels, max %d)\n", count, MQTT_HA_MAX_CHANNELS);
+        return false;
+    }
+    for (uint8_t i = 0; i < count; i++) {
+        if (!table[i].key || !table[i].id || table[i].precision > 3 || table[i].storage > MQTT_HA_I32) {
+            LOG_ERROR("MQTT: Invalid channel %u\n", i);
+            return false;
         }
-        i++;
-    }
-
-    // CLOSING the "cmps" block with "}" string.
-    offset += snprintf(cmps_block + offset, max_len - offset, "}");
-
-    //--- TOPIC and PAYLOAD for the discovery message
-    char topic[128];
-    char payload[1152];
-    // https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
-    // The discovery topic needs to follow a specific format:
-    //      homeassistant/device/<DEVICE_ID>/config
-    snprintf(topic, sizeof(topic),
-                DISCOVERY_PREFIX "/sensor/" DEVICE_ID "/config");
-
-    //--- FINAL payload (device_block + stat_t global + cmps_block)
-    snprintf(payload, sizeof(payload),
-        "{"
-            "%s,"                               // "dev": {...} block with "avty_t" (availability topic)
-            "\"stat_t\":\"" STATE_TOPIC "\","   // State topic for Home Assistant to subscribe to. Same topic for all sensors of the device.
-            "%s"                                // "cmps": {...} block with all sensors of the device
-        "}", 
-        device_block, cmps_block);
-    
-    printf("MQTT: Publishing discovery message to topic %s\n", topic);
-    printf("MQTT: Discovery payload:\n%s\n", payload);
-
-    //--- PUBLISH MQTT discovery message only once for all sensors.
-    //--- Callback will confirm if the message was published successfully,
-    //--- and then trigger the availability message to confirm discovery.
-    mqtt_publish_msg(topic, payload, true, mqtt_ha_discovery_callback);
-    //--- PUBLISH as well the BTN discovery for the LED Brightness button.
-    mqtt_ha_publish_button_discovery();
+        //--- Its entity would never reach HA
+        if (!discovery_fits(table[i])) {
+            LOG_ERROR("MQTT: Channel %u does not fit a discovery message (DISCOVERY_CHUNK_MAX)\n", i);
+            return false;
+        }
+    }
+    channels      = table;
+    channel_count = count;
+    memset(channel_set, 0, sizeof(channel_set));
+    memset(app_set, 0, sizeof(channel_set));
+    //--- Backlog records, cached discovery and deadbands belong to the previous table: start again
+    backlog_reset();
+    batch_reset();
+    discovery_reset();
+    report_reset();
+    return true;
 }
 
-//───────────────────────────────────────────────────────────────────
-//─── STATE PUBLICATION ─────────────────────────────────────────────
-//───────────────────────────────────────────────────────────────────
-// Comments and Doc will follow....
-void mqtt_ha_publish_state(double temperature, double humidity,
-                           uint16_t eco2, uint16_t tvoc, uint8_t aqi) {
-    char payload[256];
-    snprintf(payload, sizeof(payload),
-        "{\"temperature\":%.1f,"
-         "\"humidity\":%.1f,"
-         "\"eco2\":%u,"
-         "\"tvoc\":%u,"
-         "\"aqi\":%u}",
-        temperature, humidity, eco2, tvoc, aqi);
+//--- Saturate to the storage type of the channel
+int32_t mqtt_ha_lib::channel_clamp(const MqttHaChannel& c, int32_t scaled) {
+    if (scaled < storage_min[c.storage]) return storage_min[c.storage];
+    if (scaled > storage_max[c.storage]) return storage_max[c.storage];
+    return scaled;
+}
 
-    mqtt_publish_msg(STATE_TOPIC, payload, false);
-    printf("MQTT: State publié: %s\n", payload);
+//--- Same rounding as printf (see mqtt_ha_json.h), scaled by 10^precision (not NaN)
+int32_t mqtt_ha_lib::channel_scale(const MqttHaChannel& c, double value) {
+    uint64_t mag;
+    bool     neg;
+    if (!json_round_scaled(value, c.precision, &mag, &neg) || mag > INT32_MAX) {
+        mag = INT32_MAX;
+    }
+    return neg ? -(int32_t)mag : (int32_t)mag;
 }
 
-void mqtt_poll() {
-    if( !connected ) return;
+void mqtt_ha_set_scaled(uint8_t ch, int32_t scaled) {
+    if (ch >= channel_count) return;
+    app_value[ch]    = channel_clamp(channels[ch], scaled);
+    app_set[ch / 8] |= (uint8_t)(1u << (ch % 8));
+    report_sample(ch, app_value[ch]);
+}
+
+void mqtt_ha_set(uint8_t ch, double value) {
+    if (ch >= channel_count || value != value) return;   // unknown channel or NaN
+    mqtt_ha_set_scaled(ch, channel_scale(channels[ch], value));
+}
+
+//--- ,"key":value for every channel that has a value
+static void write_channel_fields(JsonWriter& json, const int32_t* values, const uint8_t* set, bool first) {
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (!channel_has_value(set, i)) continue;
+        if (!first) json.raw(",");
+        first = false;
+        json.raw("\"").raw(channels[i].key).raw("\":").fixed(values[i], channels[i].precision);
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Auto-Discovery Home Assistant ─────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// @see https://github.com/simonpra/Pico-W-Wifi-and-MQTT/blob/main/mqtt_discovery_exemple.json
+// for the expected discovery payload for Home-Assistant
+//
+// The "cmps" (components) block is generated from the channel table.
+// A message holds at most DISCOVERY_CHUNK_MAX bytes: with many channels, the components
+// are split over several messages (chunks) with the same "dev" block, so HA groups them
+// in the same device. Chunks are sent one after the other from mqtt_ha_discovery_callback(),
+// only one is ever waiting for its PUBACK.
+//      chunk 0 : homeassistant/sensor/<DEVICE_ID>/config
+//      chunk n : homeassistant/sensor/<DEVICE_ID>_<n>/config
+#define DEVICE_BLOCK                                                                                        \
+    "\"dev\":{"                                     /* DEVICE info block, used by Home Assistant to display device info and group entities */ \
+        "\"ids\":[\"" DEVICE_ID "\"],"                  /* Unique ID for the device, used by Home Assistant to identify it */ \
+        "\"name\":\"" DEVICE_NAME "\","                 /* Name of the device, used by Home Assistant to display it */        \
+        "\"mf\":\"DIY\","                               /* Manufacturer */                                                    \
+        "\"mdl\":\"Pico W + ENS160 + AHT2x\","          /* Model */                                                           \
+        "\"sw\":\"1.1\","                               /* Software version */                                                \
+        "\"hw\":\"rev0.85\""                            /* Hardware version */                                                \
+    "},"                                                                                                    \
+    "\"avty_t\":\"" DEVICE_ID "/availability\""     /* Availability topic, need to be the same as the WILL topic */
+
+// https://www.home-assistant.io/integrations/mqtt/#mqtt-discovery
+// The discovery topic needs to follow a specific format:
+//      homeassistant/device/<DEVICE_ID>/config
+#define DISCOVERY_TOPIC DISCOVERY_PREFIX "/sensor/" DEVICE_ID "/config"
+
+//--- The whole PUBLISH packet (fixed header 1 + length 2 + topic 2+n ("_NN" for chunks) + packet id 2 + payload)
+//--- must fit the lwIP MQTT output buffer, or mqtt_publish() fails with ERR_MEM at runtime.
+//--- Raise MQTT_OUTPUT_RINGBUF_SIZE in lwipopts.h (or lower DISCOVERY_CHUNK_MAX) if this fails.
+static_assert(DISCOVERY_CHUNK_MAX + sizeof(DISCOVERY_TOPIC) - 1 + 3 + 7 <= MQTT_OUTPUT_RINGBUF_SIZE,
+              "DISCOVERY_CHUNK_MAX does not fit MQTT_OUTPUT_RINGBUF_SIZE");
+static_assert(sizeof(DISCOVERY_TOPIC) + 3 <= TOPIC_MAX, "TOPIC_MAX too small for the discovery topic");
+
+
+//--- Start of every chunk: "dev" block, state topic (same for all sensors of the device), "cmps" block
+#define DISCOVERY_HEADER "{" DEVICE_BLOCK ",\"stat_t\":\"" STATE_TOPIC "\",\"cmps\":{"
+
+//--- The built-in table is known at compile time: its whole discovery payload is built
+//--- by the COMPILER and stored in flash, and its length is checked below.
+//--- Registered tables (mqtt_ha_register_channels()) are built at send time.
+template <typename W>
+static constexpr void write_builtin_discovery(W& w) {
+    w.put(DISCOVERY_HEADER);
+    bool first = true;
+    for (const MqttHaChannel& c : default_channels) {
+        // add a comma only if it's not the first sensor, to avoid JSON syntax error in the "cmps" block.
+        if (!first) w.put(",");
+        first = false;
+        write_component(w, c, DEVICE_ID);
+    }
+    w.put("}}");        // CLOSING the "cmps" block and the payload
+}
+
+static constexpr auto builtin_discovery =
+    ct_build<ct_length(write_builtin_discovery<CtCounter>)>(write_builtin_discovery<CtWriter>);
+
+//--- One message, with its '\0' (same room as the runtime chunks)
+static_assert(builtin_discovery.size() < DISCOVERY_CHUNK_MAX,
+              "built-in discovery payload does not fit DISCOVERY_CHUNK_MAX");
+
+//--- A chunk holds at least one component: the header, c, the closing "}}" and the '\0'.
+//--- Checked by mqtt_ha_register_channels(): a channel that cannot fit is refused there.
+static bool discovery_fits(const MqttHaChannel& c) {
+    CtCounter n;
+    write_component(n, c, DEVICE_ID);
+    return sizeof(DISCOVERY_HEADER) - 1 + n.len + 2 < DISCOVERY_CHUNK_MAX;
+}
+
+static uint32_t discovery_hash_value = 0;   // hash of every discovery message, 0: not computed
+
+static void discovery_reset() {
+    discovery_hash_value = 0;
+}
+
+//--- Build the chunk starting at channel first into buf (DISCOVERY_CHUNK_MAX bytes).
+//--- @return first channel of the following chunk
+static uint8_t discovery_build_chunk(char* buf, uint8_t first, size_t* len) {
+    if (channels == default_channels) {
+        memcpy(buf, builtin_discovery.c_str(), builtin_discovery.size() + 1);
+        *len = builtin_discovery.size();
+        return channel_count;
+    }
+    JsonWriter json(buf, DISCOVERY_CHUNK_MAX);
+    JsonPut    out{json};
+    json.raw(DISCOVERY_HEADER);
+    uint8_t i = first;
+    for (; i < channel_count; i++) {
+        size_t mark = json.length();
+        // add a comma only if it's not the first sensor, to avoid JSON syntax error in the "cmps" block.
+        if (i > first) json.raw(",");
+        write_component(out, channels[i], DEVICE_ID);
+        //--- Does not fit (keep room for the closing "}}"): it starts the next chunk
+        if (!json.ok() || json.remaining() < 2) {
+            json.rewind(mark);
+            break;
+        }
+    }
+    //--- Every channel fits one chunk (discovery_fits()): always at least one component
+    json.raw("}}");     // CLOSING the "cmps" block and the payload
+    *len = json.length();
+    return i;
+}
+
+//--- Topic of chunk number chunk into buf (TOPIC_MAX bytes)
+static void discovery_build_topic(char* buf, uint8_t chunk) {
+    JsonWriter t(buf, TOPIC_MAX);
+    if (chunk == 0) {
+        t.raw(DISCOVERY_TOPIC);
+    } else {
+        t.raw(DISCOVERY_PREFIX "/sensor/" DEVICE_ID "_").uinteger(chunk).raw("/config");
+    }
+}
+
+//--- Queue the chunk starting at channel discovery_next, built by outbox_flush() when sent
+//--- (topic and payload live in the scratch arena only while lwIP takes them).
+//--- @return false once every channel has been sent
+static bool discovery_publish_next_chunk() {
+    if (discovery_chunk > 0 && discovery_next >= channel_count) return false;
+
+    //--- Callback will confirm if the message was published successfully,
+    //--- and then send the next chunk or the availability message to confirm discovery.
+    bool queued = outbox_push(MQTT_HA_TOPIC_DISCOVERY, OUTBOX_DISCOVERY, nullptr, nullptr, 0, mqtt_ha_discovery_callback);
+    discovery_track(queued);
+    if (!queued && conn_state == MQTT_HA_DISCOVERY) conn_error = true;
+    return true;
+}
+
+//--- outbox_flush(): lwIP took the chunk (len 0: it could not be built)
+static void discovery_chunk_sent(uint8_t next, size_t len) {
+    if (len == 0) {
+        discovery_failed = true;
+        if (conn_state == MQTT_HA_DISCOVERY) conn_error = true;
+        return;
+    }
+    LOG_DEBUG("MQTT: Publishing discovery chunk %u (%u bytes)\n", discovery_chunk, (unsigned)len);
+    discovery_next = next;
+    discovery_chunk++;
+}
+
+static void metrics_publish_discovery();
+
+void mqtt_ha_publish_discovery() {
+    if (!connected || discovery_done) return;
+    //--- New session: every bridged device is announced again once ONLINE
+    gateway_session_start();
+
+    discovery_unacked = 0;
+    discovery_failed  = false;
+    //--- The broker still retains the very discovery we would send: straight to availability
+    if (discovery_skip()) {
+        discovery_confirm();
+        return;
+    }
+    discovery_next  = 0;
+    discovery_chunk = 0;
+    discovery_publish_next_chunk();
+    //--- PUBLISH as well the BTN discovery for the LED Brightness button.
+    mqtt_ha_publish_button_discovery();
+    //--- and the diagnostic entities of the runtime metrics
+    metrics_publish_discovery();
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── RUNTIME METRICS (diagnostics) ─────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Counters and histograms are updated where things happen (publish slot, completion,
+// incoming publish, mqtt_poll, buffers). Every METRICS_PERIOD_MS, once ONLINE, one message
+// built from them when it is sent (like the state) goes to METRICS_TOPIC:
+//      {"pub":1520,"pub_err":2,"err":{"timeout":2},"tx_bytes":..,"rx_bytes":..,"reconnects":1,"overflows":0,
+//       "log_drop":0,"broker":0,"failovers":0,"failover_ms":0,"dns_ms":12,
+//       "ack":{"p50":20,"p95":100,"max":84,"hist":[..]},"poll":{"p50":10,"p95":50,"max":31,"hist":[..]}}
+// Counters run since boot (HA "total_increasing"), histograms and max restart after each message:
+// the p95 of a degrading node rises within one period.
+// Percentiles are the upper bound of the histogram bucket (or the max when it is lower).
+#define DIAG_COMPONENT(id, name, value, extra)                                              \
+    "\"diag_" id "\":{"                                                                     \
+        "\"p\":\"sensor\","                                                                \
+        "\"name\":\"" name "\","                                                           \
+        "\"ent_cat\":\"diagnostic\","                /* shown in the Diagnostic block */  \
+        extra                                                                               \
+        "\"val_tpl\":\"{{ value_json." value " }}\","                                       \
+        "\"uniq_id\":\"" DEVICE_ID "_diag_" id "\""                                         \
+    "}"
+#define DIAG_COUNTER    "\"stat_cla\":\"total_increasing\","
+#define DIAG_BYTES      DIAG_COUNTER "\"unit_of_meas\":\"B\",\"dev_cla\":\"data_size\","
+//--- p50 / max / histogram of the period as attributes of the p95 entity
+#define DIAG_ATTR(obj)  "\"json_attr_t\":\"" METRICS_TOPIC "\",\"json_attr_tpl\":\"{{ value_json." obj " | tojson }}\","
+
+//--- Four messages (counters, traffic, timings, broker), each within the DISCOVERY_CHUNK_MAX budget of the sensor chunks
+#define DIAG_HEADER                                                                         \
+    "{"                                                                                     \
+    "\"dev\":{\"ids\":[\"" DEVICE_ID "\"]},"   /* same device as the sensors, its info comes from their block */ \
+    "\"avty_t\":\"" DEVICE_ID "/availability\","                                            \
+    "\"stat_t\":\"" METRICS_TOPIC "\","                                                      \
+    "\"cmps\":{"
+
+static const char metrics_discovery_counters[] =
+    DIAG_HEADER
+        DIAG_COMPONENT("pub",        "Publishes",        "pub",        DIAG_COUNTER) ","
+        DIAG_COMPONENT("pub_err",    "Publish errors",   "pub_err",    DIAG_COUNTER DIAG_ATTR("err")) ","
+        DIAG_COMPONENT("reconnects", "Reconnects",       "reconnects", DIAG_COUNTER) ","
+        DIAG_COMPONENT("overflows",  "Buffer overflows", "overflows",  DIAG_COUNTER)
+    "}}";
+static const char metrics_discovery_traffic[] =
+    DIAG_HEADER
+        DIAG_COMPONENT("tx",         "Bytes sent",       "tx_bytes",   DIAG_BYTES) ","
+        DIAG_COMPONENT("rx",         "Bytes received",   "rx_bytes",   DIAG_BYTES) ","
+        DIAG_COMPONENT("log_drop",   "Log records lost", "log_drop",   DIAG_COUNTER)
+    "}}";
+static const char metrics_discovery_timings[] =
+    DIAG_HEADER
+        DIAG_COMPONENT("ack",        "Publish ack p95",  "ack.p95",    "\"unit_of_meas\":\"ms\",\"dev_cla\":\"duration\"," DIAG_ATTR("ack")) ","
+        DIAG_COMPONENT("poll",       "Network poll p95", "poll.p95",   "\"unit_of_meas\":\"µs\",\"dev_cla\":\"duration\"," DIAG_ATTR("poll"))
+    "}}";
+static const char metrics_discovery_broker[] =
+    DIAG_HEADER
+        DIAG_COMPONENT("broker",     "Broker",           "broker",     "") ","
+        DIAG_COMPONENT("failovers",  "Broker failovers", "failovers",  DIAG_COUNTER) ","
+        DIAG_COMPONENT("failover",   "Failover time",    "failover_ms", "\"unit_of_meas\":\"ms\",\"dev_cla\":\"duration\",") ","
+        DIAG_COMPONENT("dns",        "DNS lookup time",  "dns_ms",     "\"unit_of_meas\":\"ms\",\"dev_cla\":\"duration\",")
+    "}}";
+
+struct MetricsDiscovery {
+    const char* topic;
+    const char* payload;
+    uint16_t    len;
+};
+#define DIAG_MESSAGE(name, payload) \
+    { DISCOVERY_PREFIX "/sensor/" DEVICE_ID "_diag_" name "/config", payload, sizeof(payload) - 1 }
+static const MetricsDiscovery metrics_discovery[] = {
+    DIAG_MESSAGE("counters", metrics_discovery_counters),
+    DIAG_MESSAGE("traffic",  metrics_discovery_traffic),
+    DIAG_MESSAGE("timings",  metrics_discovery_timings),
+    DIAG_MESSAGE("broker",   metrics_discovery_broker),
+};
+static_assert(sizeof(metrics_discovery_counters) <= DISCOVERY_CHUNK_MAX &&
+              sizeof(metrics_discovery_traffic)  <= DISCOVERY_CHUNK_MAX &&
+              sizeof(metrics_discovery_timings)  <= DISCOVERY_CHUNK_MAX &&
+              sizeof(metrics_discovery_broker)   <= DISCOVERY_CHUNK_MAX,
+              "diagnostics discovery larger than DISCOVERY_CHUNK_MAX");
+
+//--- lwIP err_t names, indexed by -err (0: unknown code)
+static const char* const metrics_err_names[MQTT_HA_ERR_CODES] = {
+    "other", "mem", "buf", "timeout", "rte", "inprogress", "val", "wouldblock", "use",
+    "already", "isconn", "conn", "if", "abrt", "rst", "clsd", "arg",
+};
+
+static void metrics_publish_discovery() {
+    if (METRICS_PERIOD_MS == 0) return;
+    for (const MetricsDiscovery& d : metrics_discovery) {
+        discovery_track(outbox_push(MQTT_HA_TOPIC_DISCOVERY, OUTBOX_STATIC, d.topic, d.payload, d.len, discovery_ack_callback));
+    }
+}
+
+static uint32_t hist_percentile(const uint32_t* hist, uint32_t max, uint32_t pct) {
+    uint32_t total = 0;
+    for (uint8_t b = 0; b < MQTT_HA_HIST_BUCKETS; b++) total += hist[b];
+    if (total == 0) return 0;
+    uint32_t target = (total * pct + 99) / 100;
+    uint32_t count  = 0;
+    for (uint8_t b = 0; b < MQTT_HA_HIST_BUCKETS - 1; b++) {
+        count += hist[b];
+        if (count >= target) return hist_bounds[b] < max ? hist_bounds[b] : max;
+    }
+    return max;
+}
+
+//--- {"p50":..,"p95":..,"max":..,"hist":[..]}
+static void write_hist(JsonWriter& json, const uint32_t* hist, uint32_t max) {
+    json.raw("{\"p50\":").uinteger(hist_percentile(hist, max, 50))
+        .raw(",\"p95\":").uinteger(hist_percentile(hist, max, 95))
+        .raw(",\"max\":").uinteger(max)
+        .raw(",\"hist\":[");
+    for (uint8_t b = 0; b < MQTT_HA_HIST_BUCKETS; b++) {
+        if (b > 0) json.raw(",");
+        json.uinteger(hist[b]);
+    }
+    json.raw("]}");
+}
+
+//--- Counters -> buf, METRICS_PAYLOAD_MAX bytes (called by outbox_flush() when the diagnostics are sent)
+static size_t metrics_build_payload(char* buf) {
+    const MqttHaMetrics& m = metrics;
+    MqttHaBrokerStats    b = mqtt_ha_broker_stats();
+    uint32_t errors = 0;
+    for (uint8_t i = 0; i < MQTT_HA_ERR_CODES; i++) errors += m.errors[i];
+
+    JsonWriter json(buf, METRICS_PAYLOAD_MAX);
+    json.raw("{\"pub\":").uinteger(m.publishes)
+        .raw(",\"pub_err\":").uinteger(errors)
+        .raw(",\"err\":{");
+    bool first = true;
+    for (uint8_t i = 0; i < MQTT_HA_ERR_CODES; i++) {
+        if (m.errors[i] == 0) continue;
+        json.raw(first ? "\"" : ",\"").raw(metrics_err_names[i]).raw("\":").uinteger(m.errors[i]);
+        first = false;
+    }
+    json.raw("},\"tx_bytes\":").uinteger(m.bytes_sent)
+        .raw(",\"rx_bytes\":").uinteger(m.bytes_received)
+        .raw(",\"reconnects\":").uinteger(m.reconnects)
+        .raw(",\"overflows\":").uinteger(m.overflows)
+        .raw(",\"log_drop\":").uinteger(mqtt_ha_log_dropped())
+        .raw(",\"broker\":").uinteger(b.current)
+        .raw(",\"failovers\":").uinteger(b.failovers)
+        .raw(",\"failover_ms\":").uinteger(b.failover_ms)
+        .raw(",\"dns_ms\":").uinteger(b.resolve_ms)
+        .raw(",\"ack\":");
+    write_hist(json, m.ack_ms, m.ack_max_ms);
+    json.raw(",\"poll\":");
+    write_hist(json, m.poll_us, m.poll_max_us);
+    json.raw("}");
+    if (!json.ok()) {
+        LOG_WARN("MQTT: Diagnostics payload too long (METRICS_PAYLOAD_MAX), dropped\n");
+        metrics.overflows++;
+        return 0;
+    }
+    return json.length();
+}
+
+static void metrics_window_reset() {
+    memset(metrics.ack_ms, 0, sizeof(metrics.ack_ms));
+    memset(metrics.poll_us, 0, sizeof(metrics.poll_us));
+    metrics.ack_max_ms  = 0;
+    metrics.poll_max_us = 0;
+}
+
+//--- Called from mqtt_poll(): diagnostics message when the period is over
+static void metrics_poll() {
+    if (METRICS_PERIOD_MS == 0 || conn_state != MQTT_HA_ONLINE) return;
+    uint32_t now = now_ms();
+    if ((int32_t)(now - metrics_due_ms) < 0) return;
+    metrics_due_ms = now + METRICS_PERIOD_MS;
+    outbox_push(MQTT_HA_TOPIC_DIAGNOSTIC, OUTBOX_METRICS, METRICS_TOPIC, nullptr, 0);
+}
+
+MqttHaMetrics mqtt_ha_metrics() {
+    MqttHaMetrics m = metrics;
+    m.log_dropped = mqtt_ha_log_dropped();
+    return m;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── DISCOVERY CACHE (hash kept in flash) ──────────────────────────
+//───────────────────────────────────────────────────────────────────
+// The hash of everything published as discovery: kept in the flash record once a
+// full discovery is acknowledged, a reconnect with the same hash skips it
+// (mqtt_ha_persist.cpp).
+//--- Every discovery message of the device: payloads, topics (chunk index) and QoS
+uint32_t mqtt_ha_lib::discovery_hash() {
+    if (discovery_hash_value != 0) return discovery_hash_value;
+    uint32_t h     = MQTT_HA_FNV_OFFSET;
+    uint8_t  first = 0;
+    uint8_t  chunk = 0;
+    ScratchScope scope(scratch);
+    char* buf = scope.alloc(DISCOVERY_CHUNK_MAX);
+    if (buf == nullptr) {               // arena exhausted: full discovery, nothing saved this session
+        discovery_failed = true;
+        return 0;
+    }
+    do {
+        size_t len;
+        first = discovery_build_chunk(buf, first, &len);
+        h = fnv1a(h, (const char*)&chunk, 1);
+        h = fnv1a(h, buf, len);
+        chunk++;
+    } while (first < channel_count);
+    h = fnv1a(h, BUTTON_DISCOVERY_TOPIC, sizeof(BUTTON_DISCOVERY_TOPIC) - 1);
+    h = fnv1a(h, button_discovery_payload, sizeof(button_discovery_payload) - 1);
+    if (METRICS_PERIOD_MS > 0) {
+        for (const MetricsDiscovery& d : metrics_discovery) {
+            h = fnv1a(h, d.topic, strlen(d.topic));
+            h = fnv1a(h, d.payload, d.len);
+        }
+    }
+    discovery_hash_value = (h != 0) ? h : 1;
+    return discovery_hash_value;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── FAST BOOT (cached AP and IP lease) ────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// A cold connection scans every channel for the SSID before joining, then waits
+// for DHCP (DISCOVER / OFFER / REQUEST / ACK) before the MQTT connect even starts:
+// seconds that a duty-cycled node pays on every wake-up. So each sequence that
+// reaches ONLINE leaves in the flash record (next to the discovery hash) the AP it
+// joined (BSSID + channel), the lease it got and the broker it reached:
+//      cold:  scan + join -> DHCP -> MQTT_CONNECT -> ...
+//      fast:  join (BSSID, channel) -> cached lease -> MQTT_CONNECT -> ...
+// Both shortcuts fall back at once, without backoff: a targeted join that fails
+// (or exceeds MQTT_HA_FAST_JOIN_TIMEOUT_MS) scans, a cached lease without CONNACK
+// within MQTT_HA_FAST_CONNECT_TIMEOUT_MS goes back to DHCP. Neither is tried again
+// before the next ONLINE, which caches whatever worked instead.
+// The flash is only written when the AP or the lease changed. Nothing of the MQTT
+// session itself is resumed: lwIP always connects with a clean session (the
+// discovery cache above already skips what the broker retains).
+// Every sequence (boot, or reconnect after ONLINE) is timed per phase.
+static MqttHaBootStats boot_stats       = {};
+static uint32_t        boot_seq_ms      = 0;        // start of the current sequence
+static uint32_t        boot_seq_base[MQTT_HA_STATE_COUNT] = {};    // conn_stats.time_in_state_ms then
+static bool            boot_seq_done    = false;    // ONLINE reached and recorded
+static bool            fast_join_active = false;    // the current join targets the cached AP
+static bool            fast_join_failed = false;    // ... and failed: scan until the next ONLINE
+static bool            fast_ip_active   = false;    // netif on the cached lease (DHCP stopped)
+static bool            fast_ip_proven   = false;    // ... and ONLINE with it
+static bool            fast_ip_failed   = false;    // ... or not: DHCP until the next ONLINE
+
+//--- AP and lease only belong to the network they were learnt on
+static uint32_t fast_wifi_key() {
+    uint32_t h = fnv1a(MQTT_HA_FNV_OFFSET, wifi_ssid_g, strlen(wifi_ssid_g) + 1);     // '\0' as separator
+    return fnv1a(h, wifi_password_g, strlen(wifi_password_g)) | 1;                  // 0: blank record
+}
+
+//--- net_init(): first sequence, nothing tried yet
+static void fast_reset() {
+    boot_stats       = {};
+    fast_join_failed = false;
+    fast_ip_active   = false;
+    fast_ip_proven   = false;
+    fast_ip_failed   = false;
+    fast_sequence_start();
+}
+
+//--- conn_fail() while ONLINE (and net_init()): the next sequence starts now
+static void fast_sequence_start() {
+    boot_seq_ms      = now_ms();
+    memcpy(boot_seq_base, conn_stats.time_in_state_ms, sizeof(boot_seq_base));
+    boot_seq_done    = false;
+    fast_join_active = false;
+}
+
+//--- conn_start_wifi(): join the cached AP, no scan. @return false: normal join
+static bool fast_join_start() {
+    fast_join_active = false;
+    if (!MQTT_HA_FAST_BOOT || fast_join_failed || persist.ap_channel == 0 || persist.wifi_key != fast_wifi_key()) {
+        return false;
+    }
+    LOG_INFO("WiFi: connecting to %s (cached AP, channel %u)...\n", wifi_ssid_g, persist.ap_channel);
+    boot_stats.fast_joins++;
+    if (cyw43_wifi_join(&cyw43_state, strlen(wifi_ssid_g), (const uint8_t*)wifi_ssid_g,
+                        strlen(wifi_password_g), (const uint8_t*)wifi_password_g,
+                        CYW43_AUTH_WPA2_AES_PSK, persist.ap_bssid, persist.ap_channel) != 0) {
+        fast_join_failed = true;
+        boot_stats.fallbacks++;
+        return false;
+    }
+    fast_join_active = true;
+    return true;
+}
+
+static uint32_t fast_join_timeout_ms() {
+    return fast_join_active ? MQTT_HA_FAST_JOIN_TIMEOUT_MS : WIFI_JOIN_TIMEOUT_MS;
+}
+
+//--- WIFI_JOIN failed: @return true if it was the targeted join (a scan is started instead)
+static bool fast_join_fallback() {
+    if (!fast_join_active) return false;
+    LOG_WARN("WiFi: cached AP not joined, scanning\n");
+    fast_join_failed = true;
+    boot_stats.fallbacks++;
+    conn_start_wifi();
+    return true;
+}
+
+//--- DHCP step, joined: the cached lease instead. @return true if it was set on the netif
+static bool fast_ip_apply() {
+    if (!MQTT_HA_FAST_BOOT || fast_ip_active || fast_ip_failed || persist.ip == 0 || persist.wifi_key != fast_wifi_key()) {
+        return false;
+    }
+    ip4_addr_t ip = { persist.ip }, netmask = { persist.netmask }, gw = { persist.gw };
+    dhcp_stop(netif_default);           // no address supplied yet: nothing to release
+    netif_set_addr(netif_default, &ip, &netmask, &gw);
+    if (persist.dns_server != 0) {      // DHCP also gave us the DNS server
+        ip_addr_t dns = IPADDR4_INIT(persist.dns_server);
+        dns_setserver(0, &dns);
+    }
+    fast_ip_active = true;
+    fast_ip_proven = false;
+    boot_stats.fast_ips++;
+    LOG_INFO("WiFi: cached lease %u.%u.%u.%u, no DHCP\n",
+             persist.ip & 0xff, (persist.ip >> 8) & 0xff, (persist.ip >> 16) & 0xff, persist.ip >> 24);
+    return true;
+}
+
+static uint32_t fast_connect_timeout_ms() {
+    if (!fast_ip_active || fast_ip_proven) return MQTT_CONNECT_TIMEOUT_MS;
+    //--- A full TLS handshake is seconds of CPU on this MCU, not a sign of a stale lease
+    return MQTT_HA_FAST_CONNECT_TIMEOUT_MS + (tls_full_expected() ? MQTT_HA_TLS_HANDSHAKE_MS : 0);
+}
+
+//--- conn_fail(): @return true if the cached lease never got us ONLINE (DHCP restarted)
+static bool fast_ip_fallback() {
+    if (!fast_ip_active || fast_ip_proven) return false;
+    ip4_addr_t any = {};
+    netif_set_addr(netif_default, &any, &any, &any);
+    dhcp_start(netif_default);
+    fast_ip_active = false;
+    fast_ip_failed = true;
+    boot_stats.fallbacks++;
+    return true;
+}
+
+//--- ONLINE: AP, lease and broker of this sequence for the next boot (flash only if changed)
+static void fast_save() {
+    //--- Hashed, not copied: with a TLS session the record is too big for the stack
+    uint32_t was = fnv1a(MQTT_HA_FNV_OFFSET, (const char*)&persist, sizeof(persist));
+    uint8_t  bssid[6];
+    uint32_t channel[3] = {};   // channel_info_t: hw, target, scan
+    if (cyw43_wifi_get_bssid(&cyw43_state, bssid) == 0 &&
+        cyw43_ioctl(&cyw43_state, CYW43_IOCTL_GET_CHANNEL, sizeof(channel), (uint8_t*)channel, CYW43_ITF_STA) == 0 &&
+        channel[0] > 0 && channel[0] <= 255) {
+        memcpy(persist.ap_bssid, bssid, sizeof(bssid));
+        persist.ap_channel = (uint8_t)channel[0];
+    }
+    if (!fast_ip_active) {                  // on the cached lease: nothing new
+        persist.ip      = netif_ip4_addr(netif_default)->addr;
+        persist.netmask = netif_ip4_netmask(netif_default)->addr;
+        persist.gw      = netif_ip4_gw(netif_default)->addr;
+        persist.dns_server = ip_2_ip4(dns_getserver(0))->addr;
+    }
+    persist.wifi_key     = fast_wifi_key();
+    persist.broker_ip    = ip_2_ip4(&broker_addr)->addr;
+    persist.broker_port  = broker_port_g;
+    persist.broker_index = broker_current;
+    tls_persist();
+    if (fnv1a(MQTT_HA_FNV_OFFSET, (const char*)&persist, sizeof(persist)) != was) persist_request();
+}
+
+//--- conn_step(), ONLINE: once per sequence (not from the lwIP callback: cyw43 ioctls in fast_save())
+static void fast_on_online() {
+    if (boot_seq_done) return;
+    boot_seq_done = true;
+    const uint32_t* t = conn_stats.time_in_state_ms;
+    const uint32_t* b = boot_seq_base;
+    boot_stats.join_ms    = t[MQTT_HA_WIFI_JOIN] - b[MQTT_HA_WIFI_JOIN];
+    boot_stats.dhcp_ms    = t[MQTT_HA_DHCP] - b[MQTT_HA_DHCP];
+    boot_stats.resolve_ms = t[MQTT_HA_RESOLVE] - b[MQTT_HA_RESOLVE];
+    boot_stats.connect_ms = t[MQTT_HA_MQTT_CONNECT] - b[MQTT_HA_MQTT_CONNECT];
+    boot_stats.setup_ms   = t[MQTT_HA_DISCOVERY] - b[MQTT_HA_DISCOVERY] + t[MQTT_HA_SUBSCRIBE] - b[MQTT_HA_SUBSCRIBE];
+    boot_stats.total_ms   = state_since_ms - boot_seq_ms;
+    if (boot_stats.online++ == 0) boot_stats.boot_ms = boot_stats.total_ms;
+    boot_stats.fast_join  = fast_join_active;
+    boot_stats.fast_ip    = fast_ip_active;
+    LOG_INFO("NET: ONLINE in %u ms (join %u, IP %u, connect %u)\n",
+             boot_stats.total_ms, boot_stats.join_ms, boot_stats.dhcp_ms, boot_stats.connect_ms);
+    LOG_DEBUG("NET: setup %u ms, cached AP %d, cached lease %d\n", boot_stats.setup_ms, fast_join_active, fast_ip_active);
+
+    //--- What worked this time is what gets cached: both shortcuts allowed again
+    fast_join_failed = false;
+    fast_ip_failed   = false;
+    fast_ip_proven   = fast_ip_active;
+    broker_on_online();
+    if (MQTT_HA_FAST_BOOT) fast_save();
+}
+
+MqttHaBootStats mqtt_ha_boot_stats() {
+    return boot_stats;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── BROKERS (DNS, failover) ───────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Each endpoint is a dotted IP or a host name. A name is looked up in RESOLVE
+// (after DHCP, or after BACKOFF with the link still up) with dns_gethostbyname():
+// lwIP's DNS table answers at once as long as the TTL of the record runs, so only
+// an expired name costs a query, to the server of the DHCP lease (cached with the
+// lease, see "FAST BOOT"). No answer within DNS_TIMEOUT_MS, or no such name: the
+// last known address of that broker is used if there is one, else the attempt fails.
+//      RESOLVE -> MQTT_CONNECT -> ... -> ONLINE        attempt OK: failures = 0
+//      any failure before ONLINE + BROKER_STABLE_MS    failures++
+//      failures == BROKER_FAILOVER_AFTER               next broker of the list, backoff from its base
+// Sticky: the device stays on the broker that works (reconnects, and reboots through
+// the flash record), the first one only comes back in turn when the current one fails.
+// A WiFi loss, or a cached lease that gets no answer, is not the broker's fault.
+// The first session on another broker sends the full discovery (see "DISCOVERY CACHE"):
+// independent brokers do not share their retained messages.
+static MqttHaBrokerStats broker_stats  = {};
+static uint8_t           broker_online = 0;     // broker of the last ONLINE (or of the last boot)
+static uint32_t          dns_seq       = 0;     // current lookup: answers to older ones are ignored
+static uint32_t          dns_sent_ms   = 0;
+static int8_t            dns_result    = 0;     // 0: waiting, 1: dns_answer, -1: failed
+static ip_addr_t         dns_answer;
+
+//--- @return false: empty or too long
+static bool broker_parse(BrokerEndpoint* ep, const char* host, uint16_t port) {
+    size_t len = host ? strlen(host) : 0;
+    if (len == 0 || len >= sizeof(ep->host)) return false;
+    memcpy(ep->host, host, len + 1);
+    ep->port     = port;
+    ep->literal  = ipaddr_aton(host, &ep->addr) != 0;
+    ep->resolved = ep->literal;
+    ep->failures = 0;
+    return true;
+}
+
+bool mqtt_ha_add_broker(const char* host, uint16_t port) {
+    if (host == nullptr) {              // standbys cleared, only the broker of wifi_mqtt_init() left
+        broker_count = 1;
+        return true;
+    }
+    if (broker_count >= MQTT_HA_MAX_BROKERS || !broker_parse(&brokers[broker_count], host, port)) {
+        LOG_ERROR("MQTT: Broker not added (%u brokers, max %d)\n", broker_count, MQTT_HA_MAX_BROKERS);
+        return false;
+    }
+    broker_count++;
+    return true;
+}
+
+//--- wifi_mqtt_init(), after persist_load(): back on the broker of the last boot
+static void broker_boot() {
+    broker_stats   = {};
+    broker_current = 0;
+    for (uint8_t i = 1; i < broker_count; i++) brokers[i].failures = 0;
+    uint8_t i = persist.broker_index;
+    if (i < broker_count && persist.broker_port == brokers[i].port && persist.broker_ip != 0 &&
+        (!brokers[i].literal || ip_2_ip4(&brokers[i].addr)->addr == persist.broker_ip)) {
+        broker_current = i;
+        if (!brokers[i].literal) {      // for a DNS outage (stale), the lookup still comes first
+            ip_addr_t last = IPADDR4_INIT(persist.broker_ip);
+            brokers[i].addr     = last;
+            brokers[i].resolved = true;
+        }
+    }
+    broker_online        = broker_current;
+    broker_stats.current = broker_current;
+}
+
+//--- Address known: connect
+static void broker_connect(const ip_addr_t& addr) {
+    BrokerEndpoint& ep = brokers[broker_current];
+    ep.addr     = addr;
+    ep.resolved = true;
+    broker_addr = addr;
+    conn_start_mqtt();
+}
+
+//--- lwIP DNS callback (ipaddr nullptr: no answer / no such name)
+static void broker_dns_found(const char* name, const ip_addr_t* ipaddr, void* arg) {
+    (void)name;
+    if ((uint32_t)(uintptr_t)arg != dns_seq || conn_state != MQTT_HA_RESOLVE) return;
+    if (ipaddr) dns_answer = *ipaddr;
+    dns_result = ipaddr ? 1 : -1;
+}
+
+//--- DHCP done, or BACKOFF with the link up: current broker, looked up if it is a name
+static void conn_start_broker() {
+    BrokerEndpoint& ep = brokers[broker_current];
+    broker_port_g = ep.port;
+    if (ep.literal) {
+        broker_connect(ep.addr);
+        return;
+    }
+    conn_set_state(MQTT_HA_RESOLVE);
+    broker_stats.lookups++;
+    dns_seq++;
+    dns_result  = 0;
+    dns_sent_ms = now_ms();
+    ip_addr_t addr;
+    err_t err = dns_gethostbyname(ep.host, &addr, broker_dns_found, (void*)(uintptr_t)dns_seq);
+    if (err == ERR_OK) {                // in lwIP's table, TTL not expired: no query
+        broker_stats.lookups_cached++;
+        broker_connect(addr);
+    } else if (err != ERR_INPROGRESS) {
+        dns_result = -1;                // no DNS server, table full...: next conn_step()
+    }
+}
+
+//--- conn_step(), RESOLVE
+static void broker_resolve_step(uint32_t in_state_ms) {
+    BrokerEndpoint& ep = brokers[broker_current];
+    if (dns_result > 0) {
+        uint32_t ms = now_ms() - dns_sent_ms;
+        broker_stats.resolve_ms = ms;
+        if (ms > broker_stats.resolve_max_ms) broker_stats.resolve_max_ms = ms;
+        LOG_INFO("DNS: %s resolved in %u ms\n", ep.host, ms);
+        broker_connect(dns_answer);
+        return;
+    }
+    if (dns_result == 0 && in_state_ms <= DNS_TIMEOUT_MS) return;
+    broker_stats.lookups_failed++;
+    if (ep.resolved) {
+        broker_stats.lookups_stale++;
+        LOG_WARN("DNS: %s not resolved, last known address\n", ep.host);
+        broker_connect(ep.addr);
+        return;
+    }
+    conn_fail("DNS: broker not resolved");
+}
+
+//--- conn_fail(), before the state changes: one more failure for the current broker?
+static void broker_on_failure() {
+    if (conn_state < MQTT_HA_RESOLVE || conn_state > MQTT_HA_ONLINE) return;
+    if (cyw43_tcpip_link_status(&cyw43_state, CYW43_ITF_STA) != CYW43_LINK_UP) return;
+    if (fast_ip_active && !fast_ip_proven) return;      // DHCP first (see fast_ip_fallback())
+    BrokerEndpoint& ep = brokers[broker_current];
+    if (conn_state == MQTT_HA_ONLINE && now_ms() - state_since_ms >= BROKER_STABLE_MS) {
+        ep.failures = 0;                                // a long session: healthy
+        return;
+    }
+    if (++ep.failures < BROKER_FAILOVER_AFTER || broker_count < 2) return;
+    ep.failures    = 0;
+    broker_current = (uint8_t)((broker_current + 1) % broker_count);
+    broker_stats.switches++;
+    persist.discovery_hash = 0;     // retained by the other broker? Not known: full discovery there
+    backoff_attempt = 0;
+    LOG_WARN("NET: broker %u failed %u times, now broker %u\n",
+             (broker_current + broker_count - 1) % broker_count, BROKER_FAILOVER_AFTER, broker_current);
+}
+
+//--- fast_on_online(): the broker works, failover timed if it is another one
+static void broker_on_online() {
+    brokers[broker_current].failures = 0;
+    broker_stats.current = broker_current;
+    if (broker_current != broker_online) {
+        uint32_t ms = state_since_ms - boot_seq_ms;
+        broker_stats.failovers++;
+        broker_stats.failover_ms = ms;
+        if (ms > broker_stats.failover_max_ms) broker_stats.failover_max_ms = ms;
+        LOG_INFO("NET: failover from broker %u to %u in %u ms\n", broker_online, broker_current, ms);
+    }
+    broker_online = broker_current;
+}
+
+MqttHaBrokerStats mqtt_ha_broker_stats() {
+    return broker_stats;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── BUILT-IN MQTT CLIENT (MQTT 5 topic aliases) ───────────────────
+//───────────────────────────────────────────────────────────────────
+// With MQTT_HA_MQTT_BUILTIN the mqtt_*() calls of this file go to mqtt_ha_mqtt.cpp:
+// same API as lwIP's MQTT app, so nothing else here changes. What a state costs
+// on the wire: lwIP's client resends "pico_env_sensor/state" (2 + 21 bytes) in
+// every PUBLISH; in MQTT 5 the second one sets up a topic alias and the next ones
+// carry 3 bytes of property instead (empty topic, Topic Alias). Discovery topics,
+// published once, never take an alias. A 3.1.1 broker is seen at CONNACK and
+// the client reconnects in 3.1.1 (mqtt_ha_mqtt_stats().fallbacks).
+static uint8_t mqtt_level = MQTT_HA_MQTT_LEVEL;
+
+bool mqtt_ha_set_mqtt_version(uint8_t level) {
+#if MQTT_HA_MQTT_BUILTIN
+    if (level != 4 && level != 5) return false;
+    mqtt_level = level;
+    return true;
+#else
+    (void)level;
+    return false;
+#endif
+}
+
+//--- net_init(), once the client exists
+static void mqtt_version_apply() {
+#if MQTT_HA_MQTT_BUILTIN
+    mqtt_ha_mqtt_set_level(mqtt_client, mqtt_level);
+#else
+    (void)mqtt_level;
+#endif
+}
+
+MqttHaMqttStats mqtt_ha_mqtt_stats() {
+    MqttHaMqttStats s = {};
+#if MQTT_HA_MQTT_BUILTIN
+    if (mqtt_client) mqtt_ha_mqtt_get_stats(mqtt_client, &s);
+#endif
+    return s;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── STORE AND FORWARD (offline backlog) ───────────────────────────
+//───────────────────────────────────────────────────────────────────
+// While the broker is unreachable, mqtt_ha_publish_channels() stores each
+// sample as a compact binary record (14 bytes for the built-in channels instead of ~70 bytes of JSON):
+//      [t_ms: 4 bytes][channel_set bitmap][each value on storage_size bytes]
+// Once the device is ONLINE again (mqtt_ha_availability_callback set discovery_done),
+// mqtt_poll() replays them oldest first, BACKLOG_BATCH per call and never more than
+// BACKLOG_IN_FLIGHT waiting for their PUBACK, so lwIP request slots stay available
+// for live states and subscriptions.
+// A replayed record stays in the ring until its PUBACK: the first backlog_in_flight
+// records are the ones lwIP holds (PUBACKs come back in order), a lost connection
+// sends them again, a failed publish goes back at the end of the ring.
+// If the buffer is full the oldest sample is evicted: recent data is worth more.
+static uint8_t            backlog_mem[BACKLOG_BYTES];
+static RecordRing         backlog(backlog_mem, sizeof(backlog_mem));
+static uint8_t            backlog_in_flight = 0;     // records at the front of the ring, sent
+static uint8_t            backlog_orphans   = 0;     // sent, then evicted: their callback pops nothing
+static MqttHaBacklogStats backlog_stats     = {};
+
+//--- Bytes of one record for the current channel table (backlog and batch)
+size_t mqtt_ha_lib::record_size() {
+    size_t size = 4 + (channel_count + 7) / 8;
+    for (uint8_t i = 0; i < channel_count; i++) size += storage_size[channels[i].storage];
+    return size;
+}
+
+static void backlog_reset() {
+    backlog.reset(record_size());
+    backlog_in_flight = 0;
+    backlog_orphans   = 0;
+}
+
+//--- Current channel values -> one binary record
+void mqtt_ha_lib::record_encode(uint8_t* rec) {
+    uint32_t t  = now_ms();
+    uint8_t  bm = (channel_count + 7) / 8;
+    memcpy(rec, &t, 4);
+    memcpy(rec + 4, channel_set, bm);
+    uint8_t* p = rec + 4 + bm;
+    for (uint8_t i = 0; i < channel_count; i++) {
+        uint8_t n = storage_size[channels[i].storage];
+        memcpy(p, &channel_value[i], n);    // little endian: the n low bytes
+        p += n;
+    }
+}
+
+//--- One record into the backlog, the oldest is evicted when full
+void mqtt_ha_lib::backlog_push(const uint8_t* rec) {
+    if (backlog.record_size() == 0) backlog_reset();   // first use with the built-in table
+    if (!backlog.push(rec)) {
+        backlog_stats.evicted++;
+        metrics.overflows++;
+        if (backlog_in_flight > 0) {
+            backlog_in_flight--;
+            backlog_orphans++;
+        }
+    }
+    backlog_stats.buffered++;
+}
+
+static void backlog_store() {
+    uint8_t rec[BACKLOG_RECORD_MAX];
+    record_encode(rec);
+    backlog_push(rec);
+}
+
+//--- One stored value -> int32
+int32_t mqtt_ha_lib::record_value(const uint8_t* p, MqttHaStorage type) {
+    switch (type) {
+    case MQTT_HA_U8:  return p[0];
+    case MQTT_HA_I8:  return (int8_t)p[0];
+    case MQTT_HA_U16: { uint16_t v; memcpy(&v, p, 2); return v; }
+    case MQTT_HA_I16: { int16_t v;  memcpy(&v, p, 2); return v; }
+    case MQTT_HA_I32: { int32_t v;  memcpy(&v, p, 4); return v; }
+    }
+    return 0;
+}
+
+//--- One binary record -> timestamp, values and bitmap
+static uint32_t record_decode(const uint8_t* rec, int32_t* values, uint8_t* set) {
+    uint32_t t;
+    uint8_t  bm = (channel_count + 7) / 8;
+    memcpy(&t, rec, 4);
+    memcpy(set, rec + 4, bm);
+    const uint8_t* p = rec + 4 + bm;
+    for (uint8_t i = 0; i < channel_count; i++) {
+        values[i] = record_value(p, channels[i].storage);
+        p += storage_size[channels[i].storage];
+    }
+    return t;
+}
+
+//--- Replay publish completed (PUBACK received or timed out): it is the oldest record sent
+static void backlog_replay_callback(void *arg, err_t result) {
+    if (result == ERR_OK) {
+        backlog_stats.replayed++;
+    } else {
+        LOG_ERROR("MQTT: Replay publish error (%d)\n", result);
+    }
+    if (backlog_orphans > 0) {          // its record was evicted meanwhile
+        backlog_orphans--;
+        return;
+    }
+    if (backlog_in_flight == 0) return; // sent before a disconnect or a new channel table
+    backlog_in_flight--;
+    uint8_t rec[BACKLOG_RECORD_MAX];
+    if (result != ERR_OK) memcpy(rec, backlog.front(), backlog.record_size());
+    backlog.pop();
+    //--- Not delivered: at the end of the ring, after the records still in flight (age_ms keeps its time)
+    if (result != ERR_OK) backlog.push(rec);
+}
+
+//--- lwIP drops its pending requests on disconnect, their callbacks will never fire:
+//--- the records sent and not acknowledged are still at the front, replayed again.
+static void backlog_on_disconnect() {
+    backlog_in_flight = 0;
+    backlog_orphans   = 0;
+}
+
+//--- Called from mqtt_poll(): send the next batch of stored samples.
+//--- Live messages first: nothing is replayed while the outbound queue is not empty.
+static void backlog_drain() {
+    if (!connected || !discovery_done || outbox_count > 0) return;
+
+    uint32_t now = now_ms();
+    for (int n = 0; n < BACKLOG_BATCH && backlog_in_flight + backlog_orphans < BACKLOG_IN_FLIGHT; n++) {
+        if (backlog_in_flight >= backlog.size()) return;
+        const uint8_t* rec = backlog.at(backlog_in_flight);      // oldest record not sent yet
+
+        int32_t  values[MQTT_HA_MAX_CHANNELS];
+        uint8_t  set[(MQTT_HA_MAX_CHANNELS + 7) / 8];
+        uint32_t t = record_decode(rec, values, set);
+
+        ScratchScope scope(scratch);
+        char* buf = scope.alloc(STATE_PAYLOAD_MAX);
+        if (buf == nullptr) return;         // arena exhausted: the sample stays, next poll
+        JsonWriter json(buf, STATE_PAYLOAD_MAX);
+        json.raw("{\"age_ms\":").uinteger(now - t);        // how old the sample is, the receiver rebuilds the timestamp
+        write_channel_fields(json, values, set, false);
+        json.raw("}");
+        if (!json.ok()) {
+            if (backlog_in_flight > 0) return;     // only the oldest can go: once the others are acknowledged
+            LOG_WARN("MQTT: Replay payload too long, dropped\n");
+            metrics.overflows++;
+            backlog.pop();
+            continue;
+        }
+
+        //--- Sample is only removed on its PUBACK (ERR_MEM keeps it unsent for the next poll)
+        if (!mqtt_publish_msg(MQTT_HA_TOPIC_REPLAY, REPLAY_TOPIC, buf, json.length(), backlog_replay_callback)) return;
+        backlog_in_flight++;
+    }
+}
+
+MqttHaBacklogStats mqtt_ha_backlog_stats() {
+    MqttHaBacklogStats s = backlog_stats;
+    s.pending = (uint16_t)backlog.size();
+    return s;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── STATE PUBLICATION ─────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// One JSON object with every channel that has a value, on STATE_TOPIC:
+//      {"temperature":23.5,"humidity":48.2,"eco2":450,"tvoc":120,"aqi":1}
+// Numbers are written from the scaled integers (mqtt_ha_json.h): no printf,
+// no floating point, and the exact length goes to mqtt_publish (no strlen).
+//--- Current channel values -> buf (called by outbox_flush() when the state is sent)
+//--- @return payload length, 0 if it does not fit STATE_PAYLOAD_MAX
+static size_t state_build_payload(char* buf) {
+    JsonWriter json(buf, STATE_PAYLOAD_MAX);
+    json.raw("{");
+    write_channel_fields(json, channel_value, channel_set, true);
+    json.raw("}");
+    if (!json.ok()) {
+        LOG_WARN("MQTT: State payload too long (STATE_PAYLOAD_MAX), dropped\n");
+        metrics.overflows++;
+        return 0;
+    }
+    return json.length();
+}
+
+//--- channel_value -> STATE_TOPIC (or the backlog), network core
+static void publish_channels_now() {
+    //--- OFFLINE: keep the reading for later instead of dropping it
+    if (!connected || !discovery_done) {
+        backlog_store();
+        return;
+    }
+    //--- Batching: K samples per message on BATCH_TOPIC, STATE_TOPIC once per batch
+    if (batch_enabled()) {
+        batch_store();
+        batch_poll();
+        return;
+    }
+    //--- Sent now if a publish slot is free, otherwise waits in the outbound queue
+    //--- (a state already waiting there will carry these newer values)
+    outbox_push(MQTT_HA_TOPIC_STATE, OUTBOX_STATE, STATE_TOPIC, nullptr, 0);
+}
+
+#if !MQTT_HA_DUAL_CORE
+//--- Past the report-by-exception filter: straight to the network part
+void mqtt_ha_lib::channels_forward() {
+    publish_channels_now();
+}
+#endif
+
+void mqtt_ha_publish_state(double temperature, double humidity,
+                           uint16_t eco2, uint16_t tvoc, uint8_t aqi) {
+    if (channels != default_channels) {
+        LOG_ERROR("MQTT: mqtt_ha_publish_state() needs the built-in channel table, use mqtt_ha_set()\n");
+        return;
+    }
+    mqtt_ha_set(CH_TEMPERATURE, temperature);
+    mqtt_ha_set(CH_HUMIDITY,    humidity);
+    mqtt_ha_set_scaled(CH_ECO2, eco2);
+    mqtt_ha_set_scaled(CH_TVOC, tvoc);
+    mqtt_ha_set_scaled(CH_AQI,  aqi);
+    mqtt_ha_publish_channels();
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── MAIN LOOP (mqtt_poll) ─────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Everything the library does outside the API calls starts here: lwIP callbacks,
+// connection steps, queued messages, the features' polls. In dual-core mode
+// net_poll() runs on core 1 (see "DUAL-CORE MODE") and mqtt_poll() keeps the rest.
+//--- One pass of the network side: lwIP, connection, outbound queue
+static void net_poll() {
     //--- let cyw43_arch do its thing (handle WiFi and MQTT events, call callbacks, etc.)
     //--- need to be called regularly in the main loop to maintain the connection and process events.
+    //--- Also polled while offline: it drives the WiFi join and DHCP.
+    uint32_t t0 = time_us_32();
     cyw43_arch_poll();
+    hist_add(metrics.poll_us, &metrics.poll_max_us, time_us_32() - t0);
+    //--- advance the connection state machine (never blocks)
+    conn_step();
+    //--- discovery hash / AP / lease changed: to the flash from mqtt_poll()
+    persist_handoff();
+    //--- messages refused earlier (lwIP full): try again
+    outbox_flush();
+    //--- diagnostics, every METRICS_PERIOD_MS
+    metrics_poll();
+    //--- batch whose oldest sample reached its max age
+    batch_poll();
+    //--- bridged devices: discovery, availability, states, one at a time
+    gateway_poll();
+    //--- replay what was stored while offline, a few samples at a time
+    backlog_drain();
 }
 
+#if !MQTT_HA_DUAL_CORE
+void mqtt_poll() {
+    if (conn_state != MQTT_HA_IDLE) {         // wifi_mqtt_init() not called (or failed)
+        net_poll();
+    }
+    report_poll();
+    persist_poll();
+    //--- logs recorded by the callbacks above, written now that lwIP is done (see mqtt_ha_log.h)
+    mqtt_ha_log_flush();
+}
+#endif
+
 bool mqtt_is_connected() {
     return connected;
-}
\ No newline at end of file
+}
+//───────────────────────────────────────────────────────────────────
+//─── DUAL-CORE MODE ────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// MQTT_HA_DUAL_CORE=1: core 1 owns the CYW43 driver, lwIP and everything
+// above (connection, outbox, backlog, metrics); core 0 only runs the application.
+//
+//      core 0 (application)                       core 1 (network, net_core_main)
+//      mqtt_ha_set() -> app_value
+//      mqtt_ha_publish_channels() --samples-->    channel_value -> state / backlog
+//      mqtt_poll(): handlers      <--commands--   lwIP callbacks -> router
+//                   + log flush
+//
+// Both directions are SPSC queues (mqtt_ha_spsc.h): no lock, no interrupt masking,
+// a full queue never blocks the producer (the item is dropped and counted).
+// A sample is a snapshot of every channel: each one popped is published or stored
+// in the backlog, the outbox still coalesces states when lwIP is behind.
+// Raw data handlers (MqttHaRoute::data) stay on core 1: the fragments are lwIP buffers.
+static std::atomic<uint32_t> core_samples{0};           // written by core 0 only
+static std::atomic<uint32_t> core_samples_dropped{0};
+static std::atomic<uint32_t> core_commands{0};          // written by core 1 only
+static std::atomic<uint32_t> core_commands_dropped{0};
+
+MqttHaCoreStats mqtt_ha_core_stats() {
+    MqttHaCoreStats s;
+    s.samples          = core_samples.load(std::memory_order_relaxed);
+    s.samples_dropped  = core_samples_dropped.load(std::memory_order_relaxed);
+    s.commands         = core_commands.load(std::memory_order_relaxed);
+    s.commands_dropped = core_commands_dropped.load(std::memory_order_relaxed);
+    return s;
+}
+
+#if MQTT_HA_DUAL_CORE
+//--- No read-modify-write on the M0+: each counter has a single writer
+static void core_count(std::atomic<uint32_t>& counter) {
+    counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+struct CoreSample {
+    int32_t values[MQTT_HA_MAX_CHANNELS];
+    uint8_t set[(MQTT_HA_MAX_CHANNELS + 7) / 8];
+};
+
+//--- A PayloadEvent with its own copy of the tokens (the tokenizer reuses its buffers)
+struct CoreCommand {
+    const char* topic;                  // router table, stays valid
+    uint8_t     entry;                  // router entry
+    bool        has_key;
+    bool        truncated;
+    bool        has_value;
+    uint8_t     len;
+    int32_t     value;
+    char        key[MQTT_HA_TOKEN_MAX];
+    char        text[MQTT_HA_TOKEN_MAX];
+};
+
+static SpscQueue<CoreSample, SAMPLE_QUEUE_SLOTS>   sample_queue;     // core 0 -> core 1
+static SpscQueue<CoreCommand, COMMAND_QUEUE_SLOTS> command_queue;    // core 1 -> core 0
+static std::atomic<int>  net_init_result{0};    // 0: pending, 1: ok, -1: failed
+static std::atomic<bool> net_running{false};
+static std::atomic<bool> net_stopped{true};
+static uint32_t          samples_dropped_seen = 0;   // core 1: already added to metrics.overflows
+
+void mqtt_ha_lib::channels_forward() {
+    CoreSample sample;
+    memcpy(sample.values, app_value, sizeof(sample.values));
+    memcpy(sample.set, app_set, sizeof(sample.set));
+    core_count(sample_queue.push(sample) ? core_samples : core_samples_dropped);
+}
+
+//--- Core 1, from a lwIP callback
+static void command_forward(uint8_t e, const char* topic, const PayloadEvent* ev) {
+    CoreCommand c;
+    c.topic     = topic;
+    c.entry     = e;
+    c.has_key   = ev->key != nullptr;
+    c.truncated = ev->truncated;
+    c.has_value = ev->has_value;
+    c.len       = ev->len;
+    c.value     = ev->value;
+    if (c.has_key) strcpy(c.key, ev->key);      // both < MQTT_HA_TOKEN_MAX
+    memcpy(c.text, ev->text, (size_t)ev->len + 1);
+    if (!command_queue.push(c)) {
+        LOG_WARN("MQTT: Command queue full (COMMAND_QUEUE_SLOTS), dropped\n");
+        core_count(core_commands_dropped);
+        metrics.overflows++;
+        return;
+    }
+    core_count(core_commands);
+}
+
+//--- Core 1: samples from the application
+static void net_samples() {
+    CoreSample sample;
+    while (sample_queue.pop(&sample)) {
+        memcpy(channel_value, sample.values, sizeof(channel_value));
+        memcpy(channel_set, sample.set, sizeof(channel_set));
+        publish_channels_now();
+    }
+    uint32_t dropped = core_samples_dropped.load(std::memory_order_relaxed);
+    metrics.overflows   += dropped - samples_dropped_seen;
+    samples_dropped_seen = dropped;
+}
+
+static void net_core_main() {
+    stack_watch_start(__builtin_frame_address(0));
+    //--- Paused by core 0 while it writes the flash (persist_poll())
+    flash_safe_execute_core_init();
+    if (!net_init()) {
+        net_stopped = true;
+        net_init_result = -1;
+        return;
+    }
+    net_init_result = 1;
+    while (net_running) {
+        net_samples();
+        net_poll();
+        sleep_ms(1);
+    }
+    net_stopped = true;
+}
+
+static bool net_core_start() {
+    mqtt_ha_stop_network_core();
+    net_init_result = 0;
+    net_running     = true;
+    net_stopped     = false;
+    multicore_launch_core1(net_core_main);
+    //--- The CYW43 / client setup result, like the single-core wifi_mqtt_init()
+    while (net_init_result == 0) tight_loop_contents();
+    if (net_init_result < 0) {
+        mqtt_ha_stop_network_core();
+        return false;
+    }
+    return true;
+}
+
+void mqtt_ha_stop_network_core() {
+    if (net_stopped && !net_running) return;
+    net_running = false;
+    //--- Let core 1 finish its pass (never reset it inside lwIP)
+    while (!net_stopped) tight_loop_contents();
+    multicore_reset_core1();
+}
+
+//--- Core 0: handlers of the commands received by core 1, then the logs
+void mqtt_poll() {
+    CoreCommand c;
+    while (command_queue.pop(&c)) {
+        PayloadEvent ev;
+        ev.key       = c.has_key ? c.key : nullptr;
+        ev.text      = c.text;
+        ev.len       = c.len;
+        ev.truncated = c.truncated;
+        ev.has_value = c.has_value;
+        ev.value     = c.value;
+        ev.hash      = 0;
+        command_call(c.entry, c.topic, &ev);
+    }
+    report_poll();
+    persist_poll();
+    mqtt_ha_log_flush();
+}
+#else
+void mqtt_ha_stop_network_core() {}
+#endif
+
+#ifdef MQTT_HA_HOST
+//───────────────────────────────────────────────────────────────────
+//─── HOST (tests and benchmarks) ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Every counter behind the *_stats() / mqtt_ha_metrics() getters lives as long as the
+// program: on the Pico that is one boot, on the host several suites share it.
+// Queues, rings and tables are left alone, wifi_mqtt_init() and the registrations own them.
+void mqtt_ha_host_reset_stats() {
+    mqtt_ha_stop_network_core();        // core 1 writes most of them
+    conn_stats       = {};
+    metrics          = {};
+    metrics_sessions = 0;
+    outbox_stats     = {};
+    persist_reset_stats();
+    boot_stats       = {};
+    broker_stats     = {};
+    tls_reset_stats();
+    backlog_stats    = {};
+    batch_reset_stats();
+    report_reset_stats();
+    gateway_reset_stats();
+    mqtt_ha_log_reset_stats();
+    core_samples          = 0;
+    core_samples_dropped  = 0;
+    core_commands         = 0;
+    core_commands_dropped = 0;
+#if MQTT_HA_DUAL_CORE
+    samples_dropped_seen  = 0;
+#endif
+}
+#endif
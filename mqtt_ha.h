@@ -1,9 +1,13 @@
 #pragma once
+#include <stddef.h>
 #include <stdint.h>
 
 // Appeler une fois après stdio_init_all()
+// Non-blocking: starts the WiFi join and returns, mqtt_poll() does the rest.
+// mqtt_broker: dotted IP or host name (resolved by lwIP DNS), see also mqtt_ha_add_broker().
+// Returns false only on a setup error (CYW43 init, client allocation, broker name empty or too long).
 bool wifi_mqtt_init(const char* ssid, const char* password,
-                    const char* mqtt_broker_ip, uint16_t mqtt_port = 1883);
+                    const char* mqtt_broker, uint16_t mqtt_port = 1883);
 
 // Publier l'auto-discovery pour tous les capteurs (appeler une fois après connexion)
 void mqtt_ha_publish_discovery();
@@ -19,15 +23,435 @@ struct CmdEntry {
 //--- Call to register the command handlers functions for incoming MQTT commands
 // @param table  : CmdEntry array containing command names and their corresponding handler functions
 // @param count  : number of entries in the array
+// A table the router cannot hold (see mqtt_ha_register_routes()) is refused, the previous one stays.
 void mqtt_register_commands(const CmdEntry* table, uint8_t count);
-//--- SUBSCRIBE to Command Topic for incoming messages (e.g., commands from Home Assistant)
+//--- SUBSCRIBE to every Command Topic for incoming messages (e.g., commands from Home Assistant)
 void mqtt_subscribe_commands();
 
+//─── Command Router ────────────────────────────────────────────────
+// Commands on any topic, with the payload passed to the handler:
+// HA numbers, switches, selects, brightness... each with its own command topic.
+// Payloads are read as they arrive (no size limit, nothing buffered):
+// a plain payload gives one call, a JSON object one call per top-level member
+// ({"state":"ON","brightness":128} -> key "state" then key "brightness").
+struct MqttHaCommand {
+    const char* topic;
+    const char* key;        // JSON member name, nullptr for a plain payload
+    const char* payload;    // payload or JSON value (without quotes), null terminated
+    uint16_t    len;
+    bool        truncated;  // payload longer than MQTT_HA_TOKEN_MAX - 1 (31) bytes, only the start is kept
+    bool        has_value;  // payload is a number or ON/OFF/TRUE/FALSE
+    int32_t     value;      // number scaled by 10^precision of the route, ON/TRUE = 1, OFF/FALSE = 0
+    void*       arg;        // MqttHaRoute::arg
+};
+typedef void (*route_handler_t)(const MqttHaCommand* cmd);
+//--- Raw payload fragments, straight from lwIP (offset / total in bytes)
+typedef void (*route_data_t)(const uint8_t* data, uint16_t len, uint32_t offset, uint32_t total, void* arg);
+
+struct MqttHaRoute {
+    const char*     topic;      // command topic, subscribed with QoS 1
+    const char*     command;    // payload that selects this route, nullptr: any payload (value passed to the handler)
+    route_handler_t handler;
+    void*           arg;        // user argument, given back in MqttHaCommand::arg
+    uint8_t         precision;  // decimals kept in MqttHaCommand::value (0..3)
+    route_data_t    data;       // optional, "any payload" routes only: every fragment (large config, OTA...)
+};
+
+//--- Call BEFORE wifi_mqtt_init(), the table must stay valid (static / const).
+//--- Lookup is a precomputed hash (topic + payload): same cost for 1 or MQTT_HA_MAX_ROUTES routes.
+//--- An exact command wins over the "any payload" route of the same topic (commands up to 31 bytes).
+// @param table  : MqttHaRoute array
+// @param count  : number of entries
+// @return false if a route is invalid, duplicated, or the router is full (the previous table stays)
+bool mqtt_ha_register_routes(const MqttHaRoute* table, uint8_t count);
+
+//─── Sensor Channels (registry) ────────────────────────────────────
+// The application describes its sensors ONCE in a MqttHaChannel table:
+// HA discovery, state payloads and the offline backlog are all generated from it.
+// A channel is then updated by its index in the table (the "handle").
+enum MqttHaStorage : uint8_t {
+    MQTT_HA_U8,
+    MQTT_HA_I8,
+    MQTT_HA_U16,
+    MQTT_HA_I16,
+    MQTT_HA_I32,
+};
+
+struct MqttHaChannel {
+    const char*   key;        // JSON key in the state payload, e.g. "temperature" (not escaped)
+    const char*   id;         // component "sensor_<id>", uniq_id "<DEVICE_ID>_<id>"
+    const char*   name;       // HA entity name, nullptr: HA names it after the device class
+    const char*   unit;       // unit_of_measurement, "" or nullptr if none
+    const char*   dev_cla;    // HA device class, nullptr if none
+    uint8_t       precision;  // decimals (0..3): the value is stored as an integer scaled by 10^precision
+    MqttHaStorage storage;    // integer type the scaled value is stored in (clamped to its range)
+};
+
+//--- Call BEFORE wifi_mqtt_init() to replace the built-in table (temperature, humidity, eco2, tvoc, aqi).
+//--- The table must stay valid (static / const). Clears the offline backlog.
+//--- mqtt_ha_register_channels(nullptr, 0) goes back to the built-in table.
+// @param table  : MqttHaChannel array
+// @param count  : number of entries (max MQTT_HA_MAX_CHANNELS)
+// @return false if the table is invalid
+bool mqtt_ha_register_channels(const MqttHaChannel* table, uint8_t count);
+//--- Update a channel value (rounded to its precision)
+void mqtt_ha_set(uint8_t channel, double value);
+//--- Update a channel with a value already scaled by 10^precision (no floating point)
+void mqtt_ha_set_scaled(uint8_t channel, int32_t scaled);
+//--- Publish every channel that has a value as one JSON state payload (or store it while offline).
+//--- With a deadband or a heartbeat set (below), only when one of them says so.
+void mqtt_ha_publish_channels();
+
+//─── Report by exception ───────────────────────────────────────────
+// Sample fast, publish on significant change: once a deadband or the heartbeat is
+// set, mqtt_ha_publish_channels() only sends a state when a channel moved by at
+// least its deadband since the last state sent, got its first value, or nothing
+// was sent for max_silence_ms. Call after mqtt_ha_register_channels() (which
+// clears the deadbands and aggregates), and from the application core.
+enum MqttHaAggregate : uint8_t {
+    MQTT_HA_AGG_LAST,       // latest value (default)
+    MQTT_HA_AGG_MIN,        // of the samples since the last state sent
+    MQTT_HA_AGG_MAX,
+    MQTT_HA_AGG_MEAN,
+    MQTT_HA_AGG_EWMA,       // every sample, alpha = 1 / 2^ewma_shift
+};
+
+//--- In channel units (0.1 for 0.1 °C), 0: any change, negative: never triggers a state by itself
+bool mqtt_ha_set_deadband(uint8_t channel, double deadband);
+//--- A state at least every max_silence_ms, also from mqtt_poll() (0: no heartbeat)
+void mqtt_ha_set_heartbeat(uint32_t max_silence_ms);
+//--- Value sent for the channel; ewma_shift 1..8 (EWMA only, 3: alpha = 1/8)
+bool mqtt_ha_set_aggregate(uint8_t channel, MqttHaAggregate mode, uint8_t ewma_shift);
+
+struct MqttHaReportStats {
+    uint32_t sent;          // states that went through the filter
+    uint32_t suppressed;    // mqtt_ha_publish_channels() calls without a significant change
+    uint32_t heartbeats;    // states sent only because of max_silence_ms
+};
+MqttHaReportStats mqtt_ha_report_stats();
+//--- How many states a channel triggered (crossed its deadband): which threshold to tune
+uint32_t mqtt_ha_report_triggers(uint8_t channel);
+
+//─── Publish Policy & Outbound Queue ───────────────────────────────
+// Every message goes through a bounded queue that respects lwIP's in-flight
+// window: ERR_MEM is retried later instead of dropping the message, and a newer
+// state replaces the one still waiting (latest value wins).
+enum MqttHaTopic : uint8_t {
+    MQTT_HA_TOPIC_DISCOVERY,        // sensor + button discovery        (default QoS 1, retained)
+    MQTT_HA_TOPIC_AVAILABILITY,     // "online"                         (default QoS 1, retained)
+    MQTT_HA_TOPIC_STATE,            // live state                       (default QoS 1)
+    MQTT_HA_TOPIC_REPLAY,           // offline samples replay           (default QoS 1)
+    MQTT_HA_TOPIC_DIAGNOSTIC,       // runtime metrics, every METRICS_PERIOD_MS (default QoS 0)
+    MQTT_HA_TOPIC_BATCH,            // batched samples, mqtt_ha_set_batching() (default QoS 1)
+    MQTT_HA_TOPIC_COUNT
+};
+
+struct MqttHaTopicPolicy {
+    uint8_t qos;        // 0: no PUBACK round trip (high rate telemetry), 1: acknowledged by the broker
+    bool    retain;
+};
+
+//--- Change QoS / retain of a topic, e.g. QoS 0 for a fast state:
+//---     mqtt_ha_set_topic_policy(MQTT_HA_TOPIC_STATE, 0, false);
+bool mqtt_ha_set_topic_policy(MqttHaTopic topic, uint8_t qos, bool retain);
+
+struct MqttHaOutboxStats {
+    uint32_t queued;        // messages that went through the queue
+    uint32_t coalesced;     // states replaced by a newer one before being sent
+    uint32_t retried;       // sends refused by lwIP (ERR_MEM) or the scratch arena, kept for later
+    uint32_t dropped;       // queue full, or message larger than lwIP's output buffer
+    uint8_t  max_depth;     // highest number of messages waiting
+    uint8_t  pending;       // waiting now
+    uint8_t  in_flight;     // publishes waiting for their completion
+};
+MqttHaOutboxStats mqtt_ha_outbox_stats();
+
 // Publier les valeurs des capteurs (appeler périodiquement)
+// Shortcut for the built-in channel table only: sets the 5 channels then mqtt_ha_publish_channels().
 void mqtt_ha_publish_state(double temperature, double humidity,
                            uint16_t eco2, uint16_t tvoc, uint8_t aqi);
 
+//─── Offline backlog (store and forward) ───────────────────────────
+// Readings published while offline are buffered and replayed after reconnect.
+struct MqttHaBacklogStats {
+    uint32_t buffered;  // samples stored while offline
+    uint32_t replayed;  // samples replayed and acknowledged by the broker
+    uint32_t evicted;   // oldest samples overwritten because the buffer was full
+    uint16_t pending;   // samples in the buffer, replays waiting for their PUBACK included
+};
+MqttHaBacklogStats mqtt_ha_backlog_stats();
+
+//─── Batched samples (bulk topic) ──────────────────────────────────
+// For high-rate sampling: K samples per message on <DEVICE_ID>/state/batch,
+//      {"age_ms":[400,200,0],"temperature":[23.5,23.5,23.6],"humidity":[48.2,48.1,48.1]}
+// sent once K samples are waiting or the oldest one is max_ms old.
+// STATE_TOPIC is still updated with the latest values, once per batch.
+//--- samples = 0 (or 1): back to one state per sample. Call from the main loop
+//--- (before wifi_mqtt_init() in dual-core mode).
+// @return false if K samples could not fit BATCH_BYTES / BATCH_PAYLOAD_MAX with this channel table
+bool mqtt_ha_set_batching(uint16_t samples, uint32_t max_ms);
+
+struct MqttHaBatchStats {
+    uint32_t batches;   // batch messages handed to lwIP
+    uint32_t samples;   // samples they carried
+    uint32_t evicted;   // oldest samples overwritten (BATCH_BYTES full) or too large
+    uint16_t pending;   // samples waiting for the next batch
+};
+MqttHaBatchStats mqtt_ha_batch_stats();
+
+//─── Discovery cache ───────────────────────────────────────────────
+// Discovery is retained by the broker: when a reconnect (or a reboot) would send
+// exactly the same messages again (hash kept in flash, mqtt_ha_store.h), the
+// device goes straight to availability and subscriptions.
+struct MqttHaDiscoveryStats {
+    uint32_t hash;          // hash of the current discovery messages
+    uint32_t published;     // sessions with a full discovery
+    uint32_t skipped;       // sessions without (hash unchanged)
+    uint32_t saves;         // flash writes
+    uint32_t full_ms;       // CONNACK -> ONLINE of the last full discovery (kept in flash)
+    uint32_t last_ms;       // CONNACK -> ONLINE of the last session
+    uint32_t saved_ms;      // time saved by the skipped sessions, since boot
+};
+MqttHaDiscoveryStats mqtt_ha_discovery_stats();
+//--- Full discovery on the next MQTT session (e.g. the broker lost its retained messages)
+void mqtt_ha_discovery_invalidate();
+
+//─── Fast boot (cached AP and IP lease) ────────────────────────────
+// The AP (BSSID + channel), the DHCP lease and the broker of the last session that
+// reached ONLINE are kept in flash with the discovery hash: the next join skips the
+// scan and the lease is reused without DHCP. Either one failing falls back to the
+// normal path at once. MQTT_HA_FAST_BOOT=0 to disable.
+// A sequence is a boot, or a reconnect after ONLINE; failed attempts and backoffs count in it.
+struct MqttHaBootStats {
+    uint32_t join_ms;       // last sequence that reached ONLINE: WiFi join (scan or targeted)
+    uint32_t dhcp_ms;       //     joined -> IP address (DHCP, or the cached lease)
+    uint32_t resolve_ms;    //     broker host name -> address (0: IP, or lwIP's DNS table)
+    uint32_t connect_ms;    //     TCP + CONNECT -> CONNACK
+    uint32_t setup_ms;      //     CONNACK -> ONLINE (discovery, availability, subscribe)
+    uint32_t total_ms;      //     start -> ONLINE
+    uint32_t boot_ms;       // total_ms of the first sequence (wifi_mqtt_init() -> ONLINE)
+    uint32_t online;        // sequences that reached ONLINE
+    uint32_t fast_joins;    // targeted joins started
+    uint32_t fast_ips;      // cached leases set on the netif
+    uint32_t fallbacks;     // ... of either that failed (scan / DHCP instead)
+    bool     fast_join;     // last sequence joined the cached AP
+    bool     fast_ip;       // last sequence runs on the cached lease
+};
+MqttHaBootStats mqtt_ha_boot_stats();
+
+//─── Brokers (DNS, failover) ───────────────────────────────────────
+// The broker of wifi_mqtt_init() and the standbys, in order of preference: a host name
+// (lwIP DNS, its table keeps each answer for its TTL) or a dotted IP.
+// BROKER_FAILOVER_AFTER failed attempts in a row on one broker (a session shorter than
+// BROKER_STABLE_MS counts as one, a WiFi loss does not) move to the next one, and the
+// device stays there while it works (also across reboots): no fall back to the first.
+//--- Call before wifi_mqtt_init(), host nullptr: standbys cleared. @return false when MQTT_HA_MAX_BROKERS is reached or host too long
+bool mqtt_ha_add_broker(const char* host, uint16_t port);
+
+struct MqttHaBrokerStats {
+    uint8_t  current;           // broker in use, 0: the one of wifi_mqtt_init()
+    uint32_t switches;          // moves to the next broker (unhealthy one)
+    uint32_t failovers;         // sessions ONLINE on another broker than the last one
+    uint32_t failover_ms;       // last failover: session lost -> ONLINE on the other broker
+    uint32_t failover_max_ms;
+    uint32_t lookups;           // host name lookups
+    uint32_t lookups_cached;    // ... answered at once by lwIP's DNS table (TTL not expired)
+    uint32_t lookups_failed;    // ... no answer within DNS_TIMEOUT_MS, or no such name
+    uint32_t lookups_stale;     // ... of those connected to the last known address anyway
+    uint32_t resolve_ms;        // last DNS query: sent -> answer
+    uint32_t resolve_max_ms;
+};
+MqttHaBrokerStats mqtt_ha_broker_stats();
+
+//─── TLS (MQTT over TLS, session resumption) ───────────────────────
+// Every broker of the list is reached over TLS (give them the TLS port, 8883).
+// The session of the last handshake is kept in RAM (and in the flash record with
+// MQTT_HA_TLS_SESSION_FLASH=1) and offered on the next connect: a reconnect resumes
+// it (ticket or session id) instead of a full handshake. Needs MQTT_HA_TLS=1 and
+// lwIP altcp_tls + mbedTLS in the firmware (see README).
+//--- Call once, before wifi_mqtt_init(). ca: the broker's CA certificate, PEM (ca_len counts
+//--- the '\0') or DER; nullptr: encrypted but not verified. Broker host names are checked
+//--- against the certificate, dotted IPs are not. @return false without MQTT_HA_TLS or on error
+bool mqtt_ha_set_tls(const uint8_t* ca, size_t ca_len);
+
+struct MqttHaTlsStats {
+    bool     enabled;           // mqtt_ha_set_tls() done
+    bool     cached;            // a session is kept for the next connect
+    bool     restored;          // ... read from flash by wifi_mqtt_init()
+    uint32_t full;              // sessions with a full handshake
+    uint32_t resumed;           // sessions that resumed the cached one
+    uint32_t rejected;          // cached session offered, the broker made a full handshake
+    uint32_t full_ms;           // last full handshake: mqtt_client_connect() -> CONNACK (TCP + TLS + CONNECT)
+    uint32_t full_max_ms;
+    uint32_t resumed_ms;        // last resumed one, same interval
+    uint32_t resumed_max_ms;
+    uint32_t saves;             // sessions put in the flash record
+};
+MqttHaTlsStats mqtt_ha_tls_stats();
+
+//─── Built-in MQTT client (MQTT 5 topic aliases) ───────────────────
+// With MQTT_HA_MQTT_BUILTIN=1 the library brings its own MQTT client
+// (mqtt_ha_mqtt.cpp, in place of lwIP's MQTT app): packets are written straight
+// into the TCP send buffer, and in MQTT 5 a state topic published again goes out
+// as a 2-byte topic alias. A 3.1.1 broker is detected at CONNACK (see README).
+//--- Call before wifi_mqtt_init(). level: 5 (default, 3.1.1 when refused) or 4 (3.1.1 only).
+//--- @return false without MQTT_HA_MQTT_BUILTIN
+bool mqtt_ha_set_mqtt_version(uint8_t level);
+
+struct MqttHaMqttStats {
+    uint8_t  level;             // of the session: 5, 4 (3.1.1); 0 before the first CONNACK, or lwIP's client
+    uint16_t alias_max;         // topic aliases the broker allows (min MQTT_HA_MQTT_ALIASES), 0 in 3.1.1
+    uint16_t aliases;           // ... set up in this session
+    uint32_t fallbacks;         // MQTT 5 refused, reconnected in 3.1.1
+    uint32_t publishes;         // PUBLISH written (since boot)
+    uint32_t aliased;           // ... carrying an alias in place of their topic
+    uint64_t bytes_sent;        // every packet written
+    uint64_t publish_bytes;     // PUBLISH packets
+    uint64_t publish_bytes_311; // the same PUBLISH in 3.1.1: publish_bytes_311 - publish_bytes is what aliases saved
+};
+MqttHaMqttStats mqtt_ha_mqtt_stats();
+
+//─── Gateway mode (bridged devices) ────────────────────────────────
+// The Pico can also stand for downstream nodes (serial, radio...): each one is a
+// separate HA device "via" the gateway, with its own channel table and topics
+//      <id>/state, <id>/availability, homeassistant/sensor/<id>/config
+// Devices are added at runtime and announced once the gateway is ONLINE (again on
+// every new session), a few messages at a time: the gateway's own messages go first.
+// Only the latest values of a device are published (no offline backlog for them).
+// Call from the main loop in single-core mode (not available in dual-core mode yet).
+#define MQTT_HA_DEVICE_ID_MAX 48    // topic level, also the HA device identifier
+
+struct MqttHaDevice {
+    const char*          id;            // e.g. "node_garage", unique, no '/' '+' '#'
+    const char*          name;          // HA device name
+    const char*          model;         // HA model, nullptr: "Pico W gateway node"
+    const MqttHaChannel* channels;      // uniq_id "<id>_<channel id>"
+    uint8_t              channel_count;
+};
+
+//--- The device and its table must stay valid (static / const)
+// @return the device handle, -1 if invalid or MQTT_HA_MAX_DEVICES / MQTT_HA_DEVICE_VALUES is full
+int  mqtt_ha_add_device(const MqttHaDevice* dev);
+void mqtt_ha_device_set(int dev, uint8_t channel, double value);
+void mqtt_ha_device_set_scaled(int dev, uint8_t channel, int32_t scaled);
+//--- Publish every channel of the device that has a value (coalesced until it is sent)
+void mqtt_ha_device_publish(int dev);
+//--- Node reachable or not (retained on <id>/availability), online when added
+void mqtt_ha_device_set_online(int dev, bool online);
+
+struct MqttHaGatewayStats {
+    uint32_t discovery;     // device discovery messages handed to lwIP
+    uint32_t availability;  // device availability messages
+    uint32_t states;        // device states
+    uint32_t coalesced;     // device states replaced by a newer one before being sent
+    uint16_t devices;       // devices added
+    uint16_t pending;       // devices with something left to send
+    uint8_t  in_flight;     // device publishes waiting for their completion
+};
+MqttHaGatewayStats mqtt_ha_gateway_stats();
+
+//─── Runtime metrics (HA diagnostic entities) ──────────────────────
+// Counted by the library itself, published every METRICS_PERIOD_MS on
+// <DEVICE_ID>/diagnostics and shown by HA in the "Diagnostic" block of the device.
+// Histogram buckets (same 1-2-5 bounds for both):
+//      < 10, < 20, < 50, < 100, < 200, < 500, < 1000, >= 1000   (ms for ack_ms, us for poll_us)
+#define MQTT_HA_HIST_BUCKETS 8
+#define MQTT_HA_ERR_CODES    17     // lwIP err_t 0..-16, indexed by -err (ERR_MEM = 1, ERR_TIMEOUT = 3...)
+
+struct MqttHaMetrics {
+    uint32_t publishes;                         // publishes completed OK
+    uint32_t errors[MQTT_HA_ERR_CODES];         // publishes refused by lwIP or completed with an error, by code
+    uint32_t bytes_sent;                        // PUBLISH packets handed to lwIP (headers included)
+    uint32_t bytes_received;                    // incoming PUBLISH (topic + payload)
+    uint32_t reconnects;                        // MQTT sessions after the first one
+    uint32_t overflows;                         // queue full, backlog eviction, payload larger than its buffer
+    uint32_t log_dropped;                       // log records lost, ring full (MQTT_HA_LOG_SLOTS)
+    //--- Histograms: since the last diagnostics message (a window of METRICS_PERIOD_MS)
+    uint32_t ack_ms[MQTT_HA_HIST_BUCKETS];      // mqtt_publish -> completion (PUBACK, or sent for QoS 0)
+    uint32_t poll_us[MQTT_HA_HIST_BUCKETS];     // cyw43_arch_poll() time in each mqtt_poll()
+    uint32_t ack_max_ms;
+    uint32_t poll_max_us;
+};
+MqttHaMetrics mqtt_ha_metrics();
+
+//─── RAM (scratch arena, stack high-water) ─────────────────────────
+// Every payload is built in one shared arena of MQTT_HA_SCRATCH_SIZE bytes (default:
+// the largest payload + its topic). The stack of the network side (the caller of
+// wifi_mqtt_init(), core 1 in dual-core mode) is painted over MQTT_HA_STACK_WATCH bytes:
+// stack_peak is the deepest byte used since, counted from the frame of wifi_mqtt_init().
+// Static RAM of the library at build time: see "RAM" in README.md.
+struct MqttHaRamStats {
+    uint32_t scratch_size;      // bytes
+    uint32_t scratch_peak;      // most bytes in use at once, since wifi_mqtt_init()
+    uint32_t scratch_failures;  // allocations refused (message dropped or delayed), should stay 0
+    uint32_t stack_watch;       // bytes watched below the frame, 0: off
+    uint32_t stack_peak;        // deepest stack use, stack_watch when it went past the painted bytes
+};
+MqttHaRamStats mqtt_ha_ram_stats();
+
 // À appeler dans la boucle principale pour maintenir la connexion
+// Never blocks: drives WiFi join, DHCP, MQTT connect and every reconnect.
 void mqtt_poll();
 
-bool mqtt_is_connected();
\ No newline at end of file
+// true while the MQTT session with the broker is up
+bool mqtt_is_connected();
+
+// Write the library logs recorded since the last call (called by mqtt_poll(),
+// the lwIP callbacks never print themselves, see mqtt_ha_log.h)
+void mqtt_ha_log_flush();
+
+//─── Dual-core mode ───────────────────────────────────────────────
+// Build with MQTT_HA_DUAL_CORE=1 (RP2040 / RP2350): wifi_mqtt_init() starts
+// core 1, which then runs the CYW43 driver, lwIP and the whole connection.
+// The application keeps the same API on core 0:
+//  - mqtt_ha_set() / mqtt_ha_publish_channels() / mqtt_ha_publish_state()
+//    queue a snapshot of the channels for core 1 (never blocks, dropped when full)
+//  - command handlers (CmdEntry, MqttHaRoute::handler) run on core 0 from mqtt_poll(),
+//    which also writes the logs; MqttHaRoute::data handlers stay on core 1
+//  - register channels / routes / commands BEFORE wifi_mqtt_init()
+//  - the stats functions are snapshots taken while core 1 runs
+#ifndef MQTT_HA_DUAL_CORE
+#define MQTT_HA_DUAL_CORE 0
+#endif
+
+struct MqttHaCoreStats {
+    uint32_t samples;           // channel snapshots queued for core 1
+    uint32_t samples_dropped;   // sample queue full (also counted in MqttHaMetrics::overflows)
+    uint32_t commands;          // commands queued for core 0
+    uint32_t commands_dropped;  // command queue full (also counted in MqttHaMetrics::overflows)
+};
+//--- All zero in single-core mode
+MqttHaCoreStats mqtt_ha_core_stats();
+//--- Stop core 1 at the end of its current pass (no-op in single-core mode)
+void mqtt_ha_stop_network_core();
+
+//─── Connection state ──────────────────────────────────────────────
+enum MqttHaState : uint8_t {
+    MQTT_HA_IDLE,           // wifi_mqtt_init() not called yet
+    MQTT_HA_WIFI_JOIN,      // associating with the access point
+    MQTT_HA_DHCP,           // joined, waiting for an IP address
+    MQTT_HA_RESOLVE,        // DNS lookup of the broker host name
+    MQTT_HA_MQTT_CONNECT,   // TCP + MQTT CONNECT sent, waiting for CONNACK
+    MQTT_HA_DISCOVERY,      // discovery + availability being published
+    MQTT_HA_SUBSCRIBE,      // subscribing to the command topic
+    MQTT_HA_ONLINE,         // everything up, states are published live
+    MQTT_HA_BACKOFF,        // a step failed, waiting before the next attempt
+    MQTT_HA_STATE_COUNT
+};
+
+struct MqttHaConnStats {
+    uint32_t time_in_state_ms[MQTT_HA_STATE_COUNT]; // total time spent in each state since init
+    uint32_t connects;      // MQTT connect attempts
+    uint32_t failures;      // failed steps (each one leads to a backoff)
+    uint32_t backoff_ms;    // last backoff delay
+};
+
+MqttHaState     mqtt_ha_state();
+const char*     mqtt_ha_state_name(MqttHaState state);
+MqttHaConnStats mqtt_ha_conn_stats();
+#ifdef MQTT_HA_HOST
+//─── Host only ─────────────────────────────────────────────────────
+//--- Zero the counters of every *_stats() getter and mqtt_ha_metrics() (stops core 1 first):
+//--- host tests and benchmark suites start from a fresh boot, not from the previous suite.
+void mqtt_ha_host_reset_stats();
+#endif
@@ -0,0 +1,64 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Scratch arena (scoped allocation) ─────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// One statically sized byte array lent to whoever builds a payload:
+// a ScratchScope takes what it needs with alloc() and gives it all back
+// when it goes out of scope. Scopes nest like stack frames, nothing is
+// freed on its own and nothing outlives the scope that made it (lwIP
+// copies a payload into its output buffer before mqtt_publish() returns).
+// alloc() returns nullptr when the arena is exhausted, counted in failures().
+// Not thread safe: only used from the lwIP / main loop context.
+#include <stddef.h>
+#include <stdint.h>
+
+class ScratchArena {
+public:
+    ScratchArena(uint8_t* mem, size_t size) : mem_(mem), size_(size) {}
+
+    size_t   size()     const { return size_; }
+    size_t   used()     const { return top_; }
+    size_t   peak()     const { return peak_; }         // most bytes in use at once
+    uint32_t failures() const { return failures_; }     // alloc() refused
+    void     reset_peak()     { peak_ = top_; }
+
+    //--- Rounded up like alloc() does it (4-byte alignment)
+    static constexpr size_t round(size_t n) { return (n + 3) & ~(size_t)3; }
+
+private:
+    friend class ScratchScope;
+
+    void* take(size_t n) {
+        n = round(n);
+        if (n > size_ - top_) {
+            failures_++;
+            return nullptr;
+        }
+        void* p = mem_ + top_;
+        top_ += n;
+        if (top_ > peak_) peak_ = top_;
+        return p;
+    }
+
+    uint8_t* mem_;
+    size_t   size_;
+    size_t   top_      = 0;
+    size_t   peak_     = 0;
+    uint32_t failures_ = 0;
+};
+
+class ScratchScope {
+public:
+    explicit ScratchScope(ScratchArena& arena) : arena_(arena), mark_(arena.top_) {}
+    ~ScratchScope() { arena_.top_ = mark_; }
+
+    ScratchScope(const ScratchScope&)            = delete;
+    ScratchScope& operator=(const ScratchScope&) = delete;
+
+    //--- n bytes (4-byte aligned) until the end of the scope, nullptr if they do not fit
+    char* alloc(size_t n) { return (char*)arena_.take(n); }
+
+private:
+    ScratchArena& arena_;
+    size_t        mark_;
+};
@@ -0,0 +1,161 @@
+//───────────────────────────────────────────────────────────────────
+//─── Batched samples (bulk topic) ──────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// At several samples per second, one MQTT message per sample spends most of the
+// airtime on headers, TCP / WiFi acks and PUBACKs. With mqtt_ha_set_batching(K, T)
+// each sample is stored as a binary record (the backlog format) and K of them, or
+// every one once the oldest is T ms old, leave as ONE columnar message on BATCH_TOPIC:
+//      {"age_ms":[800,600,400,200,0],"temperature":[23.5,23.5,23.6,null,23.6],"humidity":[...]}
+// age_ms is relative to the send time, like the replay (the Pico has no wall clock).
+// STATE_TOPIC is still updated with the latest values, once per batch, for the HA entities.
+// The payload is built when sent (outbox): records leave the ring once lwIP has them,
+// on disconnect they move to the offline backlog.
+#include "mqtt_ha.h"
+#include <string.h>
+#include "mqtt_ha_internal.h"
+#include "mqtt_ha_ring.h"
+
+static uint8_t          batch_mem[BATCH_BYTES];
+static RecordRing       batch(batch_mem, sizeof(batch_mem));
+static uint16_t         batch_samples = 0;      // K, 0: one state per sample
+static uint32_t         batch_max_ms  = 0;      // T, 0: no age limit
+static MqttHaBatchStats batch_stats   = {};
+
+bool mqtt_ha_lib::batch_enabled() {
+    return batch_samples > 0;
+}
+
+void mqtt_ha_lib::batch_reset() {
+    batch.reset(record_size());
+}
+
+//--- Longest payload K samples can give with the current table
+static size_t batch_payload_bound(uint16_t samples) {
+    static const uint8_t digits[] = { 3, 4, 5, 6, 11 };    // by MqttHaStorage, sign included
+    size_t size = 13 + (size_t)samples * 11;                // {"age_ms":[]}, 10 digits + ',' each
+    for (uint8_t i = 0; i < channel_count; i++) {
+        size_t w = digits[channels[i].storage] + (channels[i].precision ? 2 : 0);   // "-0." at worst
+        if (w < 4) w = 4;                                                            // null
+        size += strlen(channels[i].key) + 6 + (size_t)samples * (w + 1);            // ,"key":[]
+    }
+    return size;
+}
+
+bool mqtt_ha_set_batching(uint16_t samples, uint32_t max_ms) {
+    if (samples == 1) samples = 0;      // one sample per message: plain states
+    if (batch.record_size() != record_size()) batch_reset();
+    if (samples > batch.capacity() || (samples > 0 && batch_payload_bound(samples) > BATCH_PAYLOAD_MAX)) {
+        LOG_ERROR("MQTT: %u samples per batch do not fit BATCH_BYTES / BATCH_PAYLOAD_MAX\n", samples);
+        return false;
+    }
+    batch_samples = samples;
+    batch_max_ms  = max_ms;
+    return true;
+}
+
+//--- Current channel values -> batch ring (online, batching on)
+void mqtt_ha_lib::batch_store() {
+    if (batch.record_size() == 0) batch_reset();   // first use with the built-in table
+    uint8_t rec[BACKLOG_RECORD_MAX];
+    record_encode(rec);
+    if (!batch.push(rec)) {
+        batch_stats.evicted++;
+        metrics.overflows++;
+    }
+}
+
+//--- Queue the batch once K samples wait or the oldest is T ms old
+//--- (and what is left after batching was turned off)
+void mqtt_ha_lib::batch_poll() {
+    if (batch.empty() || outbox_has_batch || !connected || !discovery_done) return;
+    bool due = !batch_enabled() || batch.size() >= batch_samples;
+    if (!due && batch_max_ms > 0) {
+        uint32_t t0;
+        memcpy(&t0, batch.front(), 4);
+        due = now_ms() - t0 >= batch_max_ms;
+    }
+    if (!due) return;
+    outbox_push(MQTT_HA_TOPIC_BATCH, OUTBOX_BATCH, BATCH_TOPIC, nullptr, 0);
+    outbox_push(MQTT_HA_TOPIC_STATE, OUTBOX_STATE, STATE_TOPIC, nullptr, 0);
+}
+
+//--- Oldest records (K at most) -> buf (BATCH_PAYLOAD_MAX bytes), one column per channel that has a value
+//--- (called by outbox_flush() when the batch is sent)
+//--- @return payload length, 0 if nothing can be sent; *samples: records in the payload
+size_t mqtt_ha_lib::batch_build_payload(char* buf, uint16_t* samples) {
+    uint16_t offset[MQTT_HA_MAX_CHANNELS];
+    uint16_t off = 4 + (channel_count + 7) / 8;
+    for (uint8_t i = 0; i < channel_count; i++) {
+        offset[i] = off;
+        off += storage_size[channels[i].storage];
+    }
+    size_t n = batch.size();
+    if (batch_enabled() && n > batch_samples) n = batch_samples;
+    uint32_t now = now_ms();
+
+    //--- Always fits for K <= mqtt_ha_set_batching() bound, halved only for the leftovers of a larger K
+    for (; n > 0; n /= 2) {
+        JsonWriter json(buf, BATCH_PAYLOAD_MAX);
+        json.raw("{\"age_ms\":[");
+        for (size_t r = 0; r < n; r++) {
+            uint32_t t;
+            memcpy(&t, batch.at(r), 4);
+            if (r > 0) json.raw(",");
+            json.uinteger(now - t);
+        }
+        json.raw("]");
+        for (uint8_t i = 0; i < channel_count; i++) {
+            bool any = false;
+            for (size_t r = 0; r < n && !any; r++) any = channel_has_value(batch.at(r) + 4, i);
+            if (!any) continue;
+            json.raw(",\"").raw(channels[i].key).raw("\":[");
+            for (size_t r = 0; r < n; r++) {
+                const uint8_t* rec = batch.at(r);
+                if (r > 0) json.raw(",");
+                if (channel_has_value(rec + 4, i)) {
+                    json.fixed(record_value(rec + offset[i], channels[i].storage), channels[i].precision);
+                } else {
+                    json.raw("null");
+                }
+            }
+            json.raw("]");
+        }
+        json.raw("}");
+        if (json.ok()) {
+            *samples = (uint16_t)n;
+            return json.length();
+        }
+    }
+    //--- Not even one sample fits BATCH_PAYLOAD_MAX: drop it, or the queue would retry it forever
+    LOG_WARN("MQTT: Batch payload too long (BATCH_PAYLOAD_MAX), sample dropped\n");
+    batch.pop();
+    batch_stats.evicted++;
+    metrics.overflows++;
+    *samples = 0;
+    return 0;
+}
+
+//--- lwIP accepted the batch: its records can go
+void mqtt_ha_lib::batch_sent(uint16_t samples) {
+    if (samples == 0) return;
+    for (uint16_t i = 0; i < samples; i++) batch.pop();
+    batch_stats.batches++;
+    batch_stats.samples += samples;
+}
+
+//--- Samples not sent yet are kept with the offline ones
+void mqtt_ha_lib::batch_on_disconnect() {
+    for (; !batch.empty(); batch.pop()) backlog_push(batch.front());
+}
+
+MqttHaBatchStats mqtt_ha_batch_stats() {
+    MqttHaBatchStats s = batch_stats;
+    s.pending = (uint16_t)batch.size();
+    return s;
+}
+
+#ifdef MQTT_HA_HOST
+void mqtt_ha_lib::batch_reset_stats() {
+    batch_stats = {};
+}
+#endif
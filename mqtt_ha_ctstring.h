@@ -0,0 +1,55 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Compile-time string building ──────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Build a constant string (e.g. a JSON payload) with plain C++17 constexpr
+// code: loops, if, tables... The result is a char array placed in flash,
+// and its exact length is a compile-time constant.
+//
+// The same "write" function is run twice by the compiler:
+//  1. with a CtCounter, to get the exact length,
+//  2. with a CtWriter into a CtString<length>, to fill the characters.
+//
+//      template <typename W> constexpr void write_hello(W& w) { w.put("hello "); w.put("world"); }
+//      static constexpr auto hello = ct_build<ct_length(write_hello<CtCounter>)>(write_hello<CtWriter>);
+//      static_assert(hello.size() == 11, "");
+#include <stddef.h>
+
+//--- Counts the characters, writes nothing
+struct CtCounter {
+    size_t len = 0;
+    constexpr void put(const char* s) {
+        while (*s++) len++;
+    }
+};
+
+//--- Writes the characters into a buffer sized by CtCounter
+struct CtWriter {
+    char*  out;
+    size_t len = 0;
+    constexpr void put(const char* s) {
+        while (*s) out[len++] = *s++;
+    }
+};
+
+//--- Null-terminated constant string of exactly N characters
+template <size_t N>
+struct CtString {
+    char str[N + 1] = {};
+    constexpr const char* c_str() const { return str; }
+    static constexpr size_t size() { return N; }
+};
+
+constexpr size_t ct_length(void (*write)(CtCounter&)) {
+    CtCounter c;
+    write(c);
+    return c.len;
+}
+
+template <size_t N>
+constexpr CtString<N> ct_build(void (*write)(CtWriter&)) {
+    CtString<N> s;
+    CtWriter w{s.str};
+    write(w);
+    return s;
+}
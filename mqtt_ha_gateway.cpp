@@ -0,0 +1,297 @@
+//───────────────────────────────────────────────────────────────────
+//─── Gateway mode (runtime devices) ────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// The Pico stays the DEVICE_ID device (its Last Will, its sensors) and also bridges
+// downstream nodes (serial, radio...) as separate HA devices, added at runtime:
+//      <id>/state, <id>/availability, homeassistant/sensor/<id>/config ("via_device": DEVICE_ID)
+// A device entity is available when BOTH the gateway and the node are online
+// ("avty_mode":"all"): the gateway's Last Will marks every node unavailable at once.
+//
+// Nothing is sent from the API calls: they only flag what a device needs (discovery,
+// availability, state), and gateway_poll() sends it from mqtt_poll() once the gateway
+// is ONLINE, one message at a time, round robin over the devices:
+//  - only when the outbound queue is empty (the gateway's own messages go first,
+//    and the shared payload buffer is free again once the queue is),
+//  - at most GATEWAY_IN_FLIGHT device publishes waiting for their completion:
+//    connecting with 100+ devices never fills lwIP's request window.
+// States are coalesced: a device publishes its latest values, states made while
+// offline are not kept (only the gateway's own channels have the backlog).
+// Values live in one pool (MQTT_HA_DEVICE_VALUES) split between the devices.
+#include "mqtt_ha.h"
+#include <string.h>
+#include "mqtt_ha_internal.h"
+#include "mqtt_ha_ctstring.h"
+
+struct GatewayDevice {
+    const MqttHaDevice* dev;
+    uint16_t            base;           // first value in gateway_values
+    uint8_t             disc_next;      // next channel to describe, channel_count: discovery done
+    uint8_t             disc_chunk;     // discovery messages sent this session
+    bool                online;         // node availability wanted by the application
+    bool                avail_dirty;    // availability to publish
+    bool                state_dirty;    // values to publish
+};
+
+//--- Start of every discovery chunk of a device (W: CtCounter or JsonPut, see write_component())
+template <typename W>
+static void write_gateway_header(W& w, const MqttHaDevice& dev) {
+    w.put("{\"dev\":{\"ids\":[\""); w.put(dev.id); w.put("\"],\"name\":\""); w.put(dev.name); w.put("\",");
+    w.put(  "\"mdl\":\""); w.put(dev.model ? dev.model : "Pico W gateway node"); w.put("\",");
+    w.put(  "\"via_device\":\"" DEVICE_ID "\"},");
+    w.put("\"avty\":[{\"t\":\"" DEVICE_ID "/availability\"},{\"t\":\""); w.put(dev.id); w.put("/availability\"}],");
+    w.put("\"avty_mode\":\"all\",");
+    w.put("\"stat_t\":\""); w.put(dev.id); w.put("/state\",");
+    w.put("\"cmps\":{");
+}
+
+static GatewayDevice      gateway_devices[MQTT_HA_MAX_DEVICES];
+static uint8_t            gateway_count     = 0;
+#if !MQTT_HA_DUAL_CORE
+static uint16_t           gateway_used      = 0;     // values taken in the pool (by mqtt_ha_add_device())
+#endif
+static int32_t            gateway_values[MQTT_HA_DEVICE_VALUES];
+static uint8_t            gateway_set[(MQTT_HA_DEVICE_VALUES + 7) / 8];
+static uint8_t            gateway_cursor    = 0;     // round robin
+static bool               gateway_dirty     = false; // something may be waiting
+static uint8_t            gateway_in_flight = 0;
+static MqttHaGatewayStats gateway_stats     = {};
+
+int mqtt_ha_add_device(const MqttHaDevice* dev) {
+#if MQTT_HA_DUAL_CORE
+    (void)dev;
+    LOG_ERROR("MQTT: Gateway mode needs the single-core build\n");
+    return -1;
+#else
+    if (!dev || !dev->id || !dev->name || !dev->channels || dev->channel_count == 0 ||
+        strlen(dev->id) > MQTT_HA_DEVICE_ID_MAX) {
+        LOG_ERROR("MQTT: Invalid device\n");
+        return -1;
+    }
+    if (gateway_count >= MQTT_HA_MAX_DEVICES || gateway_used + dev->channel_count > MQTT_HA_DEVICE_VALUES) {
+        LOG_ERROR("MQTT: Device %s does not fit MQTT_HA_MAX_DEVICES / MQTT_HA_DEVICE_VALUES\n", dev->id);
+        return -1;
+    }
+    CtCounter header;
+    write_gateway_header(header, *dev);
+    for (uint8_t i = 0; i < dev->channel_count; i++) {
+        const MqttHaChannel& c = dev->channels[i];
+        if (!c.key || !c.id || c.precision > 3 || c.storage > MQTT_HA_I32) {
+            LOG_ERROR("MQTT: Invalid channel %u of device %s\n", i, dev->id);
+            return -1;
+        }
+        //--- One component per chunk at least (header, component, "}}", '\0'), like discovery_fits()
+        CtCounter n;
+        write_component(n, c, dev->id);
+        if (header.len + n.len + 2 >= DISCOVERY_CHUNK_MAX) {
+            LOG_ERROR("MQTT: Channel %u of device %s does not fit a discovery message (DISCOVERY_CHUNK_MAX)\n", i, dev->id);
+            return -1;
+        }
+    }
+    GatewayDevice& d = gateway_devices[gateway_count];
+    d             = {};
+    d.dev         = dev;
+    d.base        = gateway_used;
+    d.online      = true;
+    d.avail_dirty = true;
+    for (uint8_t i = 0; i < dev->channel_count; i++) {
+        uint16_t v = d.base + i;
+        gateway_set[v / 8] &= (uint8_t)~(1u << (v % 8));
+    }
+    gateway_used += dev->channel_count;
+    gateway_dirty = true;
+    return gateway_count++;
+#endif
+}
+
+static GatewayDevice* gateway_device(int dev) {
+    return (dev >= 0 && dev < gateway_count) ? &gateway_devices[dev] : nullptr;
+}
+
+void mqtt_ha_device_set_scaled(int dev, uint8_t ch, int32_t scaled) {
+    GatewayDevice* d = gateway_device(dev);
+    if (!d || ch >= d->dev->channel_count) return;
+    uint16_t v = d->base + ch;
+    gateway_values[v]  = channel_clamp(d->dev->channels[ch], scaled);
+    gateway_set[v / 8] |= (uint8_t)(1u << (v % 8));
+}
+
+void mqtt_ha_device_set(int dev, uint8_t ch, double value) {
+    GatewayDevice* d = gateway_device(dev);
+    if (!d || ch >= d->dev->channel_count || value != value) return;
+    mqtt_ha_device_set_scaled(dev, ch, channel_scale(d->dev->channels[ch], value));
+}
+
+void mqtt_ha_device_publish(int dev) {
+    GatewayDevice* d = gateway_device(dev);
+    if (!d) return;
+    if (d->state_dirty) gateway_stats.coalesced++;
+    d->state_dirty = true;
+    gateway_dirty  = true;
+}
+
+void mqtt_ha_device_set_online(int dev, bool online) {
+    GatewayDevice* d = gateway_device(dev);
+    if (!d || d->online == online) return;
+    d->online      = online;
+    d->avail_dirty = true;
+    gateway_dirty  = true;
+}
+
+//--- Called by mqtt_ha_publish_discovery() on every new MQTT session
+void mqtt_ha_lib::gateway_session_start() {
+    for (uint8_t i = 0; i < gateway_count; i++) {
+        GatewayDevice& d = gateway_devices[i];
+        d.disc_next   = 0;
+        d.disc_chunk  = 0;
+        d.avail_dirty = true;
+        //--- The broker kept nothing: the latest values again, if there are any
+        for (uint8_t ch = 0; ch < d.dev->channel_count && !d.state_dirty; ch++) {
+            uint16_t v = d.base + ch;
+            if ((gateway_set[v / 8] >> (v % 8)) & 1) d.state_dirty = true;
+        }
+    }
+    gateway_in_flight = 0;      // lwIP dropped its requests with the old session
+    gateway_cursor    = 0;
+    gateway_dirty     = gateway_count > 0;
+}
+
+static void gateway_publish_callback(void* arg, err_t result) {
+    if (gateway_in_flight > 0) gateway_in_flight--;
+}
+
+//--- Discovery chunk of device d starting at channel d.disc_next -> buf (DISCOVERY_CHUNK_MAX bytes)
+static size_t gateway_build_discovery(GatewayDevice& d, char* buf) {
+    const MqttHaDevice& dev = *d.dev;
+    JsonWriter json(buf, DISCOVERY_CHUNK_MAX);
+    JsonPut    out{json};
+    write_gateway_header(out, dev);
+    uint8_t i = d.disc_next;
+    for (; i < dev.channel_count; i++) {
+        size_t mark = json.length();
+        if (i > d.disc_next) json.raw(",");
+        write_component(out, dev.channels[i], dev.id);
+        if (!json.ok() || json.remaining() < 2) {
+            json.rewind(mark);
+            break;
+        }
+    }
+    //--- Every channel fits one chunk (checked by mqtt_ha_add_device())
+    json.raw("}}");
+    d.disc_next = i;
+    return json.length();
+}
+
+//--- Latest values of device d -> buf (DISCOVERY_CHUNK_MAX bytes)
+static size_t gateway_build_state(const GatewayDevice& d, char* buf) {
+    JsonWriter json(buf, DISCOVERY_CHUNK_MAX);
+    json.raw("{");
+    bool first = true;
+    for (uint8_t i = 0; i < d.dev->channel_count; i++) {
+        uint16_t v = d.base + i;
+        if (!((gateway_set[v / 8] >> (v % 8)) & 1)) continue;
+        if (!first) json.raw(",");
+        first = false;
+        json.raw("\"").raw(d.dev->channels[i].key).raw("\":").fixed(gateway_values[v], d.dev->channels[i].precision);
+    }
+    json.raw("}");
+    return json.ok() ? json.length() : 0;
+}
+
+//--- Longest device topic: homeassistant/sensor/<id>_NNN/config. Sent without the outbound queue,
+//--- a message lwIP can never take would be retried forever (see DISCOVERY_TOPIC in mqtt_ha.cpp).
+#define GATEWAY_TOPIC_LEN (sizeof(DISCOVERY_PREFIX "/sensor/") - 1 + MQTT_HA_DEVICE_ID_MAX + 4 + 7)
+static_assert(GATEWAY_TOPIC_LEN < TOPIC_MAX, "TOPIC_MAX too small for MQTT_HA_DEVICE_ID_MAX");
+static_assert(DISCOVERY_CHUNK_MAX + GATEWAY_TOPIC_LEN + 7 <= MQTT_OUTPUT_RINGBUF_SIZE,
+              "DISCOVERY_CHUNK_MAX does not fit MQTT_OUTPUT_RINGBUF_SIZE with a device topic");
+
+enum GatewaySend : uint8_t {
+    GATEWAY_IDLE,       // nothing to send for this device
+    GATEWAY_SENT,       // one message handed to lwIP (or dropped: too long)
+    GATEWAY_REFUSED,    // lwIP full (ERR_MEM), device unchanged: tried again on the next mqtt_poll()
+};
+
+//--- Next message of device d (discovery, then availability, then state), built in the
+//--- scratch arena and handed to lwIP at once: the outbound queue never holds it.
+static GatewaySend gateway_send(GatewayDevice& d) {
+    const GatewayDevice before = d;
+    const char*  id = d.dev->id;
+    ScratchScope scope(scratch);
+    char*        topic = scope.alloc(TOPIC_MAX);
+    char*        buf   = scope.alloc(DISCOVERY_CHUNK_MAX);
+    if (buf == nullptr) return GATEWAY_REFUSED;
+    JsonWriter  t(topic, TOPIC_MAX);
+    MqttHaTopic cls;
+    const char* payload = buf;
+    size_t      len;
+    if (d.disc_next < d.dev->channel_count) {
+        t.raw(DISCOVERY_PREFIX "/sensor/").raw(id);
+        if (d.disc_chunk > 0) t.raw("_").uinteger(d.disc_chunk);
+        t.raw("/config");
+        len = gateway_build_discovery(d, buf);
+        d.disc_chunk++;
+        cls = MQTT_HA_TOPIC_DISCOVERY;
+    } else if (d.avail_dirty) {
+        t.raw(id).raw("/availability");
+        payload = d.online ? "online" : "offline";
+        len     = strlen(payload);
+        d.avail_dirty = false;
+        cls = MQTT_HA_TOPIC_AVAILABILITY;
+    } else if (d.state_dirty) {
+        t.raw(id).raw("/state");
+        len = gateway_build_state(d, buf);
+        d.state_dirty = false;
+        cls = MQTT_HA_TOPIC_STATE;
+        if (len == 0) {
+            LOG_WARN("MQTT: State of %s too long (DISCOVERY_CHUNK_MAX), dropped\n", id);
+            metrics.overflows++;
+            return GATEWAY_SENT;
+        }
+    } else {
+        return GATEWAY_IDLE;
+    }
+    if (!mqtt_publish_msg(cls, topic, payload, len, gateway_publish_callback)) {
+        d = before;
+        return GATEWAY_REFUSED;
+    }
+    gateway_in_flight++;
+    if (cls == MQTT_HA_TOPIC_DISCOVERY)         gateway_stats.discovery++;
+    else if (cls == MQTT_HA_TOPIC_AVAILABILITY) gateway_stats.availability++;
+    else                                        gateway_stats.states++;
+    return GATEWAY_SENT;
+}
+
+//--- From mqtt_poll(), once the gateway is ONLINE: device messages while the window allows
+void mqtt_ha_lib::gateway_poll() {
+    if (!gateway_dirty || conn_state != MQTT_HA_ONLINE) return;
+    uint8_t idle = 0;           // devices in a row with nothing to send
+    while (idle < gateway_count) {
+        if (outbox_count > 0 || gateway_in_flight >= GATEWAY_IN_FLIGHT || pub_in_flight >= PUBLISH_IN_FLIGHT) return;
+        GatewayDevice& d = gateway_devices[gateway_cursor];
+        gateway_cursor = (uint8_t)((gateway_cursor + 1) % gateway_count);
+        GatewaySend sent = gateway_send(d);
+        if (sent == GATEWAY_REFUSED) {
+            gateway_cursor = (uint8_t)(&d - gateway_devices);  // same device first next time
+            return;
+        }
+        idle = (sent == GATEWAY_SENT) ? 0 : (uint8_t)(idle + 1);
+    }
+    gateway_dirty = false;      // a whole round with nothing to send
+}
+
+MqttHaGatewayStats mqtt_ha_gateway_stats() {
+    MqttHaGatewayStats s = gateway_stats;
+    s.devices   = gateway_count;
+    s.pending   = 0;
+    for (uint8_t i = 0; i < gateway_count; i++) {
+        const GatewayDevice& d = gateway_devices[i];
+        if (d.disc_next < d.dev->channel_count || d.avail_dirty || d.state_dirty) s.pending++;
+    }
+    s.in_flight = gateway_in_flight;
+    return s;
+}
+
+#ifdef MQTT_HA_HOST
+void mqtt_ha_lib::gateway_reset_stats() {
+    gateway_stats = {};
+}
+#endif
@@ -0,0 +1,382 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Library internals (shared by the mqtt_ha*.cpp modules) ────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha.cpp is the core: connection, channels, outbound queue, backlog,
+// discovery, metrics. The features that only plug into it have their own file
+// and reach the core through this header:
+//      mqtt_ha_batch.cpp       batched samples (bulk topic)
+//      mqtt_ha_gateway.cpp     gateway mode (runtime devices)
+//      mqtt_ha_report.cpp      report by exception (deadbands, heartbeat, aggregation)
+//      mqtt_ha_persist.cpp     discovery cache and flash record
+//      mqtt_ha_tls.cpp         TLS (session resumption)
+// Not for the application: the configuration every module must see the same way,
+// then the core's state and functions, in namespace mqtt_ha_lib so none of these
+// names meets the application's own at link time.
+#include "mqtt_ha.h"
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+#include "mqtt_ha_platform.h"   // pico SDK + lwIP (or the host fake, see host/)
+#include "mqtt_ha_json.h"
+#include "mqtt_ha_log.h"     // LOG_xxx(): deferred, formatted by mqtt_poll()
+#include "mqtt_ha_arena.h"   // payloads are built in a shared scratch arena
+
+//─── Configuration ─────────────────────────────────────────────────
+#define DEVICE_ID        "pico_env_sensor"
+#define DEVICE_NAME      "Pico Env Sensor"
+#define STATE_TOPIC      "pico_env_sensor/state"
+#define DISCOVERY_PREFIX "homeassistant"
+//──── Commands ─────────────────────────────────────────────────────
+// Need to have a Command Topic if we want to perform actions from Home Assistant.
+#define LED_CMD_TOPIC    "pico_env_sensor/led/brightness"
+#ifndef MQTT_HA_MAX_ROUTES
+#define MQTT_HA_MAX_ROUTES  64      // routes + CmdEntry commands (< 128)
+#endif
+#ifndef MQTT_HA_MAX_TOPICS
+#define MQTT_HA_MAX_TOPICS  32      // distinct command topics, each one is subscribed
+#endif
+#ifndef ROUTER_SLOTS
+#define ROUTER_SLOTS        256     // router hash table (1 byte each), power of 2 >= 2 * (routes + topics)
+#endif
+#ifndef SUBSCRIBE_IN_FLIGHT
+#define SUBSCRIBE_IN_FLIGHT 2       // SUBSCRIBE waiting for SUBACK (lwIP MQTT_REQ_MAX_IN_FLIGHT is 4)
+#endif
+//──── Connection state machine ─────────────────────────────────────
+// Every step has its own timeout, a failure waits BACKOFF_BASE_MS * 2^n
+// (capped at BACKOFF_MAX_MS, with jitter) before trying again.
+#ifndef WIFI_JOIN_TIMEOUT_MS
+#define WIFI_JOIN_TIMEOUT_MS    15000   // associate + WPA2 handshake with the AP
+#endif
+#ifndef DHCP_TIMEOUT_MS
+#define DHCP_TIMEOUT_MS         10000
+#endif
+#ifndef MQTT_CONNECT_TIMEOUT_MS
+#define MQTT_CONNECT_TIMEOUT_MS 10000   // TCP + CONNECT / CONNACK
+#endif
+#ifndef MQTT_SETUP_TIMEOUT_MS
+#define MQTT_SETUP_TIMEOUT_MS   10000   // discovery -> availability -> subscribe
+#endif
+#ifndef BACKOFF_BASE_MS
+#define BACKOFF_BASE_MS         1000
+#endif
+#ifndef BACKOFF_MAX_MS
+#define BACKOFF_MAX_MS          60000
+#endif
+//──── Fast boot (cached AP + IP lease) ─────────────────────────────
+#ifndef MQTT_HA_FAST_BOOT
+#define MQTT_HA_FAST_BOOT               1       // join the last AP without a scan, reuse its lease without DHCP
+#endif
+#ifndef MQTT_HA_FAST_JOIN_TIMEOUT_MS
+#define MQTT_HA_FAST_JOIN_TIMEOUT_MS    3000    // targeted join, then a normal join (scan)
+#endif
+#ifndef MQTT_HA_FAST_CONNECT_TIMEOUT_MS
+#define MQTT_HA_FAST_CONNECT_TIMEOUT_MS 3000    // first CONNACK on the cached lease, then DHCP
+#endif
+#ifndef CYW43_IOCTL_GET_CHANNEL
+#define CYW43_IOCTL_GET_CHANNEL         0x3a    // WLC_GET_CHANNEL (29) << 1, read
+#endif
+//──── Brokers (DNS, failover) ──────────────────────────────────────
+#ifndef MQTT_HA_MAX_BROKERS
+#define MQTT_HA_MAX_BROKERS     4       // wifi_mqtt_init() broker + mqtt_ha_add_broker() standbys
+#endif
+#ifndef BROKER_HOST_MAX
+#define BROKER_HOST_MAX         64      // host name or dotted IP, '\0' included
+#endif
+#ifndef DNS_TIMEOUT_MS
+#define DNS_TIMEOUT_MS          5000    // lookup without answer: last known address, or a failed attempt
+#endif
+#ifndef BROKER_FAILOVER_AFTER
+#define BROKER_FAILOVER_AFTER   2       // failed attempts in a row on one broker before the next one
+#endif
+#ifndef BROKER_STABLE_MS
+#define BROKER_STABLE_MS        30000   // a session lost sooner than this counts as a failed attempt
+#endif
+//──── TLS (MQTT over TLS, session resumption) ──────────────────────
+// mqtt_ha_set_tls() needs MQTT_HA_TLS=1 (compile definition) and lwIP's altcp_tls
+// over mbedTLS in the firmware: LWIP_ALTCP, LWIP_ALTCP_TLS, MBEDTLS_SSL_SESSION_TICKETS.
+// Resumption also needs MQTT_HA_MQTT_BUILTIN=1: lwIP's MQTT app keeps its pcb private.
+#ifndef MQTT_HA_TLS
+#define MQTT_HA_TLS                 0
+#endif
+#ifndef MQTT_HA_TLS_SESSION_FLASH
+#define MQTT_HA_TLS_SESSION_FLASH   0       // 1: the session is also kept in the flash record (reboots resume)
+#endif
+#ifndef MQTT_HA_TLS_SESSION_MAX
+#define MQTT_HA_TLS_SESSION_MAX     512     // serialized session in the flash record, ticket included
+#endif
+#ifndef MQTT_HA_TLS_HANDSHAKE_MS
+#define MQTT_HA_TLS_HANDSHAKE_MS    5000    // full handshake allowance on top of MQTT_HA_FAST_CONNECT_TIMEOUT_MS
+#endif
+//──── Built-in MQTT client (MQTT 5 topic aliases) ──────────────────
+// MQTT_HA_MQTT_BUILTIN=1 (compile definition): mqtt_ha_mqtt.cpp stands in for lwIP's
+// MQTT app, its MQTT_HA_MQTT_xxx settings are in mqtt_ha_mqtt.h.
+//──── Sensor channels ──────────────────────────────────────────────
+#ifndef MQTT_HA_MAX_CHANNELS
+#define MQTT_HA_MAX_CHANNELS 48     // max entries of a channel table
+#endif
+#ifndef STATE_PAYLOAD_MAX
+#define STATE_PAYLOAD_MAX    1024   // JSON state payload with every channel (~20 bytes per channel)
+#endif
+#ifndef DISCOVERY_CHUNK_MAX
+#define DISCOVERY_CHUNK_MAX  1024   // one discovery message, more channels are split in several messages
+#endif
+#ifndef MQTT_HA_DISCOVERY_SKIP
+#define MQTT_HA_DISCOVERY_SKIP 1    // reconnect: no discovery when the broker already retains the same one (hash in flash)
+#endif
+//──── Offline backlog (store and forward) ──────────────────────────
+// Samples taken while the broker is unreachable are kept in a ring buffer
+// and replayed (with their age) on REPLAY_TOPIC once the device is back online.
+#define REPLAY_TOPIC     "pico_env_sensor/state/replay"
+#ifndef BACKLOG_BYTES
+#define BACKLOG_BYTES     4096  // binary samples kept while offline (14 bytes each for the built-in channels)
+#endif
+#ifndef BACKLOG_BATCH
+#define BACKLOG_BATCH     4     // max samples replayed per mqtt_poll() call
+#endif
+#ifndef BACKLOG_IN_FLIGHT
+#define BACKLOG_IN_FLIGHT 2     // replay publishes waiting for PUBACK (lwIP MQTT_REQ_MAX_IN_FLIGHT is 4)
+#endif
+//──── Batched samples (bulk topic) ─────────────────────────────────
+// mqtt_ha_set_batching(): K samples (or T ms) in one message on BATCH_TOPIC
+#define BATCH_TOPIC      "pico_env_sensor/state/batch"
+#ifndef BATCH_BYTES
+#define BATCH_BYTES       2048  // binary samples waiting for their batch (same records as the backlog)
+#endif
+#ifndef BATCH_PAYLOAD_MAX
+#define BATCH_PAYLOAD_MAX 1024  // one batch message, mqtt_ha_set_batching() refuses K that could not fit
+#endif
+//──── Gateway mode (runtime devices) ───────────────────────────────
+#ifndef MQTT_HA_MAX_DEVICES
+#define MQTT_HA_MAX_DEVICES    16   // downstream devices bridged by mqtt_ha_add_device()
+#endif
+#ifndef MQTT_HA_DEVICE_VALUES
+#define MQTT_HA_DEVICE_VALUES  128  // channel values of all those devices together (4 bytes each)
+#endif
+static_assert(MQTT_HA_MAX_DEVICES <= 255, "device handles are uint8_t");
+#ifndef GATEWAY_IN_FLIGHT
+#define GATEWAY_IN_FLIGHT      2    // publish slots the devices may use, the rest stays for the gateway itself
+#endif
+//──── Outbound queue ───────────────────────────────────────────────
+#ifndef PUBLISH_IN_FLIGHT
+#define PUBLISH_IN_FLIGHT 3     // publishes waiting for completion, one lwIP request slot is left for SUBSCRIBE
+#endif
+#ifndef OUTBOX_SLOTS
+#define OUTBOX_SLOTS      8     // messages waiting for a free publish slot
+#endif
+//──── Runtime metrics (HA diagnostic entities) ─────────────────────
+#define METRICS_TOPIC    "pico_env_sensor/diagnostics"
+#ifndef METRICS_PERIOD_MS
+#define METRICS_PERIOD_MS   60000   // diagnostics message period, 0: not published (still counted)
+#endif
+#ifndef METRICS_PAYLOAD_MAX
+#define METRICS_PAYLOAD_MAX 512
+#endif
+//──── RAM (scratch arena, stack watch) ─────────────────────────────
+// Every payload (state, replay, batch, diagnostics, discovery, bridged devices)
+// is built in one shared arena when it is sent, see "RAM" in mqtt_ha.cpp.
+#ifndef MQTT_HA_SCRATCH_SIZE
+#define MQTT_HA_SCRATCH_SIZE 0      // bytes, 0: the largest payload above + its topic
+#endif
+#ifndef TOPIC_MAX
+#define TOPIC_MAX            128    // topics built at runtime (discovery chunks, bridged devices)
+#endif
+#ifndef MQTT_HA_STACK_WATCH
+#define MQTT_HA_STACK_WATCH  4096   // network core stack painted for the high-water mark (bytes), 0: off
+#endif
+//--- Dual-core mode (MQTT_HA_DUAL_CORE, see mqtt_ha.h)
+#ifndef SAMPLE_QUEUE_SLOTS
+#define SAMPLE_QUEUE_SLOTS  8       // channel snapshots waiting for the network core (power of 2)
+#endif
+#ifndef COMMAND_QUEUE_SLOTS
+#define COMMAND_QUEUE_SLOTS 8       // commands waiting for the application core (power of 2)
+#endif
+
+namespace mqtt_ha_lib {
+
+static inline uint32_t now_ms() {
+    return to_ms_since_boot(get_absolute_time());
+}
+
+//─── Core (mqtt_ha.cpp) ────────────────────────────────────────────
+//--- Atomic: read by mqtt_is_connected() / mqtt_ha_state() from the application core in dual-core mode
+extern std::atomic<bool>        connected;
+extern std::atomic<MqttHaState> conn_state;
+extern bool                     discovery_done;
+extern MqttHaMetrics            metrics;
+extern ScratchArena             scratch;        // payloads and runtime topics (see "RAM")
+extern mqtt_client_t*           mqtt_client;
+
+//--- Broker list (see "BROKERS"): [0] from wifi_mqtt_init(), then mqtt_ha_add_broker()
+struct BrokerEndpoint {
+    char      host[BROKER_HOST_MAX];    // host name or dotted IP
+    uint16_t  port;
+    bool      literal;                  // dotted IP: no lookup
+    bool      resolved;                 // addr known: literal, last answer, or the flash
+    uint8_t   failures;                 // failed attempts in a row
+    ip_addr_t addr;
+};
+extern BrokerEndpoint brokers[MQTT_HA_MAX_BROKERS];
+extern uint8_t        broker_count;
+extern uint8_t        broker_current;   // the one used
+
+//--- Channel table (see "SENSOR CHANNELS")
+extern const MqttHaChannel* channels;
+extern uint8_t              channel_count;
+extern const uint8_t        storage_size[];     // bytes of each MqttHaStorage type
+//--- Values set by the application (mqtt_ha_set()), before the report-by-exception filter
+#if MQTT_HA_DUAL_CORE
+extern int32_t              app_value[MQTT_HA_MAX_CHANNELS];
+extern uint8_t              app_set[(MQTT_HA_MAX_CHANNELS + 7) / 8];
+#else
+extern int32_t* const       app_value;          // the network side's own values
+extern uint8_t* const       app_set;
+#endif
+//--- Past the filter: to the network side (a state, the batch or the backlog)
+void channels_forward();
+
+static inline bool channel_has_value(const uint8_t* set, uint8_t ch) {
+    return (set[ch / 8] >> (ch % 8)) & 1;
+}
+//--- Saturate to the storage type of the channel
+int32_t channel_clamp(const MqttHaChannel& c, int32_t scaled);
+//--- Same rounding as printf (see mqtt_ha_json.h), scaled by 10^precision (not NaN)
+int32_t channel_scale(const MqttHaChannel& c, double value);
+
+//--- Discovery (see "Auto-Discovery Home Assistant")
+extern MqttHaTopicPolicy topic_policy[MQTT_HA_TOPIC_COUNT];
+extern uint8_t           discovery_unacked;     // discovery messages of this session not acknowledged yet
+extern bool              discovery_failed;      // ... one was refused or lost: nothing saved this session
+//--- Every discovery message of the device, 0 if it could not be built
+uint32_t discovery_hash();
+//--- One component of the "cmps" block, with W = CtCounter / CtWriter (compile time, see
+//--- mqtt_ha_ctstring.h) or JsonPut (runtime)
+template <typename W>
+constexpr void write_component(W& w, const MqttHaChannel& c, const char* device_id) {
+    w.put("\"sensor_"); w.put(c.id); w.put("\":{");                // component unique Key (sensor_temp, ...)
+    w.put(  "\"p\":\"sensor\",");                                // platform (type of component, here sensor)
+    if (c.name) {
+        w.put("\"name\":\""); w.put(c.name); w.put("\",");         // entity name, HA uses the device class if missing
+    }
+    if (c.dev_cla) {
+        w.put("\"dev_cla\":\""); w.put(c.dev_cla); w.put("\",");   // device class (used by Home Assistant to display the right icon and unit)
+    }
+    //--- Unit_of_measurement is only added if the unit is not empty, to avoid HomeAssistant errors.
+    if (c.unit && c.unit[0] != '\0') {
+        w.put("\"unit_of_meas\":\""); w.put(c.unit); w.put("\",");
+    }
+    w.put(  "\"val_tpl\":\"{{ value_json."); w.put(c.key); w.put(" }}\",");   // value template, extracts the value from the state JSON
+    w.put(  "\"uniq_id\":\""); w.put(device_id); w.put("_"); w.put(c.id); w.put("\"");  // unique ID for this component
+    w.put("}");
+}
+
+//--- JsonWriter as a write_component() writer
+struct JsonPut {
+    JsonWriter& json;
+    void put(const char* s) { json.raw(s); }
+};
+
+//--- Binary sample records of the backlog and the batch (see "STORE AND FORWARD")
+#define BACKLOG_RECORD_MAX (4 + (MQTT_HA_MAX_CHANNELS + 7) / 8 + 4 * MQTT_HA_MAX_CHANNELS)
+size_t  record_size();
+void    record_encode(uint8_t* rec);
+int32_t record_value(const uint8_t* p, MqttHaStorage type);
+void    backlog_push(const uint8_t* rec);
+
+//--- Outbound queue (see "OUTBOUND QUEUE")
+enum OutboxKind : uint8_t {
+    OUTBOX_STATIC,      // topic and payload stay valid until sent
+    OUTBOX_STATE,       // live state, built from the channel values when sent
+    OUTBOX_METRICS,     // diagnostics, built from the counters when sent
+    OUTBOX_BATCH,       // batched samples, built from the batch ring when sent
+    OUTBOX_DISCOVERY,   // next discovery chunk (topic and payload), built from the channel table when sent
+};
+extern uint8_t outbox_count;
+extern bool    outbox_has_batch;
+bool outbox_push(MqttHaTopic cls, OutboxKind kind, const char* topic, const char* payload, size_t len,
+                 mqtt_request_cb_t cb = nullptr, void* arg = nullptr);
+
+//--- One publish to lwIP, outside the queue (see "MQTT Publish Helper"). @return false if lwIP refused it
+extern uint8_t pub_in_flight;
+bool mqtt_publish_msg(MqttHaTopic cls, const char* topic, const char* payload, size_t payload_len,
+                      mqtt_request_cb_t cb = nullptr, void* arg = nullptr);
+
+//─── Batched samples (mqtt_ha_batch.cpp) ───────────────────────────
+bool   batch_enabled();
+void   batch_reset();
+void   batch_store();
+void   batch_poll();
+size_t batch_build_payload(char* buf, uint16_t* samples);
+void   batch_sent(uint16_t samples);
+void   batch_on_disconnect();
+#ifdef MQTT_HA_HOST
+void   batch_reset_stats();
+#endif
+
+//─── Report by exception (mqtt_ha_report.cpp) ──────────────────────
+void report_reset();
+void report_sample(uint8_t ch, int32_t scaled);
+void report_poll();
+#ifdef MQTT_HA_HOST
+void report_reset_stats();
+#endif
+
+//─── Discovery cache and flash record (mqtt_ha_persist.cpp) ────────
+//--- Kept across reboots by mqtt_ha_store_save(): discovery hash, fast boot cache, broker, TLS session
+struct PersistRecord {
+    uint32_t discovery_hash;        // last discovery fully acknowledged, 0: none
+    uint32_t discovery_online_ms;   // CONNACK -> ONLINE of that session
+    //--- Last session that reached ONLINE (see "FAST BOOT")
+    uint32_t wifi_key;              // SSID + password hash, the rest belongs to that network
+    uint32_t ip;                    // DHCP lease (network order), 0: none
+    uint32_t netmask;
+    uint32_t gw;
+    uint32_t dns_server;            // from the lease, 0: none
+    uint32_t broker_ip;             // broker reached (network order)
+    uint16_t broker_port;
+    uint8_t  ap_channel;            // 0: no AP cached
+    uint8_t  ap_bssid[6];
+    uint8_t  broker_index;          // in the broker list (see "BROKERS")
+    uint8_t  reserved[2];           // no padding: records are compared by their bytes
+#if MQTT_HA_TLS && MQTT_HA_TLS_SESSION_FLASH
+    //--- Session of the last full TLS handshake (mqtt_ha_tls.cpp)
+    uint32_t tls_fingerprint;       // mqtt_ha_tls_fingerprint() of that session
+    uint16_t tls_len;               // serialized session, 0: none
+    uint8_t  tls_broker;            // broker that issued it
+    uint8_t  tls_reserved;
+    uint8_t  tls_session[MQTT_HA_TLS_SESSION_MAX];
+#endif
+};
+extern PersistRecord persist;   // network side: change it, then persist_request()
+
+void persist_load();            // wifi_mqtt_init()
+void persist_request();         // network side: persist changed
+void persist_handoff();         // net_poll(): to mqtt_poll() for the flash
+void persist_poll();            // mqtt_poll(): the flash write
+bool discovery_skip();          // CONNACK: @return true to go straight to availability
+void discovery_try_save();      // a discovery PUBACK
+void discovery_on_online();     // the session reached ONLINE
+#ifdef MQTT_HA_HOST
+void persist_reset_stats();
+#endif
+
+//─── TLS (mqtt_ha_tls.cpp) ─────────────────────────────────────────
+struct altcp_tls_config* tls_client_config();   // NULL: no TLS
+void tls_on_connect();          // conn_start_mqtt(), connect started
+void tls_on_connack();          // CONNACK
+bool tls_full_expected();       // no session to resume on this broker
+void tls_persist();             // ONLINE: the session into the flash record
+void tls_boot();                // wifi_mqtt_init(), after persist_load()
+#ifdef MQTT_HA_HOST
+void tls_reset_stats();
+#endif
+
+//─── Gateway mode (mqtt_ha_gateway.cpp) ────────────────────────────
+void gateway_session_start();
+void gateway_poll();
+#ifdef MQTT_HA_HOST
+void gateway_reset_stats();
+#endif
+
+}  // namespace mqtt_ha_lib
+using namespace mqtt_ha_lib;
@@ -0,0 +1,92 @@
+#include "mqtt_ha_json.h"
+#include <string.h>
+
+JsonWriter::JsonWriter(char* buf, size_t size) : buf_(buf), size_(size) {
+    if (size_ > 0) buf_[0] = '\0';
+    else ok_ = false;
+}
+
+//--- One character, always keeping room for the final '\0'
+void JsonWriter::put(char c) {
+    if (len_ + 1 < size_) {
+        buf_[len_++] = c;
+        buf_[len_]   = '\0';
+    } else {
+        ok_ = false;
+    }
+}
+
+JsonWriter& JsonWriter::raw(const char* s) {
+    while (*s) put(*s++);
+    return *this;
+}
+
+JsonWriter& JsonWriter::uinteger(uint64_t v) {
+    //--- digits are produced backwards, then copied in the right order
+    char tmp[20];
+    int  n = 0;
+    do {
+        tmp[n++] = (char)('0' + v % 10);
+        v /= 10;
+    } while (v != 0);
+    while (n > 0) put(tmp[--n]);
+    return *this;
+}
+
+JsonWriter& JsonWriter::integer(int64_t v) {
+    if (v < 0) {
+        put('-');
+        return uinteger(0 - (uint64_t)v);
+    }
+    return uinteger((uint64_t)v);
+}
+
+JsonWriter& JsonWriter::fixed(int32_t v, uint8_t decimals) {
+    if (decimals == 0) return integer(v);
+
+    uint32_t mag = v < 0 ? 0u - (uint32_t)v : (uint32_t)v;
+    uint32_t div = 1;
+    for (uint8_t i = 0; i < decimals; i++) div *= 10;
+    if (v < 0) put('-');
+    uinteger(mag / div);
+    put('.');
+    //--- leading zeros of the fractional part: 2005 / 3 decimals -> "2.005"
+    uint32_t frac = mag % div;
+    for (uint32_t d = div / 10; d > 1 && frac < d; d /= 10) put('0');
+    return uinteger(frac);
+}
+
+void JsonWriter::rewind(size_t len) {
+    if (len > len_) return;
+    len_ = len;
+    if (size_ > 0) buf_[len_] = '\0';
+    ok_ = (size_ > 0);
+}
+
+//--- A double is mant * 2^e (IEEE 754). For |v| < 2^52, v * 10^decimals is computed
+//--- EXACTLY as the 64-bit integer (mant * 10^decimals) >> -e plus a remainder, which
+//--- gives the correctly rounded scaled value, like printf does.
+bool json_round_scaled(double v, uint8_t decimals, uint64_t* magnitude, bool* negative) {
+    static const uint16_t pow10[] = { 1, 10, 100, 1000 };
+    uint64_t bits;
+    memcpy(&bits, &v, sizeof(bits));
+    int      exp  = (int)((bits >> 52) & 0x7ff);
+    uint64_t mant = bits & ((1ull << 52) - 1);
+
+    *negative  = (bits >> 63) != 0;
+    *magnitude = 0;
+    if (decimals > 3) return false;
+    if (exp == 0) return true;                  // zero or subnormal
+
+    int e = exp - 1075;                         // v = (mant | 2^52) * 2^e
+    if (e >= 0) return false;                   // |v| >= 2^52, inf or nan
+    int shift = -e;
+    if (shift > 63) return true;                // far below 0.5 / 10^decimals
+    uint64_t x    = (mant | (1ull << 52)) * pow10[decimals];   // < 2^63, no overflow
+    uint64_t rem  = x & ((1ull << shift) - 1);
+    uint64_t half = 1ull << (shift - 1);
+    uint64_t q    = x >> shift;
+    if (rem > half || (rem == half && (q & 1))) q++;   // ties to even
+    *magnitude = q;
+    return true;
+}
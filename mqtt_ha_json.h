@@ -0,0 +1,51 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Small JSON serializer (no printf) ─────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Writes numbers straight into a caller buffer with integer arithmetic only:
+// no snprintf, no soft-float printf code, and the exact length is known
+// at the end (no strlen needed before publishing).
+//
+//      char buf[128];
+//      JsonWriter w(buf, sizeof(buf));
+//      w.raw("{\"temperature\":").fixed(t_tenths, 1).raw(",\"eco2\":").uinteger(eco2).raw("}");
+//      if (w.ok()) publish(buf, w.length());
+//
+// Values are scaled integers (234 with 1 decimal is "23.4"): json_round_scaled()
+// turns a double into one, rounded like printf.
+// raw() copies text as is (keys, punctuation): it is NOT escaped.
+// If the buffer is too small the output is truncated (still '\0' terminated)
+// and ok() returns false.
+#include <stddef.h>
+#include <stdint.h>
+
+//--- v * 10^decimals rounded to an integer, exactly like printf would (ties to even),
+//--- using only integer operations on the bits of the double. decimals <= 3.
+//--- @return false if |v| >= 2^52, inf or nan
+bool json_round_scaled(double v, uint8_t decimals, uint64_t* magnitude, bool* negative);
+
+class JsonWriter {
+public:
+    JsonWriter(char* buf, size_t size);
+
+    JsonWriter& raw(const char* s);
+    JsonWriter& uinteger(uint64_t v);
+    JsonWriter& integer(int64_t v);
+    //--- Fixed-point value: v = 2345, decimals = 1  ->  "234.5"
+    JsonWriter& fixed(int32_t v, uint8_t decimals);
+
+    size_t      length()    const { return len_; }
+    size_t      remaining() const { return size_ > len_ ? size_ - 1 - len_ : 0; }
+    bool        ok()        const { return ok_; }
+    const char* c_str()     const { return buf_; }
+    //--- Go back to a previous length(), e.g. to drop an element that did not fit
+    void        rewind(size_t len);
+
+private:
+    void put(char c);
+
+    char*  buf_;
+    size_t size_;
+    size_t len_ = 0;
+    bool   ok_  = true;
+};
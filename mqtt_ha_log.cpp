@@ -0,0 +1,148 @@
+#include "mqtt_ha_log.h"
+#include "mqtt_ha.h"
+#include "mqtt_ha_platform.h"
+#include "mqtt_ha_spsc.h"
+#include <atomic>
+#include <stdio.h>
+#include <string.h>
+
+//--- Records go from the producer (library code, lwIP callbacks) to the flush.
+//--- Dual-core: one ring per core, so that each one keeps a single producer.
+#if MQTT_HA_DUAL_CORE
+#define LOG_CORES   2
+#define LOG_CORE()  get_core_num()
+#else
+#define LOG_CORES   1
+#define LOG_CORE()  0
+#endif
+static SpscQueue<MqttHaLogRecord, MQTT_HA_LOG_SLOTS> log_queue[LOG_CORES];
+static std::atomic<uint32_t> log_lost[LOG_CORES];
+static std::atomic<uint32_t> log_peak[LOG_CORES];
+static uint32_t              log_lost_reported = 0;
+
+//───────────────────────────────────────────────────────────────────
+//─── Producer: lwIP callbacks / library code ───────────────────────
+//───────────────────────────────────────────────────────────────────
+void mqtt_ha_log_write(uint8_t level, const char* fmt, const uintptr_t* args, uint8_t nargs) {
+    MqttHaLogRecord r;
+    r.fmt   = fmt;
+    r.t_ms  = to_ms_since_boot(get_absolute_time());
+    r.level = level;
+    r.nargs = nargs;
+    memcpy(r.args, args, nargs * sizeof(uintptr_t));
+    uint32_t core = LOG_CORE();
+    if (!log_queue[core].push(r)) {
+        //--- single producer: load + store, no read-modify-write (the M0+ has no LDREX/STREX)
+        log_lost[core].store(log_lost[core].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        return;
+    }
+    uint32_t waiting = log_queue[core].size();
+    if (waiting > log_peak[core].load(std::memory_order_relaxed)) log_peak[core].store(waiting, std::memory_order_relaxed);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Consumer: main loop / host decoder ────────────────────────────
+//───────────────────────────────────────────────────────────────────
+bool mqtt_ha_log_pop(MqttHaLogRecord* rec) {
+    for (uint32_t core = LOG_CORES; core-- > 0;) {     // core 1 (network) first
+        if (log_queue[core].pop(rec)) return true;
+    }
+    return false;
+}
+
+uint32_t mqtt_ha_log_dropped() {
+    uint32_t lost = 0;
+    for (uint32_t core = 0; core < LOG_CORES; core++) lost += log_lost[core].load(std::memory_order_relaxed);
+    return lost;
+}
+
+uint32_t mqtt_ha_log_peak() {
+    uint32_t peak = 0;
+    for (uint32_t core = 0; core < LOG_CORES; core++) {
+        uint32_t p = log_peak[core].load(std::memory_order_relaxed);
+        if (p > peak) peak = p;
+    }
+    return peak;
+}
+
+#ifdef MQTT_HA_HOST
+//--- Producers stopped (core 1 is, see mqtt_ha_host_reset_stats())
+void mqtt_ha_log_reset_stats() {
+    for (uint32_t core = 0; core < LOG_CORES; core++) {
+        log_lost[core].store(0, std::memory_order_relaxed);
+        log_peak[core].store(0, std::memory_order_relaxed);
+    }
+    log_lost_reported = 0;
+}
+#endif
+
+//--- printf subset: each conversion is handed to snprintf with the argument in its real type
+size_t mqtt_ha_log_format(const MqttHaLogRecord& rec, char* out, size_t size) {
+    if (size == 0) return 0;
+    size_t      len = 0;
+    uint8_t     arg = 0;
+    const char* f   = rec.fmt;
+    while (*f != '\0' && len < size - 1) {
+        if (*f != '%') {
+            out[len++] = *f++;
+            continue;
+        }
+        //--- %[flags][width][.precision][length]conversion
+        char    spec[16];
+        uint8_t n = 0;
+        spec[n++] = *f++;
+        while (*f != '\0' && strchr("-+ #0123456789.", *f) && n < sizeof(spec) - 4) spec[n++] = *f++;
+        while (*f == 'l' || *f == 'h' || *f == 'z') f++;    // arguments are stored as uintptr_t
+        char conv = *f;
+        if (conv == '\0') break;
+        f++;
+        if (conv == '%') {
+            out[len++] = '%';
+            continue;
+        }
+        uintptr_t v = (arg < rec.nargs) ? rec.args[arg++] : 0;
+        int w;
+        switch (conv) {
+        case 'd': case 'i':
+            spec[n++] = 'l'; spec[n++] = conv; spec[n] = '\0';
+            w = snprintf(out + len, size - len, spec, (long)(intptr_t)v);
+            break;
+        case 'u': case 'x': case 'X':
+            spec[n++] = 'l'; spec[n++] = conv; spec[n] = '\0';
+            w = snprintf(out + len, size - len, spec, (unsigned long)v);
+            break;
+        case 'c':
+            spec[n++] = 'c'; spec[n] = '\0';
+            w = snprintf(out + len, size - len, spec, (int)v);
+            break;
+        case 's':
+            spec[n++] = 's'; spec[n] = '\0';
+            w = snprintf(out + len, size - len, spec, v ? (const char*)v : "(null)");
+            break;
+        case 'p':
+            spec[n++] = 'p'; spec[n] = '\0';
+            w = snprintf(out + len, size - len, spec, (void*)v);
+            break;
+        default:    // unsupported (%f...): shown as is
+            w = snprintf(out + len, size - len, "%%%c", conv);
+            break;
+        }
+        if (w > 0) len += ((size_t)w < size - len) ? (size_t)w : size - 1 - len;
+    }
+    out[len] = '\0';
+    return len;
+}
+
+void mqtt_ha_log_flush() {
+    char line[160];
+    MqttHaLogRecord rec;
+    for (int i = 0; i < MQTT_HA_LOG_FLUSH_MAX && mqtt_ha_log_pop(&rec); i++) {
+        mqtt_ha_log_format(rec, line, sizeof(line));
+        fputs(line, stdout);
+    }
+    uint32_t lost = mqtt_ha_log_dropped();
+    if (lost != log_lost_reported) {
+        printf("LOG: %lu records dropped (MQTT_HA_LOG_SLOTS full)\n", (unsigned long)(lost - log_lost_reported));
+        log_lost_reported = lost;
+    }
+}
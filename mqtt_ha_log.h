@@ -0,0 +1,99 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Deferred binary logging ───────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// printf() inside the lwIP callbacks blocks networking while stdio (USB CDC
+// or UART) writes the text. Here a log call only stores the format string
+// pointer (its ID: format strings stay in flash) and the raw arguments in a
+// lock-free ring; the text is formatted later, from the main loop
+// (mqtt_ha_log_flush(), called by mqtt_poll()) or by a host-side decoder
+// (mqtt_ha_log_pop() + mqtt_ha_log_format()).
+//
+//      LOG_INFO("MQTT: Subscription confirmed (%u/%u)\n", sub_acked, count);
+//
+// Levels are filtered at compile time (MQTT_HA_LOG_LEVEL): a disabled call
+// expands to nothing, its format string is not even in the binary.
+// Rules for the arguments (at most MQTT_HA_LOG_ARGS):
+//  - integers, enums and pointers: %d %i %u %x %X %c %p (with flags / width, l ll z h ignored)
+//  - %s only with strings that outlive the flush: literals, route / channel tables, static config.
+//    Never a lwIP topic or payload buffer, never a local buffer.
+//  - no floating point (%f).
+// One producer (the lwIP / main loop context) and one consumer: no lock (mqtt_ha_spsc.h).
+// In dual-core mode each core records into its own ring, mqtt_poll() on core 0 writes both.
+// When the ring is full new records are dropped and counted (mqtt_ha_log_dropped(), "log_drop"
+// in the diagnostics). A ring only holds what is logged between two flushes (one mqtt_poll()):
+// mqtt_ha_log_peak() tells how close an application gets to MQTT_HA_LOG_SLOTS.
+#include <stddef.h>
+#include <stdint.h>
+
+#define MQTT_HA_LOG_NONE    0
+#define MQTT_HA_LOG_ERROR   1
+#define MQTT_HA_LOG_WARN    2
+#define MQTT_HA_LOG_INFO    3
+#define MQTT_HA_LOG_DEBUG   4
+
+#ifndef MQTT_HA_LOG_LEVEL
+#define MQTT_HA_LOG_LEVEL   MQTT_HA_LOG_INFO
+#endif
+#ifndef MQTT_HA_LOG_SLOTS
+#define MQTT_HA_LOG_SLOTS   64      // records waiting for the flush (power of 2), per core
+#endif
+#ifndef MQTT_HA_LOG_ARGS
+#define MQTT_HA_LOG_ARGS    4       // arguments per record
+#endif
+#ifndef MQTT_HA_LOG_FLUSH_MAX
+#define MQTT_HA_LOG_FLUSH_MAX 8     // records written per mqtt_poll(), keeps the loop short
+#endif
+
+struct MqttHaLogRecord {
+    const char* fmt;                        // format string, also the message ID
+    uint32_t    t_ms;                       // time since boot
+    uint8_t     level;
+    uint8_t     nargs;
+    uintptr_t   args[MQTT_HA_LOG_ARGS];     // raw arguments, integers or pointers
+};
+
+//--- Producer side (use the LOG_xxx macros below)
+void mqtt_ha_log_write(uint8_t level, const char* fmt, const uintptr_t* args, uint8_t nargs);
+
+template <typename... A>
+static inline void mqtt_ha_log_record(uint8_t level, const char* fmt, A... a) {
+    static_assert(sizeof...(A) <= MQTT_HA_LOG_ARGS, "too many log arguments (MQTT_HA_LOG_ARGS)");
+    const uintptr_t args[sizeof...(A) + 1] = { (uintptr_t)a... };
+    mqtt_ha_log_write(level, fmt, args, (uint8_t)sizeof...(A));
+}
+
+//--- Consumer side
+//--- Oldest record, @return false if there is none
+bool   mqtt_ha_log_pop(MqttHaLogRecord* rec);
+//--- Record -> text (truncated to size), @return length
+size_t mqtt_ha_log_format(const MqttHaLogRecord& rec, char* out, size_t size);
+//--- Records dropped because the ring was full (since boot)
+uint32_t mqtt_ha_log_dropped();
+//--- Most records waiting at once in one ring (since boot): MQTT_HA_LOG_SLOTS needs more
+uint32_t mqtt_ha_log_peak();
+#ifdef MQTT_HA_HOST
+//--- Host tests and benchmarks: dropped and peak back to 0 (see mqtt_ha_host_reset_stats())
+void mqtt_ha_log_reset_stats();
+#endif
+
+#if MQTT_HA_LOG_LEVEL >= MQTT_HA_LOG_ERROR
+#define LOG_ERROR(...)  mqtt_ha_log_record(MQTT_HA_LOG_ERROR, __VA_ARGS__)
+#else
+#define LOG_ERROR(...)  do {} while (0)
+#endif
+#if MQTT_HA_LOG_LEVEL >= MQTT_HA_LOG_WARN
+#define LOG_WARN(...)   mqtt_ha_log_record(MQTT_HA_LOG_WARN, __VA_ARGS__)
+#else
+#define LOG_WARN(...)   do {} while (0)
+#endif
+#if MQTT_HA_LOG_LEVEL >= MQTT_HA_LOG_INFO
+#define LOG_INFO(...)   mqtt_ha_log_record(MQTT_HA_LOG_INFO, __VA_ARGS__)
+#else
+#define LOG_INFO(...)   do {} while (0)
+#endif
+#if MQTT_HA_LOG_LEVEL >= MQTT_HA_LOG_DEBUG
+#define LOG_DEBUG(...)  mqtt_ha_log_record(MQTT_HA_LOG_DEBUG, __VA_ARGS__)
+#else
+#define LOG_DEBUG(...)  do {} while (0)
+#endif
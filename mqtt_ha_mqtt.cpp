@@ -0,0 +1,857 @@
+//───────────────────────────────────────────────────────────────────
+//─── Built-in MQTT client over lwIP altcp ──────────────────────────
+//───────────────────────────────────────────────────────────────────
+// See mqtt_ha_mqtt.h. Same model as lwIP's mqtt.c: everything runs in the
+// altcp callbacks (connected, recv, sent, err, poll once a second), no
+// callback is ever fired from inside an mqtt_*() call.
+#include "mqtt_ha.h"
+#include <string.h>
+#include "mqtt_ha_platform.h"   // lwIP altcp (or host_net.cpp over a socket)
+#include "mqtt_ha_mqtt.h"
+#include "mqtt_ha_log.h"
+
+#if MQTT_HA_MQTT_BUILTIN
+
+#define MQTT_POLL_INTERVAL  2   // altcp_poll() in TCP coarse ticks (500 ms): once a second
+
+enum MqttConn : uint8_t {
+    MQTT_IDLE,
+    MQTT_TCP_CONNECT,       // altcp_connect() (and the TLS handshake) in progress
+    MQTT_CONNACK,           // CONNECT written, waiting for CONNACK
+    MQTT_CONNECTED,
+};
+
+enum MqttRx : uint8_t {
+    RX_TYPE,                // first byte of a packet
+    RX_LENGTH,              // remaining length, 1..4 bytes
+    RX_HEADER,              // into rx[]: a whole packet, or the variable header of a PUBLISH
+    RX_PAYLOAD,             // PUBLISH payload -> data_cb, straight from the pbufs
+    RX_SKIP,                // too long for rx[]: dropped
+};
+
+struct MqttRequest {
+    mqtt_request_cb_t cb;
+    void*             arg;
+    u16_t             pkt_id;   // 0: QoS 0 publish, done once TCP acked tx_end; else PUBACK / PUBCOMP / SUBACK / UNSUBACK
+    u16_t             age_s;
+    u32_t             tx_end;
+};
+
+struct MqttAlias {
+    u32_t hash;
+    u16_t off;                  // topic in alias_pool[]
+    u16_t len;
+};
+
+struct mqtt_client_s {
+    struct altcp_pcb*          pcb;
+    MqttConn                   conn;
+    bool                       used;
+    bool                       broken;      // a write failed halfway: closed on the next poll
+    u8_t                       level_next;  // protocol level of the next connects
+    u8_t                       level;       // ... of this one
+    //--- mqtt_client_connect() arguments, kept for the 3.1.1 reconnect
+    ip_addr_t                  ip;
+    u16_t                      port;
+    mqtt_connect_client_info_t ci;
+    mqtt_connection_cb_t       conn_cb;
+    void*                      conn_arg;
+    mqtt_incoming_publish_cb_t pub_cb;
+    mqtt_incoming_data_cb_t    data_cb;
+    void*                      inpub_arg;
+    //--- session
+    u16_t                      keep_alive;
+    u16_t                      tx_idle_s;
+    u16_t                      rx_idle_s;
+    u16_t                      connect_s;
+    u16_t                      next_id;
+    u16_t                      recv_max;    // broker's Receive Maximum: QoS 1 and 2 publishes in flight
+    u32_t                      max_packet;  // broker's Maximum Packet Size, 0: none
+    u32_t                      tx_total;    // bytes written / acked by TCP since the connect
+    u32_t                      tx_acked;
+    MqttRequest                req[MQTT_REQ_MAX_IN_FLIGHT];
+    u8_t                       req_count;
+    //--- topic aliases (MQTT 5), for this session only
+    u16_t                      alias_max;   // min(broker's Topic Alias Maximum, MQTT_HA_MQTT_ALIASES)
+    u16_t                      alias_count;
+    u16_t                      alias_bytes;
+    MqttAlias                  alias[MQTT_HA_MQTT_ALIASES];
+    char                       alias_pool[MQTT_HA_MQTT_ALIAS_BYTES];
+    u32_t                      seen[MQTT_HA_MQTT_SEEN];     // hashes of topics published once
+    u8_t                       seen_next;
+    //--- rx
+    MqttRx                     rx_state;
+    u8_t                       rx_type;
+    u8_t                       rx_shift;
+    u8_t                       rx_qos;
+    u16_t                      rx_id;
+    u32_t                      rx_remaining;
+    u32_t                      rx_left;
+    size_t                     rx_pos;
+    uint8_t                    rx[MQTT_HA_MQTT_RX_HEADER + 1];     // + the topic's '\0'
+
+    MqttHaMqttStats            stats;
+    u32_t                      last_publish;
+};
+
+static mqtt_client_s clients[MQTT_HA_MQTT_CLIENTS];
+//--- pcb aborted (not closed) inside an altcp callback: that callback returns ERR_ABRT
+static struct altcp_pcb* aborted_pcb = nullptr;
+
+//───────────────────────────────────────────────────────────────────
+//─── Encoding ──────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static size_t mqtt_varint(uint8_t* p, u32_t v) {
+    size_t n = 0;
+    do {
+        uint8_t b = v & 0x7f;
+        v >>= 7;
+        p[n++] = b | (v ? 0x80 : 0);
+    } while (v);
+    return n;
+}
+
+static u32_t mqtt_varint_size(u32_t v) {
+    return v < 128 ? 1 : v < 16384 ? 2 : v < 2097152 ? 3 : 4;
+}
+
+//--- Fixed header + remaining bytes
+static u32_t mqtt_packet_size(u32_t remaining) {
+    return 1 + mqtt_varint_size(remaining) + remaining;
+}
+
+static u32_t mqtt_hash(const char* s, size_t len) {
+    u32_t h = 2166136261u;      // FNV-1a
+    for (size_t i = 0; i < len; i++) h = (h ^ (uint8_t)s[i]) * 16777619u;
+    return h;
+}
+
+//--- Whole packet or nothing: half of one would break the stream. pieces: altcp_write() calls.
+//--- A copied write takes one pbuf per segment it starts, plus one when it extends the last
+//--- unsent segment: at most 2 per piece + len / TCP_MSS, so none of the writes can fail.
+static bool mqtt_room(const mqtt_client_s* c, u32_t len, u32_t pieces) {
+    return !c->broken && altcp_sndbuf(c->pcb) >= len
+        && altcp_sndqueuelen(c->pcb) + 2 * pieces + len / TCP_MSS <= TCP_SND_QUEUELEN;
+}
+
+//--- One piece of a packet into the TCP send buffer (lwIP copies it). more: not the last piece
+static bool mqtt_write(mqtt_client_s* c, const void* data, size_t len, bool more) {
+    if (len == 0 || c->broken) return !c->broken;
+    if (altcp_write(c->pcb, data, (u16_t)len, TCP_WRITE_FLAG_COPY | (more ? TCP_WRITE_FLAG_MORE : 0)) != ERR_OK) {
+        c->broken = true;
+        return false;
+    }
+    c->tx_total         += (u32_t)len;
+    c->stats.bytes_sent += len;
+    c->tx_idle_s         = 0;
+    return true;
+}
+
+//--- Length prefixed string (2 bytes + s)
+static bool mqtt_write_str(mqtt_client_s* c, const char* s, size_t len, bool more) {
+    uint8_t n[2] = { (uint8_t)(len >> 8), (uint8_t)len };
+    return mqtt_write(c, n, 2, len > 0 || more) && mqtt_write(c, s, len, more);
+}
+
+static u16_t mqtt_packet_id(mqtt_client_s* c) {
+    if (++c->next_id == 0) c->next_id = 1;
+    return c->next_id;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Requests ──────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static void mqtt_queue_request(mqtt_client_s* c, mqtt_request_cb_t cb, void* arg, u16_t pkt_id) {
+    MqttRequest& r = c->req[c->req_count++];
+    r.cb     = cb;
+    r.arg    = arg;
+    r.pkt_id = pkt_id;
+    r.age_s  = 0;
+    r.tx_end = c->tx_total;
+}
+
+static u8_t mqtt_acked_in_flight(const mqtt_client_s* c) {
+    u8_t n = 0;
+    for (u8_t i = 0; i < c->req_count; i++) n += c->req[i].pkt_id != 0;
+    return n;
+}
+
+//--- Request of pkt_id, or (pkt_id 0) every QoS 0 publish TCP acked, or (expired) the timed out ones -> callback
+static void mqtt_complete(mqtt_client_s* c, u16_t pkt_id, err_t err, bool expired = false) {
+    MqttRequest done[MQTT_REQ_MAX_IN_FLIGHT];
+    u8_t n = 0, kept = 0;
+    for (u8_t i = 0; i < c->req_count; i++) {
+        const MqttRequest& r = c->req[i];
+        bool match = expired ? r.age_s >= MQTT_HA_MQTT_REQ_TIMEOUT_S
+                   : pkt_id  ? r.pkt_id == pkt_id
+                   : r.pkt_id == 0 && (int32_t)(c->tx_acked - r.tx_end) >= 0;
+        if (match) done[n++]       = r;
+        else       c->req[kept++] = r;
+    }
+    c->req_count = kept;
+    //--- Callbacks may queue new requests: the list is consistent before they run
+    for (u8_t i = 0; i < n; i++) {
+        if (done[i].cb) done[i].cb(done[i].arg, err);
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Connection ────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static err_t mqtt_tcp_connected(void* arg, struct altcp_pcb* pcb, err_t err);
+static err_t mqtt_tcp_recv(void* arg, struct altcp_pcb* pcb, struct pbuf* p, err_t err);
+static err_t mqtt_tcp_sent(void* arg, struct altcp_pcb* pcb, u16_t len);
+static err_t mqtt_tcp_poll(void* arg, struct altcp_pcb* pcb);
+static void  mqtt_tcp_err(void* arg, err_t err);
+
+static void mqtt_detach(struct altcp_pcb* pcb) {
+    altcp_arg(pcb, nullptr);
+    altcp_recv(pcb, nullptr);
+    altcp_sent(pcb, nullptr);
+    altcp_err(pcb, nullptr);
+    altcp_poll(pcb, nullptr, 0);
+}
+
+//--- lwIP frees the pending requests without calling them, then reports (reason != 0)
+static void mqtt_close(mqtt_client_s* c, int reason) {
+    if (c->pcb) {
+        struct altcp_pcb* pcb = c->pcb;
+        mqtt_detach(pcb);
+        if (altcp_close(pcb) != ERR_OK) {
+            altcp_abort(pcb);
+            aborted_pcb = pcb;
+        }
+    }
+    c->pcb       = nullptr;
+    c->conn      = MQTT_IDLE;
+    c->req_count = 0;
+    c->rx_state  = RX_TYPE;
+    if (reason && c->conn_cb) c->conn_cb(c, c->conn_arg, (mqtt_connection_status_t)reason);
+}
+
+//--- lwIP has mqtt_connect_client_info_t::tls_config with LWIP_ALTCP_TLS only
+static bool mqtt_tls(const mqtt_client_s* c) {
+#if MQTT_HA_TLS
+    return c->ci.tls_config != nullptr;
+#else
+    return false;
+#endif
+}
+
+//--- New pcb, connect, fresh session (aliases included)
+static err_t mqtt_start(mqtt_client_s* c) {
+    struct altcp_pcb* pcb;
+#if MQTT_HA_TLS
+    if (mqtt_tls(c)) pcb = altcp_tls_new(c->ci.tls_config, IPADDR_TYPE_ANY);
+    else
+#endif
+    pcb = altcp_tcp_new_ip_type(IPADDR_TYPE_ANY);
+    if (!pcb) return ERR_MEM;
+    altcp_arg(pcb, c);
+    altcp_recv(pcb, mqtt_tcp_recv);
+    altcp_sent(pcb, mqtt_tcp_sent);
+    altcp_err(pcb, mqtt_tcp_err);
+    altcp_poll(pcb, mqtt_tcp_poll, MQTT_POLL_INTERVAL);
+    err_t err = altcp_connect(pcb, &c->ip, c->port, mqtt_tcp_connected);
+    if (err != ERR_OK) {
+        mqtt_detach(pcb);
+        altcp_abort(pcb);
+        return err;
+    }
+    c->pcb          = pcb;
+    c->conn         = MQTT_TCP_CONNECT;
+    c->broken       = false;
+    c->level        = c->level_next;
+    c->keep_alive   = c->ci.keep_alive;
+    c->tx_idle_s    = 0;
+    c->rx_idle_s    = 0;
+    c->connect_s    = 0;
+    c->recv_max     = 0xffff;
+    c->max_packet   = 0;
+    c->tx_total     = 0;
+    c->tx_acked     = 0;
+    c->req_count    = 0;
+    c->alias_max    = 0;
+    c->alias_count  = 0;
+    c->alias_bytes  = 0;
+    c->seen_next    = 0;
+    c->rx_state     = RX_TYPE;
+    memset(c->seen, 0, sizeof(c->seen));
+    c->stats.alias_max = 0;
+    c->stats.aliases   = 0;
+    return ERR_OK;
+}
+
+//--- CONNECT, once TCP (and TLS) is up: clean session, will, user / password
+static bool mqtt_send_connect(mqtt_client_s* c) {
+    const mqtt_connect_client_info_t& ci = c->ci;
+    bool   v5       = c->level == 5;
+    size_t id_len   = strlen(ci.client_id);
+    size_t will_len = ci.will_topic ? strlen(ci.will_topic) : 0;
+    size_t msg_len  = will_len ? strlen(ci.will_msg) : 0;
+    size_t user_len = ci.client_user ? strlen(ci.client_user) : 0;
+    size_t pass_len = ci.client_pass ? strlen(ci.client_pass) : 0;
+
+    uint8_t flags     = 0x02;   // clean session (clean start), like lwIP
+    u32_t   remaining = 10 + (v5 ? 1 : 0) + 2 + (u32_t)id_len;
+    if (will_len) {
+        flags     |= 0x04 | (ci.will_qos & 3) << 3 | (ci.will_retain ? 0x20 : 0);
+        remaining += (v5 ? 1 : 0) + 2 + (u32_t)will_len + 2 + (u32_t)msg_len;
+    }
+    if (user_len) { flags |= 0x80; remaining += 2 + (u32_t)user_len; }
+    if (pass_len) { flags |= 0x40; remaining += 2 + (u32_t)pass_len; }
+    if (!mqtt_room(c, mqtt_packet_size(remaining), 12)) return false;
+
+    uint8_t h[5 + 11];
+    size_t  n = 0;
+    h[n++] = 0x10;
+    n += mqtt_varint(h + n, remaining);
+    static const uint8_t name[6] = { 0, 4, 'M', 'Q', 'T', 'T' };
+    memcpy(h + n, name, sizeof(name));
+    n += sizeof(name);
+    h[n++] = c->level;
+    h[n++] = flags;
+    h[n++] = (uint8_t)(c->keep_alive >> 8);
+    h[n++] = (uint8_t)c->keep_alive;
+    if (v5) h[n++] = 0;         // no properties: Topic Alias Maximum 0, the broker sends us full topics
+    static const uint8_t no_props = 0;
+    bool ok = mqtt_write(c, h, n, true)
+           && mqtt_write_str(c, ci.client_id, id_len, will_len || user_len || pass_len);
+    if (ok && will_len) {
+        ok = (!v5 || mqtt_write(c, &no_props, 1, true))
+          && mqtt_write_str(c, ci.will_topic, will_len, true)
+          && mqtt_write_str(c, ci.will_msg, msg_len, user_len || pass_len);
+    }
+    if (ok && user_len) ok = mqtt_write_str(c, ci.client_user, user_len, pass_len > 0);
+    if (ok && pass_len) ok = mqtt_write_str(c, ci.client_pass, pass_len, false);
+    altcp_output(c->pcb);
+    return ok;
+}
+
+//--- A 3.1.1 broker refused the MQTT 5 CONNECT: the same again in 3.1.1 at once.
+//--- With TLS the caller reconnects (server name and session are set after mqtt_client_connect()).
+static void mqtt_fallback(mqtt_client_s* c) {
+    mqtt_close(c, 0);
+    c->level_next = 4;
+    c->stats.fallbacks++;
+    LOG_WARN("MQTT: broker without MQTT 5, 3.1.1 from now on\n");
+    if (mqtt_tls(c) || mqtt_start(c) != ERR_OK) {
+        if (c->conn_cb) c->conn_cb(c, c->conn_arg, MQTT_CONNECT_REFUSED_PROTOCOL_VERSION);
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Decoding ──────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+//--- Variable byte integer at p[at]. @return offset after it, 0 if truncated
+static size_t mqtt_varint_read(const uint8_t* p, size_t len, size_t at, u32_t* v) {
+    *v = 0;
+    for (int shift = 0; at < len && shift <= 21; shift += 7) {
+        uint8_t b = p[at++];
+        *v |= (u32_t)(b & 0x7f) << shift;
+        if (!(b & 0x80)) return at;
+    }
+    return 0;
+}
+
+//--- Value of an MQTT 5 property: 1, 2, 4 bytes, -1 varint, -2 string / binary, -3 string pair, 0 unknown
+static int mqtt_prop_size(uint8_t id) {
+    switch (id) {
+    case 0x01: case 0x17: case 0x19: case 0x24: case 0x25: case 0x28: case 0x29: case 0x2a: return 1;
+    case 0x13: case 0x21: case 0x22: case 0x23:                                             return 2;
+    case 0x02: case 0x11: case 0x18: case 0x27:                                             return 4;
+    case 0x0b:                                                                              return -1;
+    case 0x03: case 0x08: case 0x09: case 0x12: case 0x15: case 0x16: case 0x1a: case 0x1c: case 0x1f: return -2;
+    case 0x26:                                                                              return -3;
+    default:                                                                                return 0;
+    }
+}
+
+//--- MQTT 5 properties at p[at] (length first). CONNACK: the broker's limits are taken.
+//--- @return offset after them, 0 if malformed
+static size_t mqtt_props(mqtt_client_s* c, const uint8_t* p, size_t len, size_t at, bool connack) {
+    u32_t plen;
+    at = mqtt_varint_read(p, len, at, &plen);
+    if (!at || at + plen > len) return 0;
+    size_t end = at + plen;
+    while (at < end) {
+        uint8_t id   = p[at++];
+        int     size = mqtt_prop_size(id);
+        u32_t   v    = 0;
+        if (size > 0) {
+            if (at + (size_t)size > end) return 0;
+            for (int i = 0; i < size; i++) v = v << 8 | p[at++];
+        } else if (size == -1) {
+            at = mqtt_varint_read(p, end, at, &v);
+            if (!at) return 0;
+        } else if (size < -1) {
+            for (int s = 0; s < -size - 1; s++) {
+                if (at + 2 > end) return 0;
+                at += 2 + (size_t)(p[at] << 8 | p[at + 1]);
+            }
+            if (at > end) return 0;
+        } else {
+            return 0;
+        }
+        if (!connack) continue;
+        switch (id) {
+        case 0x13: c->keep_alive = (u16_t)v;                                    break;  // Server Keep Alive
+        case 0x21: c->recv_max   = v ? (u16_t)v : 0xffff;                       break;  // Receive Maximum
+        case 0x22: c->alias_max  = v < MQTT_HA_MQTT_ALIASES ? (u16_t)v : MQTT_HA_MQTT_ALIASES; break;  // Topic Alias Maximum
+        case 0x27: c->max_packet = v;                                           break;  // Maximum Packet Size
+        }
+    }
+    return end;
+}
+
+//--- PUBACK / PUBREC / PUBREL / PUBCOMP: reason code 0 left out in MQTT 5
+static void mqtt_send_ack(mqtt_client_s* c, uint8_t type, u16_t id) {
+    if (c->conn != MQTT_CONNECTED || !mqtt_room(c, 4, 1)) return;
+    uint8_t ack[4] = { type, 2, (uint8_t)(id >> 8), (uint8_t)id };
+    mqtt_write(c, ack, sizeof(ack), false);
+    altcp_output(c->pcb);
+}
+
+static void mqtt_connack(mqtt_client_s* c, const uint8_t* p, size_t len) {
+    if (c->conn != MQTT_CONNACK || len < 2) return;
+    uint8_t rc = p[1];
+    //--- A 3.1.1 broker answers MQTT 5 in 3.1.1: 0x01 unacceptable protocol version (MQTT 5: 0x84)
+    if (c->level == 5 && (rc == 0x01 || rc == 0x84)) {
+        mqtt_fallback(c);
+        return;
+    }
+    mqtt_connection_status_t status = (mqtt_connection_status_t)rc;
+    if (c->level == 5) {
+        if (rc == 0 && len > 2 && !mqtt_props(c, p, len, 2, true)) rc = 0x81;     // malformed
+        status = rc == 0    ? MQTT_CONNECT_ACCEPTED
+               : rc == 0x85 ? MQTT_CONNECT_REFUSED_IDENTIFIER
+               : rc == 0x86 ? MQTT_CONNECT_REFUSED_USERNAME_PASS
+               : rc == 0x87 ? MQTT_CONNECT_REFUSED_NOT_AUTHORIZED_
+               :              MQTT_CONNECT_REFUSED_SERVER;
+    }
+    //--- Closed before the report, like any other end of the connection: the callback may connect again
+    if (status != MQTT_CONNECT_ACCEPTED) {
+        mqtt_close(c, status);
+        return;
+    }
+    c->conn            = MQTT_CONNECTED;
+    c->stats.level     = c->level;
+    c->stats.alias_max = c->alias_max;
+    if (c->conn_cb) c->conn_cb(c, c->conn_arg, MQTT_CONNECT_ACCEPTED);
+}
+
+//--- SUBACK / UNSUBACK: reason code after the id (and the MQTT 5 properties). 0x80 and up: refused
+static err_t mqtt_ack_result(mqtt_client_s* c, const uint8_t* p, size_t len) {
+    size_t at = 2;
+    if (c->level == 5) at = len > 2 ? mqtt_props(c, p, len, 2, false) : len;
+    if (!at) return ERR_VAL;
+    return at < len && p[at] >= 0x80 ? ERR_ABRT : ERR_OK;
+}
+
+//--- One complete packet in rx[] (not a PUBLISH)
+static void mqtt_rx_packet(mqtt_client_s* c) {
+    const uint8_t* p   = c->rx;
+    size_t         len = c->rx_remaining;
+    u16_t          id  = len >= 2 ? (u16_t)(p[0] << 8 | p[1]) : 0;
+    switch (c->rx_type >> 4) {
+    case 2:                 // CONNACK
+        mqtt_connack(c, p, len);
+        break;
+    case 4:                 // PUBACK / PUBCOMP: MQTT 5 reason code, then properties
+    case 7:
+        if (len >= 2) mqtt_complete(c, id, len > 2 && p[2] >= 0x80 ? ERR_ABRT : ERR_OK);
+        break;
+    case 5:                 // PUBREC -> PUBREL, the request waits for PUBCOMP
+        if (len < 2) break;
+        if (len > 2 && p[2] >= 0x80) mqtt_complete(c, id, ERR_ABRT);
+        else                         mqtt_send_ack(c, 0x62, id);
+        break;
+    case 6:                 // PUBREL of an incoming QoS 2 -> PUBCOMP
+        if (len >= 2) mqtt_send_ack(c, 0x70, id);
+        break;
+    case 9:                 // SUBACK
+    case 11:                // UNSUBACK
+        if (len >= 2) mqtt_complete(c, id, mqtt_ack_result(c, p, len));
+        break;
+    case 14:                // DISCONNECT (MQTT 5): the broker closes
+        if (c->level == 5) mqtt_close(c, MQTT_CONNECT_DISCONNECTED);
+        break;
+    default:                // PINGRESP: rx_idle_s is enough
+        break;
+    }
+}
+
+//--- Variable header of the incoming PUBLISH, as far as rx[] tells: more bytes are needed while it exceeds rx_pos
+static size_t mqtt_rx_publish_header(const mqtt_client_s* c) {
+    const uint8_t* p = c->rx;
+    size_t         n = c->rx_pos;
+    if (n < 2) return 2;
+    size_t need = 2 + (size_t)(p[0] << 8 | p[1]) + (((c->rx_type >> 1) & 3) ? 2 : 0);
+    if (c->level < 5) return need;
+    if (n < need + 1) return need + 1;
+    u32_t plen;
+    size_t at = mqtt_varint_read(p, n, need, &plen);
+    return at ? at + plen : n + 1;
+}
+
+static size_t mqtt_rx_need(const mqtt_client_s* c) {
+    return (c->rx_type >> 4) == 3 ? mqtt_rx_publish_header(c) : c->rx_remaining;
+}
+
+//--- PUBLISH variable header complete: topic -> pub_cb, payload next
+static void mqtt_rx_publish(mqtt_client_s* c) {
+    size_t tlen = (size_t)(c->rx[0] << 8 | c->rx[1]);
+    c->rx_qos   = (c->rx_type >> 1) & 3;
+    c->rx_id    = c->rx_qos ? (u16_t)(c->rx[2 + tlen] << 8 | c->rx[3 + tlen]) : 0;
+    c->rx[2 + tlen] = '\0';     // over the id (read) or the properties (skipped), rx[] has room for it
+    c->rx_left  = c->rx_remaining - (u32_t)c->rx_pos;
+    c->rx_state = RX_PAYLOAD;
+    if (c->pub_cb) c->pub_cb(c->inpub_arg, (const char*)c->rx + 2, c->rx_left);
+}
+
+//--- PUBLISH payload complete: PUBACK (QoS 1) or PUBREC (QoS 2)
+static void mqtt_rx_publish_end(mqtt_client_s* c) {
+    c->rx_state = RX_TYPE;
+    if (c->rx_qos) mqtt_send_ack(c, c->rx_qos == 1 ? 0x40 : 0x50, c->rx_id);
+}
+
+//--- Bytes of a pbuf. Stops when a callback closed pcb
+static void mqtt_parse(mqtt_client_s* c, struct altcp_pcb* pcb, const uint8_t* data, size_t len) {
+    while (len && c->pcb == pcb) {
+        switch (c->rx_state) {
+        case RX_TYPE:
+            c->rx_type      = *data++;
+            c->rx_remaining = 0;
+            c->rx_shift     = 0;
+            c->rx_state     = RX_LENGTH;
+            len--;
+            break;
+        case RX_LENGTH: {
+            uint8_t b = *data++;
+            len--;
+            c->rx_remaining |= (u32_t)(b & 0x7f) << c->rx_shift;
+            c->rx_shift     += 7;
+            if (b & 0x80) {
+                if (c->rx_shift > 21) mqtt_close(c, MQTT_CONNECT_DISCONNECTED);    // malformed
+                break;
+            }
+            c->rx_pos   = 0;
+            c->rx_state = RX_HEADER;
+            if ((c->rx_type >> 4) != 3 && c->rx_remaining == 0) {     // PINGRESP...: nothing to wait for
+                c->rx_state = RX_TYPE;
+                mqtt_rx_packet(c);
+            }
+            break;
+        }
+        case RX_HEADER: {
+            size_t need = mqtt_rx_need(c);
+            if (need > c->rx_remaining || need > MQTT_HA_MQTT_RX_HEADER) {
+                c->rx_left  = c->rx_remaining - (u32_t)c->rx_pos;
+                c->rx_state = RX_SKIP;
+                break;
+            }
+            size_t n = need - c->rx_pos < len ? need - c->rx_pos : len;
+            memcpy(c->rx + c->rx_pos, data, n);
+            c->rx_pos += n;
+            data      += n;
+            len       -= n;
+            if (mqtt_rx_need(c) != c->rx_pos) break;
+            if ((c->rx_type >> 4) != 3) {
+                c->rx_state = RX_TYPE;
+                mqtt_rx_packet(c);
+            } else {
+                mqtt_rx_publish(c);
+                if (c->rx_left == 0 && c->pcb == pcb) {
+                    if (c->data_cb) c->data_cb(c->inpub_arg, nullptr, 0, MQTT_DATA_FLAG_LAST);
+                    mqtt_rx_publish_end(c);
+                }
+            }
+            break;
+        }
+        case RX_PAYLOAD: {
+            size_t n = c->rx_left < len ? c->rx_left : len;
+            c->rx_left -= (u32_t)n;
+            if (c->data_cb) c->data_cb(c->inpub_arg, data, (u16_t)n, c->rx_left ? 0 : MQTT_DATA_FLAG_LAST);
+            data += n;
+            len  -= n;
+            if (c->rx_left == 0 && c->pcb == pcb) mqtt_rx_publish_end(c);
+            break;
+        }
+        case RX_SKIP: {
+            size_t n = c->rx_left < len ? c->rx_left : len;
+            c->rx_left -= (u32_t)n;
+            data       += n;
+            len        -= n;
+            if (c->rx_left == 0) c->rx_state = RX_TYPE;
+            break;
+        }
+        }
+    }
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── altcp callbacks ───────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+static err_t mqtt_tcp_result(struct altcp_pcb* pcb) {
+    bool aborted = aborted_pcb == pcb;
+    aborted_pcb  = nullptr;
+    return aborted ? ERR_ABRT : ERR_OK;
+}
+
+static err_t mqtt_tcp_connected(void* arg, struct altcp_pcb* pcb, err_t err) {
+    mqtt_client_s* c = (mqtt_client_s*)arg;
+    c->conn      = MQTT_CONNACK;
+    c->rx_idle_s = 0;
+    if (err != ERR_OK || !mqtt_send_connect(c)) mqtt_close(c, MQTT_CONNECT_DISCONNECTED);
+    return mqtt_tcp_result(pcb);
+}
+
+static err_t mqtt_tcp_recv(void* arg, struct altcp_pcb* pcb, struct pbuf* p, err_t err) {
+    mqtt_client_s* c = (mqtt_client_s*)arg;
+    if (p == nullptr) {         // closed by the broker
+        mqtt_close(c, MQTT_CONNECT_DISCONNECTED);
+        return mqtt_tcp_result(pcb);
+    }
+    altcp_recved(pcb, p->tot_len);
+    c->rx_idle_s = 0;
+    for (struct pbuf* q = p; q && c->pcb == pcb; q = q->next) mqtt_parse(c, pcb, (const uint8_t*)q->payload, q->len);
+    pbuf_free(p);
+    return mqtt_tcp_result(pcb);
+}
+
+static err_t mqtt_tcp_sent(void* arg, struct altcp_pcb* pcb, u16_t len) {
+    mqtt_client_s* c = (mqtt_client_s*)arg;
+    c->tx_acked += len;
+    mqtt_complete(c, 0, ERR_OK);
+    return mqtt_tcp_result(pcb);
+}
+
+//--- pcb already freed by lwIP
+static void mqtt_tcp_err(void* arg, err_t err) {
+    mqtt_client_s* c = (mqtt_client_s*)arg;
+    c->pcb = nullptr;
+    mqtt_close(c, MQTT_CONNECT_DISCONNECTED);
+}
+
+//--- Once a second: connect timeout, request timeouts, keep alive
+static err_t mqtt_tcp_poll(void* arg, struct altcp_pcb* pcb) {
+    mqtt_client_s* c = (mqtt_client_s*)arg;
+    if (c->broken) {
+        mqtt_close(c, MQTT_CONNECT_DISCONNECTED);
+        return mqtt_tcp_result(pcb);
+    }
+    if (c->conn != MQTT_CONNECTED) {
+        if (++c->connect_s >= MQTT_HA_MQTT_CONNECT_TIMEOUT_S) mqtt_close(c, MQTT_CONNECT_TIMEOUT);
+        return mqtt_tcp_result(pcb);
+    }
+    bool expired = false;
+    for (u8_t i = 0; i < c->req_count; i++) expired |= ++c->req[i].age_s >= MQTT_HA_MQTT_REQ_TIMEOUT_S;
+    if (expired) mqtt_complete(c, 0, ERR_TIMEOUT, true);
+    //--- PINGREQ after keep_alive s without output, gone after 1.5 x without input
+    if (c->pcb == pcb && c->keep_alive) {
+        if (++c->rx_idle_s >= c->keep_alive + c->keep_alive / 2) {
+            mqtt_close(c, MQTT_CONNECT_TIMEOUT);
+        } else if (++c->tx_idle_s >= c->keep_alive && mqtt_room(c, 2, 1)) {
+            static const uint8_t ping[2] = { 0xc0, 0 };
+            mqtt_write(c, ping, sizeof(ping), false);
+            altcp_output(pcb);
+        }
+    }
+    return mqtt_tcp_result(pcb);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── lwIP MQTT app API ─────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+mqtt_client_t* mqtt_client_new(void) {
+    for (mqtt_client_s& c : clients) {
+        if (c.used) continue;
+        memset(&c, 0, sizeof(c));
+        c.used       = true;
+        c.level_next = MQTT_HA_MQTT_LEVEL == 4 ? 4 : 5;
+        return &c;
+    }
+    return nullptr;
+}
+
+void mqtt_client_free(mqtt_client_t* client) {
+    mqtt_close(client, 0);
+    client->used = false;
+}
+
+err_t mqtt_client_connect(mqtt_client_t* client, const ip_addr_t* ipaddr, u16_t port,
+                          mqtt_connection_cb_t cb, void* arg,
+                          const struct mqtt_connect_client_info_t* client_info) {
+    mqtt_client_s* c = client;
+    if (c->conn != MQTT_IDLE) return ERR_ISCONN;
+    c->ip       = *ipaddr;
+    c->port     = port;
+    c->ci       = *client_info;
+    c->conn_cb  = cb;
+    c->conn_arg = arg;
+    return mqtt_start(c);
+}
+
+void mqtt_disconnect(mqtt_client_t* client) {
+    mqtt_close(client, 0);
+}
+
+u8_t mqtt_client_is_connected(mqtt_client_t* client) {
+    return client->conn == MQTT_CONNECTED ? 1 : 0;
+}
+
+void mqtt_set_inpub_callback(mqtt_client_t* client, mqtt_incoming_publish_cb_t pub_cb,
+                             mqtt_incoming_data_cb_t data_cb, void* arg) {
+    client->pub_cb    = pub_cb;
+    client->data_cb   = data_cb;
+    client->inpub_arg = arg;
+}
+
+err_t mqtt_sub_unsub(mqtt_client_t* client, const char* topic, u8_t qos,
+                     mqtt_request_cb_t cb, void* arg, u8_t sub) {
+    mqtt_client_s* c = client;
+    if (c->conn != MQTT_CONNECTED || c->broken) return ERR_CONN;
+    size_t tlen = strlen(topic);
+    if (tlen > 0xffff) return ERR_VAL;
+    bool  v5        = c->level == 5;
+    u32_t remaining = 2 + (v5 ? 1 : 0) + 2 + (u32_t)tlen + (sub ? 1 : 0);
+    if (c->req_count >= MQTT_REQ_MAX_IN_FLIGHT || !mqtt_room(c, mqtt_packet_size(remaining), 3)) return ERR_MEM;
+
+    u16_t   id = mqtt_packet_id(c);
+    uint8_t h[5 + 3];
+    size_t  n = 0;
+    h[n++] = sub ? 0x82 : 0xa2;
+    n += mqtt_varint(h + n, remaining);
+    h[n++] = (uint8_t)(id >> 8);
+    h[n++] = (uint8_t)id;
+    if (v5) h[n++] = 0;         // no properties
+    uint8_t options = qos & 3;  // MQTT 5: no local, retain as published, retain handling 0
+    if (!mqtt_write(c, h, n, true) || !mqtt_write_str(c, topic, tlen, sub) || (sub && !mqtt_write(c, &options, 1, false))) {
+        return ERR_CONN;
+    }
+    mqtt_queue_request(c, cb, arg, id);
+    altcp_output(c->pcb);
+    return ERR_OK;
+}
+
+//--- Alias of topic in this session, 0: none
+static u16_t mqtt_alias_find(const mqtt_client_s* c, const char* topic, size_t tlen, u32_t hash) {
+    for (u16_t i = 0; i < c->alias_count; i++) {
+        const MqttAlias& a = c->alias[i];
+        if (a.hash == hash && a.len == tlen && memcmp(c->alias_pool + a.off, topic, tlen) == 0) return i + 1;
+    }
+    return 0;
+}
+
+//--- Published once already in this session? (the slot is freed: the alias takes over)
+static bool mqtt_seen_take(mqtt_client_s* c, u32_t hash) {
+    for (u32_t& h : c->seen) {
+        if (h != hash || h == 0) continue;
+        h = 0;
+        return true;
+    }
+    return false;
+}
+
+err_t mqtt_publish(mqtt_client_t* client, const char* topic, const void* payload, u16_t payload_length,
+                   u8_t qos, u8_t retain, mqtt_request_cb_t cb, void* arg) {
+    mqtt_client_s* c = client;
+    if (c->conn != MQTT_CONNECTED || c->broken) return ERR_CONN;
+    if (qos > 2) return ERR_VAL;
+    size_t tlen = strlen(topic);
+    if (tlen == 0 || tlen > 0xffff) return ERR_VAL;
+
+    //--- Topic alias (MQTT 5): known -> no topic; published once before -> set up by this PUBLISH
+    bool  v5    = c->level == 5;
+    u16_t alias = 0;
+    bool  fresh = false;
+    u32_t hash  = 0;
+    if (v5 && c->alias_max) {
+        hash  = mqtt_hash(topic, tlen) | 1;     // 0: free seen[] slot
+        alias = mqtt_alias_find(c, topic, tlen, hash);
+        if (!alias && c->alias_count < c->alias_max && c->alias_bytes + tlen <= sizeof(c->alias_pool)) {
+            for (u32_t h : c->seen) fresh |= h == hash;
+            if (fresh) alias = c->alias_count + 1;
+        }
+    }
+    size_t sent_tlen = alias && !fresh ? 0 : tlen;
+    u32_t  props     = alias ? 3 : 0;
+    u32_t  remaining = 2 + (u32_t)sent_tlen + (qos ? 2 : 0) + (v5 ? 1 + props : 0) + payload_length;
+    u32_t  total     = mqtt_packet_size(remaining);
+    if (c->max_packet && total > c->max_packet) return ERR_VAL;
+    if (c->req_count >= MQTT_REQ_MAX_IN_FLIGHT || (qos && mqtt_acked_in_flight(c) >= c->recv_max)
+        || !mqtt_room(c, total, 4)) {
+        return ERR_MEM;
+    }
+
+    //--- Header bytes on the stack, topic and payload written from the caller's memory
+    u16_t   id = qos ? mqtt_packet_id(c) : 0;
+    uint8_t h[5 + 2 + 2 + 1 + 3];
+    size_t  n = 0;
+    h[n++] = 0x30 | qos << 1 | (retain ? 1 : 0);
+    n += mqtt_varint(h + n, remaining);
+    h[n++] = (uint8_t)(sent_tlen >> 8);
+    h[n++] = (uint8_t)sent_tlen;
+    bool ok = true;
+    if (sent_tlen) {
+        ok = mqtt_write(c, h, n, true) && mqtt_write(c, topic, tlen, true);
+        n  = 0;
+    }
+    if (qos) {
+        h[n++] = (uint8_t)(id >> 8);
+        h[n++] = (uint8_t)id;
+    }
+    if (v5) {
+        h[n++] = (uint8_t)props;
+        if (alias) {
+            h[n++] = 0x23;      // Topic Alias
+            h[n++] = (uint8_t)(alias >> 8);
+            h[n++] = (uint8_t)alias;
+        }
+    }
+    ok = ok && mqtt_write(c, h, n, payload_length > 0) && mqtt_write(c, payload, payload_length, false);
+    if (!ok) return ERR_CONN;   // mqtt_room() said it fits: lwIP lost the pcb, broken, closed on the next poll
+
+    if (fresh) {
+        MqttAlias& a = c->alias[c->alias_count++];
+        a.hash = hash;
+        a.off  = c->alias_bytes;
+        a.len  = (u16_t)tlen;
+        memcpy(c->alias_pool + a.off, topic, tlen);
+        c->alias_bytes += (u16_t)tlen;
+        mqtt_seen_take(c, hash);
+        c->stats.aliases = c->alias_count;
+    } else if (hash && !alias) {
+        c->seen[c->seen_next] = hash;
+        c->seen_next = (u8_t)((c->seen_next + 1) % MQTT_HA_MQTT_SEEN);
+    }
+    mqtt_queue_request(c, cb, arg, id);
+    c->last_publish = total;
+    c->stats.publishes++;
+    c->stats.aliased           += alias && !fresh;
+    c->stats.publish_bytes     += total;
+    c->stats.publish_bytes_311 += mqtt_packet_size(2 + (u32_t)tlen + (qos ? 2 : 0) + payload_length);
+    altcp_output(c->pcb);
+    return ERR_OK;
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Extras ────────────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+void mqtt_ha_mqtt_set_level(mqtt_client_t* client, u8_t level) {
+    client->level_next = level == 4 ? 4 : 5;
+}
+
+void mqtt_ha_mqtt_get_stats(const mqtt_client_t* client, MqttHaMqttStats* stats) {
+    *stats = client->stats;
+}
+
+size_t mqtt_ha_mqtt_last_publish(const mqtt_client_t* client) {
+    return client->last_publish;
+}
+
+struct altcp_pcb* mqtt_ha_mqtt_pcb(mqtt_client_t* client) {
+    return client->pcb;
+}
+
+#endif
@@ -0,0 +1,69 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Built-in MQTT client (MQTT 5 topic aliases, 3.1.1 fallback) ───
+//───────────────────────────────────────────────────────────────────
+// With MQTT_HA_MQTT_BUILTIN=1 mqtt_ha_mqtt.cpp defines the lwIP MQTT app
+// functions used by mqtt_ha.cpp (mqtt_client_new(), mqtt_client_connect(),
+// mqtt_publish(), mqtt_sub_unsub()...) with the same signatures and callbacks,
+// over lwIP's altcp API (TCP, or altcp_tls): do not link pico_lwip_mqtt then.
+// What changes on the wire and in RAM:
+//  - each packet goes straight into the TCP send buffer: header bytes from the
+//    stack, topic and payload from the caller (altcp_write(), copied once by
+//    lwIP). No MQTT_OUTPUT_RINGBUF_SIZE output ring in between.
+//  - MQTT 5 when the broker takes it: a topic published a second time gets a
+//    topic alias (within the broker's Topic Alias Maximum), the following
+//    PUBLISH carry 2 bytes of alias instead of the topic string.
+//  - a broker that refuses MQTT 5 (CONNACK "unacceptable protocol version")
+//    is reconnected at once in 3.1.1 (with TLS: the caller's next connect),
+//    and the client stays in 3.1.1 (mqtt_ha_mqtt_set_level() to try 5 again).
+//  - incoming PUBLISH: the variable header (topic) is kept in
+//    MQTT_HA_MQTT_RX_HEADER bytes, the payload goes to data_cb in the pieces
+//    of the received pbufs, without a copy.
+// Same contract as lwIP 2.1: callbacks from the lwIP context only, QoS 0
+// publishes complete once TCP acked them, a request without its ack after
+// MQTT_HA_MQTT_REQ_TIMEOUT_S fails with ERR_TIMEOUT, mqtt_disconnect() closes
+// without DISCONNECT (the broker sends the Last Will) and without callback.
+// The client_info strings (client id, will, user, password) must stay valid
+// until CONNACK: CONNECT is written once TCP (and TLS) is up.
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MQTT_HA_MQTT_BUILTIN
+#define MQTT_HA_MQTT_BUILTIN        0
+#endif
+#ifndef MQTT_HA_MQTT_LEVEL
+#define MQTT_HA_MQTT_LEVEL          5       // protocol level of the first CONNECT: 5, or 4 (3.1.1)
+#endif
+#ifndef MQTT_HA_MQTT_CLIENTS
+#define MQTT_HA_MQTT_CLIENTS        1       // mqtt_client_new() slots (static)
+#endif
+#ifndef MQTT_HA_MQTT_ALIASES
+#define MQTT_HA_MQTT_ALIASES        16      // topic aliases per connection (the broker may allow fewer)
+#endif
+#ifndef MQTT_HA_MQTT_ALIAS_BYTES
+#define MQTT_HA_MQTT_ALIAS_BYTES    512     // topic strings behind those aliases
+#endif
+#ifndef MQTT_HA_MQTT_SEEN
+#define MQTT_HA_MQTT_SEEN           8       // topics published once: an alias on their second use
+#endif
+#ifndef MQTT_HA_MQTT_RX_HEADER
+#define MQTT_HA_MQTT_RX_HEADER      288     // incoming PUBLISH variable header (topic), or a whole ack
+#endif
+#ifndef MQTT_HA_MQTT_REQ_TIMEOUT_S
+#define MQTT_HA_MQTT_REQ_TIMEOUT_S  30      // lwIP MQTT_REQ_TIMEOUT
+#endif
+#ifndef MQTT_HA_MQTT_CONNECT_TIMEOUT_S
+#define MQTT_HA_MQTT_CONNECT_TIMEOUT_S 100  // lwIP MQTT_CONNECT_TIMOUT
+#endif
+
+#if MQTT_HA_MQTT_BUILTIN
+struct MqttHaMqttStats;
+
+//--- Protocol level of the next connects (5 or 4), e.g. a broker known to be 3.1.1
+void              mqtt_ha_mqtt_set_level(mqtt_client_t* client, u8_t level);
+void              mqtt_ha_mqtt_get_stats(const mqtt_client_t* client, MqttHaMqttStats* stats);
+//--- Bytes of the last PUBLISH written (fixed header included): what the alias saved shows there
+size_t            mqtt_ha_mqtt_last_publish(const mqtt_client_t* client);
+//--- The connection (TLS glue of mqtt_ha_platform.h: lwIP's client->conn)
+struct altcp_pcb* mqtt_ha_mqtt_pcb(mqtt_client_t* client);
+#endif
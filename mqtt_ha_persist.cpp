@@ -0,0 +1,131 @@
+//───────────────────────────────────────────────────────────────────
+//─── Discovery cache and flash record ──────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Discovery messages are retained: after a reconnect (or a reboot) the broker still
+// holds the ones we sent last time, and HA gets them again from it whenever it restarts.
+// Sending them again only delays ONLINE (one PUBACK round trip per chunk before the
+// availability and the subscriptions), so the library keeps a hash of everything it
+// publishes as discovery (channel chunks, LED button, diagnostics) and, once a full
+// discovery has been acknowledged, writes it to flash (mqtt_ha_store.h) with the
+// CONNACK -> ONLINE time it took. On the next session with the same hash:
+//      CONNACK -> availability -> subscribe -> ONLINE
+// Not skipped when the discovery is not retained (topic policy), after
+// mqtt_ha_discovery_invalidate(), or with MQTT_HA_DISCOVERY_SKIP=0.
+// Bridged devices (gateway mode) are always announced.
+// The flash is written from mqtt_poll() (core 0 in dual-core mode), only when the record changed.
+// The record (PersistRecord, mqtt_ha_internal.h) also holds the fast boot cache, the
+// broker and the TLS session: those parts change persist and call persist_request().
+#include "mqtt_ha.h"
+#include <atomic>
+#include "mqtt_ha_internal.h"
+#include "mqtt_ha_store.h"   // record kept in flash across reboots
+
+static_assert(sizeof(PersistRecord) <= MQTT_HA_STORE_MAX, "PersistRecord must fit the flash record (MQTT_HA_STORE_PAGES)");
+
+PersistRecord                mqtt_ha_lib::persist = {};     // network side
+static PersistRecord         persist_out       = {};        // copy handed to mqtt_poll() for the flash
+static std::atomic<bool>     persist_dirty{false};
+static bool                  persist_pending   = false;     // persist changed, not handed over yet (network side)
+static bool                  discovery_skipped = false;     // this session went straight to availability
+static bool                  discovery_to_save = false;     // full discovery ONLINE, waiting for its last PUBACK
+static uint32_t              discovery_session_ms = 0;      // CONNACK time
+static std::atomic<uint32_t> discovery_force_req{0};        // mqtt_ha_discovery_invalidate() calls (application side)
+static uint32_t              discovery_force_seen = 0;      // ... already applied (network side)
+static MqttHaDiscoveryStats  discovery_stats   = {};
+
+//--- From mqtt_ha_publish_discovery(), on CONNACK: @return true to go straight to availability
+bool mqtt_ha_lib::discovery_skip() {
+    discovery_session_ms = now_ms();
+    discovery_skipped    = false;
+    discovery_to_save    = false;
+    if (!MQTT_HA_DISCOVERY_SKIP) return false;
+    uint32_t h = discovery_hash() ^ topic_policy[MQTT_HA_TOPIC_DISCOVERY].qos;
+    uint32_t force = discovery_force_req.load(std::memory_order_relaxed);
+    if (force != discovery_force_seen) {
+        discovery_force_seen = force;
+        persist.discovery_hash = 0;
+    }
+    discovery_stats.hash = h;
+    if (!topic_policy[MQTT_HA_TOPIC_DISCOVERY].retain || h != persist.discovery_hash) {
+        discovery_stats.published++;
+        return false;
+    }
+    LOG_INFO("MQTT: Discovery unchanged (hash %08x), retained by the broker: skipped\n", h);
+    discovery_stats.skipped++;
+    discovery_skipped = true;
+    return true;
+}
+
+//--- Network side: persist changed, to the flash
+void mqtt_ha_lib::persist_request() {
+    persist_pending = true;
+}
+
+//--- net_poll(): hand persist over to mqtt_poll() once the previous write is done
+//--- (changes of the same pass, e.g. discovery hash + AP, make one write)
+void mqtt_ha_lib::persist_handoff() {
+    if (!persist_pending || persist_dirty.load(std::memory_order_acquire)) return;
+    persist_pending = false;
+    persist_out     = persist;
+    persist_dirty.store(true, std::memory_order_release);
+}
+
+//--- Full discovery ONLINE and every discovery message acknowledged: to flash
+void mqtt_ha_lib::discovery_try_save() {
+    if (!discovery_to_save || discovery_unacked > 0) return;
+    discovery_to_save = false;
+    if (discovery_failed) return;   // next full discovery
+    persist.discovery_hash = discovery_stats.hash;
+    persist_request();
+}
+
+//--- The session reached ONLINE
+void mqtt_ha_lib::discovery_on_online() {
+    uint32_t ms = now_ms() - discovery_session_ms;
+    discovery_stats.last_ms = ms;
+    if (discovery_skipped) {
+        uint32_t saved = (persist.discovery_online_ms > ms) ? persist.discovery_online_ms - ms : 0;
+        discovery_stats.saved_ms += saved;
+        LOG_INFO("MQTT: ONLINE %u ms after CONNACK, discovery skipped: ~%u ms saved\n", ms, saved);
+        return;
+    }
+    discovery_stats.full_ms     = ms;
+    persist.discovery_online_ms = ms;
+    discovery_to_save           = MQTT_HA_DISCOVERY_SKIP && topic_policy[MQTT_HA_TOPIC_DISCOVERY].retain;
+    discovery_try_save();
+}
+
+//--- wifi_mqtt_init(): what the last boot left in flash
+void mqtt_ha_lib::persist_load() {
+    if (!mqtt_ha_store_load(&persist, sizeof(persist))) persist = {};
+    persist_pending = false;
+    persist_dirty.store(false, std::memory_order_relaxed);
+    discovery_stats.full_ms = persist.discovery_online_ms;
+}
+
+//--- mqtt_poll(): flash write requested by the network side (interrupts off ~50 ms)
+void mqtt_ha_lib::persist_poll() {
+    if (!persist_dirty.load(std::memory_order_acquire)) return;
+    if (mqtt_ha_store_save(&persist_out, sizeof(persist_out))) {
+        discovery_stats.saves++;
+        LOG_INFO("NET: Saved to flash: discovery hash %08x, AP channel %u\n",
+                 persist_out.discovery_hash, persist_out.ap_channel);
+    } else {
+        LOG_ERROR("MQTT: Flash write failed\n");
+    }
+    persist_dirty.store(false, std::memory_order_release);
+}
+
+void mqtt_ha_discovery_invalidate() {
+    discovery_force_req.store(discovery_force_req.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+MqttHaDiscoveryStats mqtt_ha_discovery_stats() {
+    return discovery_stats;
+}
+
+#ifdef MQTT_HA_HOST
+void mqtt_ha_lib::persist_reset_stats() {
+    discovery_stats = {};
+}
+#endif
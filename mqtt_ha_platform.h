@@ -0,0 +1,103 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Platform layer ────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha.cpp only talks to the outside world through the Pico SDK
+// (cyw43_arch, sleep/time) and the lwIP MQTT app (or the built-in client of
+// mqtt_ha_mqtt.cpp, over lwIP altcp: MQTT_HA_MQTT_BUILTIN).
+// On the Pico W we simply include the real SDK headers.
+// When built on Linux (-DMQTT_HA_HOST, see host/CMakeLists.txt) the same
+// names are provided by host/host_platform.h: a fake lwIP MQTT client that
+// records every call and fires the callbacks from cyw43_arch_poll(),
+// exactly like lwIP does on the board.
+#ifdef MQTT_HA_HOST
+#include "host/host_platform.h"
+#else
+#include "pico/stdlib.h"
+#include "pico/cyw43_arch.h"
+#include "lwip/apps/mqtt.h"
+#if MQTT_HA_MQTT_BUILTIN
+//--- Built-in MQTT client (mqtt_ha_mqtt.cpp): lwIP's MQTT app headers for the types only,
+//--- pico_lwip_mqtt is not linked. Without LWIP_ALTCP the altcp_*() calls are lwIP's tcp_*().
+#include "lwip/altcp.h"
+#include "lwip/altcp_tcp.h"
+#include "lwip/pbuf.h"
+#include "mqtt_ha_mqtt.h"
+#endif
+#include "lwip/dns.h"
+#include "lwip/dhcp.h"
+#include "hardware/flash.h"
+#include "pico/flash.h"
+#if MQTT_HA_DUAL_CORE
+#include "pico/multicore.h"
+#endif
+#if MQTT_HA_TLS
+#include "lwip/altcp_tls.h"
+#include "mbedtls/ssl.h"
+//--- TLS glue (mqtt_ha_tls.cpp), lwIP 2.2 altcp_tls over mbedTLS 2.28: the pcb of the
+//--- connection, altcp_tls_get_session() / altcp_tls_set_session() on it, and its mbedTLS
+//--- context (altcp_tls_context()) for the server name and the serialized flash copy.
+#if MQTT_HA_MQTT_BUILTIN
+static inline struct altcp_pcb* mqtt_ha_tls_pcb(mqtt_client_t* client) {
+    return mqtt_ha_mqtt_pcb(client);
+}
+#else
+//--- lwIP's MQTT app keeps its pcb in mqtt_client_t::conn, declared by mqtt_priv.h only
+//--- (the pico-examples MQTT client reaches it the same way)
+#include "lwip/apps/mqtt_priv.h"
+static inline struct altcp_pcb* mqtt_ha_tls_pcb(mqtt_client_t* client) {
+    return client->conn;
+}
+#endif
+//--- After mqtt_client_connect() the TLS pcb exists, its handshake starts once TCP is up:
+//--- server name (SNI + certificate check) and session to resume are set in between.
+//--- session: kept by altcp_tls_get_session(), or saved: bytes of mqtt_ha_tls_session_save()
+static inline err_t mqtt_ha_tls_start(mqtt_client_t* client, const char* host, struct altcp_tls_session* session,
+                                      const uint8_t* saved, size_t saved_len) {
+    struct altcp_pcb*    pcb = mqtt_ha_tls_pcb(client);
+    mbedtls_ssl_context* ssl = pcb ? (mbedtls_ssl_context*)altcp_tls_context(pcb) : nullptr;
+    if (ssl == nullptr) return ERR_CONN;
+    if (host && mbedtls_ssl_set_hostname(ssl, host) != 0) return ERR_VAL;
+    if (session) return altcp_tls_set_session(pcb, session);
+    if (saved == nullptr) return ERR_OK;
+    mbedtls_ssl_session s;
+    mbedtls_ssl_session_init(&s);
+    int rc = mbedtls_ssl_session_load(&s, saved, saved_len);
+    if (rc == 0) rc = mbedtls_ssl_set_session(ssl, &s);     // copied into the handshake
+    mbedtls_ssl_session_free(&s);
+    return rc == 0 ? ERR_OK : ERR_VAL;
+}
+//--- After CONNACK: session of the connection (ticket included)
+static inline err_t mqtt_ha_tls_session_get(mqtt_client_t* client, struct altcp_tls_session* session) {
+    struct altcp_pcb* pcb = mqtt_ha_tls_pcb(client);
+    return pcb ? altcp_tls_get_session(pcb, session) : ERR_CONN;
+}
+static inline const mbedtls_ssl_session* mqtt_ha_tls_live(mqtt_client_t* client) {
+    struct altcp_pcb* pcb = mqtt_ha_tls_pcb(client);
+    return pcb ? mbedtls_ssl_get_session_pointer((const mbedtls_ssl_context*)altcp_tls_context(pcb)) : nullptr;
+}
+//--- Hash of the master secret of the connection: unchanged when the broker resumed the session. 0: none
+static inline uint32_t mqtt_ha_tls_fingerprint(mqtt_client_t* client) {
+    const mbedtls_ssl_session* s = mqtt_ha_tls_live(client);
+    if (s == nullptr) return 0;
+    uint32_t h = 2166136261u, any = 0;
+    for (size_t i = 0; i < sizeof(s->master); i++) {
+        h    = (h ^ s->master[i]) * 16777619u;
+        any |= s->master[i];
+    }
+    return any ? (h ? h : 1) : 0;
+}
+//--- Flash record: session of the connection, serialized. @return its length, 0 if it does not fit
+static inline size_t mqtt_ha_tls_session_save(mqtt_client_t* client, uint8_t* buf, size_t len) {
+    const mbedtls_ssl_session* s = mqtt_ha_tls_live(client);
+    size_t olen = 0;
+    return s && mbedtls_ssl_session_save(s, buf, len, &olen) == 0 ? olen : 0;
+}
+#endif
+//--- Lowest address of the calling core's stack (pico linker script, core 1 as
+//--- started by multicore_launch_core1()): the stack watch never paints below it
+extern "C" char __StackBottom[], __StackOneBottom[];
+static inline const void* mqtt_ha_stack_limit() {
+    return get_core_num() ? __StackOneBottom : __StackBottom;
+}
+#endif
@@ -0,0 +1,100 @@
+# Static RAM report of the library (.data + .bss), from the compiled objects:
+#
+#   cmake -DNM=arm-none-eabi-nm -DFILES="<objects or .a>" -P mqtt_ha_ram.cmake
+#
+# FILES: ';' separated objects or static libraries (every member is read),
+# e.g. the mqtt_ha*.obj of the firmware build, or the host library (host/CMakeLists.txt,
+# target ram_report: pointers are 8 bytes there, 4 on the Pico).
+# MATCH: only the objects whose name matches this regex count (default: mqtt_ha).
+# TOP: how many of the largest symbols are listed (default: 15).
+cmake_minimum_required(VERSION 3.15)
+if(NOT NM)
+    set(NM nm)
+endif()
+if(NOT DEFINED MATCH)
+    set(MATCH "mqtt_ha")
+endif()
+if(NOT TOP)
+    set(TOP 15)
+endif()
+
+set(total_data 0)
+set(total_bss 0)
+set(objects "")
+set(symbols "")
+foreach(file ${FILES})
+    get_filename_component(file_name ${file} NAME)
+    execute_process(COMMAND ${NM} -S -C -t d ${file} OUTPUT_VARIABLE out RESULT_VARIABLE rc ERROR_QUIET)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "${NM} failed on ${file}")
+    endif()
+    string(REPLACE "\n" ";" lines "${out}")
+    set(object ${file_name})            # members of a .a are announced by "name.o:"
+    foreach(line ${lines})
+        if(line MATCHES "^(.+):$")
+            set(object ${CMAKE_MATCH_1})
+            continue()
+        endif()
+        if(NOT object MATCHES "${MATCH}")
+            continue()
+        endif()
+        #--- address size type name: b/B .bss, d/D .data (sizes in decimal)
+        if(NOT line MATCHES "^[0-9]+ 0*([0-9]+) ([bBdD]) (.+)$")
+            continue()
+        endif()
+        set(size ${CMAKE_MATCH_1})
+        set(type ${CMAKE_MATCH_2})
+        set(name ${CMAKE_MATCH_3})
+        if(NOT object IN_LIST objects)
+            list(APPEND objects ${object})
+            set(data_${object} 0)
+            set(bss_${object} 0)
+        endif()
+        if(type MATCHES "[bB]")
+            math(EXPR bss_${object} "${bss_${object}} + ${size}")
+            math(EXPR total_bss "${total_bss} + ${size}")
+        else()
+            math(EXPR data_${object} "${data_${object}} + ${size}")
+            math(EXPR total_data "${total_data} + ${size}")
+        endif()
+        #--- zero padded first: a plain string sort orders them by size
+        string(LENGTH "${size}" digits)
+        math(EXPR pad "10 - ${digits}")
+        string(REPEAT "0" ${pad} zeros)
+        list(APPEND symbols "${zeros}${size}|${size}|${name}|${object}")
+    endforeach()
+endforeach()
+
+message("static RAM of the library (bytes)")
+foreach(object ${objects})
+    math(EXPR sum "${data_${object}} + ${bss_${object}}")
+    string(LENGTH "${object}" len)
+    math(EXPR pad "28 - ${len}")
+    if(pad LESS 1)
+        set(pad 1)
+    endif()
+    string(REPEAT " " ${pad} spaces)
+    message("  ${object}${spaces}${sum}  (.data ${data_${object}}, .bss ${bss_${object}})")
+endforeach()
+math(EXPR total "${total_data} + ${total_bss}")
+message("  total                       ${total}  (.data ${total_data}, .bss ${total_bss})")
+
+list(SORT symbols ORDER DESCENDING)
+list(LENGTH symbols count)
+if(count GREATER TOP)
+    list(SUBLIST symbols 0 ${TOP} symbols)
+endif()
+message("largest symbols")
+foreach(entry ${symbols})
+    string(REPLACE "|" ";" fields "${entry}")
+    list(GET fields 1 size)
+    list(GET fields 2 name)
+    list(GET fields 3 object)
+    string(LENGTH "${name}" len)
+    math(EXPR pad "32 - ${len}")
+    if(pad LESS 1)
+        set(pad 1)
+    endif()
+    string(REPEAT " " ${pad} spaces)
+    message("  ${name}${spaces}${size}  ${object}")
+endforeach()
@@ -0,0 +1,181 @@
+//───────────────────────────────────────────────────────────────────
+//─── Report by exception (deadbands, heartbeat, aggregation) ───────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha_publish_channels() can be called at the sampling rate: with a deadband
+// or a heartbeat set, a state only leaves when it is worth it:
+//  - a channel moved by at least its deadband since the last state sent
+//    (deadband 0: any change, negative: never on its own, sent along the others)
+//  - a channel got its first value
+//  - nothing was sent for max_silence_ms (heartbeat, also checked by mqtt_poll())
+// Otherwise the call is counted as suppressed and nothing else happens.
+// Aggregation (per channel): the value sent is the min / max / mean of the samples
+// set since the last state sent (the window), or an EWMA of every sample
+// (alpha = 1 / 2^shift); LAST is the plain latest value. It works with or without
+// deadbands: a 100 Hz mqtt_ha_set() and a 1 Hz mqtt_ha_publish_channels() send
+// the mean of 100 samples.
+// Everything here belongs to the application core (dual-core mode: core 0),
+// the sent values go through channels_forward() (mqtt_ha.cpp) like before.
+#include "mqtt_ha.h"
+#include <string.h>
+#include "mqtt_ha_internal.h"
+
+#define REPORT_NEVER INT32_MAX      // deadband: never triggers a state
+#define EWMA_FRAC    16             // fractional bits of the EWMA accumulator
+
+struct ReportChannel {
+    int32_t  deadband;      // scaled like the value
+    int32_t  sent;          // value of the last state sent
+    int32_t  min;
+    int32_t  max;
+    int64_t  acc;           // MEAN: sum of the window, EWMA: value << EWMA_FRAC
+    uint32_t samples;       // in the window (EWMA: 0 until the first sample)
+    uint8_t  mode;          // MqttHaAggregate
+    uint8_t  shift;         // EWMA alpha = 1 / 2^shift
+};
+
+static ReportChannel     report_ch[MQTT_HA_MAX_CHANNELS];
+static uint8_t           report_sent_set[(MQTT_HA_MAX_CHANNELS + 7) / 8];
+static uint32_t          report_triggers[MQTT_HA_MAX_CHANNELS];
+static bool              report_filter     = false;     // a deadband or the heartbeat is set
+static uint32_t          report_silence_ms = 0;         // heartbeat, 0: none
+static uint32_t          report_last_ms    = 0;
+static MqttHaReportStats report_stats      = {};
+
+static void report_window_reset(ReportChannel& r) {
+    r.min = INT32_MAX;
+    r.max = INT32_MIN;
+    if (r.mode != MQTT_HA_AGG_EWMA) {
+        r.acc     = 0;
+        r.samples = 0;
+    }
+}
+
+void mqtt_ha_lib::report_reset() {
+    memset(report_ch, 0, sizeof(report_ch));
+    memset(report_sent_set, 0, sizeof(report_sent_set));
+    memset(report_triggers, 0, sizeof(report_triggers));
+    for (auto& r : report_ch) report_window_reset(r);
+    report_filter     = report_silence_ms != 0;
+    report_last_ms    = now_ms();
+}
+
+//--- Every mqtt_ha_set(): a few integer operations, nothing when the channel has no aggregate
+void mqtt_ha_lib::report_sample(uint8_t ch, int32_t scaled) {
+    ReportChannel& r = report_ch[ch];
+    switch (r.mode) {
+    case MQTT_HA_AGG_MIN:  if (scaled < r.min) r.min = scaled; break;
+    case MQTT_HA_AGG_MAX:  if (scaled > r.max) r.max = scaled; break;
+    case MQTT_HA_AGG_MEAN: r.acc += scaled; break;
+    case MQTT_HA_AGG_EWMA:
+        if (r.samples == 0) r.acc = (int64_t)scaled << EWMA_FRAC;
+        else                r.acc += (((int64_t)scaled << EWMA_FRAC) - r.acc) >> r.shift;
+        break;
+    default: return;
+    }
+    r.samples++;
+}
+
+//--- Value a state would carry now (the window aggregate, or the latest value)
+static int32_t report_value(uint8_t ch) {
+    const ReportChannel& r = report_ch[ch];
+    if (r.samples == 0) return app_value[ch];
+    switch (r.mode) {
+    case MQTT_HA_AGG_MIN:  return r.min;
+    case MQTT_HA_AGG_MAX:  return r.max;
+    case MQTT_HA_AGG_MEAN: {
+        int64_t half = r.samples / 2;      // int64: the sum of 2^32 int32 cannot overflow
+        return (int32_t)((r.acc >= 0 ? r.acc + half : r.acc - half) / r.samples);   // rounded
+    }
+    case MQTT_HA_AGG_EWMA:
+        return (int32_t)((r.acc + (1 << (EWMA_FRAC - 1))) >> EWMA_FRAC);
+    default:
+        return app_value[ch];
+    }
+}
+
+//--- Aggregates -> app_value, then decide. @return true when the state has to be sent
+static bool report_decide(bool heartbeat_only) {
+    bool     send = !report_filter;
+    uint32_t now  = now_ms();
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (!channel_has_value(app_set, i)) continue;
+        app_value[i] = report_value(i);
+        if (!report_filter || heartbeat_only) continue;
+        const ReportChannel& r = report_ch[i];
+        int64_t delta = (int64_t)app_value[i] - r.sent;
+        if (delta < 0) delta = -delta;
+        if (!channel_has_value(report_sent_set, i) ||
+            (r.deadband != REPORT_NEVER && delta != 0 && delta >= r.deadband)) {
+            report_triggers[i]++;
+            send = true;
+        }
+    }
+    if (!send && report_silence_ms && now - report_last_ms >= report_silence_ms) {
+        report_stats.heartbeats++;
+        send = true;
+    }
+    if (!send) {
+        report_stats.suppressed++;
+        return false;
+    }
+    //--- New window, the deadbands now count from these values
+    for (uint8_t i = 0; i < channel_count; i++) {
+        if (!channel_has_value(app_set, i)) continue;
+        report_ch[i].sent = app_value[i];
+        report_window_reset(report_ch[i]);
+    }
+    memcpy(report_sent_set, app_set, sizeof(report_sent_set));
+    report_last_ms = now;
+    report_stats.sent++;
+    return true;
+}
+
+void mqtt_ha_publish_channels() {
+    if (report_decide(false)) channels_forward();
+}
+
+//--- Heartbeat while the application does not call mqtt_ha_publish_channels()
+void mqtt_ha_lib::report_poll() {
+    if (!report_silence_ms || now_ms() - report_last_ms < report_silence_ms) return;
+    bool any = false;
+    for (size_t i = 0; i < sizeof(report_sent_set); i++) any |= app_set[i] != 0;
+    if (any && report_decide(true)) channels_forward();
+}
+
+bool mqtt_ha_set_deadband(uint8_t ch, double deadband) {
+    if (ch >= channel_count || deadband != deadband) return false;
+    report_ch[ch].deadband = deadband < 0 ? REPORT_NEVER : channel_scale(channels[ch], deadband);
+    report_filter = true;
+    return true;
+}
+
+void mqtt_ha_set_heartbeat(uint32_t max_silence_ms) {
+    report_silence_ms = max_silence_ms;
+    if (max_silence_ms) report_filter = true;
+}
+
+bool mqtt_ha_set_aggregate(uint8_t ch, MqttHaAggregate mode, uint8_t ewma_shift) {
+    if (ch >= channel_count || mode > MQTT_HA_AGG_EWMA) return false;
+    if (mode == MQTT_HA_AGG_EWMA && (ewma_shift < 1 || ewma_shift > 8)) return false;
+    ReportChannel& r = report_ch[ch];
+    r.mode    = (uint8_t)mode;
+    r.shift   = ewma_shift;
+    r.acc     = 0;
+    r.samples = 0;
+    report_window_reset(r);
+    return true;
+}
+
+MqttHaReportStats mqtt_ha_report_stats() {
+    return report_stats;
+}
+
+uint32_t mqtt_ha_report_triggers(uint8_t ch) {
+    return ch < channel_count ? report_triggers[ch] : 0;
+}
+
+#ifdef MQTT_HA_HOST
+void mqtt_ha_lib::report_reset_stats() {
+    report_stats = {};
+}
+#endif
@@ -0,0 +1,65 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Fixed-size record ring buffer ─────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Allocation-free FIFO of binary records stored in a caller-provided
+// byte array. The record size is chosen at runtime (reset()), so the
+// same memory holds more records when they are smaller.
+// When full, push() overwrites the OLDEST record and returns false,
+// so the caller can count evictions: the newest data always wins.
+// Not thread safe: only used from the lwIP / main loop context.
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+class RecordRing {
+public:
+    RecordRing(uint8_t* mem, size_t mem_size) : mem_(mem), mem_size_(mem_size) {}
+
+    //--- New record size: forget every stored record
+    void reset(size_t record_size) {
+        rec_  = record_size;
+        cap_  = record_size ? mem_size_ / record_size : 0;
+        head_ = tail_ = 0;
+    }
+
+    //--- Append a record of record_size() bytes, evicting the oldest one if full.
+    //--- @return false if a record was evicted (or nothing can be stored)
+    bool push(const uint8_t* record) {
+        if (cap_ == 0) return false;
+        bool evicted = full();
+        if (evicted) tail_++;
+        memcpy(mem_ + (head_ % cap_) * rec_, record, rec_);
+        head_++;
+        return !evicted;
+    }
+
+    //--- Oldest record, nullptr if empty
+    const uint8_t* front() const {
+        return empty() ? nullptr : mem_ + (tail_ % cap_) * rec_;
+    }
+
+    //--- i-th record from the oldest (i < size())
+    const uint8_t* at(size_t i) const {
+        return mem_ + ((tail_ + i) % cap_) * rec_;
+    }
+
+    void pop() {
+        if (!empty()) tail_++;
+    }
+
+    void   clear()             { head_ = tail_ = 0; }
+    size_t size()        const { return head_ - tail_; }
+    bool   empty()       const { return head_ == tail_; }
+    bool   full()        const { return size() == cap_; }
+    size_t capacity()    const { return cap_; }
+    size_t record_size() const { return rec_; }
+
+private:
+    uint8_t* mem_;
+    size_t   mem_size_;
+    size_t   rec_  = 0;
+    size_t   cap_  = 0;
+    size_t   head_ = 0;   // free running write count
+    size_t   tail_ = 0;   // free running read count
+};
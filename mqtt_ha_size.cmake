@@ -0,0 +1,128 @@
+# Code size report (.text) of a few objects, from the compiled objects:
+#
+#   cmake -DNM=arm-none-eabi-nm -DFILES="<objects>" -DLIBS="<objects or .a>" -P mqtt_ha_size.cmake
+#
+# FILES: ';' separated objects, each measured alone, e.g. the two state payload
+# paths of host/bench (host/CMakeLists.txt, target json_size: x86-64 code there).
+# LIBS: objects or static libraries the measured objects link against: a member
+# that defines a symbol they need is pulled in whole, like a static link, and
+# so are the members it needs in turn.
+# What is left undefined comes from the toolchain's libraries (snprintf...):
+# listed as external, not counted.
+cmake_minimum_required(VERSION 3.15)
+if(NOT NM)
+    set(NM nm)
+endif()
+
+#--- Text symbols (t/T, w/W) and undefined ones of every object in file, in obj_<n>_* variables
+set(obj_count 0)
+function(read_objects file)
+    get_filename_component(file_name ${file} NAME)
+    execute_process(COMMAND ${NM} -S -t d ${file} OUTPUT_VARIABLE out RESULT_VARIABLE rc ERROR_QUIET)
+    if(NOT rc EQUAL 0)
+        message(FATAL_ERROR "${NM} failed on ${file}")
+    endif()
+    string(REPLACE "\n" ";" lines "${out}")
+    set(n ${obj_count})
+    set(obj_${n}_name ${file_name})     # members of a .a are announced by "name.o:"
+    set(obj_${n}_defined "")
+    set(obj_${n}_undefined "")
+    set(obj_${n}_text 0)
+    set(started FALSE)
+    foreach(line ${lines})
+        if(line MATCHES "^(.+):$")
+            if(started)
+                math(EXPR n "${n} + 1")
+            endif()
+            set(obj_${n}_name ${CMAKE_MATCH_1})
+            set(obj_${n}_defined "")
+            set(obj_${n}_undefined "")
+            set(obj_${n}_text 0)
+            set(started TRUE)
+        elseif(line MATCHES "^[0-9]+ 0*([0-9]+) [tTwW] (.+)$")
+            list(APPEND obj_${n}_defined ${CMAKE_MATCH_2})
+            math(EXPR obj_${n}_text "${obj_${n}_text} + ${CMAKE_MATCH_1}")
+            set(started TRUE)
+        elseif(line MATCHES "^[0-9]+ [0-9]+ [^ ] (.+)$")
+            list(APPEND obj_${n}_defined ${CMAKE_MATCH_1})
+            set(started TRUE)
+        elseif(line MATCHES "^ +[Uw] (.+)$")
+            list(APPEND obj_${n}_undefined ${CMAKE_MATCH_1})
+            set(started TRUE)
+        endif()
+    endforeach()
+    math(EXPR n "${n} + 1")
+    foreach(i RANGE ${obj_count} ${n})
+        foreach(field name defined undefined text)
+            set(obj_${i}_${field} "${obj_${i}_${field}}" PARENT_SCOPE)
+        endforeach()
+    endforeach()
+    set(obj_count ${n} PARENT_SCOPE)
+endfunction()
+
+foreach(lib ${LIBS})
+    read_objects(${lib})
+endforeach()
+set(lib_count ${obj_count})
+
+message("code size (bytes of .text)")
+foreach(file ${FILES})
+    set(obj_count ${lib_count})
+    read_objects(${file})
+    #--- The measured object, then every library member it needs, transitively
+    set(linked ${lib_count})
+    set(defined ${obj_${lib_count}_defined})
+    set(needed ${obj_${lib_count}_undefined})
+    set(external "")
+    while(needed)
+        list(POP_FRONT needed symbol)
+        if(symbol IN_LIST defined OR symbol IN_LIST external)
+            continue()
+        endif()
+        set(found "")
+        if(lib_count GREATER 0)
+            math(EXPR last "${lib_count} - 1")
+            foreach(i RANGE 0 ${last})
+                if(symbol IN_LIST obj_${i}_defined)
+                    set(found ${i})
+                    break()
+                endif()
+            endforeach()
+        endif()
+        if(found STREQUAL "")
+            list(APPEND external ${symbol})
+            continue()
+        endif()
+        list(APPEND linked ${found})
+        list(APPEND defined ${obj_${found}_defined})
+        list(APPEND needed ${obj_${found}_undefined})
+    endwhile()
+
+    set(own ${obj_${lib_count}_text})
+    set(total 0)
+    set(pulled "")
+    foreach(i ${linked})
+        math(EXPR total "${total} + ${obj_${i}_text}")
+        if(NOT i EQUAL lib_count)
+            list(APPEND pulled "${obj_${i}_name} ${obj_${i}_text}")
+        endif()
+    endforeach()
+    list(JOIN pulled ", " pulled)
+    list(JOIN external " " external)
+    if(NOT external)
+        set(external "none")
+    endif()
+    get_filename_component(file_name ${file} NAME)
+    string(LENGTH "${file_name}" len)
+    math(EXPR pad "28 - ${len}")
+    if(pad LESS 1)
+        set(pad 1)
+    endif()
+    string(REPEAT " " ${pad} spaces)
+    if(pulled)
+        message("  ${file_name}${spaces}${total}  (own ${own}, ${pulled})")
+    else()
+        message("  ${file_name}${spaces}${total}  (own ${own})")
+    endif()
+    message("    external: ${external}")
+endforeach()
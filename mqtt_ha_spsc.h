@@ -0,0 +1,53 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Lock-free single producer / single consumer queue ─────────────
+//───────────────────────────────────────────────────────────────────
+// Fixed array of N items (power of 2), no allocation, no lock:
+// one side only calls push(), the other only pop(). Safe between the
+// two cores of the RP2040 (or two threads on the host) and between an
+// interrupt / callback and the main loop.
+// Only atomic loads and stores are used (no read-modify-write, which the
+// Cortex-M0+ does not have): head_ is written by the producer alone,
+// tail_ by the consumer alone, both are free running counters.
+// When full, push() fails: the producer decides (drop and count, retry later).
+#include <atomic>
+#include <stddef.h>
+#include <stdint.h>
+
+template <typename T, uint32_t N>
+class SpscQueue {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "SpscQueue size must be a power of 2");
+
+public:
+    //--- Producer: @return false if the queue is full (nothing stored)
+    bool push(const T& item) {
+        uint32_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) >= N) return false;
+        items_[head & (N - 1)] = item;
+        //--- release: the item is written before the consumer can see it
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    //--- Consumer: @return false if the queue is empty
+    bool pop(T* item) {
+        uint32_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire)) return false;
+        *item = items_[tail & (N - 1)];
+        //--- release: the slot is read before the producer can reuse it
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    //--- Either side, a snapshot
+    uint32_t size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    bool empty() const { return size() == 0; }
+    static constexpr uint32_t capacity() { return N; }
+
+private:
+    T                     items_[N];
+    std::atomic<uint32_t> head_{0};     // next slot to write (producer)
+    std::atomic<uint32_t> tail_{0};     // next slot to read  (consumer)
+};
@@ -0,0 +1,71 @@
+#include "mqtt_ha_store.h"
+#include "mqtt_ha_platform.h"
+#include <string.h>
+
+#define STORE_MAGIC  0x31485153u    // "SQH1"
+
+struct StoreHeader {
+    uint32_t magic;
+    uint16_t len;
+    uint16_t reserved;
+    uint32_t crc;                   // CRC-32 of the data, which follows
+};
+static_assert(sizeof(StoreHeader) == 12, "MQTT_HA_STORE_MAX counts a 12-byte header");
+static_assert(MQTT_HA_STORE_PAGES * FLASH_PAGE_SIZE <= FLASH_SECTOR_SIZE, "the record must fit its sector");
+
+//--- CRC-32 (IEEE), bitwise: a few hundred bytes once per boot / save
+static uint32_t store_crc(const uint8_t* p, size_t len) {
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= p[i];
+        for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xedb88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+bool mqtt_ha_store_load(void* data, size_t len) {
+    //--- The flash is memory mapped (XIP): read in place
+    const StoreHeader* h = (const StoreHeader*)(XIP_BASE + MQTT_HA_STORE_OFFSET);
+    const uint8_t*     d = (const uint8_t*)(h + 1);
+    if (len > MQTT_HA_STORE_MAX || h->magic != STORE_MAGIC || h->len != len) return false;
+    if (store_crc(d, len) != h->crc) return false;
+    memcpy(data, d, len);
+    return true;
+}
+
+struct StoreWrite {
+    StoreHeader    header;
+    const uint8_t* data;            // in RAM: the flash is not readable while it is written
+};
+
+//--- Runs with interrupts off (and the other core paused): the record goes out one page at a
+//--- time through a page buffer in RAM, XIP comes back between two flash_range_program()
+static void store_write(void* param) {
+    const StoreWrite* w = (const StoreWrite*)param;
+    static uint8_t page[FLASH_PAGE_SIZE];       // static: off the stack
+    size_t total = sizeof(w->header) + w->header.len;
+    flash_range_erase(MQTT_HA_STORE_OFFSET, FLASH_SECTOR_SIZE);
+    for (size_t at = 0; at < total; at += FLASH_PAGE_SIZE) {
+        memset(page, 0xff, sizeof(page));
+        size_t n = 0;
+        if (at == 0) {
+            memcpy(page, &w->header, sizeof(w->header));
+            n = sizeof(w->header);
+        }
+        size_t from = at + n - sizeof(w->header);
+        size_t take = total - (at + n) < FLASH_PAGE_SIZE - n ? total - (at + n) : FLASH_PAGE_SIZE - n;
+        memcpy(page + n, w->data + from, take);
+        flash_range_program(MQTT_HA_STORE_OFFSET + (uint32_t)at, page, FLASH_PAGE_SIZE);
+    }
+}
+
+bool mqtt_ha_store_save(const void* data, size_t len) {
+    if (len > MQTT_HA_STORE_MAX) return false;
+    StoreWrite w;
+    w.header.magic    = STORE_MAGIC;
+    w.header.len      = (uint16_t)len;
+    w.header.reserved = 0xffff;
+    w.header.crc      = store_crc((const uint8_t*)data, len);
+    w.data            = (const uint8_t*)data;
+    return flash_safe_execute(store_write, &w, 100) == PICO_OK;
+}
@@ -0,0 +1,32 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Persistent record (one flash sector) ──────────────────────────
+//───────────────────────────────────────────────────────────────────
+// A few bytes the library keeps across reboots (last discovery hash...),
+// in the flash sector at MQTT_HA_STORE_OFFSET (default: the last one,
+// keep it out of the firmware and of any other flash user).
+// The record is header (magic, length, CRC) + data, programmed page by page
+// (one page for the discovery hash and the fast boot cache, more with a TLS
+// session), so a blank sector, a record of another size or a torn write
+// simply reads as "none".
+// On the host the flash is a RAM image, optionally a file (host_platform.h).
+//
+// mqtt_ha_store_save() erases then programs the sector: ~50 ms during which
+// nothing runs from flash (interrupts off, the other core paused through
+// flash_safe_execute(): in dual-core mode core 1 calls flash_safe_execute_core_init()).
+// Only save when the data changed: a sector lasts ~100k erases.
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MQTT_HA_STORE_OFFSET
+#define MQTT_HA_STORE_OFFSET  (PICO_FLASH_SIZE_BYTES - FLASH_SECTOR_SIZE)
+#endif
+#ifndef MQTT_HA_STORE_PAGES
+#define MQTT_HA_STORE_PAGES   4            // flash pages the record may take (256 bytes each)
+#endif
+#define MQTT_HA_STORE_MAX     (MQTT_HA_STORE_PAGES * 256 - 12)   // data bytes: the pages minus the header
+
+//--- @return false if there is no valid record of exactly len bytes (data untouched)
+bool mqtt_ha_store_load(void* data, size_t len);
+//--- @return false if len is too big or the flash could not be written
+bool mqtt_ha_store_save(const void* data, size_t len);
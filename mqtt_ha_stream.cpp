@@ -0,0 +1,277 @@
+#include "mqtt_ha_stream.h"
+#include <string.h>
+
+void PayloadTokenizer::begin(uint32_t seed, uint8_t precision, payload_event_cb_t cb, void* arg) {
+    cb_        = cb;
+    arg_       = arg;
+    seed_      = seed;
+    precision_ = precision;
+    bytes_     = 0;
+    state_     = FIRST;
+    key_len_   = 0;
+    key_[0]    = '\0';
+    esc_       = 0;
+    depth_     = 0;
+    skip_str_  = false;
+    token_begin();
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── Token: text, hash and number, one character at a time ─────────
+//───────────────────────────────────────────────────────────────────
+void PayloadTokenizer::token_begin() {
+    len_       = 0;
+    truncated_ = false;
+    hash_      = seed_;
+    count_     = 0;
+    num_       = 0;
+    kept_      = 0;
+    digits_    = 0;
+    neg_       = false;
+    dot_       = false;
+    extra_     = false;
+    up_        = false;
+    bad_       = false;
+}
+
+void PayloadTokenizer::token_char(char c) {
+    //--- A truncated token never matches a command: the hash stops with the text
+    if (len_ < MQTT_HA_TOKEN_MAX - 1) {
+        hash_ = (hash_ ^ (uint8_t)c) * MQTT_HA_FNV_PRIME;
+        text_[len_++] = c;
+    } else {
+        truncated_ = true;
+    }
+
+    //--- Number: [+-]digits[.digits], scaled by 10^precision while it is read
+    if (!bad_) {
+        if (count_ == 0 && (c == '-' || c == '+')) {
+            neg_ = (c == '-');
+        } else if (c == '.' && !dot_) {
+            dot_ = true;
+        } else if (c >= '0' && c <= '9') {
+            if (digits_ < 255) digits_++;
+            if (dot_ && kept_ == precision_) {
+                if (!extra_) up_ = (c >= '5');
+                extra_ = true;
+            } else {
+                num_ = num_ * 10 + (c - '0');
+                if (dot_) kept_++;
+                if (num_ > INT32_MAX) bad_ = true;
+            }
+        } else {
+            bad_ = true;
+        }
+    }
+    count_++;
+}
+
+//--- Case insensitive compare of the token with a keyword (ON, OFF...)
+static bool token_is(const char* s, uint8_t len, const char* word) {
+    uint8_t i = 0;
+    for (; i < len && word[i] != '\0'; i++) {
+        char c = s[i];
+        if (c >= 'a' && c <= 'z') c -= 'a' - 'A';
+        if (c != word[i]) return false;
+    }
+    return i == len && word[i] == '\0';
+}
+
+void PayloadTokenizer::token_end() {
+    text_[len_] = '\0';
+}
+
+void PayloadTokenizer::emit(const char* key) {
+    token_end();
+
+    PayloadEvent ev;
+    ev.key       = key;
+    ev.text      = text_;
+    ev.len       = len_;
+    ev.truncated = truncated_;
+    ev.hash      = hash_;
+    ev.value     = 0;
+    ev.has_value = false;
+    if (!truncated_ && (token_is(text_, len_, "ON") || token_is(text_, len_, "TRUE"))) {
+        ev.value     = 1;
+        ev.has_value = true;
+    } else if (!truncated_ && (token_is(text_, len_, "OFF") || token_is(text_, len_, "FALSE"))) {
+        ev.has_value = true;
+    } else if (!bad_ && digits_ > 0) {
+        int64_t v = num_;
+        for (uint8_t k = kept_; k < precision_; k++) v *= 10;
+        if (up_) v++;
+        if (v <= INT32_MAX) {
+            ev.value     = neg_ ? -(int32_t)v : (int32_t)v;
+            ev.has_value = true;
+        }
+    }
+    if (cb_) cb_(&ev, arg_);
+}
+
+//───────────────────────────────────────────────────────────────────
+//─── JSON subset ───────────────────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+void PayloadTokenizer::key_char(char c) {
+    if (key_len_ < MQTT_HA_TOKEN_MAX - 1) key_[key_len_++] = c;
+}
+
+//--- \" \\ \/ \b \f \n \r \t and \uXXXX (kept if ASCII, '?' otherwise)
+bool PayloadTokenizer::escape(char c, bool to_key) {
+    if (esc_ == 0) return false;
+    char out = 0;
+    if (esc_ == 1) {
+        switch (c) {
+        case 'b': out = '\b'; break;
+        case 'f': out = '\f'; break;
+        case 'n': out = '\n'; break;
+        case 'r': out = '\r'; break;
+        case 't': out = '\t'; break;
+        case 'u': esc_ = 2; ucode_ = 0; return true;
+        default:  out = c;    break;     // " \ / (and anything else as is)
+        }
+    } else {
+        uint8_t d;
+        if      (c >= '0' && c <= '9') d = c - '0';
+        else if (c >= 'a' && c <= 'f') d = c - 'a' + 10;
+        else if (c >= 'A' && c <= 'F') d = c - 'A' + 10;
+        else { state_ = FAILED; return true; }
+        ucode_ = (uint16_t)(ucode_ << 4 | d);
+        if (++esc_ <= 5) return true;
+        out = (ucode_ < 0x80) ? (char)ucode_ : '?';
+    }
+    esc_ = 0;
+    if (to_key) key_char(out);
+    else        token_char(out);
+    return true;
+}
+
+static bool is_space(char c) {
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+void PayloadTokenizer::json_char(char c) {
+    switch (state_) {
+    case MEMBER:
+        if (c == '"') {
+            key_len_ = 0;
+            state_   = KEY;
+        } else if (c == '}') {
+            state_ = END;
+        } else if (!is_space(c)) {
+            state_ = FAILED;
+        }
+        break;
+
+    case KEY:
+        if (escape(c, true)) break;
+        if (c == '\\') {
+            esc_ = 1;
+        } else if (c == '"') {
+            key_[key_len_] = '\0';
+            state_ = COLON;
+        } else {
+            key_char(c);
+        }
+        break;
+
+    case COLON:
+        if (c == ':') state_ = VALUE;
+        else if (!is_space(c)) state_ = FAILED;
+        break;
+
+    case VALUE:
+        if (is_space(c)) break;
+        token_begin();
+        if (c == '"') {
+            state_ = STRING;
+        } else if (c == '{' || c == '[') {
+            depth_    = 1;
+            skip_str_ = false;
+            state_    = SKIP;
+        } else if (c == ',' || c == '}' || c == ']' || c == ':') {
+            state_ = FAILED;
+        } else {
+            token_char(c);
+            state_ = BARE;
+        }
+        break;
+
+    case STRING:
+        if (escape(c, false)) break;
+        if (c == '\\') {
+            esc_ = 1;
+        } else if (c == '"') {
+            emit(key_);
+            state_ = NEXT;
+        } else {
+            token_char(c);
+        }
+        break;
+
+    case BARE:
+        if (c == ',' || c == '}' || is_space(c)) {
+            emit(key_);
+            state_ = NEXT;
+            json_char(c);   // the delimiter belongs to NEXT
+        } else {
+            token_char(c);
+        }
+        break;
+
+    case SKIP:
+        if (skip_str_) {
+            if (esc_)           esc_ = 0;
+            else if (c == '\\') esc_ = 1;
+            else if (c == '"')  skip_str_ = false;
+        } else if (c == '"') {
+            skip_str_ = true;
+        } else if (c == '{' || c == '[') {
+            if (depth_ < 255) depth_++;
+        } else if (c == '}' || c == ']') {
+            if (--depth_ == 0) state_ = NEXT;
+        }
+        break;
+
+    case NEXT:
+        if (c == ',') state_ = MEMBER;
+        else if (c == '}') state_ = END;
+        else if (!is_space(c)) state_ = FAILED;
+        break;
+
+    case END:
+        if (!is_space(c)) state_ = FAILED;
+        break;
+
+    default:
+        break;
+    }
+}
+
+void PayloadTokenizer::feed(const uint8_t* data, size_t len) {
+    bytes_ += (uint32_t)len;
+    size_t i = 0;
+    if (state_ == FIRST && len > 0) {
+        if (data[0] == '{') {
+            state_ = MEMBER;
+            i      = 1;
+        } else {
+            state_ = PLAIN;
+        }
+    }
+    if (state_ == PLAIN) {
+        for (; i < len && (len_ < MQTT_HA_TOKEN_MAX - 1 || !bad_); i++) token_char((char)data[i]);
+        //--- Text full and not a number (large payload, OTA image...): nothing left to compute
+        if (i < len) truncated_ = true;
+        return;
+    }
+    for (; i < len && state_ != FAILED; i++) json_char((char)data[i]);
+}
+
+bool PayloadTokenizer::finish() {
+    if (state_ == FIRST || state_ == PLAIN) {
+        emit(nullptr);
+        return true;
+    }
+    return state_ == END;
+}
@@ -0,0 +1,114 @@
+#pragma once
+//───────────────────────────────────────────────────────────────────
+//─── Streaming payload tokenizer ───────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// Reads an incoming MQTT payload fragment by fragment, straight from the
+// lwIP buffers (the payload is never copied), with a fixed state of about
+// 100 bytes whatever the size of the message.
+//  - plain payload ("toggle", "21.5", "ON"): one token, reported by finish()
+//  - JSON object ({"state":"ON","brightness":128}): one event per member
+//    "key": value, as soon as it is complete. Nested objects and arrays are skipped.
+// A payload is JSON when its first byte is '{'.
+//
+//      PayloadTokenizer tok;
+//      tok.begin(seed, 1, on_event, nullptr);
+//      tok.feed(fragment1, len1);      // any split, down to 1 byte
+//      tok.feed(fragment2, len2);
+//      tok.finish();                   // plain token, or checks the JSON was complete
+//
+// Tokens longer than MQTT_HA_TOKEN_MAX - 1 are truncated (flagged), the number
+// parsing still sees every byte: "123456789012345678901234567890.5" is not a number (overflow),
+// and the rest of a large plain payload costs almost nothing.
+#include <stddef.h>
+#include <stdint.h>
+
+#ifndef MQTT_HA_TOKEN_MAX
+#define MQTT_HA_TOKEN_MAX 32    // longest command name / JSON key / string value kept (with '\0')
+#endif
+
+//--- FNV-1a, also used by the command router to hash topics and commands
+#define MQTT_HA_FNV_OFFSET 2166136261u
+#define MQTT_HA_FNV_PRIME  16777619u
+
+struct PayloadEvent {
+    const char* key;        // JSON member name, nullptr for a plain payload
+    const char* text;       // token (JSON strings without quotes and unescaped), '\0' terminated
+    uint8_t     len;        // bytes in text
+    bool        truncated;  // token longer than MQTT_HA_TOKEN_MAX - 1
+    bool        has_value;  // number, ON/OFF/TRUE/FALSE (any case) or JSON true/false
+    int32_t     value;      // number scaled by 10^precision (rounded half away from zero), or 1/0
+    uint32_t    hash;       // FNV-1a of the token continuing the seed given to begin(), only if !truncated
+};
+
+typedef void (*payload_event_cb_t)(const PayloadEvent* ev, void* arg);
+
+class PayloadTokenizer {
+public:
+    //--- New payload
+    // @param seed      : initial FNV-1a state of the token hash (MQTT_HA_FNV_OFFSET for a plain hash)
+    // @param precision : decimals kept in PayloadEvent::value (0..3)
+    void begin(uint32_t seed, uint8_t precision, payload_event_cb_t cb, void* arg);
+    //--- Next fragment, JSON members are reported from here
+    void feed(const uint8_t* data, size_t len);
+    //--- End of the payload: reports the plain token.
+    //--- @return false if the JSON object was malformed or incomplete
+    bool finish();
+
+    uint32_t bytes() const { return bytes_; }
+
+private:
+    enum State : uint8_t {
+        FIRST,          // nothing received yet
+        PLAIN,          // plain payload: every byte is the token
+        MEMBER,         // JSON: expecting "key" or '}'
+        KEY,            // JSON: inside the key string
+        COLON,          // JSON: expecting ':'
+        VALUE,          // JSON: expecting a value
+        STRING,         // JSON: inside a string value
+        BARE,           // JSON: number / true / false / null
+        SKIP,           // JSON: nested object or array, skipped
+        NEXT,           // JSON: expecting ',' or '}'
+        END,            // JSON: object closed
+        FAILED,         // JSON: syntax error, the rest is ignored
+    };
+
+    void token_begin();
+    void token_char(char c);
+    void token_end();
+    void key_char(char c);
+    void emit(const char* key);
+    //--- Escape sequence inside a string: @return true while the character is consumed by it
+    bool escape(char c, bool to_key);
+    void json_char(char c);
+
+    payload_event_cb_t cb_        = nullptr;
+    void*              arg_       = nullptr;
+    uint32_t           seed_      = MQTT_HA_FNV_OFFSET;
+    uint32_t           bytes_     = 0;
+    State              state_     = FIRST;
+    uint8_t            precision_ = 0;
+
+    //--- JSON
+    char     key_[MQTT_HA_TOKEN_MAX];
+    uint8_t  key_len_   = 0;
+    uint8_t  esc_       = 0;        // 0: none, 1: after '\', 2..5: \u hex digits
+    uint16_t ucode_     = 0;
+    uint8_t  depth_     = 0;        // SKIP: nesting level
+    bool     skip_str_  = false;    // SKIP: inside a string
+
+    //--- Current token
+    char     text_[MQTT_HA_TOKEN_MAX];
+    uint8_t  len_       = 0;
+    bool     truncated_ = false;
+    uint32_t hash_      = 0;
+    uint32_t count_     = 0;        // bytes of the token
+    //--- Number being parsed
+    int64_t  num_       = 0;
+    uint8_t  kept_      = 0;        // decimals kept in num_
+    uint8_t  digits_    = 0;
+    bool     neg_       = false;
+    bool     dot_       = false;
+    bool     extra_     = false;    // a digit beyond the precision was seen, only the first one rounds
+    bool     up_        = false;
+    bool     bad_       = false;    // not a number
+};
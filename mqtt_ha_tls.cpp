@@ -0,0 +1,180 @@
+//───────────────────────────────────────────────────────────────────
+//─── TLS (session resumption) ──────────────────────────────────────
+//───────────────────────────────────────────────────────────────────
+// mqtt_ha_set_tls() makes every broker connection MQTT over TLS (lwIP altcp_tls,
+// mbedTLS on the Pico). The full handshake is what makes a secure reconnect
+// expensive on this MCU: ECDHE and the certificate chain take the CPU for seconds
+// (inside cyw43_arch_poll(): mqtt_poll() waits meanwhile), plus two round trips.
+// So the session of the last handshake (master secret, and the broker's ticket
+// when it sends one) is kept and offered on the next connect:
+//      full:     ClientHello -> Certificate, KeyExchange -> KeyExchange, Finished -> Finished
+//      resumed:  ClientHello + session -> Finished -> Finished      (no public key math)
+// A broker that does not know it any more (restarted, ticket expired) just answers
+// with a full handshake: the new session replaces the old one.
+// The session belongs to the broker that issued it: another one of the list
+// (failover) gets a full handshake. With MQTT_HA_TLS_SESSION_FLASH it also goes
+// to the flash record after a full handshake (a resumption brings nothing new),
+// so a reboot resumes too; that record then holds the master secret.
+// The session is taken from and given to the connection's pcb (mqtt_ha_platform.h:
+// lwIP's client->conn, or the built-in client's).
+// The lwIP MQTT app only shows mqtt_client_connect() and CONNACK: handshake times
+// are that interval (TCP + TLS + CONNECT), full and resumed ones apart.
+#include "mqtt_ha.h"
+#include "mqtt_ha_internal.h"
+
+#if MQTT_HA_TLS
+static struct altcp_tls_config*  tls_config   = nullptr;
+static struct altcp_tls_session* tls_session  = nullptr;   // last session established
+static uint32_t                  tls_fp       = 0;         // its fingerprint
+static bool                      tls_cached   = false;     // a session can be offered
+static bool                      tls_flash    = false;     // ... the flash record's (tls_session still empty)
+static uint8_t                   tls_broker   = 0;         // broker that issued it
+static uint32_t                  tls_offered  = 0;         // fingerprint offered by this connect, 0: none
+static uint32_t                  tls_start_ms = 0;         // mqtt_client_connect()
+static bool                      tls_to_save  = false;     // full handshake this sequence, for the flash
+static uint8_t                   tls_rejected_run = 0;     // offers refused in a row
+#endif
+static MqttHaTlsStats            tls_stats    = {};
+
+bool mqtt_ha_set_tls(const uint8_t* ca, size_t ca_len) {
+#if MQTT_HA_TLS
+    if (tls_config != nullptr) return false;        // once, before wifi_mqtt_init()
+    tls_config = altcp_tls_create_config_client(ca, ca_len);
+    if (tls_session == nullptr) tls_session = altcp_tls_alloc_session();
+    if (tls_config == nullptr || tls_session == nullptr) {
+        LOG_ERROR("TLS: client configuration failed\n");
+        tls_config = nullptr;
+        return false;
+    }
+    tls_stats.enabled = true;
+    return true;
+#else
+    (void)ca; (void)ca_len;
+    LOG_ERROR("TLS: built without MQTT_HA_TLS\n");
+    return false;
+#endif
+}
+
+struct altcp_tls_config* mqtt_ha_lib::tls_client_config() {
+#if MQTT_HA_TLS
+    return tls_config;
+#else
+    return nullptr;
+#endif
+}
+
+//--- fast_connect_timeout_ms(): nothing to resume on this broker
+bool mqtt_ha_lib::tls_full_expected() {
+#if MQTT_HA_TLS
+    return tls_config != nullptr && !(tls_cached && tls_broker == broker_current);
+#else
+    return false;
+#endif
+}
+
+//--- conn_start_mqtt(), connect started: the handshake waits for TCP, so the name
+//--- (SNI + certificate check, not for a dotted IP) and the session go in now
+void mqtt_ha_lib::tls_on_connect() {
+#if MQTT_HA_TLS
+    if (tls_config == nullptr) return;
+    const BrokerEndpoint& ep = brokers[broker_current];
+    bool offer   = tls_cached && tls_broker == broker_current;
+    tls_offered  = offer ? tls_fp : 0;
+    tls_start_ms = now_ms();
+#if MQTT_HA_TLS_SESSION_FLASH
+    const uint8_t* saved = offer && tls_flash ? persist.tls_session : nullptr;
+    size_t         saved_len = persist.tls_len;
+#else
+    const uint8_t* saved = nullptr;
+    size_t         saved_len = 0;
+#endif
+    if (mqtt_ha_tls_start(mqtt_client, ep.literal ? nullptr : ep.host, offer && !tls_flash ? tls_session : nullptr,
+                          saved, saved_len) != ERR_OK) {
+        LOG_WARN("TLS: server name or session not set\n");
+        tls_offered = 0;
+    }
+#endif
+}
+
+//--- CONNACK (lwIP callback): full or resumed? The session is kept for the next connect
+void mqtt_ha_lib::tls_on_connack() {
+#if MQTT_HA_TLS
+    if (tls_config == nullptr) return;
+    uint32_t ms = now_ms() - tls_start_ms;
+    uint32_t fp = mqtt_ha_tls_fingerprint(mqtt_client);
+    tls_cached  = fp != 0 && mqtt_ha_tls_session_get(mqtt_client, tls_session) == ERR_OK;
+    tls_fp      = tls_cached ? fp : 0;
+    tls_flash   = false;
+    tls_broker  = broker_current;
+    tls_stats.cached = tls_cached;
+    if (tls_offered != 0 && fp == tls_offered) {
+        tls_stats.resumed++;
+        tls_stats.resumed_ms = ms;
+        if (ms > tls_stats.resumed_max_ms) tls_stats.resumed_max_ms = ms;
+        tls_rejected_run = 0;
+        LOG_INFO("TLS: session resumed, CONNACK after %u ms\n", ms);
+        return;
+    }
+    tls_stats.full++;
+    tls_stats.full_ms = ms;
+    if (ms > tls_stats.full_max_ms) tls_stats.full_max_ms = ms;
+    if (tls_offered != 0) {
+        tls_stats.rejected++;
+        if (tls_rejected_run < 255) tls_rejected_run++;
+    }
+    //--- A broker that never resumes would cost a flash write per reconnect
+    tls_to_save = tls_cached && tls_rejected_run < 2;
+    LOG_INFO("TLS: full handshake, CONNACK after %u ms\n", ms);
+#endif
+}
+
+//--- fast_save(), ONLINE: the session of a full handshake into the flash record
+void mqtt_ha_lib::tls_persist() {
+#if MQTT_HA_TLS && MQTT_HA_TLS_SESSION_FLASH
+    if (!tls_to_save) return;
+    tls_to_save = false;
+    size_t len = mqtt_ha_tls_session_save(mqtt_client, persist.tls_session, sizeof(persist.tls_session));
+    if (len == 0) LOG_WARN("TLS: session larger than MQTT_HA_TLS_SESSION_MAX, not kept in flash\n");
+    persist.tls_fingerprint = len ? tls_fp : 0;
+    persist.tls_len    = (uint16_t)len;
+    persist.tls_broker = broker_current;
+    tls_stats.saves++;
+#endif
+}
+
+//--- wifi_mqtt_init(), after persist_load(): nothing in RAM after a reboot, maybe in flash
+void mqtt_ha_lib::tls_boot() {
+    MqttHaTlsStats fresh = {};
+    fresh.enabled = tls_stats.enabled;
+    tls_stats     = fresh;
+#if MQTT_HA_TLS
+    tls_cached       = false;
+    tls_flash        = false;
+    tls_fp           = 0;
+    tls_to_save      = false;
+    tls_rejected_run = 0;
+#if MQTT_HA_TLS_SESSION_FLASH
+    //--- Offered as it is by the first connect (mqtt_ha_tls_start() deserializes it)
+    if (tls_session && persist.tls_len > 0 && persist.tls_len <= sizeof(persist.tls_session) &&
+        persist.tls_broker < broker_count && persist.tls_fingerprint != 0) {
+        tls_cached         = true;
+        tls_flash          = true;
+        tls_fp             = persist.tls_fingerprint;
+        tls_broker         = persist.tls_broker;
+        tls_stats.cached   = true;
+        tls_stats.restored = true;
+        LOG_INFO("TLS: session of broker %u read from flash\n", tls_broker);
+    }
+#endif
+#endif
+}
+
+MqttHaTlsStats mqtt_ha_tls_stats() {
+    return tls_stats;
+}
+
+#ifdef MQTT_HA_HOST
+void mqtt_ha_lib::tls_reset_stats() {
+    tls_stats = {};
+}
+#endif